@@ -1,10 +1,39 @@
 /*
-* Functions to get column insights from AI using gpt.
+* Planner support function of the AI functions, estimates the cost of a call
+* from the model and the width of the arguments.
+*/
+CREATE OR REPLACE FUNCTION _pg_ai_support(
+	internal
+)RETURNS internal AS 'MODULE_PATHNAME', 'pg_ai_support' LANGUAGE C IMMUTABLE STRICT;
+
+/*
+* Functions to get column insights from AI using gpt. The AI functions make
+* network calls, they are VOLATILE and costed so that cheaper quals are
+* evaluated first.
 */
 CREATE OR REPLACE FUNCTION pg_ai_insight(
 	column_name	TEXT,
 	prompt      TEXT = NULL
-)RETURNS TEXT AS 'MODULE_PATHNAME', 'pg_ai_insight' LANGUAGE C IMMUTABLE;
+)RETURNS TEXT AS 'MODULE_PATHNAME', 'pg_ai_insight' LANGUAGE C VOLATILE PARALLEL SAFE
+COST 150000 SUPPORT _pg_ai_support;
+
+/*
+* Support functions shared by the pg_ai aggregates for parallel aggregation,
+* the states of the workers are serialized to bytea and combined.
+*/
+CREATE OR REPLACE FUNCTION _pg_ai_agg_combinefn(
+	state1		internal,
+	state2		internal
+)RETURNS internal AS 'MODULE_PATHNAME', 'pg_ai_agg_combinefn' LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _pg_ai_agg_serialfn(
+	state		internal
+)RETURNS bytea AS 'MODULE_PATHNAME', 'pg_ai_agg_serialfn' LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _pg_ai_agg_deserialfn(
+	data		bytea,
+	state		internal
+)RETURNS internal AS 'MODULE_PATHNAME', 'pg_ai_agg_deserialfn' LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
 
 /*
 * Aggregate version of the pg_ai_insight function.
@@ -13,27 +42,61 @@ CREATE OR REPLACE FUNCTION _pg_ai_insight_agg_transfn(
 	state		internal,
 	column_name	TEXT,
 	prompt      TEXT
-)RETURNS internal AS 'MODULE_PATHNAME', 'pg_ai_insight_agg_transfn' LANGUAGE C IMMUTABLE;
+)RETURNS internal AS 'MODULE_PATHNAME', 'pg_ai_insight_agg_transfn' LANGUAGE C IMMUTABLE PARALLEL SAFE;
 
 CREATE OR REPLACE FUNCTION _pg_ai_insight_agg_finalfn(
 	state		internal,
 	column_name  	TEXT,
 	prompt      TEXT
-)RETURNS TEXT AS 'MODULE_PATHNAME', 'pg_ai_insight_agg_finalfn' LANGUAGE C IMMUTABLE;
+)RETURNS TEXT AS 'MODULE_PATHNAME', 'pg_ai_insight_agg_finalfn' LANGUAGE C VOLATILE;
 
 CREATE AGGREGATE pg_ai_insight_agg (column_name TEXT, prompt TEXT)
 (
 	sfunc = _pg_ai_insight_agg_transfn,
 	stype = internal,
 	finalfunc = _pg_ai_insight_agg_finalfn,
-	finalfunc_extra
+	finalfunc_extra,
+	combinefunc = _pg_ai_agg_combinefn,
+	serialfunc = _pg_ai_agg_serialfn,
+	deserialfunc = _pg_ai_agg_deserialfn,
+	parallel = safe
+);
+
+/*
+* With pg_ai.agg_sample_tokens set the values of each stratum get an equal
+* share of the budget of the sample.
+*/
+CREATE OR REPLACE FUNCTION _pg_ai_insight_agg_transfn(
+	state		internal,
+	column_name	TEXT,
+	prompt      TEXT,
+	stratum		TEXT
+)RETURNS internal AS 'MODULE_PATHNAME', 'pg_ai_insight_agg_transfn' LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _pg_ai_insight_agg_finalfn(
+	state		internal,
+	column_name  	TEXT,
+	prompt      TEXT,
+	stratum		TEXT
+)RETURNS TEXT AS 'MODULE_PATHNAME', 'pg_ai_insight_agg_finalfn' LANGUAGE C VOLATILE;
+
+CREATE AGGREGATE pg_ai_insight_agg (column_name TEXT, prompt TEXT, stratum TEXT)
+(
+	sfunc = _pg_ai_insight_agg_transfn,
+	stype = internal,
+	finalfunc = _pg_ai_insight_agg_finalfn,
+	finalfunc_extra,
+	combinefunc = _pg_ai_agg_combinefn,
+	serialfunc = _pg_ai_agg_serialfn,
+	deserialfunc = _pg_ai_agg_deserialfn,
+	parallel = safe
 );
 
 /*
 * Function to get help on the AI functions.
 */
 CREATE OR REPLACE FUNCTION pg_ai_help()
-RETURNS TEXT AS 'MODULE_PATHNAME', 'pg_ai_help' LANGUAGE C IMMUTABLE;
+RETURNS TEXT AS 'MODULE_PATHNAME', 'pg_ai_help' LANGUAGE C STABLE PARALLEL SAFE;
 
 /*
 * Function to create a vector store.
@@ -42,7 +105,7 @@ CREATE OR REPLACE FUNCTION pg_ai_create_vector_store(
 	store  			NAME,
 	sql_query      	TEXT,
 	notes		  	NAME = NULL
-)RETURNS TEXT AS 'MODULE_PATHNAME', 'pg_ai_create_vector_store' LANGUAGE C IMMUTABLE;
+)RETURNS TEXT AS 'MODULE_PATHNAME', 'pg_ai_create_vector_store' LANGUAGE C VOLATILE;
 
 /*
 * Function to query the vector store.
@@ -51,7 +114,8 @@ CREATE OR REPLACE FUNCTION pg_ai_query_vector_store(
 	store		  			NAME,
 	nl_query  				TEXT,
 	count                   INT = 2
-)RETURNS SETOF record AS 'MODULE_PATHNAME', 'pg_ai_query_vector_store' LANGUAGE C IMMUTABLE;
+)RETURNS SETOF record AS 'MODULE_PATHNAME', 'pg_ai_query_vector_store' LANGUAGE C VOLATILE
+COST 10000 ROWS 2 SUPPORT _pg_ai_support;
 
 /*
 * Function to generate the image from the column text.
@@ -59,7 +123,8 @@ CREATE OR REPLACE FUNCTION pg_ai_query_vector_store(
 CREATE OR REPLACE FUNCTION pg_ai_generate_image(
 	column_name		TEXT,
 	prompt         	TEXT = NULL
-)RETURNS TEXT AS 'MODULE_PATHNAME', 'pg_ai_generate_image' LANGUAGE C IMMUTABLE;
+)RETURNS TEXT AS 'MODULE_PATHNAME', 'pg_ai_generate_image' LANGUAGE C VOLATILE PARALLEL SAFE
+COST 400000 SUPPORT _pg_ai_support;
 
 
 /*
@@ -69,20 +134,24 @@ CREATE OR REPLACE FUNCTION _pg_ai_generate_image_agg_transfn(
 	state		internal,
 	column_name	TEXT,
 	prompt      TEXT
-)RETURNS internal AS 'MODULE_PATHNAME', 'pg_ai_generate_image_agg_transfn' LANGUAGE C IMMUTABLE;
+)RETURNS internal AS 'MODULE_PATHNAME', 'pg_ai_generate_image_agg_transfn' LANGUAGE C IMMUTABLE PARALLEL SAFE;
 
 CREATE OR REPLACE FUNCTION _pg_ai_generate_image_agg_finalfn(
 	state		internal,
 	column_name  	TEXT,
 	prompt      TEXT
-)RETURNS TEXT AS 'MODULE_PATHNAME', 'pg_ai_generate_image_agg_finalfn' LANGUAGE C IMMUTABLE;
+)RETURNS TEXT AS 'MODULE_PATHNAME', 'pg_ai_generate_image_agg_finalfn' LANGUAGE C VOLATILE;
 
 CREATE AGGREGATE pg_ai_generate_image_agg (column_name TEXT, prompt TEXT)
 (
 	sfunc = _pg_ai_generate_image_agg_transfn,
 	stype = internal,
 	finalfunc = _pg_ai_generate_image_agg_finalfn,
-	finalfunc_extra
+	finalfunc_extra,
+	combinefunc = _pg_ai_agg_combinefn,
+	serialfunc = _pg_ai_agg_serialfn,
+	deserialfunc = _pg_ai_agg_deserialfn,
+	parallel = safe
 );
 
 /*
@@ -91,7 +160,8 @@ CREATE AGGREGATE pg_ai_generate_image_agg (column_name TEXT, prompt TEXT)
 CREATE OR REPLACE FUNCTION pg_ai_moderation(
 	column_name		TEXT,
 	prompt         	TEXT = NULL
-)RETURNS TEXT AS 'MODULE_PATHNAME', 'pg_ai_moderation' LANGUAGE C IMMUTABLE;
+)RETURNS TEXT AS 'MODULE_PATHNAME', 'pg_ai_moderation' LANGUAGE C VOLATILE PARALLEL SAFE
+COST 10000 SUPPORT _pg_ai_support;
 
 /*
 * Aggregate version of the pg_ai_moderation function.
@@ -100,18 +170,374 @@ CREATE OR REPLACE FUNCTION _pg_ai_moderation_agg_transfn(
 	state		internal,
 	column_name 	TEXT,
 	prompt      TEXT
-)RETURNS internal AS 'MODULE_PATHNAME', 'pg_ai_moderation_agg_transfn' LANGUAGE C IMMUTABLE;
+)RETURNS internal AS 'MODULE_PATHNAME', 'pg_ai_moderation_agg_transfn' LANGUAGE C IMMUTABLE PARALLEL SAFE;
 
 CREATE OR REPLACE FUNCTION _pg_ai_moderation_agg_finalfn(
 	state		internal,
 	column_name  	TEXT,
 	prompt      TEXT
-)RETURNS TEXT AS 'MODULE_PATHNAME', 'pg_ai_moderation_agg_finalfn' LANGUAGE C IMMUTABLE;
+)RETURNS TEXT AS 'MODULE_PATHNAME', 'pg_ai_moderation_agg_finalfn' LANGUAGE C VOLATILE;
 
 CREATE AGGREGATE pg_ai_moderation_agg (column_name TEXT, prompt TEXT)
 (
 	sfunc = _pg_ai_moderation_agg_transfn,
 	stype = internal,
 	finalfunc = _pg_ai_moderation_agg_finalfn,
-	finalfunc_extra
-);
\ No newline at end of file
+	finalfunc_extra,
+	combinefunc = _pg_ai_agg_combinefn,
+	serialfunc = _pg_ai_agg_serialfn,
+	deserialfunc = _pg_ai_agg_deserialfn,
+	parallel = safe
+);
+
+/*
+* Batch versions of pg_ai_insight and pg_ai_moderation. The values of an array,
+* or the first column of the rows of an open cursor, are sent with their
+* requests in flight concurrently and the results come in the order of the
+* values.
+*/
+CREATE OR REPLACE FUNCTION pg_ai_insight_batch(
+	column_values	TEXT[],
+	prompt			TEXT = NULL
+)RETURNS TABLE(ordinality BIGINT, result TEXT) AS 'MODULE_PATHNAME', 'pg_ai_insight_batch' LANGUAGE C VOLATILE PARALLEL SAFE
+COST 150000;
+
+CREATE OR REPLACE FUNCTION pg_ai_insight_batch(
+	cursor_name		REFCURSOR,
+	prompt			TEXT = NULL
+)RETURNS TABLE(ordinality BIGINT, result TEXT) AS 'MODULE_PATHNAME', 'pg_ai_insight_batch_cursor' LANGUAGE C VOLATILE PARALLEL RESTRICTED
+COST 150000;
+
+CREATE OR REPLACE FUNCTION pg_ai_moderation_batch(
+	column_values	TEXT[],
+	prompt			TEXT = NULL
+)RETURNS TABLE(ordinality BIGINT, result TEXT) AS 'MODULE_PATHNAME', 'pg_ai_moderation_batch' LANGUAGE C VOLATILE PARALLEL SAFE
+COST 10000;
+
+CREATE OR REPLACE FUNCTION pg_ai_moderation_batch(
+	cursor_name		REFCURSOR,
+	prompt			TEXT = NULL
+)RETURNS TABLE(ordinality BIGINT, result TEXT) AS 'MODULE_PATHNAME', 'pg_ai_moderation_batch_cursor' LANGUAGE C VOLATILE PARALLEL RESTRICTED
+COST 10000;
+
+/*
+* Statistics of the shared query embeddings cache used by
+* pg_ai_query_vector_store.
+*/
+CREATE OR REPLACE FUNCTION pg_ai_query_cache_stats(
+	OUT entries		BIGINT,
+	OUT hits		BIGINT,
+	OUT misses		BIGINT,
+	OUT hit_ratio	FLOAT8
+)RETURNS record AS 'MODULE_PATHNAME', 'pg_ai_query_cache_stats' LANGUAGE C VOLATILE;
+
+/*
+* Function to empty the query embeddings cache and reset its statistics. The
+* cache is shared by all the roles, only those granted it can empty it.
+*/
+CREATE OR REPLACE FUNCTION pg_ai_query_cache_reset()
+RETURNS VOID AS 'MODULE_PATHNAME', 'pg_ai_query_cache_reset' LANGUAGE C VOLATILE;
+REVOKE ALL ON FUNCTION pg_ai_query_cache_reset() FROM PUBLIC;
+
+/*
+* Results of pg_ai_insight and pg_ai_moderation, keyed by the fingerprint of
+* (role, service, model, function, prompt, column value). Used when
+* pg_ai.result_cache_ttl is set, the rows of each role are trimmed to
+* pg_ai.result_cache_max_rows. A role only sees and reuses its own results.
+*/
+CREATE UNLOGGED TABLE pg_ai_result_cache(
+	fingerprint_1	BIGINT NOT NULL,
+	fingerprint_2	BIGINT NOT NULL,
+	owner			REGROLE NOT NULL DEFAULT current_user::regrole,
+	service			TEXT NOT NULL,
+	model			TEXT NOT NULL,
+	result			TEXT NOT NULL,
+	created_at		TIMESTAMPTZ NOT NULL DEFAULT now(),
+	PRIMARY KEY (fingerprint_1, fingerprint_2)
+);
+CREATE INDEX pg_ai_result_cache_created_at_idx ON pg_ai_result_cache(created_at);
+ALTER TABLE pg_ai_result_cache ENABLE ROW LEVEL SECURITY;
+CREATE POLICY pg_ai_result_cache_owner ON pg_ai_result_cache
+	USING (owner = current_user::regrole)
+	WITH CHECK (owner = current_user::regrole);
+GRANT SELECT, INSERT, UPDATE, DELETE ON pg_ai_result_cache TO PUBLIC;
+
+/*
+* Results of pg_ai_insight and pg_ai_moderation reused for near duplicate
+* values, keyed by the fingerprint of (role, service, model, function, prompt)
+* and the embeddings of the value. Created only when pgvector is installed
+* before pg_ai. The embeddings of the Gemini (768) and OpenAI (1536) models
+* have an HNSW index each, with a pgvector that has HNSW.
+*/
+DO $$
+DECLARE
+	vector_schema	TEXT;
+	dimensions		INTEGER;
+BEGIN
+	SELECT n.nspname INTO vector_schema
+	  FROM pg_extension e JOIN pg_namespace n ON n.oid = e.extnamespace
+	 WHERE e.extname = 'vector';
+	IF vector_schema IS NULL THEN
+		RETURN;
+	END IF;
+
+	EXECUTE format('CREATE UNLOGGED TABLE @extschema@.pg_ai_semantic_cache(
+		context_1	BIGINT NOT NULL,
+		context_2	BIGINT NOT NULL,
+		owner		REGROLE NOT NULL DEFAULT current_user::regrole,
+		embeddings	%I.vector NOT NULL,
+		result		TEXT NOT NULL,
+		created_at	TIMESTAMPTZ NOT NULL DEFAULT now()
+	)', vector_schema);
+	CREATE INDEX pg_ai_semantic_cache_context_idx
+		ON @extschema@.pg_ai_semantic_cache(context_1, context_2, created_at);
+	IF EXISTS (SELECT 1 FROM pg_am WHERE amname = 'hnsw') THEN
+		FOREACH dimensions IN ARRAY ARRAY[768, 1536] LOOP
+			EXECUTE format('CREATE INDEX pg_ai_semantic_cache_%2$s_idx
+				ON @extschema@.pg_ai_semantic_cache USING hnsw
+				((embeddings::%1$I.vector(%2$s)) %1$I.vector_cosine_ops)
+				WHERE %1$I.vector_dims(embeddings) = %2$s',
+				vector_schema, dimensions);
+		END LOOP;
+	END IF;
+
+	ALTER TABLE @extschema@.pg_ai_semantic_cache ENABLE ROW LEVEL SECURITY;
+	CREATE POLICY pg_ai_semantic_cache_owner ON @extschema@.pg_ai_semantic_cache
+		USING (owner = current_user::regrole)
+		WITH CHECK (owner = current_user::regrole);
+	GRANT SELECT, INSERT, DELETE ON @extschema@.pg_ai_semantic_cache TO PUBLIC;
+END
+$$;
+
+/*
+* Adaptive concurrency limit of every endpoint in use, the limit grows while
+* the requests succeed and is cut when the service throttles or the latency
+* spikes. The requests in flight and waiting are split by traffic class.
+*/
+CREATE OR REPLACE FUNCTION pg_ai_concurrency_limits(
+	OUT endpoint	TEXT,
+	OUT concurrency_limit	FLOAT8,
+	OUT in_flight	INTEGER,
+	OUT batch_in_flight	INTEGER,
+	OUT interactive_waiting	INTEGER,
+	OUT batch_waiting	INTEGER,
+	OUT latency_ms	FLOAT8
+)RETURNS SETOF record AS 'MODULE_PATHNAME', 'pg_ai_concurrency_limits' LANGUAGE C VOLATILE;
+
+/*
+* Recent changes in the concurrency limit of the endpoints, the reason is one
+* of increase, throttled or latency.
+*/
+CREATE OR REPLACE FUNCTION pg_ai_concurrency_history(
+	OUT endpoint	TEXT,
+	OUT changed_at	TIMESTAMPTZ,
+	OUT concurrency_limit	FLOAT8,
+	OUT reason		TEXT
+)RETURNS SETOF record AS 'MODULE_PATHNAME', 'pg_ai_concurrency_history' LANGUAGE C VOLATILE;
+
+/*
+* Statistics of the requests of all the sessions per service, model and
+* function since the last reset. The errors are the calls without an HTTP 200
+* answer, split into client errors (4xx but 429), throttled (429), server
+* errors (5xx) and transfer errors (no answer). The tokens are read from the
+* usage of the responses, the cache hits are the calls answered by the shared
+* caches. The latency percentiles are estimated from a histogram. The time
+* of the requests is split into the DNS lookup, the TCP connect, the TLS
+* handshake, the wait for the first byte of the answer (ttfb) and the
+* transfer of the answer, new_connections are the requests that did not reuse
+* a connection.
+*/
+CREATE OR REPLACE FUNCTION pg_ai_stat(
+	OUT service		TEXT,
+	OUT model		TEXT,
+	OUT function	TEXT,
+	OUT calls		BIGINT,
+	OUT errors		BIGINT,
+	OUT client_errors	BIGINT,
+	OUT throttled	BIGINT,
+	OUT server_errors	BIGINT,
+	OUT transfer_errors	BIGINT,
+	OUT bytes_sent	BIGINT,
+	OUT bytes_received	BIGINT,
+	OUT tokens_in	BIGINT,
+	OUT tokens_out	BIGINT,
+	OUT cache_hits	BIGINT,
+	OUT total_time_ms	FLOAT8,
+	OUT mean_time_ms	FLOAT8,
+	OUT p50_ms		FLOAT8,
+	OUT p95_ms		FLOAT8,
+	OUT p99_ms		FLOAT8,
+	OUT dns_time_ms	FLOAT8,
+	OUT connect_time_ms	FLOAT8,
+	OUT tls_time_ms	FLOAT8,
+	OUT ttfb_time_ms	FLOAT8,
+	OUT transfer_time_ms	FLOAT8,
+	OUT new_connections	BIGINT,
+	OUT http1_calls	BIGINT,
+	OUT http2_calls	BIGINT,
+	OUT http3_calls	BIGINT,
+	OUT stats_since	TIMESTAMPTZ
+)RETURNS SETOF record AS 'MODULE_PATHNAME', 'pg_ai_stat' LANGUAGE C VOLATILE;
+
+CREATE VIEW pg_stat_pg_ai AS SELECT * FROM pg_ai_stat();
+
+/*
+* Function to forget the statistics of all the requests.
+*/
+CREATE OR REPLACE FUNCTION pg_ai_stat_reset()
+RETURNS VOID AS 'MODULE_PATHNAME', 'pg_ai_stat_reset' LANGUAGE C VOLATILE;
+REVOKE ALL ON FUNCTION pg_ai_stat_reset() FROM PUBLIC;
+
+/*
+* The last requests of all the sessions, the oldest first, kept in a ring in
+* shared memory. The endpoint is the URL without its query string, the status
+* is NULL for a transfer without an HTTP answer. request_hash is a hash of
+* the request body, to tell repeated prompts apart without keeping them.
+*/
+CREATE OR REPLACE FUNCTION pg_ai_recent_requests(
+	OUT finished_at	TIMESTAMPTZ,
+	OUT pid			INTEGER,
+	OUT function	TEXT,
+	OUT endpoint	TEXT,
+	OUT status		INTEGER,
+	OUT http_version	TEXT,
+	OUT latency_ms	FLOAT8,
+	OUT dns_ms		FLOAT8,
+	OUT connect_ms	FLOAT8,
+	OUT tls_ms		FLOAT8,
+	OUT ttfb_ms		FLOAT8,
+	OUT transfer_ms	FLOAT8,
+	OUT new_connection	BOOLEAN,
+	OUT bytes_sent	BIGINT,
+	OUT bytes_received	BIGINT,
+	OUT request_hash	TEXT
+)RETURNS SETOF record AS 'MODULE_PATHNAME', 'pg_ai_recent_requests' LANGUAGE C VOLATILE;
+
+/*
+* Jobs run by background workers as the role that submitted them. settings
+* has the pg_ai settings of the submitting session other than the API key,
+* the workers take the key set for the role or the database. provider_batch
+* is the batch of the provider a job in the provider_batch mode waits on.
+*/
+CREATE TABLE pg_ai_jobs(
+	id				BIGSERIAL PRIMARY KEY,
+	kind			TEXT NOT NULL,
+	args			JSONB NOT NULL,
+	settings		JSONB NOT NULL DEFAULT '{}',
+	owner			REGROLE NOT NULL,
+	status			TEXT NOT NULL DEFAULT 'queued'
+					CHECK (status IN ('queued', 'running', 'done', 'failed')),
+	attempts		INTEGER NOT NULL DEFAULT 0 CHECK (attempts >= 0),
+	rows_done		BIGINT NOT NULL DEFAULT 0 CHECK (rows_done >= 0),
+	provider_batch	TEXT,
+	error			TEXT,
+	submitted_at	TIMESTAMPTZ NOT NULL DEFAULT now(),
+	run_after		TIMESTAMPTZ NOT NULL DEFAULT now(),
+	started_at		TIMESTAMPTZ,
+	finished_at		TIMESTAMPTZ
+);
+CREATE INDEX pg_ai_jobs_queue_idx ON pg_ai_jobs(owner, status, run_after);
+
+/*
+* Results of the jobs, a row per row of the query of an insight or
+* moderation job in the order of the query.
+*/
+CREATE TABLE pg_ai_job_results(
+	job_id			BIGINT NOT NULL REFERENCES pg_ai_jobs(id) ON DELETE CASCADE,
+	ordinality		BIGINT NOT NULL,
+	value			TEXT,
+	result			TEXT,
+	PRIMARY KEY (job_id, ordinality)
+);
+
+/*
+* A role sees the jobs of the roles it is a member of. The roles only read
+* the jobs, pg_ai_submit_job checks a job and inserts it and the workers write
+* the jobs and their results, both as the owner of the tables.
+*/
+ALTER TABLE pg_ai_jobs ENABLE ROW LEVEL SECURITY;
+CREATE POLICY pg_ai_jobs_owner ON pg_ai_jobs
+	USING (pg_has_role(owner, 'MEMBER'))
+	WITH CHECK (owner = current_user::regrole);
+ALTER TABLE pg_ai_job_results ENABLE ROW LEVEL SECURITY;
+CREATE POLICY pg_ai_job_results_owner ON pg_ai_job_results
+	USING (EXISTS (SELECT 1 FROM pg_ai_jobs j WHERE j.id = job_id));
+GRANT SELECT ON pg_ai_jobs TO PUBLIC;
+GRANT SELECT ON pg_ai_job_results TO PUBLIC;
+
+/* the jobs and their results are data, pg_dump keeps them */
+SELECT pg_catalog.pg_extension_config_dump('pg_ai_jobs', '');
+SELECT pg_catalog.pg_extension_config_dump('pg_ai_jobs_id_seq', '');
+SELECT pg_catalog.pg_extension_config_dump('pg_ai_job_results', '');
+
+/*
+* Function to queue a job for the background workers, returns the id of the
+* job. The kinds and their args:
+*	insight, moderation		{"query": <SQL query>, "prompt": <prompt>,
+*							 "mode": "provider_batch"}
+*	create_vector_store		{"store": <name>, "query": <SQL query>,
+*							 "notes": <notes>}
+* The workers notify the channel pg_ai_jobs with '<id>:done|failed'.
+*/
+CREATE OR REPLACE FUNCTION pg_ai_submit_job(
+	kind			TEXT,
+	args			JSONB
+)RETURNS BIGINT AS 'MODULE_PATHNAME', 'pg_ai_submit_job' LANGUAGE C VOLATILE;
+
+/*
+* Function to get the state of a job, status is one of queued, running, done
+* or failed.
+*/
+CREATE OR REPLACE FUNCTION pg_ai_job_status(
+	job_id			BIGINT,
+	OUT kind		TEXT,
+	OUT status		TEXT,
+	OUT attempts	INTEGER,
+	OUT rows_done	BIGINT,
+	OUT error		TEXT,
+	OUT submitted_at	TIMESTAMPTZ,
+	OUT started_at	TIMESTAMPTZ,
+	OUT finished_at	TIMESTAMPTZ
+)RETURNS record AS $$
+	SELECT kind, status, attempts, rows_done, error, submitted_at, started_at,
+		   finished_at
+	  FROM @extschema@.pg_ai_jobs WHERE id = job_id
+$$ LANGUAGE sql STABLE;
+
+/*
+* Function to start a worker for the jobs of the role left queued or running,
+* as after a restart. Returns false if no jobs are waiting.
+*/
+CREATE OR REPLACE FUNCTION pg_ai_resume_jobs()
+RETURNS BOOLEAN AS 'MODULE_PATHNAME', 'pg_ai_resume_jobs' LANGUAGE C VOLATILE;
+
+/*
+* Functions to start pg_ai_insight and pg_ai_moderation in the background,
+* they return a handle at once. The calls started by a session are in flight
+* together till their handles are awaited, a handle is awaited once. A call
+* not finished at the end of its transaction is cancelled.
+*/
+CREATE OR REPLACE FUNCTION pg_ai_insight_async(
+	column_name		TEXT,
+	prompt			TEXT = NULL
+)RETURNS BIGINT AS 'MODULE_PATHNAME', 'pg_ai_insight_async' LANGUAGE C VOLATILE;
+
+CREATE OR REPLACE FUNCTION pg_ai_moderation_async(
+	column_name		TEXT,
+	prompt			TEXT = NULL
+)RETURNS BIGINT AS 'MODULE_PATHNAME', 'pg_ai_moderation_async' LANGUAGE C VOLATILE;
+
+/*
+* Function to wait for the result of a call started in the background.
+*/
+CREATE OR REPLACE FUNCTION pg_ai_await(
+	handle			BIGINT
+)RETURNS TEXT AS 'MODULE_PATHNAME', 'pg_ai_await' LANGUAGE C VOLATILE STRICT;
+
+/*
+* Function to wait for the results of a set of calls started in the
+* background, the results are in the order of the handles.
+*/
+CREATE OR REPLACE FUNCTION pg_ai_await_all(
+	handles			BIGINT[]
+)RETURNS TEXT[] AS 'MODULE_PATHNAME', 'pg_ai_await_all' LANGUAGE C VOLATILE STRICT;
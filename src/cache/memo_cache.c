@@ -0,0 +1,107 @@
+#include "memo_cache.h"
+
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+
+#include "cache/service_cache.h"
+#include "core/memory_budget.h"
+#include "core/utils_pg_ai.h"
+
+/* a result memoized for a column value and prompt */
+typedef struct MemoCacheEntry
+{
+	PgAiFingerprint key; /* hash key, must be first */
+	char *result;
+} MemoCacheEntry;
+
+/* the memo of a call site, lives as long as the query */
+typedef struct MemoCache
+{
+	MemoryContext memory_context;
+	HTAB *hash;
+	Size used_bytes;
+	Size max_bytes;
+} MemoCache;
+
+/*
+ * Return the memo of the calling function, created on the first call in the
+ * memory context of the function call info.
+ */
+static MemoCache *get_memo_cache(FunctionCallInfo fcinfo)
+{
+	PgAiCallState *call_state = get_call_state(fcinfo);
+	MemoCache *memo_cache = (MemoCache *)call_state->memo_cache;
+	HASHCTL info;
+
+	if (memo_cache)
+		return memo_cache;
+
+	memo_cache = MemoryContextAllocZero(fcinfo->flinfo->fn_mcxt,
+										sizeof(MemoCache));
+	memo_cache->memory_context = AllocSetContextCreate(
+		fcinfo->flinfo->fn_mcxt, PG_AI_MEMO_MCTX, ALLOCSET_DEFAULT_SIZES);
+	memo_cache->max_bytes = get_work_mem_bytes();
+
+	info.keysize = sizeof(PgAiFingerprint);
+	info.entrysize = sizeof(MemoCacheEntry);
+	info.hcxt = memo_cache->memory_context;
+	memo_cache->hash = hash_create(PG_AI_MEMO_MCTX, 256, &info,
+								   HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
+	call_state->memo_cache = memo_cache;
+	return memo_cache;
+}
+
+/*
+ * Make the key for a column value and prompt, a NULL prompt (the default
+ * prompt) is different from an empty one.
+ */
+static void make_key(const char *column_value, const char *prompt,
+					 PgAiFingerprint *key)
+{
+	const char *parts[] = {column_value, prompt};
+
+	make_fingerprint(key, parts, prompt ? 2 : 1);
+}
+
+/*
+ * Return the result of an earlier call in the same query with the same column
+ * value and prompt, NULL if the value is seen for the first time.
+ */
+char *memo_cache_lookup(FunctionCallInfo fcinfo, const char *column_value,
+						const char *prompt)
+{
+	MemoCache *memo_cache = get_memo_cache(fcinfo);
+	MemoCacheEntry *entry;
+	PgAiFingerprint key;
+
+	make_key(column_value, prompt, &key);
+	entry = hash_search(memo_cache->hash, &key, HASH_FIND, NULL);
+
+	return entry ? entry->result : NULL;
+}
+
+/*
+ * Remember the result for the rest of the query. Once the memo has used up
+ * pg_ai.work_mem new results are no longer added.
+ */
+void memo_cache_store(FunctionCallInfo fcinfo, const char *column_value,
+					  const char *prompt, const char *result)
+{
+	MemoCache *memo_cache = get_memo_cache(fcinfo);
+	MemoCacheEntry *entry;
+	PgAiFingerprint key;
+	Size entry_bytes = sizeof(MemoCacheEntry) + strlen(result) + 1;
+	bool found;
+
+	if (memo_cache->used_bytes + entry_bytes > memo_cache->max_bytes)
+		return;
+
+	make_key(column_value, prompt, &key);
+	entry = hash_search(memo_cache->hash, &key, HASH_ENTER, &found);
+	if (!found)
+	{
+		entry->result = MemoryContextStrdup(memo_cache->memory_context, result);
+		memo_cache->used_bytes += entry_bytes;
+	}
+}
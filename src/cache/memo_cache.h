@@ -0,0 +1,13 @@
+#ifndef _MEMO_CACHE_H_
+#define _MEMO_CACHE_H_
+
+#include "postgres.h"
+#include "fmgr.h"
+
+/* results of the repeated inputs within a query, kept in fn_extra */
+char *memo_cache_lookup(FunctionCallInfo fcinfo, const char *column_value,
+						const char *prompt);
+void memo_cache_store(FunctionCallInfo fcinfo, const char *column_value,
+					  const char *prompt, const char *result);
+
+#endif /* _MEMO_CACHE_H_ */
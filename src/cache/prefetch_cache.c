@@ -0,0 +1,129 @@
+#include "prefetch_cache.h"
+
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+
+#include "core/ai_config_str.h"
+#include "core/utils_pg_ai.h"
+
+/* the result of a call, NULL till the response of the call is in */
+typedef struct PrefetchCacheEntry
+{
+	PgAiFingerprint key; /* hash key, must be first */
+	char *result;
+} PrefetchCacheEntry;
+
+struct PrefetchCache
+{
+	MemoryContext memory_context;
+	HTAB *hash;
+	MemoryContextCallback reset_callback;
+	struct PrefetchCache *next;
+};
+
+/* the caches of the prefetch scans running in the backend */
+static PrefetchCache *active_caches = NULL;
+
+/* take a cache off the active ones as its memory context goes away */
+static void unlink_prefetch_cache(void *arg)
+{
+	PrefetchCache **prev = &active_caches;
+
+	for (; *prev; prev = &(*prev)->next)
+		if (*prev == (PrefetchCache *)arg)
+		{
+			*prev = (*prev)->next;
+			break;
+		}
+}
+
+PrefetchCache *prefetch_cache_create(MemoryContext memory_context)
+{
+	PrefetchCache *prefetch_cache;
+	HASHCTL info;
+
+	prefetch_cache =
+		MemoryContextAllocZero(memory_context, sizeof(PrefetchCache));
+	prefetch_cache->memory_context = memory_context;
+
+	info.keysize = sizeof(PgAiFingerprint);
+	info.entrysize = sizeof(PrefetchCacheEntry);
+	info.hcxt = memory_context;
+	prefetch_cache->hash = hash_create(PG_AI_PREFETCH_MCTX, 64, &info,
+									   HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
+	prefetch_cache->reset_callback.func = unlink_prefetch_cache;
+	prefetch_cache->reset_callback.arg = prefetch_cache;
+	MemoryContextRegisterResetCallback(memory_context,
+									   &prefetch_cache->reset_callback);
+
+	prefetch_cache->next = active_caches;
+	active_caches = prefetch_cache;
+	return prefetch_cache;
+}
+
+/*
+ * Make the key for a call, the function is part of it as the functions take
+ * the same column value and prompt.
+ */
+static void make_key(const int function_flags, const char *column_value,
+					 const char *prompt, PgAiFingerprint *key)
+{
+	char function[16];
+	const char *parts[] = {function, column_value, prompt};
+
+	snprintf(function, sizeof(function), "%d", function_flags);
+	make_fingerprint(key, parts, prompt ? 3 : 2);
+}
+
+bool prefetch_cache_reserve(PrefetchCache *prefetch_cache,
+							const int function_flags, const char *column_value,
+							const char *prompt)
+{
+	PrefetchCacheEntry *entry;
+	PgAiFingerprint key;
+	bool found;
+
+	make_key(function_flags, column_value, prompt, &key);
+	entry = hash_search(prefetch_cache->hash, &key, HASH_ENTER, &found);
+	if (!found)
+		entry->result = NULL;
+
+	return !found;
+}
+
+void prefetch_cache_store(PrefetchCache *prefetch_cache,
+						  const int function_flags, const char *column_value,
+						  const char *prompt, const char *result)
+{
+	PrefetchCacheEntry *entry;
+	PgAiFingerprint key;
+	bool found;
+
+	make_key(function_flags, column_value, prompt, &key);
+	entry = hash_search(prefetch_cache->hash, &key, HASH_ENTER, &found);
+	entry->result = MemoryContextStrdup(prefetch_cache->memory_context, result);
+}
+
+/*
+ * A call reserved but without a result, a failed request, is not answered
+ * here. The function then calls the service itself and reports the error as
+ * it would without the prefetch.
+ */
+char *prefetch_cache_lookup(const int function_flags, const char *column_value,
+							const char *prompt)
+{
+	PrefetchCacheEntry *entry;
+	PgAiFingerprint key;
+
+	if (!active_caches)
+		return NULL;
+
+	make_key(function_flags, column_value, prompt, &key);
+	for (PrefetchCache *cache = active_caches; cache; cache = cache->next)
+		if ((entry = hash_search(cache->hash, &key, HASH_FIND, NULL)) &&
+			entry->result)
+			return entry->result;
+
+	return NULL;
+}
@@ -0,0 +1,27 @@
+#ifndef _PREFETCH_CACHE_H_
+#define _PREFETCH_CACHE_H_
+
+#include "postgres.h"
+
+/*
+ * The results a prefetch scan got ahead of the projection of its rows, for
+ * a window of rows. The cache goes away with the memory context it is made
+ * in, the per-row functions look it up before calling the service.
+ */
+typedef struct PrefetchCache PrefetchCache;
+
+PrefetchCache *prefetch_cache_create(MemoryContext memory_context);
+
+/* add a call to the cache, false if the same call is already in it */
+bool prefetch_cache_reserve(PrefetchCache *prefetch_cache,
+							const int function_flags, const char *column_value,
+							const char *prompt);
+void prefetch_cache_store(PrefetchCache *prefetch_cache,
+						  const int function_flags, const char *column_value,
+						  const char *prompt, const char *result);
+
+/* the result of a call in any of the caches of the backend, NULL if none */
+char *prefetch_cache_lookup(const int function_flags, const char *column_value,
+							const char *prompt);
+
+#endif /* _PREFETCH_CACHE_H_ */
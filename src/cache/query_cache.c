@@ -0,0 +1,245 @@
+#include "query_cache.h"
+
+#include "lib/ilist.h"
+#include "storage/shmem.h"
+#include "utils/hsearch.h"
+
+#include "core/utils_pg_ai.h"
+#include "guc/pg_ai_guc.h"
+#include "rest/request_stats.h"
+
+/* the key is the fingerprint of the service, model and normalized query */
+typedef struct QueryCacheKey
+{
+	PgAiFingerprint fingerprint;
+} QueryCacheKey;
+
+/* a cached query vector, the entries are linked in the LRU order */
+typedef struct QueryCacheEntry
+{
+	QueryCacheKey key; /* hash key, must be first */
+	dlist_node lru_node;
+	int dimensions;
+	float4 vector[QUERY_CACHE_MAX_DIMENSIONS];
+} QueryCacheEntry;
+
+/* the state of the cache shared across the backends */
+typedef struct QueryCacheState
+{
+	LWLock *lock;
+	dlist_head lru_list; /* most recently used entry at the head */
+	int64 hits;
+	int64 misses;
+} QueryCacheState;
+
+/* stays NULL if pg_ai is not in shared_preload_libraries */
+static QueryCacheState *query_cache = NULL;
+static HTAB *query_cache_hash = NULL;
+
+/*
+ * Max number of entries in the cache, the GUC can only be set at start.
+ */
+static int get_max_entries(void)
+{
+	return *get_pg_ai_guc_int_variable(PG_AI_GUC_QUERY_CACHE_SIZE);
+}
+
+/*
+ * Shared memory needed by the cache, none if the cache is disabled.
+ */
+Size query_cache_shmem_size(void)
+{
+	int max_entries = get_max_entries();
+
+	if (max_entries == 0)
+		return 0;
+
+	return add_size(MAXALIGN(sizeof(QueryCacheState)),
+					hash_estimate_size(max_entries, sizeof(QueryCacheEntry)));
+}
+
+/*
+ * Attach to the shared state of the cache, initialize it on the first call.
+ */
+void query_cache_shmem_startup(LWLock *lock)
+{
+	HASHCTL info;
+	bool found;
+	int max_entries = get_max_entries();
+
+	query_cache = ShmemInitStruct(PG_AI_SHMEM_QUERY_CACHE,
+								  sizeof(QueryCacheState), &found);
+	if (!found)
+	{
+		query_cache->lock = lock;
+		dlist_init(&query_cache->lru_list);
+		query_cache->hits = 0;
+		query_cache->misses = 0;
+	}
+
+	info.keysize = sizeof(QueryCacheKey);
+	info.entrysize = sizeof(QueryCacheEntry);
+	query_cache_hash =
+		ShmemInitHash(PG_AI_SHMEM_QUERY_CACHE_HASH, max_entries, max_entries,
+					  &info, HASH_ELEM | HASH_BLOBS);
+}
+
+/*
+ * Make the cache key for a query. The key is independent of the case and the
+ * white spaces in the query.
+ */
+static void make_key(AIService *ai_service, const char *query_text,
+					 QueryCacheKey *key)
+{
+	char *normalized = normalize_text(query_text);
+	const char *parts[] = {ai_service->get_service_name(ai_service),
+						   ai_service->get_model_name(ai_service), normalized};
+
+	memset(key, 0, sizeof(QueryCacheKey));
+	make_fingerprint(&key->fingerprint, parts, 3);
+	pfree(normalized);
+}
+
+/*
+ * Look up the vector of a natural language query. On a hit the vector text is
+ * copied to the given buffer and the entry becomes the most recently used.
+ */
+bool query_cache_lookup(AIService *ai_service, const char *query_text,
+						char *vector_text, const size_t max_len)
+{
+	QueryCacheKey key;
+	QueryCacheEntry *entry;
+	float4 *vector;
+	int dimensions = 0;
+	bool found;
+
+	if (!query_cache)
+		return false;
+
+	make_key(ai_service, query_text, &key);
+	vector = palloc(sizeof(float4) * QUERY_CACHE_MAX_DIMENSIONS);
+
+	/* an exclusive lock as a hit reorders the LRU list */
+	LWLockAcquire(query_cache->lock, LW_EXCLUSIVE);
+	entry = hash_search(query_cache_hash, &key, HASH_FIND, NULL);
+	if (entry)
+	{
+		dlist_move_head(&query_cache->lru_list, &entry->lru_node);
+		dimensions = entry->dimensions;
+		memcpy(vector, entry->vector, sizeof(float4) * dimensions);
+		query_cache->hits++;
+	}
+	else
+		query_cache->misses++;
+	LWLockRelease(query_cache->lock);
+
+	/* format outside the lock */
+	found = (dimensions > 0) &&
+			format_vector_text(vector, dimensions, vector_text, max_len);
+	pfree(vector);
+
+	if (found)
+		request_stats_count_cache_hit(ai_service);
+	if (found && DEBUG_LEVEL(PG_AI_DEBUG_3))
+		ereport(INFO, (errmsg("Query cache hit: %s\n", query_text)));
+
+	return found;
+}
+
+/*
+ * Store the vector of a natural language query. If the cache is full the
+ * least recently used entry is evicted.
+ */
+void query_cache_store(AIService *ai_service, const char *query_text,
+					   const char *vector_text)
+{
+	QueryCacheKey key;
+	QueryCacheEntry *entry;
+	QueryCacheEntry *victim;
+	float4 *vector;
+	int dimensions;
+
+	if (!query_cache)
+		return;
+
+	vector = palloc(sizeof(float4) * QUERY_CACHE_MAX_DIMENSIONS);
+	dimensions =
+		parse_vector_text(vector_text, vector, QUERY_CACHE_MAX_DIMENSIONS);
+	if (dimensions == 0)
+	{
+		pfree(vector);
+		return;
+	}
+	make_key(ai_service, query_text, &key);
+
+	LWLockAcquire(query_cache->lock, LW_EXCLUSIVE);
+	entry = hash_search(query_cache_hash, &key, HASH_FIND, NULL);
+	if (!entry)
+	{
+		/* make room by evicting the entry at the tail */
+		if (hash_get_num_entries(query_cache_hash) >= get_max_entries())
+		{
+			victim = dlist_tail_element(QueryCacheEntry, lru_node,
+										&query_cache->lru_list);
+			dlist_delete(&victim->lru_node);
+			hash_search(query_cache_hash, &victim->key, HASH_REMOVE, NULL);
+		}
+
+		entry = hash_search(query_cache_hash, &key, HASH_ENTER_NULL, NULL);
+		if (entry)
+			dlist_push_head(&query_cache->lru_list, &entry->lru_node);
+	}
+	else
+		dlist_move_head(&query_cache->lru_list, &entry->lru_node);
+
+	if (entry)
+	{
+		entry->dimensions = dimensions;
+		memcpy(entry->vector, vector, sizeof(float4) * dimensions);
+	}
+	LWLockRelease(query_cache->lock);
+
+	pfree(vector);
+}
+
+/*
+ * Get the number of entries and the hit/miss counts of the cache.
+ */
+void query_cache_get_stats(int64 *entries, int64 *hits, int64 *misses)
+{
+	*entries = 0;
+	*hits = 0;
+	*misses = 0;
+
+	if (!query_cache)
+		return;
+
+	LWLockAcquire(query_cache->lock, LW_SHARED);
+	*entries = hash_get_num_entries(query_cache_hash);
+	*hits = query_cache->hits;
+	*misses = query_cache->misses;
+	LWLockRelease(query_cache->lock);
+}
+
+/*
+ * Remove all the entries and reset the hit/miss counts.
+ */
+void query_cache_reset(void)
+{
+	dlist_mutable_iter iter;
+	QueryCacheEntry *entry;
+
+	if (!query_cache)
+		return;
+
+	LWLockAcquire(query_cache->lock, LW_EXCLUSIVE);
+	dlist_foreach_modify(iter, &query_cache->lru_list)
+	{
+		entry = dlist_container(QueryCacheEntry, lru_node, iter.cur);
+		dlist_delete(iter.cur);
+		hash_search(query_cache_hash, &entry->key, HASH_REMOVE, NULL);
+	}
+	query_cache->hits = 0;
+	query_cache->misses = 0;
+	LWLockRelease(query_cache->lock);
+}
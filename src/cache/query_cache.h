@@ -0,0 +1,21 @@
+#ifndef _QUERY_CACHE_H_
+#define _QUERY_CACHE_H_
+
+#include "core/ai_service.h"
+#include "storage/lwlock.h"
+
+/* shared memory setup, called from the pg_ai shmem hooks */
+Size query_cache_shmem_size(void);
+void query_cache_shmem_startup(LWLock *lock);
+
+/* lookup and store the vectors of the natural language queries */
+bool query_cache_lookup(AIService *ai_service, const char *query_text,
+						char *vector_text, const size_t max_len);
+void query_cache_store(AIService *ai_service, const char *query_text,
+					   const char *vector_text);
+
+/* statistics of the cache */
+void query_cache_get_stats(int64 *entries, int64 *hits, int64 *misses);
+void query_cache_reset(void);
+
+#endif /* _QUERY_CACHE_H_ */
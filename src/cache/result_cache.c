@@ -0,0 +1,183 @@
+#include "result_cache.h"
+
+#include "access/parallel.h"
+#include "access/xact.h"
+#include "catalog/pg_type.h"
+#include "executor/spi.h"
+#include "miscadmin.h"
+#include "utils/builtins.h"
+#include "utils/memutils.h"
+
+#include "core/utils_pg_ai.h"
+#include "guc/pg_ai_guc.h"
+#include "rest/request_stats.h"
+
+/* queries on the result cache table, %s is the qualified table name */
+#define RESULT_CACHE_LOOKUP_QUERY                                              \
+	"SELECT result FROM %s WHERE fingerprint_1 = $1 AND fingerprint_2 = $2 "   \
+	"AND created_at > now() - make_interval(secs => $3)"
+
+#define RESULT_CACHE_STORE_QUERY                                               \
+	"INSERT INTO %s (fingerprint_1, fingerprint_2, service, model, result) "   \
+	"VALUES ($1, $2, $3, $4, $5) ON CONFLICT (fingerprint_1, fingerprint_2) "  \
+	"DO UPDATE SET result = EXCLUDED.result, created_at = now()"
+
+#define RESULT_CACHE_TRIM_QUERY                                                \
+	"DELETE FROM %s WHERE created_at <= now() - make_interval(secs => $1) "    \
+	"OR ctid IN (SELECT ctid FROM %s ORDER BY created_at DESC OFFSET $2)"
+
+/* qualified name of the cache table, resolved once per backend */
+static char *result_cache_table = NULL;
+
+/* number of results stored by this backend, to trim the table periodically */
+static uint64 result_cache_stores = 0;
+
+/*
+ * Seconds a cached result stays valid, 0 when the cache is disabled.
+ */
+static int get_ttl(void)
+{
+	return *get_pg_ai_guc_int_variable(PG_AI_GUC_RESULT_CACHE_TTL);
+}
+
+/*
+ * Return the schema qualified name of the cache table, NULL if the extension
+ * is not created.
+ */
+static const char *get_result_cache_table(void)
+{
+	if (!result_cache_table)
+	{
+		char *name = make_pg_ai_object_name(PG_AI_RESULT_CACHE_TABLE);
+
+		if (!name)
+			return NULL;
+		result_cache_table = MemoryContextStrdup(TopMemoryContext, name);
+	}
+	return result_cache_table;
+}
+
+/*
+ * Make the cache key for a column value. The key covers everything that
+ * decides the response: the service, model, function, prompt and the value,
+ * and the role so the results are not shared across roles.
+ */
+static void make_key(AIService *ai_service, const char *column_value,
+					 PgAiFingerprint *fingerprint)
+{
+	char role_id[16];
+	char function_id[16];
+	const char *prompt;
+	const char *parts[6];
+
+	snprintf(role_id, sizeof(role_id), "%u", GetUserId());
+	snprintf(function_id, sizeof(function_id), "%d",
+			 ai_service->function_flags);
+	prompt = get_option_value(AI_SERVICE_OPTIONS, OPTION_SERVICE_PROMPT);
+
+	parts[0] = role_id;
+	parts[1] = ai_service->get_service_name(ai_service);
+	parts[2] = ai_service->get_model_name(ai_service);
+	parts[3] = function_id;
+	parts[4] = prompt ? prompt : "";
+	parts[5] = column_value;
+	make_fingerprint(fingerprint, parts, 6);
+}
+
+/*
+ * Look up the result of an earlier call with the same service, model, prompt
+ * and column value. Returns the result allocated in the current memory
+ * context, NULL on a miss or if the cache is disabled.
+ */
+char *result_cache_lookup(AIService *ai_service, const char *column_value)
+{
+	MemoryContext caller_context = CurrentMemoryContext;
+	PgAiFingerprint fingerprint;
+	const char *table;
+	char *result = NULL;
+	Oid arg_types[3] = {INT8OID, INT8OID, FLOAT8OID};
+	Datum args[3];
+	int ret;
+
+	if (get_ttl() == 0 || !(table = get_result_cache_table()))
+		return NULL;
+
+	make_key(ai_service, column_value, &fingerprint);
+	args[0] = Int64GetDatum((int64)fingerprint.hash_1);
+	args[1] = Int64GetDatum((int64)fingerprint.hash_2);
+	args[2] = Float8GetDatum((float8)get_ttl());
+
+	SPI_connect();
+	ret = SPI_execute_with_args(psprintf(RESULT_CACHE_LOOKUP_QUERY, table), 3,
+								arg_types, args, NULL, true /* read_only */,
+								1 /* count */);
+	if (ret == SPI_OK_SELECT && SPI_processed > 0)
+		result = MemoryContextStrdup(
+			caller_context, SPI_getvalue(SPI_tuptable->vals[0],
+										 SPI_tuptable->tupdesc, 1));
+	SPI_finish();
+
+	if (result)
+		request_stats_count_cache_hit(ai_service);
+	if (result && DEBUG_LEVEL(PG_AI_DEBUG_3))
+		ereport(INFO, (errmsg("Result cache hit: %s\n", column_value)));
+
+	return result;
+}
+
+/*
+ * Remove the expired results and the oldest ones beyond the max rows, of the
+ * rows of the role the policy of the table lets it see.
+ */
+static void trim_result_cache(const char *table)
+{
+	Oid arg_types[2] = {FLOAT8OID, INT8OID};
+	Datum args[2];
+	int max_rows;
+
+	max_rows = *get_pg_ai_guc_int_variable(PG_AI_GUC_RESULT_CACHE_MAX_ROWS);
+	args[0] = Float8GetDatum((float8)get_ttl());
+	args[1] = Int64GetDatum((int64)max_rows);
+
+	SPI_execute_with_args(psprintf(RESULT_CACHE_TRIM_QUERY, table, table), 2,
+						  arg_types, args, NULL, false /* read_only */, 0);
+}
+
+/*
+ * Store the result of a successful REST transfer against the column value.
+ * Nothing is stored in read only transactions or in parallel mode.
+ */
+void result_cache_store(AIService *ai_service, const char *column_value)
+{
+	PgAiFingerprint fingerprint;
+	const char *table;
+	const char *result = (const char *)ai_service->rest_response->data;
+	Oid arg_types[5] = {INT8OID, INT8OID, TEXTOID, TEXTOID, TEXTOID};
+	Datum args[5];
+
+	if (get_ttl() == 0 || !(table = get_result_cache_table()))
+		return;
+
+	if (ai_service->rest_response->response_code != HTTP_OK ||
+		result[0] == '\0')
+		return;
+
+	if (XactReadOnly || IsInParallelMode())
+		return;
+
+	make_key(ai_service, column_value, &fingerprint);
+	args[0] = Int64GetDatum((int64)fingerprint.hash_1);
+	args[1] = Int64GetDatum((int64)fingerprint.hash_2);
+	args[2] = CStringGetTextDatum(ai_service->get_service_name(ai_service));
+	args[3] = CStringGetTextDatum(ai_service->get_model_name(ai_service));
+	args[4] = CStringGetTextDatum(result);
+
+	SPI_connect();
+	SPI_execute_with_args(psprintf(RESULT_CACHE_STORE_QUERY, table), 5,
+						  arg_types, args, NULL, false /* read_only */, 0);
+
+	/* keep the table within the size limit */
+	if (result_cache_stores++ % RESULT_CACHE_TRIM_INTERVAL == 0)
+		trim_result_cache(table);
+	SPI_finish();
+}
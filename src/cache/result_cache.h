@@ -0,0 +1,10 @@
+#ifndef _RESULT_CACHE_H_
+#define _RESULT_CACHE_H_
+
+#include "core/ai_service.h"
+
+/* lookup and store the results of the per row insight/moderation calls */
+char *result_cache_lookup(AIService *ai_service, const char *column_value);
+void result_cache_store(AIService *ai_service, const char *column_value);
+
+#endif /* _RESULT_CACHE_H_ */
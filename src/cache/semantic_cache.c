@@ -0,0 +1,270 @@
+#include "semantic_cache.h"
+
+#include "access/parallel.h"
+#include "access/xact.h"
+#include "catalog/pg_type.h"
+#include "commands/extension.h"
+#include "executor/spi.h"
+#include "miscadmin.h"
+#include "utils/builtins.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+
+#include "cache/service_cache.h"
+#include "core/ai_config_str.h"
+#include "core/utils_pg_ai.h"
+#include "guc/pg_ai_guc.h"
+#include "rest/request_stats.h"
+
+/*
+ * Queries on the table, created by the extension script when pgvector is
+ * installed. %1$s is the qualified table name, %2$d the dimensions of the
+ * embeddings and %3$s the schema of pgvector, the lookup matches the HNSW
+ * index of those dimensions. The objects of pgvector are qualified, they are
+ * not taken from the search_path.
+ */
+#define SEMANTIC_CACHE_LOOKUP_QUERY                                            \
+	"SELECT result, 1 - (embeddings::%3$s.vector(%2$d) "                       \
+	"OPERATOR(%3$s.<=>) $3::%3$s.vector(%2$d)) "                               \
+	"FROM %1$s WHERE context_1 = $1 AND context_2 = $2 "                       \
+	"AND %3$s.vector_dims(embeddings) = %2$d "                                 \
+	"AND created_at > now() - make_interval(secs => $4) "                      \
+	"ORDER BY embeddings::%3$s.vector(%2$d) "                                  \
+	"OPERATOR(%3$s.<=>) $3::%3$s.vector(%2$d) LIMIT 1"
+
+#define SEMANTIC_CACHE_STORE_QUERY                                             \
+	"INSERT INTO %1$s (context_1, context_2, embeddings, result) "             \
+	"VALUES ($1, $2, $3::%2$s.vector, $4)"
+
+#define SEMANTIC_CACHE_TRIM_QUERY                                              \
+	"DELETE FROM %s WHERE created_at <= now() - make_interval(secs => $1) "    \
+	"OR ctid IN (SELECT ctid FROM %s ORDER BY created_at DESC OFFSET $2)"
+
+/* number of results stored by this backend, to trim the table periodically */
+static uint64 semantic_cache_stores = 0;
+
+/*
+ * The semantic cache extends the result cache, it shares its TTL and size.
+ */
+static int get_ttl(void)
+{
+	return *get_pg_ai_guc_int_variable(PG_AI_GUC_RESULT_CACHE_TTL);
+}
+
+static double get_threshold(void)
+{
+	return *get_pg_ai_guc_real_variable(PG_AI_GUC_SEMANTIC_CACHE_THRESHOLD);
+}
+
+/*
+ * Return the qualified name of the cache table, NULL if it does not exist as
+ * pgvector was not installed before pg_ai.
+ */
+static char *get_semantic_cache_table(void)
+{
+	if (!OidIsValid(get_relname_relid(PG_AI_SEMANTIC_CACHE_TABLE,
+									  get_pg_ai_schema())))
+		return NULL;
+	return make_pg_ai_object_name(PG_AI_SEMANTIC_CACHE_TABLE);
+}
+
+/*
+ * Return the quoted schema of pgvector, NULL if it is not installed. It is
+ * looked up once per session.
+ */
+static const char *get_vector_schema(void)
+{
+	static char *schema_name = NULL;
+	Oid extension_oid;
+	char *name;
+
+	if (!schema_name)
+	{
+		extension_oid = get_extension_oid(PG_EXTENSION_PG_VECTOR, true);
+		if (!OidIsValid(extension_oid) ||
+			!(name = get_namespace_name(get_extension_schema(extension_oid))))
+			return NULL;
+		schema_name =
+			MemoryContextStrdup(TopMemoryContext, quote_identifier(name));
+	}
+	return schema_name;
+}
+
+/*
+ * Make the context of a cached result, the results are reused only across
+ * the calls of the same role with the same service, model, function and
+ * prompt.
+ */
+static void make_context(AIService *ai_service, PgAiFingerprint *context)
+{
+	char role_id[16];
+	char function_id[16];
+	const char *prompt;
+	const char *parts[5];
+
+	snprintf(role_id, sizeof(role_id), "%u", GetUserId());
+	snprintf(function_id, sizeof(function_id), "%d",
+			 ai_service->function_flags);
+	prompt = get_option_value(AI_SERVICE_OPTIONS, OPTION_SERVICE_PROMPT);
+
+	parts[0] = role_id;
+	parts[1] = ai_service->get_service_name(ai_service);
+	parts[2] = ai_service->get_model_name(ai_service);
+	parts[3] = function_id;
+	parts[4] = prompt ? prompt : "";
+	make_fingerprint(context, parts, 5);
+}
+
+/* the dimensions of the embeddings in the vector text form [x,y,...] */
+static int get_dimensions(const char *embeddings)
+{
+	int dimensions = 1;
+
+	for (const char *c = embeddings; *c; c++)
+		if (*c == ',')
+			dimensions++;
+	return dimensions;
+}
+
+/*
+ * Get the embeddings of a text from the embeddings model of the configured
+ * service. Returns the vector text, NULL if the embeddings are not available.
+ */
+static char *embed_text(const char *text)
+{
+	AIService *embed_service;
+
+	/* the embeddings service of the session is reused */
+	if (!(embed_service = get_session_service(FUNCTION_EMBED_TEXT,
+											  CurrentMemoryContext)) ||
+		embed_service->set_and_validate_options(embed_service, NULL) ||
+		embed_service->set_service_data(embed_service, (void *)text) ||
+		embed_service->prepare_for_transfer(embed_service))
+		return NULL;
+
+	embed_service->rest_transfer(embed_service);
+	if (embed_service->rest_response->response_code != HTTP_OK)
+		return NULL;
+
+	return pstrdup((char *)(embed_service->rest_response->data));
+}
+
+/*
+ * Look up the result of an earlier input similar to the column value. The
+ * input is embedded and the nearest cached input is reused if its cosine
+ * similarity is at least pg_ai.semantic_cache_threshold. The embeddings are
+ * returned to be stored with the result on a miss.
+ */
+char *semantic_cache_lookup(AIService *ai_service, const char *column_value,
+							char **embeddings)
+{
+	MemoryContext caller_context = CurrentMemoryContext;
+	PgAiFingerprint context;
+	char *table;
+	const char *vector_schema;
+	char *result = NULL;
+	double similarity = 0;
+	Oid arg_types[4] = {INT8OID, INT8OID, TEXTOID, FLOAT8OID};
+	Datum args[4];
+	bool isnull;
+	int ret;
+
+	*embeddings = NULL;
+	if (get_threshold() == 0 || get_ttl() == 0 ||
+		!(table = get_semantic_cache_table()) ||
+		!(vector_schema = get_vector_schema()))
+		return NULL;
+
+	if (!(*embeddings = embed_text(column_value)))
+		return NULL;
+
+	make_context(ai_service, &context);
+	args[0] = Int64GetDatum((int64)context.hash_1);
+	args[1] = Int64GetDatum((int64)context.hash_2);
+	args[2] = CStringGetTextDatum(*embeddings);
+	args[3] = Float8GetDatum((float8)get_ttl());
+
+	SPI_connect();
+	ret = SPI_execute_with_args(psprintf(SEMANTIC_CACHE_LOOKUP_QUERY, table,
+										 get_dimensions(*embeddings),
+										 vector_schema),
+								4, arg_types, args, NULL, true /* read_only */,
+								1 /* count */);
+	if (ret == SPI_OK_SELECT && SPI_processed > 0)
+	{
+		similarity = DatumGetFloat8(SPI_getbinval(
+			SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 2, &isnull));
+		if (!isnull && similarity >= get_threshold())
+			result = MemoryContextStrdup(
+				caller_context, SPI_getvalue(SPI_tuptable->vals[0],
+											 SPI_tuptable->tupdesc, 1));
+	}
+	SPI_finish();
+
+	if (result)
+		request_stats_count_cache_hit(ai_service);
+	if (result && DEBUG_LEVEL(PG_AI_DEBUG_3))
+		ereport(INFO, (errmsg("Semantic cache hit(%.4f): %s\n", similarity,
+							  column_value)));
+
+	return result;
+}
+
+/*
+ * Remove the expired results and the oldest ones beyond the max rows, of the
+ * rows of the role the policy of the table lets it see.
+ */
+static void trim_semantic_cache(const char *table)
+{
+	Oid arg_types[2] = {FLOAT8OID, INT8OID};
+	Datum args[2];
+	int max_rows;
+
+	max_rows = *get_pg_ai_guc_int_variable(PG_AI_GUC_RESULT_CACHE_MAX_ROWS);
+	args[0] = Float8GetDatum((float8)get_ttl());
+	args[1] = Int64GetDatum((int64)max_rows);
+
+	SPI_execute_with_args(psprintf(SEMANTIC_CACHE_TRIM_QUERY, table, table), 2,
+						  arg_types, args, NULL, false /* read_only */, 0);
+}
+
+/*
+ * Store the result of a successful REST transfer against the embeddings of
+ * the input. Nothing is stored in read only transactions or in parallel mode.
+ */
+void semantic_cache_store(AIService *ai_service, const char *embeddings)
+{
+	PgAiFingerprint context;
+	char *table;
+	const char *vector_schema;
+	const char *result = (const char *)ai_service->rest_response->data;
+	Oid arg_types[4] = {INT8OID, INT8OID, TEXTOID, TEXTOID};
+	Datum args[4];
+
+	if (!embeddings || !(table = get_semantic_cache_table()) ||
+		!(vector_schema = get_vector_schema()))
+		return;
+
+	if (ai_service->rest_response->response_code != HTTP_OK ||
+		result[0] == '\0')
+		return;
+
+	if (XactReadOnly || IsInParallelMode())
+		return;
+
+	make_context(ai_service, &context);
+	args[0] = Int64GetDatum((int64)context.hash_1);
+	args[1] = Int64GetDatum((int64)context.hash_2);
+	args[2] = CStringGetTextDatum(embeddings);
+	args[3] = CStringGetTextDatum(result);
+
+	SPI_connect();
+	SPI_execute_with_args(psprintf(SEMANTIC_CACHE_STORE_QUERY, table,
+								   vector_schema),
+						  4, arg_types, args, NULL, false /* read_only */, 0);
+
+	/* keep the table within the size limit */
+	if (semantic_cache_stores++ % RESULT_CACHE_TRIM_INTERVAL == 0)
+		trim_semantic_cache(table);
+	SPI_finish();
+}
@@ -0,0 +1,11 @@
+#ifndef _SEMANTIC_CACHE_H_
+#define _SEMANTIC_CACHE_H_
+
+#include "core/ai_service.h"
+
+/* reuse the results of inputs similar to the earlier ones */
+char *semantic_cache_lookup(AIService *ai_service, const char *column_value,
+							char **embeddings);
+void semantic_cache_store(AIService *ai_service, const char *embeddings);
+
+#endif /* _SEMANTIC_CACHE_H_ */
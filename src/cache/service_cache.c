@@ -0,0 +1,232 @@
+#include "service_cache.h"
+
+#include "access/xact.h"
+#include "utils/builtins.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+
+#include "core/memory_budget.h"
+
+/* the services of a session are told apart by the service, model, function */
+typedef struct ServiceCacheKey
+{
+	size_t service_flags;
+	size_t model_flags;
+	int function_flags;
+} ServiceCacheKey;
+
+typedef struct ServiceCacheEntry
+{
+	ServiceCacheKey key; /* hash key, must be first */
+	AIService *ai_service;
+	uint64 last_used;	 /* use count of the cache at the last use */
+	uint64 last_xact;	 /* transaction count at the last use */
+} ServiceCacheEntry;
+
+/* the services created in this session, in the session memory context */
+static HTAB *service_cache = NULL;
+static uint64 service_cache_uses = 0;
+static uint64 service_cache_xacts = 0;
+
+/*
+ * Return the state of the calling function, created on the first call in the
+ * memory context of the function call info.
+ */
+PgAiCallState *get_call_state(FunctionCallInfo fcinfo)
+{
+	if (!fcinfo->flinfo->fn_extra)
+		fcinfo->flinfo->fn_extra = MemoryContextAllocZero(
+			fcinfo->flinfo->fn_mcxt, sizeof(PgAiCallState));
+
+	return (PgAiCallState *)fcinfo->flinfo->fn_extra;
+}
+
+/*
+ * Drop the least recently used services not used in the current transaction
+ * until the session memory is within pg_ai.work_mem. The services used by the
+ * transaction could be referenced from the call state of a running query.
+ */
+static void evict_idle_services(void)
+{
+	HASH_SEQ_STATUS status;
+	ServiceCacheEntry *entry;
+	ServiceCacheEntry *victim;
+
+	while (get_session_memory_used() > get_work_mem_bytes())
+	{
+		victim = NULL;
+		hash_seq_init(&status, service_cache);
+		while ((entry = hash_seq_search(&status)))
+			if (entry->last_xact != service_cache_xacts &&
+				(!victim || entry->last_used < victim->last_used))
+				victim = entry;
+
+		if (!victim)
+			break;
+
+		MemoryContextDelete(victim->ai_service->memory_context);
+		hash_search(service_cache, &victim->key, HASH_REMOVE, NULL);
+	}
+}
+
+/*
+ * At the end of a transaction none of the services is in use, the session
+ * memory is brought back within the budget.
+ */
+static void service_cache_xact_callback(XactEvent event, void *arg)
+{
+	switch (event)
+	{
+	case XACT_EVENT_COMMIT:
+	case XACT_EVENT_PARALLEL_COMMIT:
+	case XACT_EVENT_ABORT:
+	case XACT_EVENT_PARALLEL_ABORT:
+	case XACT_EVENT_PREPARE:
+		service_cache_xacts++;
+		evict_idle_services();
+		break;
+	default:
+		break;
+	}
+}
+
+/*
+ * Create the session hash of the services on the first use.
+ */
+static void init_service_cache(void)
+{
+	HASHCTL info;
+
+	info.keysize = sizeof(ServiceCacheKey);
+	info.entrysize = sizeof(ServiceCacheEntry);
+	info.hcxt = get_session_memory_context();
+	service_cache = hash_create(PG_AI_SERVICE_MCTX, 16, &info,
+								HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
+	RegisterXactCallback(service_cache_xact_callback, NULL);
+}
+
+/*
+ * Create a service in a memory context of its own, the buffers and options
+ * of the service live as long as the session. NULL if the function is not
+ * supported by the service.
+ */
+static AIService *create_session_service(const ServiceCacheKey *key)
+{
+	MemoryContext service_context;
+	MemoryContext old_context;
+	AIService *ai_service;
+	int failed = RETURN_ERROR;
+
+	service_context = AllocSetContextCreate(
+		get_session_memory_context(), PG_AI_MCTX, ALLOCSET_DEFAULT_SIZES);
+	old_context = MemoryContextSwitchTo(service_context);
+
+	PG_TRY();
+	{
+		ai_service = palloc_AIService();
+		ai_service->memory_context = service_context;
+		ai_service->function_flags = key->function_flags;
+		failed = initialize_service(key->service_flags, key->model_flags,
+									ai_service);
+	}
+	PG_CATCH();
+	{
+		MemoryContextSwitchTo(old_context);
+		MemoryContextDelete(service_context);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	MemoryContextSwitchTo(old_context);
+	if (failed)
+	{
+		MemoryContextDelete(service_context);
+		return NULL;
+	}
+	return ai_service;
+}
+
+/*
+ * Return the session service of a function for the configured service and
+ * model. The options read from the GUCs are set again as they could have
+ * changed since the last use of the service.
+ *
+ * A new service that does not fit in pg_ai.work_mem with the services in use
+ * is not cached, it is moved to the call context and freed with it.
+ */
+AIService *get_session_service(const int function_flags,
+							   MemoryContext call_context)
+{
+	ServiceCacheKey key;
+	ServiceCacheEntry *entry;
+	AIService *ai_service;
+	bool found;
+
+	memset(&key, 0, sizeof(ServiceCacheKey));
+	key.function_flags = function_flags;
+	if (get_service_model_flags(function_flags, &key.service_flags,
+								&key.model_flags))
+		return NULL;
+
+	if (!service_cache)
+		init_service_cache();
+
+	entry = hash_search(service_cache, &key, HASH_FIND, NULL);
+	if (entry)
+	{
+		entry->last_used = ++service_cache_uses;
+		entry->last_xact = service_cache_xacts;
+		set_guc_options(entry->ai_service);
+		return entry->ai_service;
+	}
+
+	if (!(ai_service = create_session_service(&key)))
+		return NULL;
+
+	evict_idle_services();
+	if (get_session_memory_used() > get_work_mem_bytes())
+	{
+		MemoryContextSetParent(ai_service->memory_context, call_context);
+		return ai_service;
+	}
+
+	entry = hash_search(service_cache, &key, HASH_ENTER, &found);
+	entry->ai_service = ai_service;
+	entry->last_used = ++service_cache_uses;
+	entry->last_xact = service_cache_xacts;
+	return ai_service;
+}
+
+/*
+ * Return the service of the calling function, looked up in the session once
+ * per query and kept in the call state for the later rows.
+ */
+AIService *get_call_service(FunctionCallInfo fcinfo, const int function_flags)
+{
+	PgAiCallState *call_state = get_call_state(fcinfo);
+
+	if (!call_state->ai_service)
+		call_state->ai_service =
+			get_session_service(function_flags, fcinfo->flinfo->fn_mcxt);
+
+	return call_state->ai_service;
+}
+
+/*
+ * Set the options of a service as a call of a per-row function with the
+ * value and prompt would, for the calls made outside of the function.
+ */
+int set_row_call_options(AIService *ai_service, const char *column_value,
+						 const char *prompt)
+{
+	LOCAL_FCINFO(fcinfo, 2);
+
+	InitFunctionCallInfoData(*fcinfo, NULL, 2, InvalidOid, NULL, NULL);
+	fcinfo->args[0].value = CStringGetTextDatum(column_value);
+	fcinfo->args[0].isnull = false;
+	fcinfo->args[1].value = prompt ? CStringGetTextDatum(prompt) : (Datum)0;
+	fcinfo->args[1].isnull = (prompt == NULL);
+
+	return ai_service->set_and_validate_options(ai_service, fcinfo);
+}
@@ -0,0 +1,37 @@
+#ifndef _SERVICE_CACHE_H_
+#define _SERVICE_CACHE_H_
+
+#include "postgres.h"
+#include "fmgr.h"
+
+#include "core/ai_service.h"
+
+/* the state of a call site of a per-row function, kept in fn_extra */
+typedef struct PgAiCallState
+{
+	AIService *ai_service; /* the session service used by the call site */
+	void *memo_cache;	   /* the results memoized for the query */
+} PgAiCallState;
+
+/* the state of the calling function, created on the first call */
+PgAiCallState *get_call_state(FunctionCallInfo fcinfo);
+
+/*
+ * The service of a function for the configured service and model, created
+ * once for the session and reused by all the later calls. The service goes
+ * with the call context if the session is out of pg_ai.work_mem.
+ */
+AIService *get_session_service(const int function_flags,
+							   MemoryContext call_context);
+AIService *get_call_service(FunctionCallInfo fcinfo, const int function_flags);
+int set_row_call_options(AIService *ai_service, const char *column_value,
+						 const char *prompt);
+
+#define GET_CALL_SERVICE(ai_service, fcinfo, function_flags)                   \
+	do                                                                         \
+	{                                                                          \
+		if (!(ai_service = get_call_service(fcinfo, function_flags)))          \
+			PG_RETURN_TEXT_P(GET_ERR_TEXT(UNSUPPORTED_SERVICE));               \
+	} while (0)
+
+#endif /* _SERVICE_CACHE_H_ */
@@ -0,0 +1,338 @@
+#include "agg_sample.h"
+
+#include "common/hashfn.h"
+#include "libpq/pqformat.h"
+
+#include "core/ai_config.h"
+#include "core/tokenizer.h"
+
+/* a value in the sample */
+typedef struct SampledValue
+{
+	uint64 key;
+	int64 tokens;
+	char *value;
+} SampledValue;
+
+/* the sampled values of a stratum, a max heap on the key */
+typedef struct AggStratum
+{
+	char *name; /* NULL for the values with no stratum or over the strata */
+	uint32 name_hash;
+	SampledValue *values;
+	int count;
+	int size;
+	int64 tokens;
+	uint64 threshold; /* the values with a key at or over it are left out */
+} AggStratum;
+
+struct AggSample
+{
+	int64 token_budget;
+	int stratum_count;
+	AggStratum strata[AGG_SAMPLE_MAX_STRATA];
+};
+
+static void swap_values(SampledValue *values, const int i, const int j)
+{
+	SampledValue tmp = values[i];
+
+	values[i] = values[j];
+	values[j] = tmp;
+}
+
+static void sift_up(SampledValue *values, int i)
+{
+	while (i > 0 && values[(i - 1) / 2].key < values[i].key)
+	{
+		swap_values(values, i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+}
+
+static void sift_down(SampledValue *values, const int count, int i)
+{
+	for (;;)
+	{
+		int largest = i;
+		int left = 2 * i + 1;
+		int right = left + 1;
+
+		if (left < count && values[left].key > values[largest].key)
+			largest = left;
+		if (right < count && values[right].key > values[largest].key)
+			largest = right;
+		if (largest == i)
+			break;
+		swap_values(values, i, largest);
+		i = largest;
+	}
+}
+
+static int64 get_stratum_budget(const AggSample *sample)
+{
+	return sample->token_budget / Max(sample->stratum_count, 1);
+}
+
+/*
+ * Drop the values with the largest keys till the stratum is within the
+ * budget. The key of a dropped value becomes the threshold, a value with a
+ * larger key would have been dropped before it.
+ */
+static void trim_stratum(AggStratum *stratum, const int64 budget)
+{
+	while (stratum->count > 0 && (stratum->tokens > budget ||
+								  stratum->values[0].key >= stratum->threshold))
+	{
+		stratum->threshold = Min(stratum->threshold, stratum->values[0].key);
+		stratum->tokens -= stratum->values[0].tokens;
+		pfree(stratum->values[0].value);
+		stratum->values[0] = stratum->values[--stratum->count];
+		sift_down(stratum->values, stratum->count, 0);
+	}
+}
+
+static void trim_strata(AggSample *sample)
+{
+	for (int i = 0; i < sample->stratum_count; i++)
+		trim_stratum(&sample->strata[i], get_stratum_budget(sample));
+}
+
+static void push_value(AggStratum *stratum, const uint64 key,
+					   const int64 tokens, char *value)
+{
+	if (stratum->count == stratum->size)
+	{
+		stratum->size = Max(stratum->size * 2, 8);
+		stratum->values =
+			stratum->values ?
+				repalloc(stratum->values,
+						 sizeof(SampledValue) * stratum->size) :
+				palloc(sizeof(SampledValue) * stratum->size);
+	}
+
+	stratum->values[stratum->count].key = key;
+	stratum->values[stratum->count].tokens = tokens;
+	stratum->values[stratum->count].value = value;
+	sift_up(stratum->values, stratum->count++);
+	stratum->tokens += tokens;
+}
+
+static AggStratum *add_stratum(AggSample *sample, const char *name,
+							   const uint32 name_hash)
+{
+	AggStratum *stratum = &sample->strata[sample->stratum_count++];
+
+	memset(stratum, 0, sizeof(AggStratum));
+	stratum->name = name ? pstrdup(name) : NULL;
+	stratum->name_hash = name_hash;
+	stratum->threshold = PG_UINT64_MAX;
+	return stratum;
+}
+
+/*
+ * Get the stratum of a name, a new stratum takes its share of the budget
+ * from the others. The last stratum is kept for the values with no stratum,
+ * the values of the strata over it are sampled there.
+ */
+static AggStratum *get_stratum(AggSample *sample, const char *name)
+{
+	uint32 name_hash =
+		name ? hash_bytes((const unsigned char *)name, strlen(name)) : 0;
+	AggStratum *stratum;
+
+	for (int i = 0; i < sample->stratum_count; i++)
+	{
+		stratum = &sample->strata[i];
+		if (!name && !stratum->name)
+			return stratum;
+		if (name && stratum->name && stratum->name_hash == name_hash &&
+			strcmp(stratum->name, name) == 0)
+			return stratum;
+	}
+
+	if (name && sample->stratum_count >= AGG_SAMPLE_MAX_STRATA - 1)
+		return get_stratum(sample, NULL);
+
+	stratum = add_stratum(sample, name, name_hash);
+	trim_strata(sample);
+	return stratum;
+}
+
+/*
+ * Add a value to a stratum if its key is under the threshold and it is not
+ * in the sample already. The value is copied.
+ */
+static void add_value(AggSample *sample, AggStratum *stratum, const uint64 key,
+					  const int64 tokens, const char *value, const int len)
+{
+	int64 budget = get_stratum_budget(sample);
+
+	/* a value over the budget alone is left out, it does not move the key */
+	if (key >= stratum->threshold || tokens > budget)
+		return;
+
+	for (int i = 0; i < stratum->count; i++)
+		if (stratum->values[i].key == key &&
+			strncmp(stratum->values[i].value, value, len) == 0 &&
+			stratum->values[i].value[len] == '\0')
+			return;
+
+	push_value(stratum, key, tokens, pnstrdup(value, len));
+	trim_stratum(stratum, budget);
+}
+
+AggSample *agg_sample_create(const int64 token_budget)
+{
+	AggSample *sample = palloc0(sizeof(AggSample));
+
+	sample->token_budget = token_budget;
+	return sample;
+}
+
+void agg_sample_add(AggSample *sample, const char *stratum, const char *value,
+					const int len)
+{
+	uint64 key =
+		hash_bytes_extended((const unsigned char *)value, len, AGG_SAMPLE_SEED);
+
+	add_value(sample, get_stratum(sample, stratum), key,
+			  count_tokens(NULL, value, len), value, len);
+}
+
+/*
+ * Merge the sample of a parallel worker, into an empty sample made with no
+ * budget too. A stratum keeps the lower of the two thresholds, the values of
+ * either sample over it are left out.
+ */
+void agg_sample_merge(AggSample *sample, AggSample *other)
+{
+	sample->token_budget = Max(sample->token_budget, other->token_budget);
+	for (int i = 0; i < other->stratum_count; i++)
+	{
+		AggStratum *from = &other->strata[i];
+		AggStratum *to = get_stratum(sample, from->name);
+
+		to->threshold = Min(to->threshold, from->threshold);
+		for (int j = 0; j < from->count; j++)
+			add_value(sample, to, from->values[j].key, from->values[j].tokens,
+					  from->values[j].value, strlen(from->values[j].value));
+	}
+
+	trim_strata(sample);
+}
+
+static int compare_strata(const void *a, const void *b)
+{
+	const AggStratum *stratum_a = *(AggStratum *const *)a;
+	const AggStratum *stratum_b = *(AggStratum *const *)b;
+
+	if (!stratum_a->name || !stratum_b->name)
+		return (stratum_a->name == NULL) - (stratum_b->name == NULL);
+	return strcmp(stratum_a->name, stratum_b->name);
+}
+
+static int compare_values(const void *a, const void *b)
+{
+	uint64 key_a = ((const SampledValue *)a)->key;
+	uint64 key_b = ((const SampledValue *)b)->key;
+
+	return (key_a > key_b) - (key_a < key_b);
+}
+
+/*
+ * Append the sampled values. The order only depends on the sample, so the
+ * same input gives the same request whatever the order of the rows.
+ */
+void agg_sample_get_values(AggSample *sample, StringInfo values,
+						   const char separator)
+{
+	AggStratum *strata[AGG_SAMPLE_MAX_STRATA];
+	bool first = true;
+
+	for (int i = 0; i < sample->stratum_count; i++)
+		strata[i] = &sample->strata[i];
+	qsort(strata, sample->stratum_count, sizeof(AggStratum *),
+		  compare_strata);
+
+	for (int i = 0; i < sample->stratum_count; i++)
+	{
+		SampledValue *sorted = palloc(sizeof(SampledValue) * strata[i]->count);
+
+		memcpy(sorted, strata[i]->values,
+			   sizeof(SampledValue) * strata[i]->count);
+		qsort(sorted, strata[i]->count, sizeof(SampledValue), compare_values);
+		for (int j = 0; j < strata[i]->count; j++)
+		{
+			if (!first)
+				appendStringInfoChar(values, separator);
+			appendStringInfoString(values, sorted[j].value);
+			first = false;
+		}
+		pfree(sorted);
+	}
+}
+
+void agg_send_string(StringInfo buf, const char *str)
+{
+	int len = strlen(str);
+
+	pq_sendint32(buf, len);
+	pq_sendbytes(buf, str, len);
+}
+
+char *agg_get_string(StringInfo buf)
+{
+	int len = pq_getmsgint(buf, 4);
+
+	return pnstrdup(pq_getmsgbytes(buf, len), len);
+}
+
+void agg_sample_serialize(StringInfo buf, AggSample *sample)
+{
+	pq_sendint64(buf, sample->token_budget);
+	pq_sendint32(buf, sample->stratum_count);
+	for (int i = 0; i < sample->stratum_count; i++)
+	{
+		AggStratum *stratum = &sample->strata[i];
+
+		pq_sendbyte(buf, stratum->name != NULL);
+		if (stratum->name)
+			agg_send_string(buf, stratum->name);
+		pq_sendint64(buf, stratum->threshold);
+		pq_sendint32(buf, stratum->count);
+		for (int j = 0; j < stratum->count; j++)
+		{
+			pq_sendint64(buf, stratum->values[j].key);
+			pq_sendint64(buf, stratum->values[j].tokens);
+			agg_send_string(buf, stratum->values[j].value);
+		}
+	}
+}
+
+AggSample *agg_sample_deserialize(StringInfo buf)
+{
+	AggSample *sample = agg_sample_create(pq_getmsgint64(buf));
+	int stratum_count = pq_getmsgint(buf, 4);
+
+	for (int i = 0; i < stratum_count; i++)
+	{
+		char *name = pq_getmsgbyte(buf) ? agg_get_string(buf) : NULL;
+		AggStratum *stratum = add_stratum(
+			sample, name,
+			name ? hash_bytes((const unsigned char *)name, strlen(name)) : 0);
+		int count;
+
+		stratum->threshold = pq_getmsgint64(buf);
+		count = pq_getmsgint(buf, 4);
+		for (int j = 0; j < count; j++)
+		{
+			uint64 key = pq_getmsgint64(buf);
+			int64 tokens = pq_getmsgint64(buf);
+
+			push_value(stratum, key, tokens, agg_get_string(buf));
+		}
+	}
+
+	return sample;
+}
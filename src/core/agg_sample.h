@@ -0,0 +1,35 @@
+#ifndef _AGG_SAMPLE_H_
+#define _AGG_SAMPLE_H_
+
+#include "postgres.h"
+#include "lib/stringinfo.h"
+
+/*
+ * The sample of the values of an aggregate within a token budget. Each value
+ * is keyed by its hash and the values with the smallest keys that fit in the
+ * budget are kept. A repeated value has the same key so it is kept once, and
+ * the sample is the same for the same distinct values in any order, so the
+ * samples of parallel workers merge into the sample of the whole input.
+ * With a stratum the budget is shared equally by the strata seen.
+ */
+typedef struct AggSample AggSample;
+
+/* the sample is made in, and grows in, the current memory context */
+AggSample *agg_sample_create(const int64 token_budget);
+void agg_sample_add(AggSample *sample, const char *stratum, const char *value,
+					const int len);
+void agg_sample_merge(AggSample *sample, AggSample *other);
+
+/* append the sampled values, ordered by stratum and key */
+void agg_sample_get_values(AggSample *sample, StringInfo values,
+						   const char separator);
+
+/* for the transfer of the sample from a parallel worker */
+void agg_sample_serialize(StringInfo buf, AggSample *sample);
+AggSample *agg_sample_deserialize(StringInfo buf);
+
+/* strings in the serialized states, with no encoding conversion */
+void agg_send_string(StringInfo buf, const char *str);
+char *agg_get_string(StringInfo buf);
+
+#endif /* _AGG_SAMPLE_H_ */
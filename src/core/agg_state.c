@@ -0,0 +1,222 @@
+#include "agg_state.h"
+
+#include "libpq/pqformat.h"
+#include "utils/builtins.h"
+
+#include "core/memory_budget.h"
+#include "guc/pg_ai_guc.h"
+
+/*
+ * Make an empty state in the aggregate memory context.
+ */
+static PgAiAggState *make_agg_state(MemoryContext agg_context)
+{
+	MemoryContext old_context = MemoryContextSwitchTo(agg_context);
+	PgAiAggState *state = palloc0(sizeof(PgAiAggState));
+
+	initStringInfo(&state->values);
+	MemoryContextSwitchTo(old_context);
+
+	return state;
+}
+
+/*
+ * Append a value to the state, the state is within pg_ai.work_mem.
+ */
+static void append_value(PgAiAggState *state, const char *value,
+						 const int len)
+{
+	check_work_mem(state->values.len + len + 1, "Aggregate input");
+
+	if (state->value_count)
+		appendStringInfoChar(&state->values, AGG_STATE_SEPARATOR);
+	appendBinaryStringInfo(&state->values, value, len);
+}
+
+/*
+ * Accumulate the value of a row. The state is made on the first row with the
+ * prompt of that row, the prompt of the later rows is not used. If sampling
+ * is allowed and pg_ai.agg_sample_tokens is set, the values are sampled
+ * within that budget, by the stratum in the fourth argument if there is one.
+ */
+PgAiAggState *agg_state_accumulate(FunctionCallInfo fcinfo,
+								   const bool can_sample)
+{
+	MemoryContext agg_context;
+	MemoryContext old_context;
+	PgAiAggState *state;
+	text *value;
+	char *stratum;
+	int sample_tokens;
+
+	if (!AggCheckCallContext(fcinfo, &agg_context))
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("Function called in non-aggregate context")));
+
+	if (PG_ARGISNULL(0))
+	{
+		state = make_agg_state(agg_context);
+		if (!PG_ARGISNULL(2))
+			state->prompt = MemoryContextStrdup(
+				agg_context, text_to_cstring(PG_GETARG_TEXT_PP(2)));
+
+		sample_tokens =
+			*get_pg_ai_guc_int_variable(PG_AI_GUC_AGG_SAMPLE_TOKENS);
+		if (can_sample && sample_tokens > 0)
+		{
+			old_context = MemoryContextSwitchTo(agg_context);
+			state->sample = agg_sample_create(sample_tokens);
+			MemoryContextSwitchTo(old_context);
+		}
+	}
+	else
+		state = (PgAiAggState *)PG_GETARG_POINTER(0);
+
+	/* accumulate the non NULL values */
+	if (!PG_ARGISNULL(1))
+	{
+		value = PG_GETARG_TEXT_PP(1);
+		if (state->sample)
+		{
+			stratum = (PG_NARGS() > 3 && !PG_ARGISNULL(3)) ?
+						  text_to_cstring(PG_GETARG_TEXT_PP(3)) :
+						  NULL;
+			old_context = MemoryContextSwitchTo(agg_context);
+			agg_sample_add(state->sample, stratum, VARDATA_ANY(value),
+						   VARSIZE_ANY_EXHDR(value));
+			MemoryContextSwitchTo(old_context);
+		}
+		else
+			append_value(state, VARDATA_ANY(value), VARSIZE_ANY_EXHDR(value));
+		state->value_count++;
+	}
+
+	return state;
+}
+
+/*
+ * Combine the states of two parallel workers into the first one. The second
+ * state is short lived, its data is copied to the aggregate memory context.
+ */
+PgAiAggState *agg_state_combine(MemoryContext agg_context,
+								PgAiAggState *state1, PgAiAggState *state2)
+{
+	MemoryContext old_context;
+
+	if (!state2)
+		return state1;
+
+	if (!state1)
+		state1 = make_agg_state(agg_context);
+
+	if (!state1->prompt && state2->prompt)
+		state1->prompt = MemoryContextStrdup(agg_context, state2->prompt);
+
+	if (state2->sample)
+	{
+		old_context = MemoryContextSwitchTo(agg_context);
+		if (!state1->sample)
+			state1->sample = agg_sample_create(0);
+		agg_sample_merge(state1->sample, state2->sample);
+		MemoryContextSwitchTo(old_context);
+		state1->value_count += state2->value_count;
+	}
+	else if (state2->value_count)
+	{
+		append_value(state1, state2->values.data, state2->values.len);
+		state1->value_count += state2->value_count;
+	}
+
+	return state1;
+}
+
+/*
+ * Serialize the state for the transfer from a parallel worker.
+ */
+bytea *agg_state_serialize(PgAiAggState *state)
+{
+	StringInfoData buf;
+
+	pq_begintypsend(&buf);
+	pq_sendint64(&buf, state->value_count);
+	pq_sendbyte(&buf, state->prompt != NULL);
+	if (state->prompt)
+		agg_send_string(&buf, state->prompt);
+	pq_sendbyte(&buf, state->sample != NULL);
+	if (state->sample)
+		agg_sample_serialize(&buf, state->sample);
+	else
+		pq_sendbytes(&buf, state->values.data, state->values.len);
+
+	return pq_endtypsend(&buf);
+}
+
+/*
+ * Make the state from its serialized form, in the current memory context as
+ * it is copied by the combine function.
+ */
+PgAiAggState *agg_state_deserialize(bytea *data)
+{
+	PgAiAggState *state = make_agg_state(CurrentMemoryContext);
+	StringInfoData buf;
+	int len;
+
+	initStringInfo(&buf);
+	appendBinaryStringInfo(&buf, VARDATA_ANY(data), VARSIZE_ANY_EXHDR(data));
+
+	state->value_count = pq_getmsgint64(&buf);
+	if (pq_getmsgbyte(&buf))
+		state->prompt = agg_get_string(&buf);
+	if (pq_getmsgbyte(&buf))
+		state->sample = agg_sample_deserialize(&buf);
+	else
+	{
+		len = buf.len - buf.cursor;
+		appendBinaryStringInfo(&state->values, pq_getmsgbytes(&buf, len),
+							   len);
+	}
+	pq_getmsgend(&buf);
+
+	pfree(buf.data);
+	return state;
+}
+
+/*
+ * The values of the aggregate for the service, the sampled values if the
+ * input was sampled.
+ */
+char *agg_state_get_values(PgAiAggState *state)
+{
+	if (state->sample)
+	{
+		resetStringInfo(&state->values);
+		agg_sample_get_values(state->sample, &state->values,
+							  AGG_STATE_SEPARATOR);
+	}
+
+	return state->values.data;
+}
+
+/*
+ * Set the options of the service as for a call with the prompt of the
+ * aggregate, the accumulated values are then set as the data of the service.
+ */
+int set_agg_state_options(AIService *ai_service, PgAiAggState *state)
+{
+	LOCAL_FCINFO(agg_fcinfo, 3);
+
+	/* the arguments of the aggregate as seen by the transition function */
+	InitFunctionCallInfoData(*agg_fcinfo, NULL, 3, InvalidOid, NULL, NULL);
+	agg_fcinfo->args[0].isnull = true;
+	agg_fcinfo->args[1].isnull = true;
+	agg_fcinfo->args[2].isnull = (state->prompt == NULL);
+	agg_fcinfo->args[2].value =
+		state->prompt ? PointerGetDatum(cstring_to_text(state->prompt)) : 0;
+
+	if (ai_service->set_and_validate_options(ai_service, agg_fcinfo))
+		return RETURN_ERROR;
+
+	/* the service is reused, the values of an earlier group are dropped */
+	reset_option_value(AI_SERVICE_OPTIONS, OPTION_COLUMN_VALUE);
+	return RETURN_ZERO;
+}
@@ -0,0 +1,42 @@
+#ifndef _AGG_STATE_H_
+#define _AGG_STATE_H_
+
+#include "postgres.h"
+#include "fmgr.h"
+#include "lib/stringinfo.h"
+
+#include "core/agg_sample.h"
+#include "core/ai_service.h"
+
+/* the separator of the values accumulated by an aggregate */
+#define AGG_STATE_SEPARATOR ' '
+
+/*
+ * The transition state of the pg_ai aggregates. The values are appended to
+ * a buffer that doubles when full, or kept in a sample in sampling mode. The
+ * service is only made in the final function so the state can be combined
+ * and passed between processes.
+ */
+typedef struct PgAiAggState
+{
+	StringInfoData values; /* the non NULL values, separated by a space */
+	char *prompt;		   /* prompt of the first row, NULL for the default */
+	int64 value_count;	   /* the non NULL values seen, sampled or not */
+	AggSample *sample;	   /* NULL unless the values are sampled */
+} PgAiAggState;
+
+/* the transition function common to the aggregates */
+PgAiAggState *agg_state_accumulate(FunctionCallInfo fcinfo,
+								   const bool can_sample);
+
+/* support for the parallel aggregation */
+PgAiAggState *agg_state_combine(MemoryContext agg_context,
+								PgAiAggState *state1, PgAiAggState *state2);
+bytea *agg_state_serialize(PgAiAggState *state);
+PgAiAggState *agg_state_deserialize(bytea *data);
+
+/* the values and the options of the service from the final state */
+char *agg_state_get_values(PgAiAggState *state);
+int set_agg_state_options(AIService *ai_service, PgAiAggState *state);
+
+#endif /* _AGG_STATE_H_ */
@@ -34,6 +34,8 @@
 #define FUNCTION_QUERY_VECTOR_STORE 0x00000020
 #define FUNCTION_MODERATION 0x00000040
 #define FUNCTION_MODERATION_AGGREGATE 0x00000080
+/* internal, embeds a text for the semantic result cache */
+#define FUNCTION_EMBED_TEXT 0x00000100
 /*------------ Services. Models, Functions >8----------*/
 
 #define MAX_BYTE_VALUE 255
@@ -53,6 +55,8 @@
 
 /* http responses */
 #define HTTP_OK 200
+#define HTTP_TOO_MANY_REQUESTS 429
+#define HTTP_SERVICE_UNAVAILABLE 503
 
 /* internal error codes, for use within pg_ai */
 #define RETURN_ZERO 0
@@ -67,11 +71,28 @@
 /* help buffer size */
 #define MAX_HELP_TEXT_SIZE 4 * 1024
 
-/* TODO this has be replaced by dynamic READ call back */
+/*
+ * Room for the JSON of a service around the escaped data of a request, the
+ * POST data is allocated with the size of the escaped data and this.
+ */
 #define POST_DATA_SIZE 16 * 1024
 
 #define APPROX_WORDS_PER_1K_TOKENS 400
 
+/*
+ * A pre-tokenized piece of text over this is merged by BPE in parts, and the
+ * bytes per token of the estimate used without a BPE vocabulary.
+ */
+#define BPE_MAX_PIECE_SIZE 256
+#define ESTIMATE_BYTES_PER_TOKEN 4
+
+/*
+ * Planner cost of a token sent to a model and of a token asked from it, in
+ * cpu_operator_cost units, the output is generated a token at a time.
+ */
+#define PLANNER_INPUT_TOKEN_COST 1
+#define PLANNER_OUTPUT_TOKEN_COST 100
+
 #define PG_AI_DEBUG_0 0
 #define PG_AI_DEBUG_1 1
 #define PG_AI_DEBUG_2 2
@@ -89,4 +110,99 @@
 /* max array size to hold the SQL queries */
 #define SQL_QUERY_MAX_LENGTH 256 * 1024
 
+/* seeds for the two halves of a 128 bit request fingerprint */
+#define FINGERPRINT_SEED_1 0x70675F6169ULL
+#define FINGERPRINT_SEED_2 0x9E3779B97F4A7C15ULL
+
+/* largest vector held by the query cache, across all embedding models */
+#define QUERY_CACHE_MAX_DIMENSIONS EMBEDDINGS_LIST_SIZE
+
+/* largest response shared by a single flight request with the waiters */
+#define SINGLE_FLIGHT_MAX_RESULT_SIZE (32 * 1024)
+
+/*
+ * Max texts in one batched embeddings request and their total size. The size
+ * keeps a batch within the word limit and the POST buffer of a transfer.
+ */
+#define EMBED_BATCH_MAX_SIZE 16
+#define EMBED_BATCH_MAX_TEXT_SIZE (2 * 1024)
+
+/* endpoints with an adaptive concurrency limit and the changes kept for each */
+#define ADAPTIVE_LIMIT_MAX_ENDPOINTS 16
+#define ADAPTIVE_LIMIT_URL_LENGTH 256
+#define ADAPTIVE_LIMIT_HISTORY_SIZE 128
+
+/* the limit starts here, grows by one per limit requests, halves on a cut */
+#define ADAPTIVE_LIMIT_INITIAL 4
+#define ADAPTIVE_LIMIT_DECREASE_FACTOR 0.5
+
+/* weight of a new latency sample in the smoothed latency */
+#define ADAPTIVE_LIMIT_LATENCY_WEIGHT 0.1
+
+/*
+ * (service, model, function) with request statistics, and the buckets of
+ * their latency histograms. The buckets split each doubling of the latency
+ * from 1ms, the last one takes all the longer requests.
+ */
+#define REQUEST_STATS_MAX_ENTRIES 128
+#define REQUEST_STATS_NAME_LENGTH 64
+#define REQUEST_STATS_LATENCY_BUCKETS 80
+#define REQUEST_STATS_BUCKETS_PER_DOUBLING 4
+
+/*
+ * Requests kept in the shared ring of the recent requests, and the length of
+ * the URL path kept with each.
+ */
+#define RECENT_REQUESTS_SIZE 1024
+#define RECENT_REQUESTS_ENDPOINT_LENGTH 128
+
+/*
+ * Max size of a chunk of an aggregate input summarized in one request, the
+ * chunk is escaped into the POST buffer of the transfer.
+ */
+#define MAP_REDUCE_CHUNK_SIZE (4 * 1024)
+
+/* the tokens kept for the text a service puts around the data */
+#define MAP_REDUCE_TOKEN_MARGIN 16
+
+/*
+ * Strata with a share of the budget of a sampled aggregate, the values of
+ * the strata seen later are sampled together. And the seed of the keys.
+ */
+#define AGG_SAMPLE_MAX_STRATA 64
+#define AGG_SAMPLE_SEED 0x5A4D504C45ULL
+
+/* max response to a request of a set transferred concurrently */
+#define REST_TRANSFER_MANY_RESPONSE_SIZE (64 * 1024)
+
+/* values of a batch function held in memory, and transferred, at a time */
+#define BATCH_WINDOW_SIZE 256
+
+/* calls of a session started in the background and not awaited yet */
+#define ASYNC_MAX_CALLS 256
+
+/*
+ * Attempts of a job before it fails, and the wait before the second attempt
+ * in seconds, doubled for every attempt after it.
+ */
+#define JOB_MAX_ATTEMPTS 3
+#define JOB_RETRY_DELAY 30
+
+/*
+ * Requests in one batch of the provider batch API, the provider limit, and
+ * the ms between the polls of a batch in progress.
+ */
+#define PROVIDER_BATCH_MAX_REQUESTS 50000
+#define PROVIDER_BATCH_POLL_INTERVAL (30 * 1000)
+
+/* ms a job worker sleeps at most before looking for jobs to retry */
+#define JOB_WORKER_MAX_WAIT (60 * 1000)
+
+/* jobs a worker tries to claim at a time, and the class of their locks */
+#define JOB_CLAIM_CANDIDATES 16
+#define JOB_LOCK_CLASS 0x70676169
+
+/* the result cache table is trimmed once every these many stores */
+#define RESULT_CACHE_TRIM_INTERVAL 64
+
 #endif /* _AI_CONFIG_H_ */
@@ -12,6 +12,36 @@
 
 /* string to describe the newly allocated memory context */
 #define PG_AI_MCTX "pg_ai_memory_context"
+#define PG_AI_ASYNC_MCTX "pg_ai_async_context"
+#define PG_AI_BATCH_MCTX "pg_ai_batch_context"
+#define PG_AI_JOB_MCTX "pg_ai_job_context"
+#define PG_AI_MEMO_MCTX "pg_ai_memo_context"
+#define PG_AI_PREFETCH_MCTX "pg_ai_prefetch_context"
+#define PG_AI_SERVICE_MCTX "pg_ai_service_context"
+#define PG_AI_SESSION_MCTX "pg_ai_session_context"
+#define PG_AI_TOKENIZER_MCTX "pg_ai_tokenizer_context"
+
+/* names of the shared memory areas and the locks guarding them */
+#define PG_AI_LWLOCK_TRANCHE "pg_ai"
+#define PG_AI_SHMEM_QUERY_CACHE "pg_ai_query_cache"
+#define PG_AI_SHMEM_QUERY_CACHE_HASH "pg_ai_query_cache_hash"
+#define PG_AI_SHMEM_SINGLE_FLIGHT "pg_ai_single_flight"
+#define PG_AI_SHMEM_EMBED_BATCH "pg_ai_embed_batch"
+#define PG_AI_SHMEM_ADAPTIVE_LIMIT "pg_ai_adaptive_limit"
+#define PG_AI_SHMEM_REQUEST_STATS "pg_ai_request_stats"
+#define PG_AI_SHMEM_RECENT_REQUESTS "pg_ai_recent_requests"
+
+/* table persisting the insight and moderation results */
+#define PG_AI_EXTENSION_NAME "pg_ai"
+#define PG_AI_RESULT_CACHE_TABLE "pg_ai_result_cache"
+#define PG_AI_SEMANTIC_CACHE_TABLE "pg_ai_semantic_cache"
+
+/* the job queue, its workers and the channel notified as the jobs finish */
+#define PG_AI_JOBS_TABLE "pg_ai_jobs"
+#define PG_AI_JOB_RESULTS_TABLE "pg_ai_job_results"
+#define PG_AI_JOB_WORKER_TYPE "pg_ai job worker"
+#define PG_AI_JOB_WORKER_FUNCTION "pg_ai_job_worker_main"
+#define PG_AI_JOB_CHANNEL "pg_ai_jobs"
 
 /* column name consts for the vector store table */
 #define EMBEDDINGS_COLUMN_NAME "embeddings"
@@ -26,6 +56,15 @@
 #define EMBEDDINGS_SIMILARITY_INNER_PRODUCT "inner_product"
 /*--------- supported similarity algos >8----------------*/
 
+/* prompt to summarize a chunk of the input of an aggregate, %s is its prompt */
+#define MAP_REDUCE_PROMPT                                                      \
+	"Summarize the following in a few sentences, keep what is needed for "     \
+	"\"%s\""
+
+/* values of pg_ai.traffic_class */
+#define TRAFFIC_CLASS_INTERACTIVE_NAME "interactive"
+#define TRAFFIC_CLASS_BATCH_NAME "batch"
+
 /*---------------------------8< help text ------------------------------------*/
 #define INSIGHT_FUNCTIONS                                                      \
 	"\nFunctions:\n"                                                           \
@@ -57,47 +96,47 @@
 /*--------------------------- help text >8------------------------------------*/
 
 /* -----------------8<--Function Arguments ---------- */
-#define OPTION_SERVICE_NAME "service"
+#define OPTION_SERVICE_NAME_STR "service"
 #define OPTION_SERVICE_NAME_DESC "The name of the AI service."
 
-#define OPTION_MODEL_NAME "model"
+#define OPTION_MODEL_NAME_STR "model"
 #define OPTION_MODEL_NAME_DESC "The name of the model to be used."
 
-#define OPTION_SERVICE_API_KEY "key"
+#define OPTION_SERVICE_API_KEY_STR "key"
 #define OPTION_SERVICE_API_KEY_DESC "API Key value from the service provider."
 
-#define OPTION_COLUMN_VALUE "column_name"
+#define OPTION_COLUMN_VALUE_STR "column_name"
 #define OPTION_COLUMN_VALUE_DESC "The input column to the LLM."
 
-#define OPTION_SERVICE_PROMPT "prompt"
+#define OPTION_SERVICE_PROMPT_STR "prompt"
 #define OPTION_SERVICE_PROMPT_DESC "Text to be used as input to the LLM."
 
-#define OPTION_SERVICE_PROMPT_AGG "promptagg"
+#define OPTION_SERVICE_PROMPT_AGG_STR "promptagg"
 #define OPTION_SERVICE_PROMPT_AGG_DESC                                         \
 	"The prompt to be used as input for the aggregate function."
 
-#define OPTION_STORE_NAME "store"
+#define OPTION_STORE_NAME_STR "store"
 #define OPTION_STORE_NAME_DESC                                                 \
 	"Table name, will contain the query result set and vectors."
 
-#define OPTION_SQL_QUERY "sql_query"
+#define OPTION_SQL_QUERY_STR "sql_query"
 #define OPTION_SQL_QUERY_DESC "SQL query to materialize."
 
-#define OPTION_NL_QUERY "nl_query"
+#define OPTION_NL_QUERY_STR "nl_query"
 #define OPTION_NL_QUERY_DESC                                                   \
 	"Natural language query to fetch data from the vector store."
 
-#define OPTION_NL_NOTES "notes"
+#define OPTION_NL_NOTES_STR "notes"
 #define OPTION_NL_NOTES_DESC "Notes on the result set."
 
-#define OPTION_RECORD_COUNT "count"
+#define OPTION_RECORD_COUNT_STR "count"
 #define OPTION_RECORD_COUNT_DESC "No of records to display.(default: 2)"
 
-#define OPTION_SIMILARITY_ALGORITHM "algorithm"
+#define OPTION_SIMILARITY_ALGORITHM_STR "algorithm"
 #define OPTION_SIMILARITY_ALGORITHM_DESC                                       \
 	"Vector similarity algorithm.(cosine(default), ecludian, inner_product)"
 
-#define OPTION_ENDPOINT_URL "endpoint_url"
+#define OPTION_ENDPOINT_URL_STR "endpoint_url"
 #define OPTION_ENDPOINT_URL_DESC "URL for the Rest API endpoint."
 /* ---------------------Function Arguments -->8------ */
 
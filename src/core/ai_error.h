@@ -6,7 +6,9 @@
 #define PG_AI_ERR_NULL_STR "Null"
 #define PG_AI_ERR_ARG_NULL "Argument is null."
 #define PG_AI_ERR_TRANSFER_FAIL "Transfer failed. Try again."
-#define PG_AI_ERR_DATA_TOO_BIG "Data to big, model only supports %lu words."
+#define PG_AI_ERR_DATA_TOO_BIG "Data too big, model only supports %lu tokens."
+#define PG_AI_ERR_ASYNC_CANCELLED "Call not awaited in its transaction."
+#define PG_AI_ERR_NO_REDUCE "Summaries of the input do not get any shorter."
 
 #define GET_ERR_TEXT(err) cstring_to_text(PG_AI_ERR_##err)
 #define GET_ERR_STR(err) PG_AI_ERR_##err
\ No newline at end of file
@@ -5,6 +5,7 @@
 #include "guc/pg_ai_guc.h"
 #include "ai_service_init_oai.h"
 #include "ai_service_init_gem.h"
+#include "utils_pg_ai.h"
 
 /*
  * Clear the AIService data
@@ -22,7 +23,8 @@ static int set_open_ai_models(AIService *ai_service, size_t *model_flags)
 		(FUNCTION_GET_INSIGHT | FUNCTION_GET_INSIGHT_AGGREGATE))
 		*model_flags = MODEL_OPENAI_GPT;
 	else if (ai_service->function_flags &
-			 (FUNCTION_CREATE_VECTOR_STORE | FUNCTION_QUERY_VECTOR_STORE))
+			 (FUNCTION_CREATE_VECTOR_STORE | FUNCTION_QUERY_VECTOR_STORE |
+			  FUNCTION_EMBED_TEXT))
 		*model_flags = MODEL_OPENAI_EMBEDDINGS;
 	else if (ai_service->function_flags &
 			 (FUNCTION_MODERATION | FUNCTION_MODERATION_AGGREGATE))
@@ -46,7 +48,8 @@ static int set_gemini_models(AIService *ai_service, size_t *model_flags)
 			 (FUNCTION_MODERATION | FUNCTION_MODERATION_AGGREGATE))
 		*model_flags = MODEL_GEMINI_GENC_MOD;
 	else if (ai_service->function_flags &
-			 (FUNCTION_CREATE_VECTOR_STORE | FUNCTION_QUERY_VECTOR_STORE))
+			 (FUNCTION_CREATE_VECTOR_STORE | FUNCTION_QUERY_VECTOR_STORE |
+			  FUNCTION_EMBED_TEXT))
 		*model_flags = MODEL_GEMINI_EMBEDDINGS;
 	else
 		return RETURN_ERROR;
@@ -80,21 +83,25 @@ static int init_service_model_from_guc(AIService *ai_service,
 }
 
 /*
- * Set the common options for the service and model.
+ * Return the service and model used for a function by the current GUCs.
  */
-static void set_common_options(AIService *ai_service, const char *service_name,
-							   const char *model_name, const char *model_url)
+int get_service_model_flags(const int function_flags, size_t *service_flags,
+							size_t *model_flags)
+{
+	AIService ai_service = {.function_flags = function_flags};
+
+	return init_service_model_from_guc(&ai_service, service_flags,
+									   model_flags);
+}
+
+/*
+ * Set the options read from the GUCs that can change during a session.
+ */
+void set_guc_options(AIService *ai_service)
 {
 	char *api_key;
 	int *debug_level;
 
-	set_option_value(AI_SERVICE_OPTIONS, OPTION_SERVICE_NAME, service_name,
-					 false /* concat */);
-	set_option_value(AI_SERVICE_OPTIONS, OPTION_MODEL_NAME, model_name,
-					 false /* concat */);
-	set_option_value(AI_SERVICE_OPTIONS, OPTION_ENDPOINT_URL, model_url,
-					 false /* concat */);
-
 	/* set the API key if it is available in a GUC */
 	api_key = get_pg_ai_guc_string_variable(PG_AI_GUC_API_KEY);
 	if (api_key)
@@ -106,6 +113,22 @@ static void set_common_options(AIService *ai_service, const char *service_name,
 		ai_service->debug_level = *debug_level;
 }
 
+/*
+ * Set the common options for the service and model.
+ */
+static void set_common_options(AIService *ai_service, const char *service_name,
+							   const char *model_name, const char *model_url)
+{
+	set_option_value(AI_SERVICE_OPTIONS, OPTION_SERVICE_NAME, service_name,
+					 false /* concat */);
+	set_option_value(AI_SERVICE_OPTIONS, OPTION_MODEL_NAME, model_name,
+					 false /* concat */);
+	set_option_value(AI_SERVICE_OPTIONS, OPTION_ENDPOINT_URL,
+					 make_service_url(model_url), false /* concat */);
+
+	set_guc_options(ai_service);
+}
+
 /*
  * Given the specific service and model, create the service.
  */
@@ -183,25 +206,22 @@ int create_service(AIService *ai_service)
 void define_common_options(void *service)
 {
 	AIService *ai_service = (AIService *)service;
-	ServiceOption **option_list = &(AI_SERVICE_OPTIONS);
+	ServiceOption *option_list = AI_SERVICE_OPTIONS;
 
 	/* common options for the services */
 	define_new_option(option_list, OPTION_SERVICE_NAME,
-					  OPTION_SERVICE_NAME_DESC,
 					  OPTION_FLAG_REQUIRED | OPTION_FLAG_GUC,
 					  NULL /* storage ptr */, 0 /* max size */);
 
-	define_new_option(option_list, OPTION_MODEL_NAME, OPTION_MODEL_NAME_DESC,
+	define_new_option(option_list, OPTION_MODEL_NAME,
 					  OPTION_FLAG_REQUIRED | OPTION_FLAG_GUC,
 					  NULL /* storage ptr */, 0 /* max size */);
 
 	define_new_option(option_list, OPTION_ENDPOINT_URL,
-					  OPTION_ENDPOINT_URL_DESC,
 					  OPTION_FLAG_REQUIRED | OPTION_FLAG_GUC,
 					  NULL /* storage ptr */, 0 /* max size */);
 
 	define_new_option(option_list, OPTION_SERVICE_API_KEY,
-					  OPTION_SERVICE_API_KEY_DESC,
 					  OPTION_FLAG_REQUIRED | OPTION_FLAG_GUC,
 					  NULL /* storage ptr */, 0 /* max size */);
 }
@@ -49,8 +49,8 @@ typedef struct ServiceData
 	BYTE *response_data;
 	size_t max_response_size;
 
-	/* options(params+gucs) for this service */
-	ServiceOption *options;
+	/* options(params+gucs) for this service, indexed by ServiceOptionId */
+	ServiceOption options[OPTION_COUNT];
 
 } ServiceData;
 
@@ -182,6 +182,9 @@ AIService *palloc_AIService(void);
 AIService *valid_AIService_ptr(AIService *ai_service);
 void reset_service(AIService *ai_service);
 int create_service(AIService *ai_service);
+int get_service_model_flags(const int function_flags, size_t *service_flags,
+							size_t *model_flags);
+void set_guc_options(AIService *ai_service);
 int initialize_service(size_t service_flags, size_t model_flags,
 					   AIService *ai_service);
 const char *get_service_name(const AIService *ai_service);
@@ -23,6 +23,7 @@ static int initialize_gen_content(AIService *ai_service, char *model_name,
 
 	/* PgAi <-> REST functions */
 	ai_service->rest_transfer = gen_content_rest_transfer;
+	ai_service->process_rest_response = gen_content_process_rest_response;
 	ai_service->add_rest_headers = gen_content_add_rest_headers;
 	ai_service->add_rest_data = gen_content_add_rest_data;
 
@@ -53,6 +54,7 @@ static int initialize_genc_mod_content(AIService *ai_service, char *model_name,
 
 	/* PgAi <-> REST functions */
 	ai_service->rest_transfer = genc_mod_rest_transfer;
+	ai_service->process_rest_response = genc_mod_process_rest_response;
 	ai_service->add_rest_headers = genc_mod_add_rest_headers;
 	ai_service->add_rest_data = genc_mod_add_rest_data;
 
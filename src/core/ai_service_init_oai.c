@@ -24,6 +24,7 @@ static int initialize_gpt(AIService *ai_service, char *model_name,
 
 	/* PgAi <-> REST functions */
 	ai_service->rest_transfer = gpt_rest_transfer;
+	ai_service->process_rest_response = gpt_process_rest_response;
 	ai_service->add_rest_headers = gpt_add_rest_headers;
 	ai_service->add_rest_data = gpt_add_rest_data;
 
@@ -115,6 +116,7 @@ static int initialize_moderation(AIService *ai_service, char *model_name,
 
 	/* PG_AI <-> REST functions */
 	ai_service->rest_transfer = moderation_rest_transfer;
+	ai_service->process_rest_response = moderation_process_rest_response;
 	ai_service->add_rest_headers = moderation_add_rest_headers;
 	ai_service->add_rest_data = moderation_add_rest_data;
 
@@ -0,0 +1,246 @@
+#include "async_call.h"
+
+#include "miscadmin.h"
+#include "access/xact.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+
+#include "cache/result_cache.h"
+#include "cache/service_cache.h"
+#include "core/ai_config.h"
+#include "core/ai_config_str.h"
+#include "rest/rest_transfer.h"
+
+/* how long an await waits before it checks for interrupts */
+#define ASYNC_CALL_POLL_MS 100
+
+/* a call started in the background, answered by the cache or in flight */
+typedef struct AsyncCall
+{
+	int64 handle; /* hash key, must be first */
+	int function_flags;
+	char *column_value;
+	char *prompt;
+	char *result;
+	RestAsyncTransfer *transfer;
+} AsyncCall;
+
+/* the calls of the session not awaited yet, and their memory */
+static MemoryContext async_context = NULL;
+static HTAB *async_calls = NULL;
+static int64 last_handle = 0;
+
+static bool is_in_flight(AsyncCall *call)
+{
+	return call->transfer && !rest_async_response(call->transfer);
+}
+
+/*
+ * Cancel the requests still in flight at the end of the transaction that
+ * started them, so no endpoint slot is held while the session is idle. Their
+ * handles are kept and awaited with an error as the result.
+ */
+static void async_call_xact_callback(XactEvent event, void *arg)
+{
+	HASH_SEQ_STATUS status;
+	AsyncCall *call;
+
+	switch (event)
+	{
+	case XACT_EVENT_COMMIT:
+	case XACT_EVENT_ABORT:
+	case XACT_EVENT_PREPARE:
+		break;
+	default:
+		return;
+	}
+
+	hash_seq_init(&status, async_calls);
+	while ((call = hash_seq_search(&status)))
+	{
+		if (!is_in_flight(call))
+			continue;
+		rest_async_free(call->transfer);
+		call->transfer = NULL;
+		call->result =
+			MemoryContextStrdup(async_context, GET_ERR_STR(ASYNC_CANCELLED));
+	}
+}
+
+static HTAB *get_async_calls(void)
+{
+	HASHCTL info;
+
+	if (!async_calls)
+	{
+		async_context = AllocSetContextCreate(
+			TopMemoryContext, PG_AI_ASYNC_MCTX, ALLOCSET_DEFAULT_SIZES);
+		info.keysize = sizeof(int64);
+		info.entrysize = sizeof(AsyncCall);
+		info.hcxt = async_context;
+		async_calls = hash_create(PG_AI_ASYNC_MCTX, 64, &info,
+								  HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+		RegisterXactCallback(async_call_xact_callback, NULL);
+	}
+	return async_calls;
+}
+
+/* the service of the session with the options of a call */
+static AIService *get_call_options_service(const int function_flags,
+										   const char *column_value,
+										   const char *prompt)
+{
+	AIService *ai_service;
+
+	if (!(ai_service =
+			  get_session_service(function_flags, CurrentMemoryContext)) ||
+		!ai_service->process_rest_response)
+		ereport(ERROR, (errmsg("%s", GET_ERR_STR(UNSUPPORTED_SERVICE))));
+	if (set_row_call_options(ai_service, column_value, prompt))
+		ereport(ERROR, (errmsg("%s", GET_ERR_STR(INVALID_OPTIONS))));
+
+	return ai_service;
+}
+
+int64 async_call_start(const int function_flags, const char *column_value,
+					   const char *prompt)
+{
+	HTAB *calls = get_async_calls();
+	AIService *ai_service;
+	AsyncCall *call;
+	RestAsyncTransfer *transfer = NULL;
+	char *result;
+	int64 handle;
+
+	if (hash_get_num_entries(calls) >= ASYNC_MAX_CALLS)
+		ereport(ERROR,
+				(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+				 errmsg("too many pg_ai calls not awaited"),
+				 errhint("A session keeps up to %d calls till they are "
+						 "awaited.",
+						 ASYNC_MAX_CALLS)));
+
+	/* a value seen earlier is answered by the cache, without a request */
+	ai_service = get_call_options_service(function_flags, column_value, prompt);
+	if (!(result = result_cache_lookup(ai_service, column_value)))
+	{
+		if (ai_service->set_service_data(ai_service, (void *)column_value) ||
+			ai_service->prepare_for_transfer(ai_service))
+			ereport(ERROR, (errmsg("%s", GET_ERR_STR(INT_PREP_TNSFR))));
+		transfer = rest_async_start(ai_service, ai_service->rest_request->data,
+									async_context);
+	}
+
+	handle = ++last_handle;
+	call = hash_search(calls, &handle, HASH_ENTER, NULL);
+	call->function_flags = function_flags;
+	call->column_value = MemoryContextStrdup(async_context, column_value);
+	call->prompt = prompt ? MemoryContextStrdup(async_context, prompt) : NULL;
+	call->result = result ? MemoryContextStrdup(async_context, result) : NULL;
+	call->transfer = transfer;
+
+	return handle;
+}
+
+static AsyncCall *find_call(const int64 handle)
+{
+	AsyncCall *call = hash_search(get_async_calls(), &handle, HASH_FIND, NULL);
+
+	if (!call)
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("unknown pg_ai handle " INT64_FORMAT, handle),
+						errdetail("A handle is awaited only once, in the "
+								  "session that started it.")));
+	return call;
+}
+
+/*
+ * Make the result of a finished call as the per-row function would and
+ * forget the call. A successful result is stored in the result cache.
+ */
+static char *finish_call(AsyncCall *call)
+{
+	AIService *ai_service;
+	RestResponse *response;
+	char *result;
+
+	if (call->result)
+		result = pstrdup(call->result);
+	else
+	{
+		response = rest_async_response(call->transfer);
+		ai_service = get_call_options_service(
+			call->function_flags, call->column_value, call->prompt);
+		process_many_response(ai_service, response);
+		if (response->response_code == HTTP_OK)
+		{
+			result_cache_store(ai_service, call->column_value);
+			result = pstrdup(ai_service->service_data->response_data);
+		}
+		else
+			result = response->data_size ?
+						 pnstrdup(response->data, response->data_size) :
+						 pstrdup(GET_ERR_STR(TRANSFER_FAIL));
+		rest_async_free(call->transfer);
+	}
+
+	pfree(call->column_value);
+	if (call->prompt)
+		pfree(call->prompt);
+	if (call->result)
+		pfree(call->result);
+	hash_search(async_calls, &call->handle, HASH_REMOVE, NULL);
+
+	return result;
+}
+
+char *async_call_await(const int64 handle)
+{
+	AsyncCall *call = find_call(handle);
+
+	while (is_in_flight(call))
+	{
+		rest_async_poll(ASYNC_CALL_POLL_MS);
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	return finish_call(call);
+}
+
+void async_call_await_all(const int64 *handles, const bool *nulls,
+						  const int count, char **results)
+{
+	AsyncCall **calls = palloc0(sizeof(AsyncCall *) * count);
+	bool in_flight = true;
+
+	/* every handle is checked before waiting for any */
+	for (int i = 0; i < count; i++)
+		if (!nulls[i])
+			calls[i] = find_call(handles[i]);
+
+	while (in_flight)
+	{
+		in_flight = false;
+		for (int i = 0; i < count && !in_flight; i++)
+			in_flight = calls[i] && is_in_flight(calls[i]);
+		if (in_flight)
+		{
+			rest_async_poll(ASYNC_CALL_POLL_MS);
+			CHECK_FOR_INTERRUPTS();
+		}
+	}
+
+	/* a handle given twice gets the result of its first place */
+	for (int i = 0; i < count; i++)
+	{
+		results[i] = NULL;
+		if (!calls[i])
+			continue;
+		for (int j = 0; j < i && !results[i]; j++)
+			if (calls[j] == calls[i])
+				results[i] = pstrdup(results[j]);
+		if (!results[i])
+			results[i] = finish_call(calls[i]);
+	}
+	pfree(calls);
+}
@@ -0,0 +1,26 @@
+#ifndef _ASYNC_CALL_H_
+#define _ASYNC_CALL_H_
+
+#include "postgres.h"
+
+/*
+ * Calls of the per-row functions started in the background of the session.
+ * A call returns a handle at once and its request is in flight with the
+ * other calls started, till the handle is awaited. A request not finished at
+ * the end of its transaction is cancelled. The handles are kept for the
+ * session, across transactions, till they are awaited.
+ */
+int64 async_call_start(const int function_flags, const char *column_value,
+					   const char *prompt);
+
+/* wait for the result of a call, it is allocated in the current context */
+char *async_call_await(const int64 handle);
+
+/*
+ * Wait for the results of the calls of the handles, a NULL handle gets a
+ * NULL result. The results are in the order of the handles.
+ */
+void async_call_await_all(const int64 *handles, const bool *nulls,
+						  const int count, char **results);
+
+#endif /* _ASYNC_CALL_H_ */
@@ -0,0 +1,120 @@
+#include "batch_call.h"
+
+#include "utils/builtins.h"
+
+#include "cache/result_cache.h"
+#include "guc/pg_ai_guc.h"
+#include "rest/rest_transfer.h"
+
+/* the values of a batch and their results till they are put in order */
+typedef struct BatchWindow
+{
+	BatchCallResult put_result;
+	void *arg;
+	char **values;
+	char **results;
+	bool *done;
+	int *request_values; /* the value of each request */
+	int count;
+	int next_row; /* the first value not in the result yet */
+	int64 first_ordinality;
+} BatchWindow;
+
+/*
+ * Put the results of the values done up to the first one still in flight,
+ * the rows go out in the order of the values as soon as they can.
+ */
+static void put_ready_rows(BatchWindow *window)
+{
+	for (; window->next_row < window->count &&
+		   window->done[window->next_row];
+		 window->next_row++)
+	{
+		char *result = window->results[window->next_row];
+
+		window->put_result(window->arg,
+						   window->first_ordinality + window->next_row, result);
+		if (result)
+			pfree(result);
+	}
+}
+
+static void set_result(BatchWindow *window, const int value, char *result)
+{
+	window->results[value] = result;
+	window->done[value] = true;
+	put_ready_rows(window);
+}
+
+/*
+ * Keep the result of a request. A successful one is stored in the result
+ * cache as the result of a single call.
+ */
+static void store_result(AIService *ai_service, const int index,
+						 RestResponse *response, void *arg)
+{
+	BatchWindow *window = (BatchWindow *)arg;
+	int value = window->request_values[index];
+
+	process_many_response(ai_service, response);
+	if (response->response_code == HTTP_OK)
+	{
+		result_cache_store(ai_service, window->values[value]);
+		set_result(window, value,
+				   pstrdup(ai_service->service_data->response_data));
+	}
+	else
+		set_result(window, value,
+				   response->data_size ?
+					   pnstrdup(response->data, response->data_size) :
+					   pstrdup(GET_ERR_STR(TRANSFER_FAIL)));
+}
+
+void batch_call(AIService *ai_service, char **values, const int count,
+				const int64 first_ordinality, BatchCallResult put_result,
+				void *arg)
+{
+	BatchWindow window;
+	char **requests;
+	char *cached;
+	int request_count = 0;
+
+	window.put_result = put_result;
+	window.arg = arg;
+	window.values = values;
+	window.results = palloc0(sizeof(char *) * count);
+	window.done = palloc0(sizeof(bool) * count);
+	window.request_values = palloc(sizeof(int) * count);
+	window.count = count;
+	window.next_row = 0;
+	window.first_ordinality = first_ordinality;
+
+	/* the service makes the request of each value as for a single call */
+	requests = palloc(sizeof(char *) * count);
+	for (int i = 0; i < count; i++)
+	{
+		if (!values[i])
+		{
+			set_result(&window, i, NULL);
+			continue;
+		}
+		if ((cached = result_cache_lookup(ai_service, values[i])))
+		{
+			set_result(&window, i, cached);
+			continue;
+		}
+
+		reset_option_value(AI_SERVICE_OPTIONS, OPTION_COLUMN_VALUE);
+		if (ai_service->set_service_data(ai_service, values[i]) ||
+			ai_service->prepare_for_transfer(ai_service))
+			ereport(ERROR, (errmsg("%s", GET_ERR_STR(INT_PREP_TNSFR))));
+		requests[request_count] = pnstrdup(ai_service->rest_request->data,
+										   ai_service->rest_request->data_size);
+		window.request_values[request_count++] = i;
+	}
+
+	rest_transfer_many(
+		ai_service, requests, request_count,
+		*get_pg_ai_guc_int_variable(PG_AI_GUC_BATCH_CONCURRENCY),
+		store_result, &window);
+}
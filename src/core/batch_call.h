@@ -0,0 +1,22 @@
+#ifndef _BATCH_CALL_H_
+#define _BATCH_CALL_H_
+
+#include "postgres.h"
+
+#include "core/ai_service.h"
+
+/* takes the result of a value, called in the order of the values */
+typedef void (*BatchCallResult)(void *arg, const int64 ordinality,
+								const char *result);
+
+/*
+ * Call the service for each of the values with the requests in flight
+ * concurrently, and pass the (ordinality, result) of every value on in the
+ * order of the values. A NULL value gets a NULL result and a failed request
+ * the error of the service, as from the per-row function.
+ */
+void batch_call(AIService *ai_service, char **values, const int count,
+				const int64 first_ordinality, BatchCallResult put_result,
+				void *arg);
+
+#endif /* _BATCH_CALL_H_ */
@@ -0,0 +1,196 @@
+#include "map_reduce.h"
+
+#include "lib/stringinfo.h"
+#include "mb/pg_wchar.h"
+#include "nodes/pg_list.h"
+
+#include "core/tokenizer.h"
+#include "core/utils_pg_ai.h"
+#include "guc/pg_ai_guc.h"
+#include "rest/rest_transfer.h"
+
+/* the summaries of the chunks of a round, and the first error */
+typedef struct MapReduceRound
+{
+	char **summaries;
+	char *error;
+} MapReduceRound;
+
+/*
+ * The tokens left for the data of a request after the prompt, with room for
+ * the text the service puts around the data.
+ */
+static int64 get_data_token_count(const ModelContext *model, const char *prompt)
+{
+	return Max(get_request_token_limit(model) -
+				   count_tokens(model, prompt, strlen(prompt)) -
+				   MAP_REDUCE_TOKEN_MARGIN,
+			   1);
+}
+
+static bool fits_one_request(const ModelContext *model, const char *values,
+							 const int64 max_tokens)
+{
+	size_t len = strlen(values);
+
+	return len <= MAP_REDUCE_CHUNK_SIZE &&
+		   get_token_prefix_length(model, values, len, max_tokens) == len;
+}
+
+/*
+ * Split the values into chunks within the tokens and the chunk size. A chunk
+ * ends at a space, a word longer than a chunk is cut at a character.
+ */
+static List *split_values(const ModelContext *model, const char *values,
+						  const int64 max_tokens)
+{
+	List *chunks = NIL;
+	size_t len = strlen(values);
+	size_t start = 0;
+
+	while (start < len)
+	{
+		const char *chunk = values + start;
+		size_t window = Min(len - start, MAP_REDUCE_CHUNK_SIZE);
+		size_t cut = get_token_prefix_length(model, chunk, window, max_tokens);
+
+		if (start + cut < len)
+		{
+			size_t space = cut;
+
+			while (space > 0 && chunk[space] != ' ')
+				space--;
+			/* a token has a byte at least, so max_tokens bytes always fit */
+			cut = space ? space :
+						  pg_mbcliplen(chunk, window, Min(window, max_tokens));
+		}
+
+		chunks = lappend(chunks, pnstrdup(chunk, cut));
+		for (start += cut; values[start] == ' '; start++)
+			;
+	}
+
+	return chunks;
+}
+
+/*
+ * Keep the summary of a chunk. The service extracts the text from the
+ * response of the chunk as from a response of its own.
+ */
+static void store_summary(AIService *ai_service, const int index,
+						  RestResponse *response, void *arg)
+{
+	MapReduceRound *round = (MapReduceRound *)arg;
+
+	process_many_response(ai_service, response);
+	if (response->response_code == HTTP_OK)
+		round->summaries[index] =
+			pstrdup(ai_service->service_data->response_data);
+	else if (!round->error)
+		round->error = response->data_size ?
+						   pnstrdup(response->data, response->data_size) :
+						   pstrdup(GET_ERR_STR(TRANSFER_FAIL));
+}
+
+/*
+ * Summarize the chunks concurrently, the map of a round. Returns the
+ * summaries joined in the order of the chunks, NULL with the error set if a
+ * chunk fails.
+ */
+static char *map_chunks(AIService *ai_service, List *chunks, char **error)
+{
+	MapReduceRound round;
+	StringInfoData joined;
+	char **requests;
+	ListCell *lc;
+	int count = list_length(chunks);
+	int i = 0;
+
+	/* the service makes the request of each chunk as for a single call */
+	requests = palloc(sizeof(char *) * count);
+	foreach (lc, chunks)
+	{
+		reset_option_value(AI_SERVICE_OPTIONS, OPTION_COLUMN_VALUE);
+		if (ai_service->set_service_data(ai_service, lfirst(lc)) ||
+			ai_service->prepare_for_transfer(ai_service))
+		{
+			*error = pstrdup(GET_ERR_STR(INT_PREP_TNSFR));
+			return NULL;
+		}
+		requests[i++] = pnstrdup(ai_service->rest_request->data,
+								 ai_service->rest_request->data_size);
+	}
+
+	round.summaries = palloc0(sizeof(char *) * count);
+	round.error = NULL;
+	rest_transfer_many(
+		ai_service, requests, count,
+		*get_pg_ai_guc_int_variable(PG_AI_GUC_AGG_CONCURRENCY),
+		store_summary, &round);
+	if (round.error)
+	{
+		*error = round.error;
+		return NULL;
+	}
+
+	initStringInfo(&joined);
+	for (i = 0; i < count; i++)
+	{
+		if (i)
+			appendStringInfoChar(&joined, ' ');
+		appendStringInfoString(&joined, round.summaries[i]);
+	}
+
+	return joined.data;
+}
+
+/*
+ * Values over one request are split into chunks that are summarized
+ * concurrently, then the joined summaries are split and summarized again
+ * until they fit in one request. A round only waits for its slowest chunk, so
+ * the time taken grows with the log of the number of chunks. The values are
+ * returned as they are if they fit, or if the service cannot summarize them.
+ */
+char *map_reduce_values(AIService *ai_service, char *values, char **error)
+{
+	const ModelContext *model =
+		get_model_context(ai_service->get_model_name(ai_service));
+	char *prompt;
+	char map_prompt[SERVICE_DATA_SIZE];
+	int64 max_tokens;
+	int64 map_tokens;
+	char *reduced = values;
+	char *summaries;
+
+	prompt = pstrdup(
+		get_option_value(AI_SERVICE_OPTIONS, OPTION_SERVICE_PROMPT_AGG));
+	max_tokens = get_data_token_count(model, prompt);
+	if (fits_one_request(model, values, max_tokens) ||
+		!ai_service->process_rest_response)
+		return values;
+
+	/* the chunks are summarized toward the prompt of the aggregate */
+	snprintf(map_prompt, SERVICE_DATA_SIZE, MAP_REDUCE_PROMPT, prompt);
+	set_option_value(AI_SERVICE_OPTIONS, OPTION_SERVICE_PROMPT_AGG, map_prompt,
+					 false /* concat */);
+	map_tokens = get_data_token_count(model, map_prompt);
+
+	do
+	{
+		summaries = map_chunks(ai_service,
+							   split_values(model, reduced, map_tokens), error);
+		if (summaries && strlen(summaries) >= strlen(reduced))
+		{
+			*error = pstrdup(GET_ERR_STR(NO_REDUCE));
+			summaries = NULL;
+		}
+		reduced = summaries;
+	} while (reduced && !fits_one_request(model, reduced, max_tokens));
+
+	/* the final request is made with the prompt of the aggregate */
+	set_option_value(AI_SERVICE_OPTIONS, OPTION_SERVICE_PROMPT_AGG, prompt,
+					 false /* concat */);
+	reset_option_value(AI_SERVICE_OPTIONS, OPTION_COLUMN_VALUE);
+
+	return reduced;
+}
@@ -0,0 +1,12 @@
+#ifndef _MAP_REDUCE_H_
+#define _MAP_REDUCE_H_
+
+#include "core/ai_service.h"
+
+/*
+ * Reduce the values of an aggregate to a text that fits in one request of
+ * the service. Returns NULL with the error text set if a request fails.
+ */
+char *map_reduce_values(AIService *ai_service, char *values, char **error);
+
+#endif /* _MAP_REDUCE_H_ */
@@ -0,0 +1,64 @@
+#include "memory_budget.h"
+
+#include "utils/memutils.h"
+
+#include "core/ai_config_str.h"
+#include "guc/pg_ai_guc.h"
+
+/* the memory kept by pg_ai for the session, see get_session_memory_used() */
+static MemoryContext session_memory_context = NULL;
+
+/*
+ * Return the budget set by pg_ai.work_mem in bytes.
+ */
+Size get_work_mem_bytes(void)
+{
+	return (Size)*get_pg_ai_guc_int_variable(PG_AI_GUC_WORK_MEM_SIZE) * 1024;
+}
+
+/*
+ * Return the memory context for the allocations that live as long as the
+ * session, created on the first use.
+ */
+MemoryContext get_session_memory_context(void)
+{
+	if (!session_memory_context)
+		session_memory_context = AllocSetContextCreate(
+			TopMemoryContext, PG_AI_SESSION_MCTX, ALLOCSET_DEFAULT_SIZES);
+
+	return session_memory_context;
+}
+
+/*
+ * Return the memory kept by pg_ai for the session, the blocks allocated by
+ * the session context and all its children.
+ */
+Size get_session_memory_used(void)
+{
+	if (!session_memory_context)
+		return 0;
+
+	return MemoryContextMemAllocated(session_memory_context, true);
+}
+
+/*
+ * Return true if the memory used by a call is within pg_ai.work_mem.
+ */
+bool within_work_mem(const Size used)
+{
+	return used <= get_work_mem_bytes();
+}
+
+/*
+ * Error out if the memory used by a call is over pg_ai.work_mem, for the
+ * features that can neither spill nor drop what they hold.
+ */
+void check_work_mem(const Size used, const char *what)
+{
+	if (!within_work_mem(used))
+		ereport(ERROR,
+				(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+				 errmsg("%s needs %zu kB, over pg_ai.work_mem", what,
+						used / 1024),
+				 errhint("Increase pg_ai.work_mem or pass less data.")));
+}
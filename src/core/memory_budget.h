@@ -0,0 +1,23 @@
+#ifndef _MEMORY_BUDGET_H_
+#define _MEMORY_BUDGET_H_
+
+#include "postgres.h"
+
+/*
+ * pg_ai.work_mem is the budget of the memory pg_ai keeps for a session (the
+ * cached services) and of the memory used by a call (the memoized results
+ * and the input of an aggregate).
+ */
+Size get_work_mem_bytes(void);
+
+/* the parent of the memory kept by pg_ai for the session */
+MemoryContext get_session_memory_context(void);
+Size get_session_memory_used(void);
+
+/* true if the memory used by a call would stay within the budget */
+bool within_work_mem(const Size used);
+
+/* error out when a call goes over the budget */
+void check_work_mem(const Size used, const char *what);
+
+#endif /* _MEMORY_BUDGET_H_ */
@@ -0,0 +1,639 @@
+#include "prefetch_scan.h"
+
+#include "catalog/pg_type.h"
+#include "commands/explain.h"
+#include "executor/executor.h"
+#include "nodes/extensible.h"
+#include "nodes/makefuncs.h"
+#include "nodes/nodeFuncs.h"
+#include "optimizer/optimizer.h"
+#include "optimizer/planner.h"
+#include "optimizer/tlist.h"
+#include "parser/parsetree.h"
+#include "utils/builtins.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+
+#include "cache/prefetch_cache.h"
+#include "cache/result_cache.h"
+#include "cache/service_cache.h"
+#include "core/ai_service.h"
+#include "core/utils_pg_ai.h"
+#include "guc/pg_ai_guc.h"
+#include "rest/rest_transfer.h"
+
+#define PREFETCH_SCAN_NAME "PgAiPrefetch"
+
+/* the per-row functions the scan calls ahead, value and prompt arguments */
+typedef struct PrefetchFunction
+{
+	const char *name;
+	int function_flags;
+} PrefetchFunction;
+
+static const PrefetchFunction prefetch_functions[] = {
+	{"pg_ai_insight", FUNCTION_GET_INSIGHT},
+	{"pg_ai_moderation", FUNCTION_MODERATION}};
+
+#define PREFETCH_FUNCTION_ARGS 2
+
+/* the state of the scan, the rows of a window and the calls on them */
+typedef struct PrefetchScanState
+{
+	CustomScanState css;
+	PlanState *child;
+	int call_count;
+	int *function_flags;
+	List **call_args; /* the value and prompt of each call */
+	TupleTableSlot **rows;
+	int max_rows;
+	int window_rows; /* the rows read for the next window */
+	int row_count;
+	int next_row;
+	bool child_done;
+	MemoryContext window_context;
+} PrefetchScanState;
+
+/* the calls of a window with the requests in flight */
+typedef struct PrefetchWindow
+{
+	PrefetchCache *cache;
+	int function_flags;
+	char **values;
+	char **prompts;
+	int *request_values; /* the row of each request */
+} PrefetchWindow;
+
+/* walking the plan, once for the plan node ids and once to rewrite */
+typedef struct PrefetchPlanContext
+{
+	bool rewrite;
+	int next_plan_node_id;
+} PrefetchPlanContext;
+
+/* resolving the columns of a child to the expressions they come from */
+typedef struct FlattenContext
+{
+	Plan *plan;
+	bool failed;
+} FlattenContext;
+
+static planner_hook_type prev_planner_hook = NULL;
+
+static Node *create_prefetch_scan_state(CustomScan *cscan);
+static void begin_prefetch_scan(CustomScanState *node, EState *estate,
+								int eflags);
+static TupleTableSlot *exec_prefetch_scan(CustomScanState *node);
+static void end_prefetch_scan(CustomScanState *node);
+static void rescan_prefetch_scan(CustomScanState *node);
+static void explain_prefetch_scan(CustomScanState *node, List *ancestors,
+								  ExplainState *es);
+
+static const CustomScanMethods prefetch_scan_methods = {
+	.CustomName = PREFETCH_SCAN_NAME,
+	.CreateCustomScanState = create_prefetch_scan_state};
+
+static const CustomExecMethods prefetch_exec_methods = {
+	.CustomName = PREFETCH_SCAN_NAME,
+	.BeginCustomScan = begin_prefetch_scan,
+	.ExecCustomScan = exec_prefetch_scan,
+	.EndCustomScan = end_prefetch_scan,
+	.ReScanCustomScan = rescan_prefetch_scan,
+	.ExplainCustomScan = explain_prefetch_scan};
+
+/* the calls of the functions of the extension, not of others of that name */
+static int get_function_flags(FuncExpr *expr)
+{
+	char *name;
+
+	if (expr->funcretset || expr->funcresulttype != TEXTOID ||
+		list_length(expr->args) != PREFETCH_FUNCTION_ARGS ||
+		get_func_namespace(expr->funcid) != get_pg_ai_schema() ||
+		!(name = get_func_name(expr->funcid)))
+		return 0;
+
+	for (int i = 0; i < lengthof(prefetch_functions); i++)
+		if (strcmp(prefetch_functions[i].name, name) == 0)
+			return prefetch_functions[i].function_flags;
+	return 0;
+}
+
+/*
+ * Collect the calls that can be made ahead. The arguments are evaluated once
+ * more for the prefetch, so the ones with volatile functions are left out.
+ * The calls in conditional expressions may not run for a row, they are not
+ * made ahead as that could send requests the query never makes.
+ */
+static bool find_calls_walker(Node *node, List **calls)
+{
+	if (!node)
+		return false;
+
+	if (IsA(node, CaseExpr) || IsA(node, CoalesceExpr) ||
+		IsA(node, BoolExpr) || IsA(node, MinMaxExpr) ||
+		IsA(node, NullIfExpr))
+		return false;
+
+	if (IsA(node, FuncExpr) && get_function_flags((FuncExpr *)node) &&
+		!contain_volatile_functions((Node *)((FuncExpr *)node)->args))
+		*calls = lappend(*calls, node);
+
+	return expression_tree_walker(node, find_calls_walker, calls);
+}
+
+static Plan *get_outer_plan(Plan *plan)
+{
+	if (IsA(plan, Append))
+		return linitial(((Append *)plan)->appendplans);
+	if (IsA(plan, MergeAppend))
+		return linitial(((MergeAppend *)plan)->mergeplans);
+	return outerPlan(plan);
+}
+
+/*
+ * Replace the references to the columns of the children with the
+ * expressions below. The scan has no plan of its own to resolve them
+ * against, EXPLAIN shows its columns with these.
+ */
+static Node *flatten_mutator(Node *node, FlattenContext *context)
+{
+	if (!node)
+		return NULL;
+
+	if (IsA(node, Var) && (((Var *)node)->varno == OUTER_VAR ||
+						   ((Var *)node)->varno == INNER_VAR))
+	{
+		Var *var = (Var *)node;
+		FlattenContext child_context = {NULL, false};
+		TargetEntry *tle = NULL;
+		Node *expr;
+
+		child_context.plan = var->varno == OUTER_VAR ?
+								 get_outer_plan(context->plan) :
+								 innerPlan(context->plan);
+		if (child_context.plan)
+			tle = get_tle_by_resno(child_context.plan->targetlist,
+								   var->varattno);
+		if (!tle)
+		{
+			context->failed = true;
+			return copyObject(node);
+		}
+
+		expr = flatten_mutator((Node *)tle->expr, &child_context);
+		context->failed |= child_context.failed;
+		return expr;
+	}
+
+	/* the other special references and the aggregates are not resolved */
+	if ((IsA(node, Var) && IS_SPECIAL_VARNO(((Var *)node)->varno)) ||
+		IsA(node, Aggref) || IsA(node, WindowFunc) ||
+		IsA(node, GroupingFunc))
+	{
+		context->failed = true;
+		return copyObject(node);
+	}
+
+	return expression_tree_mutator(node, flatten_mutator, context);
+}
+
+/* refer the columns of the child as the columns of the scan tuple */
+static Node *scan_var_mutator(Node *node, List *scan_tlist)
+{
+	if (!node)
+		return NULL;
+
+	if (IsA(node, Var))
+	{
+		Var *var = (Var *)node;
+		TargetEntry *tle = tlist_member((Expr *)node, scan_tlist);
+
+		return (Node *)makeVar(INDEX_VAR, tle->resno, var->vartype,
+							   var->vartypmod, var->varcollid, 0);
+	}
+
+	return expression_tree_mutator(node, scan_var_mutator, scan_tlist);
+}
+
+/* the plans that project their rows and can have a scan on top */
+static bool can_prefetch(Plan *plan)
+{
+	switch (nodeTag(plan))
+	{
+		case T_SeqScan:
+		case T_SampleScan:
+		case T_IndexScan:
+		case T_BitmapHeapScan:
+		case T_TidScan:
+		case T_TidRangeScan:
+			return true;
+		case T_Result:
+			return outerPlan(plan) != NULL;
+		default:
+			return false;
+	}
+}
+
+/*
+ * Put a prefetch scan on top of a plan projecting the per-row functions.
+ * The plan is left to return the columns its target list uses and the scan
+ * projects the target list, with the calls answered from the prefetch.
+ */
+static Plan *make_prefetch_scan(Plan *plan, PrefetchPlanContext *context)
+{
+	CustomScan *cscan;
+	FlattenContext flatten = {plan, false};
+	List *calls = NIL;
+	List *scan_tlist = NIL;
+	List *custom_scan_tlist = NIL;
+	List *function_flags = NIL;
+	ListCell *lc;
+
+	if (!can_prefetch(plan) || contain_subplans((Node *)plan->targetlist))
+		return plan;
+	find_calls_walker((Node *)plan->targetlist, &calls);
+	if (!calls)
+		return plan;
+
+	/* the columns used by the target list, once each */
+	foreach (lc, pull_var_clause((Node *)plan->targetlist,
+								 PVC_RECURSE_AGGREGATES |
+									 PVC_RECURSE_WINDOWFUNCS |
+									 PVC_RECURSE_PLACEHOLDERS))
+		if (!tlist_member(lfirst(lc), scan_tlist))
+			scan_tlist = lappend(
+				scan_tlist, makeTargetEntry(lfirst(lc),
+											list_length(scan_tlist) + 1,
+											NULL, false /* resjunk */));
+
+	foreach (lc, scan_tlist)
+	{
+		TargetEntry *tle = (TargetEntry *)lfirst(lc);
+
+		custom_scan_tlist = lappend(
+			custom_scan_tlist,
+			makeTargetEntry((Expr *)flatten_mutator((Node *)tle->expr,
+													&flatten),
+							tle->resno, NULL, false /* resjunk */));
+	}
+	if (flatten.failed)
+		return plan;
+
+	cscan = makeNode(CustomScan);
+	cscan->scan.plan.targetlist =
+		(List *)scan_var_mutator((Node *)plan->targetlist, scan_tlist);
+	calls = NIL;
+	find_calls_walker((Node *)cscan->scan.plan.targetlist, &calls);
+	foreach (lc, calls)
+		function_flags =
+			lappend_int(function_flags, get_function_flags(lfirst(lc)));
+
+	cscan->scan.plan.startup_cost = plan->startup_cost;
+	cscan->scan.plan.total_cost = plan->total_cost;
+	cscan->scan.plan.plan_rows = plan->plan_rows;
+	cscan->scan.plan.plan_width = plan->plan_width;
+	cscan->scan.plan.parallel_safe = plan->parallel_safe;
+	cscan->scan.plan.plan_node_id = context->next_plan_node_id++;
+	cscan->scan.plan.extParam = bms_copy(plan->extParam);
+	cscan->scan.plan.allParam = bms_copy(plan->allParam);
+	cscan->scan.scanrelid = 0;
+	cscan->custom_plans = list_make1(plan);
+	cscan->custom_exprs = copyObject(calls);
+	cscan->custom_private = function_flags;
+	cscan->custom_scan_tlist = custom_scan_tlist;
+	cscan->methods = &prefetch_scan_methods;
+
+	plan->targetlist = scan_tlist;
+	return (Plan *)cscan;
+}
+
+static Plan *prefetch_plan(Plan *plan, PrefetchPlanContext *context)
+{
+	ListCell *lc;
+
+	if (!plan)
+		return NULL;
+
+	context->next_plan_node_id =
+		Max(context->next_plan_node_id, plan->plan_node_id + 1);
+
+	plan->lefttree = prefetch_plan(plan->lefttree, context);
+	/* the inner side of a merge join may be marked and restored */
+	if (!IsA(plan, MergeJoin) || !context->rewrite)
+		plan->righttree = prefetch_plan(plan->righttree, context);
+
+	switch (nodeTag(plan))
+	{
+		case T_Append:
+			foreach (lc, ((Append *)plan)->appendplans)
+				lfirst(lc) = prefetch_plan(lfirst(lc), context);
+			break;
+		case T_MergeAppend:
+			foreach (lc, ((MergeAppend *)plan)->mergeplans)
+				lfirst(lc) = prefetch_plan(lfirst(lc), context);
+			break;
+		case T_BitmapAnd:
+			foreach (lc, ((BitmapAnd *)plan)->bitmapplans)
+				lfirst(lc) = prefetch_plan(lfirst(lc), context);
+			break;
+		case T_BitmapOr:
+			foreach (lc, ((BitmapOr *)plan)->bitmapplans)
+				lfirst(lc) = prefetch_plan(lfirst(lc), context);
+			break;
+		case T_SubqueryScan:
+			((SubqueryScan *)plan)->subplan =
+				prefetch_plan(((SubqueryScan *)plan)->subplan, context);
+			break;
+		case T_CustomScan:
+			foreach (lc, ((CustomScan *)plan)->custom_plans)
+				lfirst(lc) = prefetch_plan(lfirst(lc), context);
+			break;
+		default:
+			break;
+	}
+
+	return context->rewrite ? make_prefetch_scan(plan, context) : plan;
+}
+
+/*
+ * Plan the query and put the prefetch scans in. The plans that may run
+ * backwards or lock and modify rows are left as they are.
+ */
+static PlannedStmt *prefetch_planner(Query *parse, const char *query_string,
+									 int cursorOptions,
+									 ParamListInfo boundParams)
+{
+	PrefetchPlanContext context = {false, 0};
+	PlannedStmt *stmt;
+	ListCell *lc;
+
+	if (prev_planner_hook)
+		stmt = prev_planner_hook(parse, query_string, cursorOptions,
+								 boundParams);
+	else
+		stmt = standard_planner(parse, query_string, cursorOptions,
+								boundParams);
+
+	if (*get_pg_ai_guc_int_variable(PG_AI_GUC_PREFETCH_ROWS) == 0 ||
+		stmt->commandType != CMD_SELECT || stmt->hasModifyingCTE ||
+		stmt->rowMarks != NIL || (cursorOptions & CURSOR_OPT_SCROLL))
+		return stmt;
+
+	prefetch_plan(stmt->planTree, &context);
+	foreach (lc, stmt->subplans)
+		prefetch_plan(lfirst(lc), &context);
+
+	context.rewrite = true;
+	stmt->planTree = prefetch_plan(stmt->planTree, &context);
+	foreach (lc, stmt->subplans)
+		lfirst(lc) = prefetch_plan(lfirst(lc), &context);
+
+	return stmt;
+}
+
+static Node *create_prefetch_scan_state(CustomScan *cscan)
+{
+	PrefetchScanState *state = (PrefetchScanState *)newNode(
+		sizeof(PrefetchScanState), T_CustomScanState);
+
+	state->css.methods = &prefetch_exec_methods;
+	return (Node *)state;
+}
+
+static void begin_prefetch_scan(CustomScanState *node, EState *estate,
+								int eflags)
+{
+	PrefetchScanState *state = (PrefetchScanState *)node;
+	CustomScan *cscan = (CustomScan *)node->ss.ps.plan;
+	TupleDesc scan_desc = node->ss.ss_ScanTupleSlot->tts_tupleDescriptor;
+	ListCell *lc;
+
+	state->child = ExecInitNode(linitial(cscan->custom_plans), estate, eflags);
+	node->custom_ps = list_make1(state->child);
+
+	state->call_count = list_length(cscan->custom_exprs);
+	state->function_flags = palloc(sizeof(int) * state->call_count);
+	state->call_args = palloc(sizeof(List *) * state->call_count);
+	foreach (lc, cscan->custom_exprs)
+	{
+		int call = foreach_current_index(lc);
+
+		state->function_flags[call] = list_nth_int(cscan->custom_private, call);
+		state->call_args[call] =
+			ExecInitExprList(((FuncExpr *)lfirst(lc))->args, &node->ss.ps);
+	}
+
+	/* a plan kept from before the prefetch was disabled reads a row ahead */
+	state->max_rows =
+		Max(*get_pg_ai_guc_int_variable(PG_AI_GUC_PREFETCH_ROWS), 1);
+	state->rows = palloc(sizeof(TupleTableSlot *) * state->max_rows);
+	for (int i = 0; i < state->max_rows; i++)
+		state->rows[i] =
+			MakeSingleTupleTableSlot(scan_desc, &TTSOpsMinimalTuple);
+
+	state->window_rows = 1;
+	state->window_context = AllocSetContextCreate(
+		CurrentMemoryContext, PG_AI_PREFETCH_MCTX, ALLOCSET_DEFAULT_SIZES);
+}
+
+static char *eval_text_arg(ExprState *arg, ExprContext *econtext)
+{
+	bool isnull;
+	Datum value = ExecEvalExprSwitchContext(arg, econtext, &isnull);
+
+	return isnull ? NULL : TextDatumGetCString(value);
+}
+
+/*
+ * Keep the result of a request for the projection of its row. A successful
+ * one is stored in the result cache as the result of a single call, the
+ * failed ones are left for the function to make again.
+ */
+static void store_prefetched(AIService *ai_service, const int index,
+							 RestResponse *response, void *arg)
+{
+	PrefetchWindow *window = (PrefetchWindow *)arg;
+	int row = window->request_values[index];
+
+	process_many_response(ai_service, response);
+	if (response->response_code != HTTP_OK)
+		return;
+
+	/* the result cache keys on the prompt in the options */
+	if (set_row_call_options(ai_service, window->values[row],
+							 window->prompts[row]) == RETURN_ZERO)
+		result_cache_store(ai_service, window->values[row]);
+	prefetch_cache_store(window->cache, window->function_flags,
+						 window->values[row], window->prompts[row],
+						 ai_service->service_data->response_data);
+}
+
+/*
+ * Call the service for a call on the rows of the window. The NULL values
+ * and the calls the service can not make are left to the function.
+ */
+static void prefetch_calls(PrefetchScanState *state, const int call,
+						   PrefetchCache *cache)
+{
+	ExprContext *econtext = state->css.ss.ps.ps_ExprContext;
+	int function_flags = state->function_flags[call];
+	List *args = state->call_args[call];
+	AIService *ai_service;
+	PrefetchWindow window;
+	char **requests;
+	char *cached;
+	int request_count = 0;
+
+	ai_service = get_session_service(function_flags,
+									 state->css.ss.ps.state->es_query_cxt);
+	if (!ai_service || !ai_service->process_rest_response)
+		return;
+
+	window.cache = cache;
+	window.function_flags = function_flags;
+	window.values = palloc(sizeof(char *) * state->row_count);
+	window.prompts = palloc(sizeof(char *) * state->row_count);
+	window.request_values = palloc(sizeof(int) * state->row_count);
+	requests = palloc(sizeof(char *) * state->row_count);
+
+	for (int row = 0; row < state->row_count; row++)
+	{
+		char *value;
+		char *prompt;
+
+		econtext->ecxt_scantuple = state->rows[row];
+		value = eval_text_arg(linitial(args), econtext);
+		prompt = eval_text_arg(lsecond(args), econtext);
+		ResetExprContext(econtext);
+		window.values[row] = value;
+		window.prompts[row] = prompt;
+
+		/* a value repeated in the window is requested once */
+		if (!value ||
+			!prefetch_cache_reserve(cache, function_flags, value, prompt))
+			continue;
+
+		if (set_row_call_options(ai_service, value, prompt))
+			continue;
+		reset_option_value(AI_SERVICE_OPTIONS, OPTION_COLUMN_VALUE);
+		if (ai_service->set_service_data(ai_service, value))
+			continue;
+		if ((cached = result_cache_lookup(ai_service, value)))
+		{
+			prefetch_cache_store(cache, function_flags, value, prompt,
+								 cached);
+			continue;
+		}
+		if (ai_service->prepare_for_transfer(ai_service))
+			continue;
+
+		requests[request_count] = pnstrdup(ai_service->rest_request->data,
+										   ai_service->rest_request->data_size);
+		window.request_values[request_count++] = row;
+	}
+
+	if (request_count)
+		rest_transfer_many(
+			ai_service, requests, request_count,
+			*get_pg_ai_guc_int_variable(PG_AI_GUC_BATCH_CONCURRENCY),
+			store_prefetched, &window);
+}
+
+/*
+ * Read the next window of rows and make their calls. The window starts at a
+ * row and doubles up to pg_ai.prefetch_rows, a LIMIT on top does not make
+ * many more calls than the rows it takes.
+ */
+static bool fill_window(PrefetchScanState *state)
+{
+	MemoryContext old_context;
+	PrefetchCache *cache;
+	TupleTableSlot *slot;
+
+	/* the rows of the last window are projected, their results go */
+	MemoryContextReset(state->window_context);
+	state->row_count = state->next_row = 0;
+
+	while (!state->child_done && state->row_count < state->window_rows)
+	{
+		slot = ExecProcNode(state->child);
+		if (TupIsNull(slot))
+			state->child_done = true;
+		else
+			ExecCopySlot(state->rows[state->row_count++], slot);
+	}
+	if (state->row_count == 0)
+		return false;
+	state->window_rows = Min(state->window_rows * 2, state->max_rows);
+
+	old_context = MemoryContextSwitchTo(state->window_context);
+	cache = prefetch_cache_create(state->window_context);
+	for (int call = 0; call < state->call_count; call++)
+		prefetch_calls(state, call, cache);
+	MemoryContextSwitchTo(old_context);
+
+	return true;
+}
+
+static TupleTableSlot *prefetch_next(ScanState *node)
+{
+	PrefetchScanState *state = (PrefetchScanState *)node;
+
+	if (state->next_row == state->row_count && !fill_window(state))
+		return ExecClearTuple(node->ss_ScanTupleSlot);
+
+	return ExecCopySlot(node->ss_ScanTupleSlot,
+						state->rows[state->next_row++]);
+}
+
+static bool prefetch_recheck(ScanState *node, TupleTableSlot *slot)
+{
+	return true;
+}
+
+static TupleTableSlot *exec_prefetch_scan(CustomScanState *node)
+{
+	return ExecScan(&node->ss, (ExecScanAccessMtd)prefetch_next,
+					(ExecScanRecheckMtd)prefetch_recheck);
+}
+
+static void end_prefetch_scan(CustomScanState *node)
+{
+	PrefetchScanState *state = (PrefetchScanState *)node;
+
+	for (int i = 0; i < state->max_rows; i++)
+		ExecDropSingleTupleTableSlot(state->rows[i]);
+	MemoryContextDelete(state->window_context);
+	ExecEndNode(state->child);
+}
+
+static void rescan_prefetch_scan(CustomScanState *node)
+{
+	PrefetchScanState *state = (PrefetchScanState *)node;
+
+	MemoryContextReset(state->window_context);
+	state->row_count = state->next_row = 0;
+	state->window_rows = 1;
+	state->child_done = false;
+
+	if (node->ss.ps.chgParam != NULL)
+		UpdateChangedParamSet(state->child, node->ss.ps.chgParam);
+	if (state->child->chgParam == NULL)
+		ExecReScan(state->child);
+}
+
+static void explain_prefetch_scan(CustomScanState *node, List *ancestors,
+								  ExplainState *es)
+{
+	PrefetchScanState *state = (PrefetchScanState *)node;
+
+	ExplainPropertyInteger("Prefetch Rows", NULL, state->max_rows, es);
+}
+
+void init_prefetch_scan(void)
+{
+	RegisterCustomScanMethods(&prefetch_scan_methods);
+
+	prev_planner_hook = planner_hook;
+	planner_hook = prefetch_planner;
+}
@@ -0,0 +1,14 @@
+#ifndef _PREFETCH_SCAN_H_
+#define _PREFETCH_SCAN_H_
+
+#include "postgres.h"
+
+/*
+ * A custom scan that reads the rows of its child ahead of the projection of
+ * the per-row functions and calls the service for a window of rows at a
+ * time, concurrently. The planner hook puts it where the functions are
+ * projected, the rows still go out one at a time and in order.
+ */
+void init_prefetch_scan(void);
+
+#endif /* _PREFETCH_SCAN_H_ */
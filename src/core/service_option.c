@@ -2,170 +2,211 @@
 
 #include <postgres.h>
 
+#include "ai_config_str.h"
+#include "memory_budget.h"
+
+/*
+ * The names, descriptions and value sizes of the options, in the order of
+ * ServiceOptionId. The options are displayed in this order.
+ */
+static const ServiceOptionDesc option_descs[OPTION_COUNT] = {
+	[OPTION_SERVICE_NAME] = {OPTION_SERVICE_NAME_STR,
+							 OPTION_SERVICE_NAME_DESC, NAMEDATALEN},
+	[OPTION_MODEL_NAME] = {OPTION_MODEL_NAME_STR, OPTION_MODEL_NAME_DESC,
+						   NAMEDATALEN},
+	[OPTION_ENDPOINT_URL] = {OPTION_ENDPOINT_URL_STR,
+							 OPTION_ENDPOINT_URL_DESC, OPTION_VALUE_LEN},
+	[OPTION_SERVICE_API_KEY] = {OPTION_SERVICE_API_KEY_STR,
+								OPTION_SERVICE_API_KEY_DESC,
+								OPTION_VALUE_LEN},
+	[OPTION_COLUMN_VALUE] = {OPTION_COLUMN_VALUE_STR,
+							 OPTION_COLUMN_VALUE_DESC, OPTION_VALUE_LEN},
+	[OPTION_SERVICE_PROMPT] = {OPTION_SERVICE_PROMPT_STR,
+							   OPTION_SERVICE_PROMPT_DESC, OPTION_VALUE_LEN},
+	[OPTION_SERVICE_PROMPT_AGG] = {OPTION_SERVICE_PROMPT_AGG_STR,
+								   OPTION_SERVICE_PROMPT_AGG_DESC,
+								   OPTION_VALUE_LEN},
+	[OPTION_STORE_NAME] = {OPTION_STORE_NAME_STR, OPTION_STORE_NAME_DESC,
+						   NAMEDATALEN},
+	[OPTION_SQL_QUERY] = {OPTION_SQL_QUERY_STR, OPTION_SQL_QUERY_DESC,
+						  OPTION_VALUE_LEN},
+	[OPTION_NL_QUERY] = {OPTION_NL_QUERY_STR, OPTION_NL_QUERY_DESC,
+						 OPTION_VALUE_LEN},
+	[OPTION_NL_NOTES] = {OPTION_NL_NOTES_STR, OPTION_NL_NOTES_DESC,
+						 NAMEDATALEN},
+	[OPTION_RECORD_COUNT] = {OPTION_RECORD_COUNT_STR,
+							 OPTION_RECORD_COUNT_DESC, 16},
+	[OPTION_SIMILARITY_ALGORITHM] = {OPTION_SIMILARITY_ALGORITHM_STR,
+									 OPTION_SIMILARITY_ALGORITHM_DESC,
+									 NAMEDATALEN}};
+
 /*
- * Allocate a new ServiceOption node.
+ * Return the option if it is defined for the service, NULL otherwise.
  */
-static ServiceOption *get_new_node()
+static inline ServiceOption *defined_option(ServiceOption *options,
+											const ServiceOptionId id)
 {
-	return ((ServiceOption *)palloc0(sizeof(ServiceOption)));
+	ServiceOption *option = &options[id];
+
+	return (option->flags & OPTION_FLAG_DEFINED) ? option : NULL;
 }
 
 /*
- * Function to define a service specific option and add it to the list of
- * options at the front.
+ * Function to define a service specific option, the name and description of
+ * the option come from the option table.
  */
-void define_new_option(ServiceOption **option_list, const char *name,
-					   char *description, const uint32_t flags,
-					   char *storage_ptr, const size_t max_storage_size)
+void define_new_option(ServiceOption *options, const ServiceOptionId id,
+					   const uint32_t flags, char *storage_ptr,
+					   const size_t max_storage_size)
 {
-	ServiceOption *header = *option_list;
-	ServiceOption *new_node = get_new_node();
+	ServiceOption *option = &options[id];
 
-	strncpy(new_node->name, name, OPTION_NAME_LEN);
-	strncpy(new_node->description, description, OPTION_VALUE_LEN);
-	new_node->flags = flags;
-	new_node->value_ptr = NULL;
-
-	/* insert the node in the list */
-	*option_list = new_node;
-	if (header)
-	{
-		new_node->next = header;
-		header->prev = new_node;
-	}
+	option->flags = flags | OPTION_FLAG_DEFINED;
+	option->current_len = 0;
 
 	/*
 	 * If a storage ptr is passed reuse the same (optimization to avoid
-	 * duplicate copies) otherwise allocate a new memory.
+	 * duplicate copies) otherwise allocate the size of the option.
 	 */
 	if (storage_ptr)
 	{
-		new_node->value_ptr = storage_ptr;
-		new_node->max_len = max_storage_size;
+		option->value_ptr = storage_ptr;
+		option->max_len = max_storage_size;
 	}
 	else
 	{
-		new_node->value_ptr = palloc0(OPTION_VALUE_LEN);
-		new_node->max_len = OPTION_VALUE_LEN;
+		option->value_ptr = palloc0(option_descs[id].max_len);
+		option->max_len = option_descs[id].max_len;
 	}
 
 	/* initialize for a concat */
-	new_node->value_ptr[0] = '\0';
+	option->value_ptr[0] = '\0';
 }
 
 /*
- * Set the value for a particular option. If value_ptr is NULL, a new memory
- * is allocated and the value is copied to it. Otherwise, the value_ptr is
- * used to store the value. data_size is used to check the max length of the
- * value_ptr.
+ * Set the value for a particular option. The value is copied to the storage
+ * of the option, max_len of the option is checked for the length of the
+ * value. Returns non-zero if the option is not defined for the service.
  */
-int set_option_value(ServiceOption *list, const char *name, const char *value,
-					 bool concat)
+int set_option_value(ServiceOption *options, const ServiceOptionId id,
+					 const char *value, bool concat)
 {
-	ServiceOption *node = list;
-	bool found = false;
+	ServiceOption *option = defined_option(options, id);
+	char what[NAMEDATALEN * 2];
 	size_t len;
 
-	while (node && !found)
+	if (!option)
+		return 1;
+
+	len = strlen(value);
+
+	/* the values accumulated by an aggregate are held up to pg_ai.work_mem */
+	if (concat)
 	{
-		if (!strcmp(name, node->name))
-		{
-			len = strlen(value);
-
-			if ((concat) && (node->current_len + len > node->max_len))
-				ereport(ERROR,
-						(errmsg("Value for option %s is too long", name)));
-
-			if (concat)
-			{
-				strcat(node->value_ptr, " ");
-				strncat(node->value_ptr, value, len);
-				node->current_len += len + 1;
-			}
-			else
-			{
-				strncpy(node->value_ptr, value, len);
-				node->current_len = len;
-			}
-
-			node->flags |= OPTION_FLAG_IS_SET;
-			found = true;
-			break;
-		}
-		node = node->next;
+		snprintf(what, sizeof(what), "Value for option %s",
+				 option_descs[id].name);
+		check_work_mem(option->current_len + len + 2, what);
 	}
 
-	return !found;
+	/* room for the separator and the terminating null */
+	if ((concat ? option->current_len + len + 2 : len + 1) > option->max_len)
+		ereport(ERROR, (errmsg("Value for option %s is too long",
+							   option_descs[id].name)));
+
+	if (concat)
+	{
+		strcat(option->value_ptr, " ");
+		strncat(option->value_ptr, value, len);
+		option->current_len += len + 1;
+	}
+	else
+	{
+		/* a reused option may hold a longer earlier value */
+		memcpy(option->value_ptr, value, len + 1);
+		option->current_len = len;
+	}
+
+	option->flags |= OPTION_FLAG_IS_SET;
+	return 0;
 }
 
 /*
- * Get the value for a particular option, NULL if the option is not found.
+ * Clear the value of a particular option, the option is no longer set.
  */
-char *get_option_value(ServiceOption *list, const char *name)
+void reset_option_value(ServiceOption *options, const ServiceOptionId id)
 {
-	ServiceOption *node = list;
+	ServiceOption *option = defined_option(options, id);
 
-	while (node)
-	{
-		if (!strcmp(name, node->name))
-			return node->value_ptr;
-		node = node->next;
-	}
+	if (!option)
+		return;
 
-	return NULL;
+	option->value_ptr[0] = '\0';
+	option->current_len = 0;
+	option->flags &= ~OPTION_FLAG_IS_SET;
 }
 
 /*
- * Get the length of the value for a particular option, -1 if the option is
- * not found.
+ * Get the value for a particular option, NULL if the option is not defined.
  */
-int get_option_value_length(ServiceOption *list, const char *name)
+char *get_option_value(ServiceOption *options, const ServiceOptionId id)
 {
-	ServiceOption *node = list;
+	ServiceOption *option = defined_option(options, id);
 
-	while (node)
-	{
-		if (!strcmp(name, node->name))
-			return node->current_len;
-		node = node->next;
-	}
+	return option ? option->value_ptr : NULL;
+}
 
-	return -1;
+/*
+ * Get the length of the value for a particular option, -1 if the option is
+ * not defined.
+ */
+int get_option_value_length(ServiceOption *options, const ServiceOptionId id)
+{
+	ServiceOption *option = defined_option(options, id);
+
+	return option ? option->current_len : -1;
 }
 
 /*
  * Get the max length of the value for a particular option, -1 if the option is
- * not found.
+ * not defined.
  */
-int get_option_value_max_length(ServiceOption *list, const char *name)
+int get_option_value_max_length(ServiceOption *options,
+								const ServiceOptionId id)
 {
-	ServiceOption *node = list;
-
-	while (node)
-	{
-		if (!strcmp(name, node->name))
-			return node->max_len;
-		node = node->next;
-	}
+	ServiceOption *option = defined_option(options, id);
 
-	return -1;
+	return option ? option->max_len : -1;
 }
 
 /*
- * Get the option node for a particular option, NULL if the option is not found.
+ * Get a particular option, NULL if the option is not defined.
  */
-ServiceOption *get_option(ServiceOption *list, const char *name)
+ServiceOption *get_option(ServiceOption *options, const ServiceOptionId id)
 {
-	ServiceOption *node = list;
+	return defined_option(options, id);
+}
 
-	while (node)
+/*
+ * Check that all the required options of the service are set. Reports the
+ * first missing option and returns non-zero if one is not set.
+ */
+int check_required_options(ServiceOption *options)
+{
+	for (int id = 0; id < OPTION_COUNT; id++)
 	{
-		if (!strcmp(name, node->name))
-			return node;
-		node = node->next;
+		if ((options[id].flags & OPTION_FLAG_DEFINED) &&
+			(options[id].flags & OPTION_FLAG_REQUIRED) &&
+			!(options[id].flags & OPTION_FLAG_IS_SET))
+		{
+			ereport(INFO,
+					(errmsg("Required %s option \"%s\" missing.\n",
+							options[id].flags & OPTION_FLAG_GUC ? "GUC" :
+																  "function",
+							option_descs[id].name)));
+			return 1;
+		}
 	}
-
-	return NULL;
+	return 0;
 }
 
 /*
@@ -173,32 +214,26 @@ ServiceOption *get_option(ServiceOption *list, const char *name)
  * is true, the value of the option is printed, otherwise the description is
  * printed.
  */
-void print_service_options(ServiceOption *list, bool print_value, char *text,
-						   size_t max_len)
+void print_service_options(ServiceOption *options, bool print_value,
+						   char *text, size_t max_len)
 {
-	ServiceOption *last_node = list;
-	char option_info[OPTION_NAME_LEN + OPTION_VALUE_LEN + 8];
-
-	/* options are added to the front display from last to get the same order */
-	while (last_node && last_node->next)
-		last_node = last_node->next;
+	char option_info[NAMEDATALEN + OPTION_VALUE_LEN + 8];
 
-	while (last_node)
+	for (int id = 0; id < OPTION_COUNT; id++)
 	{
+		if (!(options[id].flags & OPTION_FLAG_DEFINED))
+			continue;
+
 		/* TODO print value by default if DEBUG */
-		if (print_value)
-			sprintf(option_info, "\n%s: %s", last_node->name,
-					last_node->value_ptr);
-		else
-			sprintf(option_info, "\n%s: %s", last_node->name,
-					last_node->description);
+		snprintf(option_info, sizeof(option_info), "\n%s: %s",
+				 option_descs[id].name,
+				 print_value ? options[id].value_ptr :
+							   option_descs[id].description);
 
 		/* print all options in case of console */
 		if (!text)
 			ereport(INFO, (errmsg("%s", option_info)));
-		else if (last_node->flags & OPTION_FLAG_HELP_DISPLAY)
+		else if (options[id].flags & OPTION_FLAG_HELP_DISPLAY)
 			strncat(text, option_info, max_len);
-
-		last_node = last_node->prev;
 	}
 }
@@ -5,36 +5,63 @@
 #include <stddef.h>
 #include <stdint.h>
 
-#define OPTION_NAME_LEN 255
 #define OPTION_VALUE_LEN 1 * 1024
 
 #define OPTION_FLAG_REQUIRED 0x00000001
 #define OPTION_FLAG_IS_SET 0x00000002
 #define OPTION_FLAG_GUC 0x00000004
 #define OPTION_FLAG_HELP_DISPLAY 0x00000008
+#define OPTION_FLAG_DEFINED 0x00000010
 
+/* the options of all the services, index into the options of a service */
+typedef enum ServiceOptionId
+{
+	OPTION_SERVICE_NAME = 0,
+	OPTION_MODEL_NAME,
+	OPTION_ENDPOINT_URL,
+	OPTION_SERVICE_API_KEY,
+	OPTION_COLUMN_VALUE,
+	OPTION_SERVICE_PROMPT,
+	OPTION_SERVICE_PROMPT_AGG,
+	OPTION_STORE_NAME,
+	OPTION_SQL_QUERY,
+	OPTION_NL_QUERY,
+	OPTION_NL_NOTES,
+	OPTION_RECORD_COUNT,
+	OPTION_SIMILARITY_ALGORITHM,
+	OPTION_COUNT
+} ServiceOptionId;
+
+/* the fixed part of an option, same for all the services */
+typedef struct ServiceOptionDesc
+{
+	const char *name;
+	const char *description;
+	size_t max_len; /* of the value if the service gives no storage */
+} ServiceOptionDesc;
+
+/* the value of an option in a service */
 typedef struct ServiceOption
 {
-	char name[OPTION_NAME_LEN];
-	char description[OPTION_VALUE_LEN];
 	uint32_t flags;
 	char *value_ptr;
 	size_t current_len;
 	size_t max_len;
-	struct ServiceOption *next;
-	struct ServiceOption *prev;
 } ServiceOption;
 
-void define_new_option(ServiceOption **option_list, const char *name,
-					   char *description, const uint32_t flags,
-					   char *storage_ptr, const size_t max_storage_size);
-int set_option_value(ServiceOption *list, const char *name, const char *value,
-					 bool concat);
-char *get_option_value(ServiceOption *list, const char *name);
-void print_service_options(ServiceOption *list, bool print_value, char *text,
-						   size_t max_len);
-int get_option_value_length(ServiceOption *list, const char *name);
-int get_option_value_max_length(ServiceOption *list, const char *name);
-ServiceOption *get_option(ServiceOption *list, const char *name);
+void define_new_option(ServiceOption *options, const ServiceOptionId id,
+					   const uint32_t flags, char *storage_ptr,
+					   const size_t max_storage_size);
+int set_option_value(ServiceOption *options, const ServiceOptionId id,
+					 const char *value, bool concat);
+void reset_option_value(ServiceOption *options, const ServiceOptionId id);
+char *get_option_value(ServiceOption *options, const ServiceOptionId id);
+void print_service_options(ServiceOption *options, bool print_value,
+						   char *text, size_t max_len);
+int get_option_value_length(ServiceOption *options, const ServiceOptionId id);
+int get_option_value_max_length(ServiceOption *options,
+								const ServiceOptionId id);
+ServiceOption *get_option(ServiceOption *options, const ServiceOptionId id);
+int check_required_options(ServiceOption *options);
 
 #endif /* _SERVICE_OPTION_H */
@@ -0,0 +1,417 @@
+#include "tokenizer.h"
+
+#include "common/base64.h"
+#include "common/hashfn.h"
+#include "miscadmin.h"
+#include "storage/fd.h"
+#include "utils/memutils.h"
+
+#include "core/ai_config.h"
+#include "core/ai_service.h"
+#include "guc/pg_ai_guc.h"
+
+/* a token of the vocabulary in the open addressing table */
+typedef struct BpeEntry
+{
+	uint32 offset; /* of the token in the bytes of the vocabulary */
+	uint32 rank;
+	uint16 len; /* 0 for an empty slot */
+} BpeEntry;
+
+/* the tokens of a tiktoken file and their merge ranks */
+typedef struct BpeVocabulary
+{
+	char *bytes;
+	BpeEntry *entries;
+	uint32 mask;
+} BpeVocabulary;
+
+static const ModelContext model_contexts[] = {
+	{SERVICE_OPENAI, MODEL_OPENAI_GPT, MODEL_OPENAI_GPT_NAME,
+	 GPT_CONTEXT_TOKENS, GPT_OUTPUT_TOKENS, GPT_CALL_COST, true},
+	{SERVICE_OPENAI, MODEL_OPENAI_EMBEDDINGS, MODEL_OPENAI_EMBEDDINGS_NAME,
+	 EMBEDDINGS_CONTEXT_TOKENS, 0, EMBEDDINGS_CALL_COST, true},
+	{SERVICE_OPENAI, MODEL_OPENAI_MODERATION, MODEL_OPENAI_MODERATION_NAME,
+	 MODERATION_CONTEXT_TOKENS, 0, MODERATION_CALL_COST, true},
+	{SERVICE_OPENAI, MODEL_OPENAI_IMAGE_GEN, MODEL_OPENAI_IMAGE_GEN_NAME,
+	 IMAGE_GEN_CONTEXT_TOKENS, 0, IMAGE_GEN_CALL_COST, true},
+	{SERVICE_GEMINI, MODEL_GEMINI_GENC, MODEL_GEMINI_GENC_NAME,
+	 GENC_CONTEXT_TOKENS, GENC_OUTPUT_TOKENS, GENC_CALL_COST, false},
+	{SERVICE_GEMINI, MODEL_GEMINI_GENC_MOD, MODEL_GEMINI_GENC_MOD_NAME,
+	 GENC_CONTEXT_TOKENS, GENC_OUTPUT_TOKENS, GENC_CALL_COST, false},
+	{SERVICE_GEMINI, MODEL_GEMINI_EMBEDDINGS, MODEL_GEMINI_EMBEDDINGS_NAME,
+	 GEMINI_EMBEDDINGS_CONTEXT_TOKENS, 0, GEMINI_EMBEDDINGS_CALL_COST, false}};
+
+static const ModelContext default_model_context = {
+	0, 0, NULL, GPT_CONTEXT_TOKENS, GPT_OUTPUT_TOKENS, GPT_CALL_COST, true};
+
+/* loaded once per backend, again only if pg_ai.tokenizer_file changes */
+static MemoryContext tokenizer_context = NULL;
+static BpeVocabulary *vocabulary = NULL;
+static char *vocabulary_file = NULL;
+
+const ModelContext *get_model_context(const char *model_name)
+{
+	if (model_name)
+		for (int i = 0; i < lengthof(model_contexts); i++)
+			if (strcmp(model_contexts[i].model_name, model_name) == 0)
+				return &model_contexts[i];
+
+	return &default_model_context;
+}
+
+const ModelContext *get_function_model_context(const int function_flags)
+{
+	size_t service_flags;
+	size_t model_flags;
+
+	if (get_service_model_flags(function_flags, &service_flags, &model_flags))
+		return &default_model_context;
+
+	for (int i = 0; i < lengthof(model_contexts); i++)
+		if (model_contexts[i].service_flags == service_flags &&
+			model_contexts[i].model_flags == model_flags)
+			return &model_contexts[i];
+
+	return &default_model_context;
+}
+
+int64 get_request_token_limit(const ModelContext *model)
+{
+	return model->context_tokens - model->output_tokens;
+}
+
+static int64 lookup_rank(const BpeVocabulary *vocab, const char *token,
+						 const int len)
+{
+	uint32 slot = hash_bytes((const unsigned char *)token, len) & vocab->mask;
+
+	for (;; slot = (slot + 1) & vocab->mask)
+	{
+		BpeEntry *entry = &vocab->entries[slot];
+
+		if (entry->len == 0)
+			return -1;
+		if (entry->len == len &&
+			memcmp(vocab->bytes + entry->offset, token, len) == 0)
+			return entry->rank;
+	}
+}
+
+static void insert_token(BpeVocabulary *vocab, const uint32 offset,
+						 const int len, const uint32 rank)
+{
+	uint32 slot =
+		hash_bytes((const unsigned char *)vocab->bytes + offset, len) &
+		vocab->mask;
+
+	while (vocab->entries[slot].len != 0)
+		slot = (slot + 1) & vocab->mask;
+
+	vocab->entries[slot].offset = offset;
+	vocab->entries[slot].rank = rank;
+	vocab->entries[slot].len = len;
+}
+
+/*
+ * Read a tiktoken file, a line per token with the token in base64 and its
+ * rank. A relative name is looked up in the extension directory.
+ */
+static BpeVocabulary *load_vocabulary(const char *file)
+{
+	char path[MAXPGPATH];
+	char share_path[MAXPGPATH];
+	char buffer[8192];
+	StringInfoData contents;
+	BpeVocabulary *vocab;
+	FILE *fp;
+	size_t read;
+	uint32 used = 0;
+	int lines = 0;
+	char *line;
+	char *end;
+
+	if (is_absolute_path(file))
+		strlcpy(path, file, MAXPGPATH);
+	else
+	{
+		get_share_path(my_exec_path, share_path);
+		snprintf(path, MAXPGPATH, "%s/extension/%s", share_path, file);
+	}
+
+	fp = AllocateFile(path, PG_BINARY_R);
+	if (!fp)
+	{
+		ereport(WARNING,
+				(errcode_for_file_access(),
+				 errmsg("could not open tokenizer file \"%s\": %m", path),
+				 errhint("Token counts are estimated.")));
+		return NULL;
+	}
+
+	initStringInfo(&contents);
+	while ((read = fread(buffer, 1, sizeof(buffer), fp)) > 0)
+		appendBinaryStringInfo(&contents, buffer, read);
+	FreeFile(fp);
+
+	for (int i = 0; i < contents.len; i++)
+		lines += (contents.data[i] == '\n');
+
+	/* the table is at most half full, the decoded tokens fit in the file */
+	vocab = palloc(sizeof(BpeVocabulary));
+	vocab->mask = 1;
+	while (vocab->mask < (uint32)(lines + 1) * 2)
+		vocab->mask <<= 1;
+	vocab->entries = palloc0(sizeof(BpeEntry) * vocab->mask);
+	vocab->mask--;
+	vocab->bytes = palloc(contents.len + 1);
+
+	for (line = contents.data; *line != '\0'; line = end)
+	{
+		char *space = line;
+		int len;
+
+		end = strchr(line, '\n');
+		end = end ? end + 1 : line + strlen(line);
+		while (space < end && *space != ' ')
+			space++;
+		if (space == end)
+			continue;
+
+		len = pg_b64_decode(line, space - line, vocab->bytes + used,
+							contents.len - used);
+		if (len <= 0 || len > PG_UINT16_MAX)
+		{
+			ereport(WARNING,
+					(errmsg("invalid token in tokenizer file \"%s\"", path),
+					 errhint("Token counts are estimated.")));
+			return NULL;
+		}
+
+		insert_token(vocab, used, len, (uint32)strtoul(space + 1, NULL, 10));
+		used += len;
+	}
+
+	pfree(contents.data);
+	return vocab;
+}
+
+/*
+ * The vocabulary of pg_ai.tokenizer_file, NULL if it is not set or it cannot
+ * be read. A file that cannot be read is not tried again till the setting
+ * changes.
+ */
+static BpeVocabulary *get_vocabulary(void)
+{
+	const char *file = get_pg_ai_guc_string_variable(PG_AI_GUC_TOKENIZER_FILE);
+	MemoryContext old_context;
+
+	if (!file || *file == '\0')
+		return NULL;
+	if (vocabulary_file && strcmp(vocabulary_file, file) == 0)
+		return vocabulary;
+
+	if (tokenizer_context)
+		MemoryContextReset(tokenizer_context);
+	else
+		tokenizer_context = AllocSetContextCreate(
+			TopMemoryContext, PG_AI_TOKENIZER_MCTX, ALLOCSET_DEFAULT_SIZES);
+
+	vocabulary = NULL;
+	old_context = MemoryContextSwitchTo(tokenizer_context);
+	vocabulary_file = pstrdup(file);
+	vocabulary = load_vocabulary(file);
+	MemoryContextSwitchTo(old_context);
+
+	return vocabulary;
+}
+
+static inline bool is_letter(const unsigned char c)
+{
+	/* the bytes of the multibyte characters are taken as letters */
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c >= 0x80;
+}
+
+static inline bool is_digit(const unsigned char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+static inline bool is_space(const unsigned char c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' ||
+		   c == '\v';
+}
+
+static inline bool is_newline(const unsigned char c)
+{
+	return c == '\n' || c == '\r';
+}
+
+/*
+ * The end of the pre-tokenized piece at the position, with the rules of the
+ * cl100k_base split pattern in their order: contractions, letters with one
+ * leading symbol or space, up to 3 digits, symbols with one leading space,
+ * and the spaces. The spaces before a word leave their last space to it.
+ */
+static size_t next_piece(const unsigned char *text, const size_t len,
+						 const size_t start)
+{
+	size_t end = start;
+	size_t last_newline;
+
+	if (text[start] == '\'' && start + 1 < len)
+	{
+		unsigned char c1 = pg_ascii_tolower(text[start + 1]);
+		unsigned char c2 =
+			(start + 2 < len) ? pg_ascii_tolower(text[start + 2]) : 0;
+
+		if (c1 == 's' || c1 == 'd' || c1 == 'm' || c1 == 't')
+			return start + 2;
+		if ((c1 == 'l' && c2 == 'l') || (c1 == 'v' && c2 == 'e') ||
+			(c1 == 'r' && c2 == 'e'))
+			return start + 3;
+	}
+
+	if (is_letter(text[start]) ||
+		(!is_newline(text[start]) && !is_digit(text[start]) &&
+		 start + 1 < len && is_letter(text[start + 1])))
+	{
+		for (end = start + 1; end < len && is_letter(text[end]); end++)
+			;
+		return end;
+	}
+
+	if (is_digit(text[start]))
+	{
+		for (end = start + 1;
+			 end < len && end < start + 3 && is_digit(text[end]); end++)
+			;
+		return end;
+	}
+
+	end = (text[start] == ' ') ? start + 1 : start;
+	if (end < len && !is_space(text[end]) && !is_letter(text[end]) &&
+		!is_digit(text[end]))
+	{
+		while (end < len && !is_space(text[end]) && !is_letter(text[end]) &&
+			   !is_digit(text[end]))
+			end++;
+		while (end < len && is_newline(text[end]))
+			end++;
+		return end;
+	}
+
+	/* a run of spaces, up to its last newline if it has one */
+	last_newline = 0;
+	for (end = start; end < len && is_space(text[end]); end++)
+		if (is_newline(text[end]))
+			last_newline = end + 1;
+	if (last_newline)
+		return last_newline;
+	if (end < len && end - start > 1)
+		return end - 1;
+	return end;
+}
+
+/*
+ * The tokens of a piece, merging the pair with the lowest rank till no pair
+ * of the parts is a token.
+ */
+static int64 count_bpe_tokens(const BpeVocabulary *vocab, const char *piece,
+							  const int len)
+{
+	int starts[BPE_MAX_PIECE_SIZE + 1];
+	int parts = len;
+
+	if (lookup_rank(vocab, piece, len) >= 0)
+		return 1;
+
+	for (int i = 0; i <= len; i++)
+		starts[i] = i;
+
+	while (parts > 1)
+	{
+		int64 best_rank = -1;
+		int best = -1;
+
+		for (int i = 0; i + 1 < parts; i++)
+		{
+			int64 rank = lookup_rank(vocab, piece + starts[i],
+									 starts[i + 2] - starts[i]);
+
+			if (rank >= 0 && (best < 0 || rank < best_rank))
+			{
+				best = i;
+				best_rank = rank;
+			}
+		}
+		if (best < 0)
+			break;
+
+		memmove(&starts[best + 1], &starts[best + 2],
+				sizeof(int) * (parts - best - 1));
+		parts--;
+	}
+
+	return parts;
+}
+
+static int64 count_piece_tokens(const BpeVocabulary *vocab, const char *piece,
+								const size_t len)
+{
+	int64 tokens = 0;
+
+	if (!vocab)
+		return (len + ESTIMATE_BYTES_PER_TOKEN - 1) / ESTIMATE_BYTES_PER_TOKEN;
+
+	/* a long piece is merged in parts, its count is an upper bound */
+	for (size_t offset = 0; offset < len; offset += BPE_MAX_PIECE_SIZE)
+		tokens += count_bpe_tokens(vocab, piece + offset,
+								   Min(len - offset, BPE_MAX_PIECE_SIZE));
+	return tokens;
+}
+
+int64 count_tokens(const ModelContext *model, const char *text,
+				   const size_t len)
+{
+	const BpeVocabulary *vocab;
+	int64 tokens = 0;
+	size_t start;
+	size_t end;
+
+	if (!model)
+		model = &default_model_context;
+	vocab = model->bpe ? get_vocabulary() : NULL;
+
+	for (start = 0; start < len; start = end)
+	{
+		end = next_piece((const unsigned char *)text, len, start);
+		tokens += count_piece_tokens(vocab, text + start, end - start);
+	}
+
+	return tokens;
+}
+
+size_t get_token_prefix_length(const ModelContext *model, const char *text,
+							   const size_t len, const int64 max_tokens)
+{
+	const BpeVocabulary *vocab;
+	int64 tokens = 0;
+	size_t start;
+	size_t end;
+
+	if (!model)
+		model = &default_model_context;
+	vocab = model->bpe ? get_vocabulary() : NULL;
+
+	for (start = 0; start < len; start = end)
+	{
+		end = next_piece((const unsigned char *)text, len, start);
+		tokens += count_piece_tokens(vocab, text + start, end - start);
+		if (tokens > max_tokens)
+			break;
+	}
+
+	return start;
+}
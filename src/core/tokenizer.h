@@ -0,0 +1,42 @@
+#ifndef _TOKENIZER_H_
+#define _TOKENIZER_H_
+
+#include "postgres.h"
+
+/*
+ * The context of a model in tokens and the part of it kept for the output.
+ * The OpenAI models count with the BPE vocabulary of pg_ai.tokenizer_file,
+ * the other models and all of them without the file get an estimate.
+ */
+typedef struct ModelContext
+{
+	size_t service_flags;
+	size_t model_flags;
+	const char *model_name;
+	int64 context_tokens;
+	int64 output_tokens;
+	int64 call_cost; /* for the planner, in cpu_operator_cost units */
+	bool bpe;
+} ModelContext;
+
+/* the context of a model, a default for the unknown models and for NULL */
+const ModelContext *get_model_context(const char *model_name);
+
+/* the context of the model the current GUCs use for a function */
+const ModelContext *get_function_model_context(const int function_flags);
+
+/* the tokens a request to the model can take */
+int64 get_request_token_limit(const ModelContext *model);
+
+/* the tokens of a text */
+int64 count_tokens(const ModelContext *model, const char *text,
+				   const size_t len);
+
+/*
+ * The length of the longest prefix of the text within the tokens, it ends
+ * between two pre-tokenized pieces of the text.
+ */
+size_t get_token_prefix_length(const ModelContext *model, const char *text,
+							   const size_t len, const int64 max_tokens);
+
+#endif /* _TOKENIZER_H_ */
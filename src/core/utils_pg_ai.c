@@ -1,6 +1,11 @@
 #include "utils_pg_ai.h"
 
 #include <funcapi.h>
+#include <commands/extension.h>
+#include <common/hashfn.h>
+#include <common/shortest_dec.h>
+#include <utils/lsyscache.h>
+#include <utils/memutils.h>
 
 #include "guc/pg_ai_guc.h"
 
@@ -198,6 +203,68 @@ int is_extension_installed(const char *ext_name)
 	return extension_exists;
 }
 
+/*
+ * Function to qualify the name of a pg_ai object with the schema the extension
+ * was created in. The schema is looked up once per backend, NULL is returned
+ * if the extension is not created in this database.
+ */
+char *make_pg_ai_object_name(const char *object_name)
+{
+	static char *schema_name = NULL;
+	Oid extension_oid;
+	char *name;
+
+	if (!schema_name)
+	{
+		extension_oid = get_extension_oid(PG_AI_EXTENSION_NAME, true);
+		if (!OidIsValid(extension_oid))
+			return NULL;
+
+		name = get_namespace_name(get_extension_schema(extension_oid));
+		if (!name)
+			return NULL;
+
+		schema_name =
+			MemoryContextStrdup(TopMemoryContext, quote_identifier(name));
+	}
+
+	return psprintf("%s.%s", schema_name, quote_identifier(object_name));
+}
+
+/*
+ * Function to get the URL of a service endpoint. With pg_ai.api_url set the
+ * scheme and host of the URL are replaced by it, the path is kept.
+ */
+char *make_service_url(const char *url)
+{
+	const char *api_url = get_pg_ai_guc_string_variable(PG_AI_GUC_API_URL);
+	const char *host = strstr(url, "://");
+	const char *path = host ? strchr(host + 3, '/') : NULL;
+
+	if (!api_url || !api_url[0] || !path)
+		return pstrdup(url);
+	return psprintf("%s%s", api_url, path);
+}
+
+/*
+ * Function to get the schema the extension was created in. The schema is
+ * looked up once per backend, InvalidOid is returned if the extension is not
+ * created in this database.
+ */
+Oid get_pg_ai_schema(void)
+{
+	static Oid schema_oid = InvalidOid;
+	Oid extension_oid;
+
+	if (!OidIsValid(schema_oid))
+	{
+		extension_oid = get_extension_oid(PG_AI_EXTENSION_NAME, true);
+		if (OidIsValid(extension_oid))
+			schema_oid = get_extension_schema(extension_oid);
+	}
+	return schema_oid;
+}
+
 /*
  * Function to generate a primary key column name from the given vector store
  * name.
@@ -209,37 +276,37 @@ void make_pk_col_name(char *name, size_t max_len, const char *vector_store_name)
 
 /*
  * Function to generate a JSON string from the given keys, values and data
- * types.
+ * types, truncated to the buffer of maxlen.
  */
-void generate_json(char *buffer, const char *keys[], const char *values[],
-				   const char *data_types[], size_t num_entries)
+void generate_json(char *buffer, const size_t maxlen, const char *keys[],
+				   const char *values[], const char *data_types[],
+				   size_t num_entries)
 {
 	/* Ensure the buffer is empty */
-	buffer[0] = '\0';
-	strcat(buffer, "{");
+	strlcpy(buffer, "{", maxlen);
 
 	for (size_t i = 0; i < num_entries; i++)
 	{
 		/* Add key */
-		strcat(buffer, "\"");
-		strcat(buffer, keys[i]);
-		strcat(buffer, "\":");
+		strlcat(buffer, "\"", maxlen);
+		strlcat(buffer, keys[i], maxlen);
+		strlcat(buffer, "\":", maxlen);
 
 		/* Check data type and handle accordingly */
 		if (strcmp(data_types[i], "string") == 0)
 		{
-			strcat(buffer, "\"");
-			strcat(buffer, values[i]);
-			strcat(buffer, "\"");
+			strlcat(buffer, "\"", maxlen);
+			strlcat(buffer, values[i], maxlen);
+			strlcat(buffer, "\"", maxlen);
 		}
 		else
-			strcat(buffer, values[i]);
+			strlcat(buffer, values[i], maxlen);
 
 		/* Add comma if not the last entry */
 		if (i < num_entries - 1)
-			strcat(buffer, ",");
+			strlcat(buffer, ",", maxlen);
 	}
-	strcat(buffer, "}");
+	strlcat(buffer, "}", maxlen);
 }
 
 /*
@@ -265,6 +332,127 @@ void remove_new_lines(char *stream)
 	*q = '\0';
 }
 
+/*
+ * Function to normalize a text before it is used as a cache key. The text is
+ * lower cased, runs of white space are collapsed to a single space and the
+ * leading and trailing spaces are removed. Returns a palloc'd string.
+ */
+char *normalize_text(const char *text)
+{
+	char *normalized = palloc(strlen(text) + 1);
+	const char *p = text;
+	char *q = normalized;
+	bool in_space = true; /* drops the leading white space */
+
+	while (*p != '\0')
+	{
+		if (isspace((unsigned char)*p))
+		{
+			if (!in_space)
+				*q++ = ' ';
+			in_space = true;
+		}
+		else
+		{
+			*q++ = pg_tolower((unsigned char)*p);
+			in_space = false;
+		}
+		p++;
+	}
+
+	/* drop the trailing space */
+	if (q > normalized && *(q - 1) == ' ')
+		q--;
+	*q = '\0';
+	return normalized;
+}
+
+/*
+ * Function to make a 128 bit fingerprint out of the given strings. The
+ * terminating null of every part is hashed too, so that the parts ("ab", "c")
+ * and ("a", "bc") do not end up with the same fingerprint.
+ */
+void make_fingerprint(PgAiFingerprint *fingerprint, const char *parts[],
+					  const size_t num_parts)
+{
+	fingerprint->hash_1 = FINGERPRINT_SEED_1;
+	fingerprint->hash_2 = FINGERPRINT_SEED_2;
+
+	for (size_t i = 0; i < num_parts; i++)
+	{
+		const char *part = parts[i] ? parts[i] : "";
+		int len = strlen(part) + 1;
+
+		fingerprint->hash_1 = hash_bytes_extended((const unsigned char *)part,
+												  len, fingerprint->hash_1);
+		fingerprint->hash_2 = hash_bytes_extended((const unsigned char *)part,
+												  len, fingerprint->hash_2);
+	}
+}
+
+/*
+ * Parse the vector text "[0.1,-0.2,...]" returned by the service into floats.
+ * Returns the number of dimensions, 0 if the text is not a valid vector.
+ */
+int parse_vector_text(const char *vector_text, float4 *vector,
+							 const int max_dimensions)
+{
+	const char *p = vector_text;
+	char *end;
+	int dimensions = 0;
+
+	if (*p++ != '[')
+		return 0;
+
+	while (*p != ']' && *p != '\0')
+	{
+		if (dimensions == max_dimensions)
+			return 0;
+
+		vector[dimensions++] = strtof(p, &end);
+		if (end == p)
+			return 0;
+
+		p = end;
+		if (*p == ',')
+			p++;
+	}
+
+	return (*p == ']') ? dimensions : 0;
+}
+
+/*
+ * Make the vector text in the pgvector input format from the floats. The
+ * shortest exact representation is used so that the vector is not altered
+ * by a round trip through the cache.
+ */
+bool format_vector_text(const float4 *vector, const int dimensions,
+							   char *vector_text, const size_t max_len)
+{
+	char number[FLOAT_SHORTEST_DECIMAL_LEN];
+	size_t len = 0;
+	int number_len;
+
+	vector_text[len++] = '[';
+	for (int i = 0; i < dimensions; i++)
+	{
+		number_len = float_to_shortest_decimal_bufn(vector[i], number);
+
+		/* room for the separator, the closing bracket and the terminator */
+		if (len + number_len + 3 > max_len)
+			return false;
+
+		if (i > 0)
+			vector_text[len++] = ',';
+		memcpy(vector_text + len, number, number_len);
+		len += number_len;
+	}
+	vector_text[len++] = ']';
+	vector_text[len] = '\0';
+
+	return true;
+}
+
 /*
  * wrapper to execute the query using SPI
  */
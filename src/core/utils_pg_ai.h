@@ -7,21 +7,41 @@
 
 #include "ai_service.h"
 
+/* 128 bit hash identifying a request, used as key by the caches */
+typedef struct PgAiFingerprint
+{
+	uint64 hash_1;
+	uint64 hash_2;
+} PgAiFingerprint;
+
 /* input/ooput text manipulation helpers */
 int escape_encode(const char *src, const size_t src_len, char *dst,
 				  const size_t max_dst_len);
 int get_word_count(const char *text, const size_t max_allowed,
 				   size_t *actual_count);
 void remove_new_lines(char *stream);
+char *normalize_text(const char *text);
+void make_fingerprint(PgAiFingerprint *fingerprint, const char *parts[],
+					  const size_t num_parts);
+
+/* vector text in the pgvector input format to/from floats */
+int parse_vector_text(const char *vector_text, float4 *vector,
+					  const int max_dimensions);
+bool format_vector_text(const float4 *vector, const int dimensions,
+						char *vector_text, const size_t max_len);
 
 /* generic helper functions */
 int is_extension_installed(const char *extension_name);
+char *make_pg_ai_object_name(const char *object_name);
+char *make_service_url(const char *url);
+Oid get_pg_ai_schema(void);
 void make_pk_col_name(char *name, size_t max_len,
 					  const char *vector_store_name);
 
 /* JSON generation helpers */
-void generate_json(char *buffer, const char *keys[], const char *values[],
-				   const char *data_types[], size_t num_entries);
+void generate_json(char *buffer, const size_t maxlen, const char *keys[],
+				   const char *values[], const char *data_types[],
+				   size_t num_entries);
 
 /* tuple manipulation helpers */
 TupleDesc remove_columns(TupleDesc tupdesc, char **column_names,
@@ -3,22 +3,40 @@
 #include "postgres.h"
 #include "utils/guc.h"
 
+#include "core/ai_config.h"
+
 /* GUCs that accept a strings values */
 typedef struct PgAiStringGUCs
 {
 	char *name;
 	char *description;
+	GucContext context;
 } PgAiStringGUCs;
 
-/* for new str GUCs, add entries to this and the values array */
-PgAiStringGUCs pg_ai_str_gucs[] = {
-	{PG_AI_GUC_API_KEY, PG_AI_GUC_API_KEY_DESCRIPTION},
-	{PG_AI_GUC_MODEL, PG_AI_GUC_MODEL_DESCRIPTION},
-	{PG_AI_GUC_SERVICE, PG_AI_GUC_SERVICE_DESCRIPTION},
-	{PG_AI_GUC_VEC_SIMILARITY_ALGO, PG_AI_GUC_VEC_SIMILARITY_ALGO_DESC}};
+/* for new str GUCs, add an entry to PgAiStringGuc, this and the values array */
+static const PgAiStringGUCs pg_ai_str_gucs[PG_AI_STRING_GUC_COUNT] = {
+	[PG_AI_GUC_API_KEY] = {PG_AI_GUC_API_KEY_NAME,
+						   PG_AI_GUC_API_KEY_DESCRIPTION, PGC_USERSET},
+	[PG_AI_GUC_MODEL] = {PG_AI_GUC_MODEL_NAME, PG_AI_GUC_MODEL_DESCRIPTION,
+						 PGC_USERSET},
+	[PG_AI_GUC_SERVICE] = {PG_AI_GUC_SERVICE_NAME,
+						   PG_AI_GUC_SERVICE_DESCRIPTION, PGC_USERSET},
+	[PG_AI_GUC_VEC_SIMILARITY_ALGO] = {PG_AI_GUC_VEC_SIMILARITY_ALGO_NAME,
+									   PG_AI_GUC_VEC_SIMILARITY_ALGO_DESC,
+									   PGC_USERSET},
+	[PG_AI_GUC_TRAFFIC_CLASS] = {PG_AI_GUC_TRAFFIC_CLASS_NAME,
+								 PG_AI_GUC_TRAFFIC_CLASS_DESC, PGC_USERSET},
+	/* the file is read by the server, only a superuser can choose it */
+	[PG_AI_GUC_TOKENIZER_FILE] = {PG_AI_GUC_TOKENIZER_FILE_NAME,
+								  PG_AI_GUC_TOKENIZER_FILE_DESC, PGC_SUSET},
+	[PG_AI_GUC_BATCH_API_URL] = {PG_AI_GUC_BATCH_API_URL_NAME,
+								 PG_AI_GUC_BATCH_API_URL_DESC, PGC_USERSET},
+	/* the requests carry the API key, only a superuser can send them away */
+	[PG_AI_GUC_API_URL] = {PG_AI_GUC_API_URL_NAME, PG_AI_GUC_API_URL_DESC,
+						   PGC_SUSET}};
 
-/* the values array should be in sync with the above definition array */
-static char *pg_ai_str_guc_values[] = {NULL, NULL, NULL, NULL};
+/* the values, indexed the same as the definitions */
+static char *pg_ai_str_guc_values[PG_AI_STRING_GUC_COUNT];
 
 /* GUCs that accept a integer values */
 typedef struct PgAiIntGUCs
@@ -27,32 +45,144 @@ typedef struct PgAiIntGUCs
 	char *description;
 	int min_value;
 	int max_value;
+	GucContext context;
 } PgAiIntGUCs;
 
-/* for new int GUCs, add entries to this and the values array */
-PgAiIntGUCs pg_ai_int_gucs[] = {
-	{PG_AI_GUC_WORK_MEM_SIZE, PG_AI_GUC_WORK_MEM_SIZE_DESCRIPTION,
-	 PG_AI_GUC_MINIMUM_WORK_MEM_KB, PG_AI_GUC_MAXIMUM_WORK_MEM_KB},
-	{PG_AI_GUC_DEBUG_LEVEL, PG_AI_GUC_DEBUG_LEVEL_DESCRIPTION,
-	 PG_AI_GUC_MINIMUM_DEBUG_LEVEL, PG_AI_GUC_MAXIMUM_DEBUG_LEVEL}};
+/* for new int GUCs, add an entry to PgAiIntGuc, this and the values array */
+static const PgAiIntGUCs pg_ai_int_gucs[PG_AI_INT_GUC_COUNT] = {
+	[PG_AI_GUC_WORK_MEM_SIZE] = {PG_AI_GUC_WORK_MEM_SIZE_NAME,
+								 PG_AI_GUC_WORK_MEM_SIZE_DESCRIPTION,
+								 PG_AI_GUC_MINIMUM_WORK_MEM_KB,
+								 PG_AI_GUC_MAXIMUM_WORK_MEM_KB, PGC_USERSET},
+	[PG_AI_GUC_DEBUG_LEVEL] = {PG_AI_GUC_DEBUG_LEVEL_NAME,
+							   PG_AI_GUC_DEBUG_LEVEL_DESCRIPTION,
+							   PG_AI_GUC_MINIMUM_DEBUG_LEVEL,
+							   PG_AI_GUC_MAXIMUM_DEBUG_LEVEL, PGC_USERSET},
+	[PG_AI_GUC_QUERY_CACHE_SIZE] = {PG_AI_GUC_QUERY_CACHE_SIZE_NAME,
+									PG_AI_GUC_QUERY_CACHE_SIZE_DESCRIPTION,
+									PG_AI_GUC_MINIMUM_QUERY_CACHE_SIZE,
+									PG_AI_GUC_MAXIMUM_QUERY_CACHE_SIZE,
+									PGC_POSTMASTER},
+	[PG_AI_GUC_SINGLE_FLIGHT_SLOTS] = {
+		PG_AI_GUC_SINGLE_FLIGHT_SLOTS_NAME,
+		PG_AI_GUC_SINGLE_FLIGHT_SLOTS_DESCRIPTION,
+		PG_AI_GUC_MINIMUM_SINGLE_FLIGHT_SLOTS,
+		PG_AI_GUC_MAXIMUM_SINGLE_FLIGHT_SLOTS, PGC_POSTMASTER},
+	[PG_AI_GUC_EMBED_BATCH_SLOTS] = {PG_AI_GUC_EMBED_BATCH_SLOTS_NAME,
+									 PG_AI_GUC_EMBED_BATCH_SLOTS_DESCRIPTION,
+									 PG_AI_GUC_MINIMUM_EMBED_BATCH_SLOTS,
+									 PG_AI_GUC_MAXIMUM_EMBED_BATCH_SLOTS,
+									 PGC_POSTMASTER},
+	[PG_AI_GUC_EMBED_BATCH_WAIT] = {PG_AI_GUC_EMBED_BATCH_WAIT_NAME,
+									PG_AI_GUC_EMBED_BATCH_WAIT_DESCRIPTION,
+									PG_AI_GUC_MINIMUM_EMBED_BATCH_WAIT,
+									PG_AI_GUC_MAXIMUM_EMBED_BATCH_WAIT,
+									PGC_USERSET},
+	[PG_AI_GUC_EMBED_BATCH_SIZE] = {PG_AI_GUC_EMBED_BATCH_SIZE_NAME,
+									PG_AI_GUC_EMBED_BATCH_SIZE_DESCRIPTION,
+									PG_AI_GUC_MINIMUM_EMBED_BATCH_SIZE,
+									PG_AI_GUC_MAXIMUM_EMBED_BATCH_SIZE,
+									PGC_USERSET},
+	[PG_AI_GUC_MAX_CONCURRENCY] = {PG_AI_GUC_MAX_CONCURRENCY_NAME,
+								   PG_AI_GUC_MAX_CONCURRENCY_DESCRIPTION,
+								   PG_AI_GUC_MINIMUM_MAX_CONCURRENCY,
+								   PG_AI_GUC_MAXIMUM_MAX_CONCURRENCY,
+								   PGC_SIGHUP},
+	[PG_AI_GUC_RESULT_CACHE_TTL] = {PG_AI_GUC_RESULT_CACHE_TTL_NAME,
+									PG_AI_GUC_RESULT_CACHE_TTL_DESCRIPTION,
+									PG_AI_GUC_MINIMUM_RESULT_CACHE_TTL,
+									PG_AI_GUC_MAXIMUM_RESULT_CACHE_TTL,
+									PGC_USERSET},
+	[PG_AI_GUC_RESULT_CACHE_MAX_ROWS] = {
+		PG_AI_GUC_RESULT_CACHE_MAX_ROWS_NAME,
+		PG_AI_GUC_RESULT_CACHE_MAX_ROWS_DESCRIPTION,
+		PG_AI_GUC_MINIMUM_RESULT_CACHE_MAX_ROWS,
+		PG_AI_GUC_MAXIMUM_RESULT_CACHE_MAX_ROWS, PGC_USERSET},
+	[PG_AI_GUC_AGG_CONCURRENCY] = {PG_AI_GUC_AGG_CONCURRENCY_NAME,
+								   PG_AI_GUC_AGG_CONCURRENCY_DESCRIPTION,
+								   PG_AI_GUC_MINIMUM_AGG_CONCURRENCY,
+								   PG_AI_GUC_MAXIMUM_AGG_CONCURRENCY,
+								   PGC_USERSET},
+	[PG_AI_GUC_AGG_SAMPLE_TOKENS] = {PG_AI_GUC_AGG_SAMPLE_TOKENS_NAME,
+									 PG_AI_GUC_AGG_SAMPLE_TOKENS_DESCRIPTION,
+									 PG_AI_GUC_MINIMUM_AGG_SAMPLE_TOKENS,
+									 PG_AI_GUC_MAXIMUM_AGG_SAMPLE_TOKENS,
+									 PGC_USERSET},
+	[PG_AI_GUC_BATCH_CONCURRENCY] = {PG_AI_GUC_BATCH_CONCURRENCY_NAME,
+									 PG_AI_GUC_BATCH_CONCURRENCY_DESCRIPTION,
+									 PG_AI_GUC_MINIMUM_BATCH_CONCURRENCY,
+									 PG_AI_GUC_MAXIMUM_BATCH_CONCURRENCY,
+									 PGC_USERSET},
+	[PG_AI_GUC_PREFETCH_ROWS] = {PG_AI_GUC_PREFETCH_ROWS_NAME,
+								 PG_AI_GUC_PREFETCH_ROWS_DESCRIPTION,
+								 PG_AI_GUC_MINIMUM_PREFETCH_ROWS,
+								 PG_AI_GUC_MAXIMUM_PREFETCH_ROWS, PGC_USERSET},
+	[PG_AI_GUC_JOB_WORKERS] = {PG_AI_GUC_JOB_WORKERS_NAME,
+							   PG_AI_GUC_JOB_WORKERS_DESCRIPTION,
+							   PG_AI_GUC_MINIMUM_JOB_WORKERS,
+							   PG_AI_GUC_MAXIMUM_JOB_WORKERS, PGC_SIGHUP}};
+
+/* the values with the default/boot value, indexed same as the definitions */
+static int pg_ai_int_guc_values[PG_AI_INT_GUC_COUNT] = {
+	[PG_AI_GUC_WORK_MEM_SIZE] = PG_AI_GUC_DEFAULT_WORK_MEM_KB,
+	[PG_AI_GUC_DEBUG_LEVEL] = PG_AI_GUC_DEFAULT_DEBUG_LEVEL,
+	[PG_AI_GUC_QUERY_CACHE_SIZE] = PG_AI_GUC_DEFAULT_QUERY_CACHE_SIZE,
+	[PG_AI_GUC_SINGLE_FLIGHT_SLOTS] = PG_AI_GUC_DEFAULT_SINGLE_FLIGHT_SLOTS,
+	[PG_AI_GUC_EMBED_BATCH_SLOTS] = PG_AI_GUC_DEFAULT_EMBED_BATCH_SLOTS,
+	[PG_AI_GUC_EMBED_BATCH_WAIT] = PG_AI_GUC_DEFAULT_EMBED_BATCH_WAIT,
+	[PG_AI_GUC_EMBED_BATCH_SIZE] = PG_AI_GUC_DEFAULT_EMBED_BATCH_SIZE,
+	[PG_AI_GUC_MAX_CONCURRENCY] = PG_AI_GUC_DEFAULT_MAX_CONCURRENCY,
+	[PG_AI_GUC_RESULT_CACHE_TTL] = PG_AI_GUC_DEFAULT_RESULT_CACHE_TTL,
+	[PG_AI_GUC_RESULT_CACHE_MAX_ROWS] =
+		PG_AI_GUC_DEFAULT_RESULT_CACHE_MAX_ROWS,
+	[PG_AI_GUC_AGG_CONCURRENCY] = PG_AI_GUC_DEFAULT_AGG_CONCURRENCY,
+	[PG_AI_GUC_AGG_SAMPLE_TOKENS] = PG_AI_GUC_DEFAULT_AGG_SAMPLE_TOKENS,
+	[PG_AI_GUC_BATCH_CONCURRENCY] = PG_AI_GUC_DEFAULT_BATCH_CONCURRENCY,
+	[PG_AI_GUC_PREFETCH_ROWS] = PG_AI_GUC_DEFAULT_PREFETCH_ROWS,
+	[PG_AI_GUC_JOB_WORKERS] = PG_AI_GUC_DEFAULT_JOB_WORKERS};
+
+/* GUCs that accept a real values */
+typedef struct PgAiRealGUCs
+{
+	char *name;
+	char *description;
+	double min_value;
+	double max_value;
+	GucContext context;
+} PgAiRealGUCs;
 
-/* set the default/boot value */
-static int pg_ai_work_mem = PG_AI_GUC_DEFAULT_WORK_MEM_KB;
-static int pg_ai_debug_level = PG_AI_GUC_DEFAULT_DEBUG_LEVEL;
+/* for new real GUCs, add an entry to PgAiRealGuc, this and the values array */
+static const PgAiRealGUCs pg_ai_real_gucs[PG_AI_REAL_GUC_COUNT] = {
+	[PG_AI_GUC_SEMANTIC_CACHE_THRESHOLD] = {
+		PG_AI_GUC_SEMANTIC_CACHE_THRESHOLD_NAME,
+		PG_AI_GUC_SEMANTIC_CACHE_THRESHOLD_DESCRIPTION,
+		PG_AI_GUC_MINIMUM_SEMANTIC_CACHE_THRESHOLD,
+		PG_AI_GUC_MAXIMUM_SEMANTIC_CACHE_THRESHOLD, PGC_USERSET},
+	[PG_AI_GUC_LATENCY_SPIKE_FACTOR] = {
+		PG_AI_GUC_LATENCY_SPIKE_FACTOR_NAME,
+		PG_AI_GUC_LATENCY_SPIKE_FACTOR_DESCRIPTION,
+		PG_AI_GUC_MINIMUM_LATENCY_SPIKE_FACTOR,
+		PG_AI_GUC_MAXIMUM_LATENCY_SPIKE_FACTOR, PGC_SIGHUP},
+	[PG_AI_GUC_INTERACTIVE_RESERVE] = {
+		PG_AI_GUC_INTERACTIVE_RESERVE_NAME,
+		PG_AI_GUC_INTERACTIVE_RESERVE_DESCRIPTION,
+		PG_AI_GUC_MINIMUM_INTERACTIVE_RESERVE,
+		PG_AI_GUC_MAXIMUM_INTERACTIVE_RESERVE, PGC_SIGHUP}};
 
-/* the values array should be in sync with the above definition array */
-static int *pg_ai_int_guc_values[] = {&pg_ai_work_mem, &pg_ai_debug_level};
+/* the values with the default/boot value, indexed same as the definitions */
+static double pg_ai_real_guc_values[PG_AI_REAL_GUC_COUNT] = {
+	[PG_AI_GUC_SEMANTIC_CACHE_THRESHOLD] =
+		PG_AI_GUC_DEFAULT_SEMANTIC_CACHE_THRESHOLD,
+	[PG_AI_GUC_LATENCY_SPIKE_FACTOR] = PG_AI_GUC_DEFAULT_LATENCY_SPIKE_FACTOR,
+	[PG_AI_GUC_INTERACTIVE_RESERVE] = PG_AI_GUC_DEFAULT_INTERACTIVE_RESERVE};
 
 /*
  * Define the GUCs for the AI services.
  */
 void define_pg_ai_guc_variables()
 {
-	int count;
-
 	/* Define the string GUCs */
-	count = sizeof(pg_ai_str_gucs) / sizeof(pg_ai_str_gucs[0]);
-	for (int i = 0; i < count; i++)
+	for (int i = 0; i < PG_AI_STRING_GUC_COUNT; i++)
 	{
 		DefineCustomStringVariable(
 			pg_ai_str_gucs[i].name,		   /* name */
@@ -60,7 +190,7 @@ void define_pg_ai_guc_variables()
 			pg_ai_str_gucs[i].description, /* long desc */
 			&pg_ai_str_guc_values[i],	   /* char** value */
 			NULL,						   /* boot/default value */
-			PGC_USERSET,				   /* context */
+			pg_ai_str_gucs[i].context,	   /* context */
 			0,							   /* flags */
 			NULL,						   /* check_hook */
 			NULL,						   /* assign_hook */
@@ -69,49 +199,137 @@ void define_pg_ai_guc_variables()
 	}
 
 	/* Define the integer GUCs */
-	count = sizeof(pg_ai_int_gucs) / sizeof(pg_ai_int_gucs[0]);
-	for (int i = 0; i < count; i++)
+	for (int i = 0; i < PG_AI_INT_GUC_COUNT; i++)
 	{
 		DefineCustomIntVariable(
 			pg_ai_int_gucs[i].name,		   /* name */
 			pg_ai_int_gucs[i].description, /* short desc */
 			pg_ai_int_gucs[i].description, /* long desc */
-			pg_ai_int_guc_values[i],	   /* int* for value */
-			*pg_ai_int_guc_values[i],	   /* boot/default value */
+			&pg_ai_int_guc_values[i],	   /* int* for value */
+			pg_ai_int_guc_values[i],	   /* boot/default value */
 			pg_ai_int_gucs[i].min_value, pg_ai_int_gucs[i].max_value,
-			PGC_USERSET, /* context */
-			0,			 /* flags */
-			NULL,		 /* check_hook */
-			NULL,		 /* assign_hook */
-			NULL		 /* show_hook */
+			pg_ai_int_gucs[i].context, /* context */
+			0,						   /* flags */
+			NULL,					   /* check_hook */
+			NULL,					   /* assign_hook */
+			NULL					   /* show_hook */
+		);
+	}
+
+	/* Define the real GUCs */
+	for (int i = 0; i < PG_AI_REAL_GUC_COUNT; i++)
+	{
+		DefineCustomRealVariable(
+			pg_ai_real_gucs[i].name,		/* name */
+			pg_ai_real_gucs[i].description, /* short desc */
+			pg_ai_real_gucs[i].description, /* long desc */
+			&pg_ai_real_guc_values[i],		/* double* for value */
+			pg_ai_real_guc_values[i],		/* boot/default value */
+			pg_ai_real_gucs[i].min_value, pg_ai_real_gucs[i].max_value,
+			pg_ai_real_gucs[i].context, /* context */
+			0,							/* flags */
+			NULL,						/* check_hook */
+			NULL,						/* assign_hook */
+			NULL						/* show_hook */
 		);
 	}
 }
 
 /*
- * Rreturn the value of a given string GUC.
+ * Return the value of a given string GUC.
  */
-char *get_pg_ai_guc_string_variable(char *name)
+char *get_pg_ai_guc_string_variable(const PgAiStringGuc guc)
 {
-	int count;
+	return pg_ai_str_guc_values[guc];
+}
+
+/*
+ * Return the value of a given integer GUC.
+ */
+int *get_pg_ai_guc_int_variable(const PgAiIntGuc guc)
+{
+	return &pg_ai_int_guc_values[guc];
+}
+
+/*
+ * Return the value of a given real GUC.
+ */
+double *get_pg_ai_guc_real_variable(const PgAiRealGuc guc)
+{
+	return &pg_ai_real_guc_values[guc];
+}
+
+/*
+ * The names of the GUCs a background job takes from the submitting session.
+ * The API key stays out of the job table, the worker has the key of its
+ * role or database.
+ */
+static int get_job_setting_names(const char **names)
+{
+	int count = 0;
+
+	for (int i = 0; i < PG_AI_STRING_GUC_COUNT; i++)
+		if (i != PG_AI_GUC_API_KEY && pg_ai_str_gucs[i].context == PGC_USERSET)
+			names[count++] = pg_ai_str_gucs[i].name;
+	for (int i = 0; i < PG_AI_INT_GUC_COUNT; i++)
+		if (pg_ai_int_gucs[i].context == PGC_USERSET)
+			names[count++] = pg_ai_int_gucs[i].name;
+	for (int i = 0; i < PG_AI_REAL_GUC_COUNT; i++)
+		if (pg_ai_real_gucs[i].context == PGC_USERSET)
+			names[count++] = pg_ai_real_gucs[i].name;
+
+	return count;
+}
+
+/*
+ * Return the job settings of the session, the unset strings are left out.
+ */
+int get_pg_ai_job_settings(const char **names, char **values)
+{
+	const char *setting_names[PG_AI_GUC_COUNT];
+	int setting_count = get_job_setting_names(setting_names);
+	int count = 0;
+	const char *value;
+
+	for (int i = 0; i < setting_count; i++)
+	{
+		value = GetConfigOption(setting_names[i], true, false);
+		if (!value || value[0] == '\0')
+			continue;
+		names[count] = setting_names[i];
+		values[count++] = pstrdup(value);
+	}
+
+	return count;
+}
+
+/*
+ * Reset the job settings to the defaults of the worker, before the settings
+ * of the next job are set.
+ */
+void reset_pg_ai_job_settings(void)
+{
+	const char *names[PG_AI_GUC_COUNT];
+	int count = get_job_setting_names(names);
 
-	count = sizeof(pg_ai_str_gucs) / sizeof(pg_ai_str_gucs[0]);
 	for (int i = 0; i < count; i++)
-		if (strcmp(pg_ai_str_gucs[i].name, name) == 0)
-			return pg_ai_str_guc_values[i];
-	return NULL;
+		SetConfigOption(names[i], NULL, PGC_USERSET, PGC_S_SESSION);
 }
 
 /*
- * Rreturn the value of a given integer GUC.
+ * Set one of the job settings, false for a name that is not one of them.
  */
-int *get_pg_ai_guc_int_variable(char *name)
+bool set_pg_ai_job_setting(const char *name, const char *value)
 {
-	int count;
+	const char *names[PG_AI_GUC_COUNT];
+	int count = get_job_setting_names(names);
 
-	count = sizeof(pg_ai_int_gucs) / sizeof(pg_ai_int_gucs[0]);
 	for (int i = 0; i < count; i++)
-		if (strcmp(pg_ai_int_gucs[i].name, name) == 0)
-			return pg_ai_int_guc_values[i];
-	return NULL;
+		if (strcmp(names[i], name) == 0)
+		{
+			SetConfigOption(name, value, PGC_USERSET, PGC_S_SESSION);
+			return true;
+		}
+
+	return false;
 }
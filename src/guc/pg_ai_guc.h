@@ -1,38 +1,229 @@
 #ifndef _PG_AI_GUC_H
 #define _PG_AI_GUC_H
 
+#include "postgres.h"
+
 /* ------8< string gucs ----------------------- */
-#define PG_AI_GUC_API_KEY "pg_ai.api_key"
+#define PG_AI_GUC_API_KEY_NAME "pg_ai.api_key"
 #define PG_AI_GUC_API_KEY_DESCRIPTION "AI Service API key"
 
-#define PG_AI_GUC_SERVICE "pg_ai.service"
+#define PG_AI_GUC_SERVICE_NAME "pg_ai.service"
 #define PG_AI_GUC_SERVICE_DESCRIPTION "AI Service"
 
-#define PG_AI_GUC_MODEL "pg_ai.model"
+#define PG_AI_GUC_MODEL_NAME "pg_ai.model"
 #define PG_AI_GUC_MODEL_DESCRIPTION "AI model"
 
-#define PG_AI_GUC_VEC_SIMILARITY_ALGO "pg_ai.similarity_algorithm"
+#define PG_AI_GUC_VEC_SIMILARITY_ALGO_NAME "pg_ai.similarity_algorithm"
 #define PG_AI_GUC_VEC_SIMILARITY_ALGO_DESC "Vector similarity algorithm"
+
+#define PG_AI_GUC_TRAFFIC_CLASS_NAME "pg_ai.traffic_class"
+#define PG_AI_GUC_TRAFFIC_CLASS_DESC                                           \
+	"Traffic class of the requests: interactive or batch, unset for the "     \
+	"default of the function"
+
+#define PG_AI_GUC_TOKENIZER_FILE_NAME "pg_ai.tokenizer_file"
+#define PG_AI_GUC_TOKENIZER_FILE_DESC                                          \
+	"tiktoken BPE vocabulary file, relative to the extension directory, "     \
+	"unset to estimate the tokens"
+
+#define PG_AI_GUC_BATCH_API_URL_NAME "pg_ai.batch_api_url"
+#define PG_AI_GUC_BATCH_API_URL_DESC                                           \
+	"Base URL of the files and batches endpoints of the provider batch API, "  \
+	"unset for the OpenAI API"
+
+#define PG_AI_GUC_API_URL_NAME "pg_ai.api_url"
+#define PG_AI_GUC_API_URL_DESC                                                 \
+	"Scheme and host the requests to the services are sent to, the paths "    \
+	"kept, unset for the hosts of the services"
 /* ------ string gucs >8----------------------- */
 
 /* ------8< integer gucs ----------------------- */
-#define PG_AI_GUC_WORK_MEM_SIZE "pg_ai.work_mem"
+#define PG_AI_GUC_WORK_MEM_SIZE_NAME "pg_ai.work_mem"
 #define PG_AI_GUC_WORK_MEM_SIZE_DESCRIPTION                                    \
-	"Max memory that can be used by pg_ai in KB"
-#define PG_AI_GUC_MINIMUM_WORK_MEM_KB 1024
+	"Max memory kept by pg_ai for a session and used by a call in KB"
+#define PG_AI_GUC_MINIMUM_WORK_MEM_KB 64
 #define PG_AI_GUC_DEFAULT_WORK_MEM_KB (8 * 1024)
 #define PG_AI_GUC_MAXIMUM_WORK_MEM_KB (1024 * 1024)
 
-#define PG_AI_GUC_DEBUG_LEVEL "pg_ai.debug_level"
+#define PG_AI_GUC_DEBUG_LEVEL_NAME "pg_ai.debug_level"
 #define PG_AI_GUC_DEBUG_LEVEL_DESCRIPTION                                      \
 	"Debug level for pg_ai. 0: No debug, 1: Info, 2: Debug, 3: Trace"
 #define PG_AI_GUC_MINIMUM_DEBUG_LEVEL 0
 #define PG_AI_GUC_DEFAULT_DEBUG_LEVEL 1
 #define PG_AI_GUC_MAXIMUM_DEBUG_LEVEL 3
+
+#define PG_AI_GUC_QUERY_CACHE_SIZE_NAME "pg_ai.query_cache_size"
+#define PG_AI_GUC_QUERY_CACHE_SIZE_DESCRIPTION                                 \
+	"Max number of query embeddings cached in shared memory, 0 to disable"
+#define PG_AI_GUC_MINIMUM_QUERY_CACHE_SIZE 0
+#define PG_AI_GUC_DEFAULT_QUERY_CACHE_SIZE 256
+#define PG_AI_GUC_MAXIMUM_QUERY_CACHE_SIZE (64 * 1024)
+
+#define PG_AI_GUC_SINGLE_FLIGHT_SLOTS_NAME "pg_ai.single_flight_slots"
+#define PG_AI_GUC_SINGLE_FLIGHT_SLOTS_DESCRIPTION                              \
+	"Max number of distinct requests shared across backends, 0 to disable"
+#define PG_AI_GUC_MINIMUM_SINGLE_FLIGHT_SLOTS 0
+#define PG_AI_GUC_DEFAULT_SINGLE_FLIGHT_SLOTS 64
+#define PG_AI_GUC_MAXIMUM_SINGLE_FLIGHT_SLOTS 1024
+
+#define PG_AI_GUC_EMBED_BATCH_SLOTS_NAME "pg_ai.embed_batch_slots"
+#define PG_AI_GUC_EMBED_BATCH_SLOTS_DESCRIPTION                                \
+	"Max number of embeddings batches collected at a time, 0 to disable"
+#define PG_AI_GUC_MINIMUM_EMBED_BATCH_SLOTS 0
+#define PG_AI_GUC_DEFAULT_EMBED_BATCH_SLOTS 4
+#define PG_AI_GUC_MAXIMUM_EMBED_BATCH_SLOTS 64
+
+#define PG_AI_GUC_EMBED_BATCH_WAIT_NAME "pg_ai.embed_batch_wait"
+#define PG_AI_GUC_EMBED_BATCH_WAIT_DESCRIPTION                                 \
+	"Milliseconds an embeddings request waits to be batched, 0 to disable"
+#define PG_AI_GUC_MINIMUM_EMBED_BATCH_WAIT 0
+#define PG_AI_GUC_DEFAULT_EMBED_BATCH_WAIT 0
+#define PG_AI_GUC_MAXIMUM_EMBED_BATCH_WAIT 1000
+
+#define PG_AI_GUC_EMBED_BATCH_SIZE_NAME "pg_ai.embed_batch_size"
+#define PG_AI_GUC_EMBED_BATCH_SIZE_DESCRIPTION                                 \
+	"Number of embeddings requests that sends a batch without waiting"
+#define PG_AI_GUC_MINIMUM_EMBED_BATCH_SIZE 2
+#define PG_AI_GUC_DEFAULT_EMBED_BATCH_SIZE EMBED_BATCH_MAX_SIZE
+#define PG_AI_GUC_MAXIMUM_EMBED_BATCH_SIZE EMBED_BATCH_MAX_SIZE
+
+#define PG_AI_GUC_MAX_CONCURRENCY_NAME "pg_ai.max_concurrency"
+#define PG_AI_GUC_MAX_CONCURRENCY_DESCRIPTION                                  \
+	"Max adaptive limit of concurrent requests to an endpoint, 0 to disable"
+#define PG_AI_GUC_MINIMUM_MAX_CONCURRENCY 0
+#define PG_AI_GUC_DEFAULT_MAX_CONCURRENCY 64
+#define PG_AI_GUC_MAXIMUM_MAX_CONCURRENCY 1024
+
+#define PG_AI_GUC_RESULT_CACHE_TTL_NAME "pg_ai.result_cache_ttl"
+#define PG_AI_GUC_RESULT_CACHE_TTL_DESCRIPTION                                 \
+	"Seconds a cached insight/moderation result stays valid, 0 to disable"
+#define PG_AI_GUC_MINIMUM_RESULT_CACHE_TTL 0
+#define PG_AI_GUC_DEFAULT_RESULT_CACHE_TTL 0
+#define PG_AI_GUC_MAXIMUM_RESULT_CACHE_TTL (365 * 24 * 60 * 60)
+
+#define PG_AI_GUC_RESULT_CACHE_MAX_ROWS_NAME "pg_ai.result_cache_max_rows"
+#define PG_AI_GUC_RESULT_CACHE_MAX_ROWS_DESCRIPTION                            \
+	"Max number of results of a role kept in the result cache table"
+#define PG_AI_GUC_MINIMUM_RESULT_CACHE_MAX_ROWS 1
+#define PG_AI_GUC_DEFAULT_RESULT_CACHE_MAX_ROWS 10000
+#define PG_AI_GUC_MAXIMUM_RESULT_CACHE_MAX_ROWS (10 * 1000 * 1000)
+
+#define PG_AI_GUC_AGG_CONCURRENCY_NAME "pg_ai.agg_concurrency"
+#define PG_AI_GUC_AGG_CONCURRENCY_DESCRIPTION                                  \
+	"Requests in flight at a time while an aggregate summarizes its input"
+#define PG_AI_GUC_MINIMUM_AGG_CONCURRENCY 1
+#define PG_AI_GUC_DEFAULT_AGG_CONCURRENCY 8
+#define PG_AI_GUC_MAXIMUM_AGG_CONCURRENCY 64
+
+#define PG_AI_GUC_BATCH_CONCURRENCY_NAME "pg_ai.batch_concurrency"
+#define PG_AI_GUC_BATCH_CONCURRENCY_DESCRIPTION                                \
+	"Requests in flight at a time for the values of a batch function"
+#define PG_AI_GUC_MINIMUM_BATCH_CONCURRENCY 1
+#define PG_AI_GUC_DEFAULT_BATCH_CONCURRENCY 8
+#define PG_AI_GUC_MAXIMUM_BATCH_CONCURRENCY 64
+
+#define PG_AI_GUC_PREFETCH_ROWS_NAME "pg_ai.prefetch_rows"
+#define PG_AI_GUC_PREFETCH_ROWS_DESCRIPTION                                    \
+	"Rows read ahead to call the per-row functions concurrently, 0 to disable"
+#define PG_AI_GUC_MINIMUM_PREFETCH_ROWS 0
+#define PG_AI_GUC_DEFAULT_PREFETCH_ROWS 32
+#define PG_AI_GUC_MAXIMUM_PREFETCH_ROWS 1024
+
+#define PG_AI_GUC_JOB_WORKERS_NAME "pg_ai.job_workers"
+#define PG_AI_GUC_JOB_WORKERS_DESCRIPTION                                      \
+	"Background workers running the jobs of a role in a database"
+#define PG_AI_GUC_MINIMUM_JOB_WORKERS 1
+#define PG_AI_GUC_DEFAULT_JOB_WORKERS 2
+#define PG_AI_GUC_MAXIMUM_JOB_WORKERS 32
+
+#define PG_AI_GUC_AGG_SAMPLE_TOKENS_NAME "pg_ai.agg_sample_tokens"
+#define PG_AI_GUC_AGG_SAMPLE_TOKENS_DESCRIPTION                                \
+	"Token budget of a sample of the insight aggregate input, 0 to disable"
+#define PG_AI_GUC_MINIMUM_AGG_SAMPLE_TOKENS 0
+#define PG_AI_GUC_DEFAULT_AGG_SAMPLE_TOKENS 0
+#define PG_AI_GUC_MAXIMUM_AGG_SAMPLE_TOKENS (1000 * 1000)
 /* ------ integer gucs >8----------------------- */
 
+/* ------8< real gucs ----------------------- */
+#define PG_AI_GUC_SEMANTIC_CACHE_THRESHOLD_NAME "pg_ai.semantic_cache_threshold"
+#define PG_AI_GUC_SEMANTIC_CACHE_THRESHOLD_DESCRIPTION                         \
+	"Min cosine similarity of the input to reuse a cached result, 0 to "      \
+	"disable"
+#define PG_AI_GUC_MINIMUM_SEMANTIC_CACHE_THRESHOLD 0.0
+#define PG_AI_GUC_DEFAULT_SEMANTIC_CACHE_THRESHOLD 0.0
+#define PG_AI_GUC_MAXIMUM_SEMANTIC_CACHE_THRESHOLD 1.0
+
+#define PG_AI_GUC_LATENCY_SPIKE_FACTOR_NAME "pg_ai.latency_spike_factor"
+#define PG_AI_GUC_LATENCY_SPIKE_FACTOR_DESCRIPTION                             \
+	"Latency over the smoothed latency by this factor cuts the concurrency"
+#define PG_AI_GUC_MINIMUM_LATENCY_SPIKE_FACTOR 1.0
+#define PG_AI_GUC_DEFAULT_LATENCY_SPIKE_FACTOR 3.0
+#define PG_AI_GUC_MAXIMUM_LATENCY_SPIKE_FACTOR 100.0
+
+#define PG_AI_GUC_INTERACTIVE_RESERVE_NAME "pg_ai.interactive_reserve"
+#define PG_AI_GUC_INTERACTIVE_RESERVE_DESCRIPTION                              \
+	"Share of the concurrency limit of an endpoint kept for interactive calls"
+#define PG_AI_GUC_MINIMUM_INTERACTIVE_RESERVE 0.0
+#define PG_AI_GUC_DEFAULT_INTERACTIVE_RESERVE 0.25
+#define PG_AI_GUC_MAXIMUM_INTERACTIVE_RESERVE 0.9
+/* ------ real gucs >8----------------------- */
+
+/* the GUCs of each type, index into the definition and values arrays */
+typedef enum PgAiStringGuc
+{
+	PG_AI_GUC_API_KEY = 0,
+	PG_AI_GUC_MODEL,
+	PG_AI_GUC_SERVICE,
+	PG_AI_GUC_VEC_SIMILARITY_ALGO,
+	PG_AI_GUC_TRAFFIC_CLASS,
+	PG_AI_GUC_TOKENIZER_FILE,
+	PG_AI_GUC_BATCH_API_URL,
+	PG_AI_GUC_API_URL,
+	PG_AI_STRING_GUC_COUNT
+} PgAiStringGuc;
+
+typedef enum PgAiIntGuc
+{
+	PG_AI_GUC_WORK_MEM_SIZE = 0,
+	PG_AI_GUC_DEBUG_LEVEL,
+	PG_AI_GUC_QUERY_CACHE_SIZE,
+	PG_AI_GUC_SINGLE_FLIGHT_SLOTS,
+	PG_AI_GUC_EMBED_BATCH_SLOTS,
+	PG_AI_GUC_EMBED_BATCH_WAIT,
+	PG_AI_GUC_EMBED_BATCH_SIZE,
+	PG_AI_GUC_MAX_CONCURRENCY,
+	PG_AI_GUC_RESULT_CACHE_TTL,
+	PG_AI_GUC_RESULT_CACHE_MAX_ROWS,
+	PG_AI_GUC_AGG_CONCURRENCY,
+	PG_AI_GUC_AGG_SAMPLE_TOKENS,
+	PG_AI_GUC_BATCH_CONCURRENCY,
+	PG_AI_GUC_PREFETCH_ROWS,
+	PG_AI_GUC_JOB_WORKERS,
+	PG_AI_INT_GUC_COUNT
+} PgAiIntGuc;
+
+typedef enum PgAiRealGuc
+{
+	PG_AI_GUC_SEMANTIC_CACHE_THRESHOLD = 0,
+	PG_AI_GUC_LATENCY_SPIKE_FACTOR,
+	PG_AI_GUC_INTERACTIVE_RESERVE,
+	PG_AI_REAL_GUC_COUNT
+} PgAiRealGuc;
+
 void define_pg_ai_guc_variables(void);
-char *get_pg_ai_guc_string_variable(char *name);
-int *get_pg_ai_guc_int_variable(char *name);
+char *get_pg_ai_guc_string_variable(const PgAiStringGuc guc);
+int *get_pg_ai_guc_int_variable(const PgAiIntGuc guc);
+double *get_pg_ai_guc_real_variable(const PgAiRealGuc guc);
+
+#define PG_AI_GUC_COUNT                                                        \
+	(PG_AI_STRING_GUC_COUNT + PG_AI_INT_GUC_COUNT + PG_AI_REAL_GUC_COUNT)
+
+/*
+ * The settings a background job runs with, the GUCs a session can set other
+ * than the API key. The names and values arrays take PG_AI_GUC_COUNT.
+ */
+int get_pg_ai_job_settings(const char **names, char **values);
+void reset_pg_ai_job_settings(void);
+bool set_pg_ai_job_setting(const char *name, const char *value);
 
 #endif /* _PG_AI_GUC_H */
@@ -0,0 +1,315 @@
+#include "job_queue.h"
+
+#include "access/xact.h"
+#include "catalog/pg_type.h"
+#include "executor/spi.h"
+#include "miscadmin.h"
+#include "postmaster/bgworker.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+
+#include "core/ai_config.h"
+#include "core/ai_config_str.h"
+#include "core/utils_pg_ai.h"
+#include "guc/pg_ai_guc.h"
+
+/* queries on the job table, %s is the qualified table name */
+#define JOB_SUBMIT_QUERY                                                       \
+	"INSERT INTO %s (kind, args, settings, owner) "                            \
+	"VALUES ($1, $2, jsonb_object($3, $4), $5) RETURNING id"
+
+#define JOB_WAITING_QUERY                                                      \
+	"SELECT 1 FROM %s WHERE owner = $1 AND status IN ('queued', 'running') "   \
+	"LIMIT 1"
+
+#define JOB_TABLES_OWNER_QUERY                                                 \
+	"SELECT relowner FROM pg_class WHERE oid = $1::regclass"
+
+#define JOB_WORKERS_QUERY                                                      \
+	"SELECT count(*) FROM pg_stat_activity WHERE backend_type = $1 "           \
+	"AND datid = $2 AND usesysid = $3"
+
+/* the arguments a kind of job needs */
+#define JOB_MAX_REQUIRED_ARGS 2
+
+typedef struct PgAiJobKindDef
+{
+	const char *name;
+	const char *required_args[JOB_MAX_REQUIRED_ARGS];
+} PgAiJobKindDef;
+
+static const PgAiJobKindDef job_kinds[JOB_KIND_COUNT] = {
+	[JOB_KIND_INSIGHT] = {"insight", {JOB_ARG_QUERY}},
+	[JOB_KIND_MODERATION] = {"moderation", {JOB_ARG_QUERY}},
+	[JOB_KIND_CREATE_VECTOR_STORE] = {"create_vector_store",
+									  {JOB_ARG_STORE, JOB_ARG_QUERY}}};
+
+/* a worker is to be started for this role as the transaction commits */
+static bool job_worker_pending = false;
+static Oid job_worker_role = InvalidOid;
+static bool job_xact_callback_registered = false;
+
+int get_job_kind(const char *name)
+{
+	for (int i = 0; i < JOB_KIND_COUNT; i++)
+		if (strcmp(job_kinds[i].name, name) == 0)
+			return i;
+
+	return -1;
+}
+
+char *get_job_arg(Jsonb *args, const char *name)
+{
+	JsonbValue value;
+
+	if (!JB_ROOT_IS_OBJECT(args) ||
+		!getKeyJsonValueFromContainer(&args->root, name, strlen(name),
+									  &value) ||
+		value.type != jbvString)
+		return NULL;
+
+	return pnstrdup(value.val.string.val, value.val.string.len);
+}
+
+bool is_provider_batch_job(Jsonb *args)
+{
+	char *mode = get_job_arg(args, JOB_ARG_MODE);
+
+	return mode && strcmp(mode, JOB_MODE_PROVIDER_BATCH) == 0;
+}
+
+/*
+ * Start a worker for the jobs of the role in the database, the worker exits
+ * once it finds no more jobs. A worker that cannot be started leaves the
+ * jobs queued for the next submit or pg_ai_resume_jobs.
+ */
+static void start_job_worker(const Oid role_id)
+{
+	BackgroundWorker worker;
+
+	memset(&worker, 0, sizeof(worker));
+	worker.bgw_flags =
+		BGWORKER_SHMEM_ACCESS | BGWORKER_BACKEND_DATABASE_CONNECTION;
+	worker.bgw_start_time = BgWorkerStart_RecoveryFinished;
+	worker.bgw_restart_time = BGW_NEVER_RESTART;
+	snprintf(worker.bgw_library_name, BGW_MAXLEN, PG_AI_EXTENSION_NAME);
+	snprintf(worker.bgw_function_name, BGW_MAXLEN, PG_AI_JOB_WORKER_FUNCTION);
+	snprintf(worker.bgw_name, BGW_MAXLEN, "%s for role %u",
+			 PG_AI_JOB_WORKER_TYPE, role_id);
+	snprintf(worker.bgw_type, BGW_MAXLEN, PG_AI_JOB_WORKER_TYPE);
+	worker.bgw_main_arg = ObjectIdGetDatum(MyDatabaseId);
+	memcpy(worker.bgw_extra, &role_id, sizeof(Oid));
+
+	if (!RegisterDynamicBackgroundWorker(&worker, NULL))
+		ereport(WARNING,
+				(errmsg("could not start a pg_ai job worker, the jobs stay "
+						"queued"),
+				 errhint("Raise max_worker_processes, and call "
+						 "pg_ai_resume_jobs().")));
+}
+
+/* the worker is started only once the jobs it is to find are committed */
+static void job_xact_callback(XactEvent event, void *arg)
+{
+	switch (event)
+	{
+	case XACT_EVENT_COMMIT:
+		if (job_worker_pending)
+			start_job_worker(job_worker_role);
+		job_worker_pending = false;
+		break;
+	case XACT_EVENT_ABORT:
+	case XACT_EVENT_PREPARE:
+		job_worker_pending = false;
+		break;
+	default:
+		break;
+	}
+}
+
+/*
+ * Have a worker started at the commit if fewer than pg_ai.job_workers run
+ * for the role in the database. Called with SPI connected.
+ */
+static void schedule_job_worker(void)
+{
+	Oid arg_types[3] = {TEXTOID, OIDOID, OIDOID};
+	Datum args[3];
+	bool isnull;
+	int64 workers = 0;
+
+	args[0] = CStringGetTextDatum(PG_AI_JOB_WORKER_TYPE);
+	args[1] = ObjectIdGetDatum(MyDatabaseId);
+	args[2] = ObjectIdGetDatum(GetUserId());
+	if (SPI_execute_with_args(JOB_WORKERS_QUERY, 3, arg_types, args, NULL,
+							  true /* read_only */, 1) == SPI_OK_SELECT &&
+		SPI_processed > 0)
+		workers = DatumGetInt64(SPI_getbinval(SPI_tuptable->vals[0],
+											  SPI_tuptable->tupdesc, 1,
+											  &isnull));
+	if (workers >= *get_pg_ai_guc_int_variable(PG_AI_GUC_JOB_WORKERS))
+		return;
+
+	if (!job_xact_callback_registered)
+	{
+		RegisterXactCallback(job_xact_callback, NULL);
+		job_xact_callback_registered = true;
+	}
+	job_worker_pending = true;
+	job_worker_role = GetUserId();
+}
+
+/* the job table, errors out if the extension is not created */
+static char *get_jobs_table(void)
+{
+	char *table = make_pg_ai_object_name(PG_AI_JOBS_TABLE);
+
+	if (!table)
+		ereport(ERROR, (errcode(ERRCODE_UNDEFINED_OBJECT),
+						errmsg("extension \"%s\" is not created",
+							   PG_AI_EXTENSION_NAME)));
+	return table;
+}
+
+/* check the kind of a job has the arguments it needs */
+static void validate_job(const char *kind, Jsonb *args)
+{
+	const PgAiJobKindDef *kind_def;
+	int job_kind;
+
+	if ((job_kind = get_job_kind(kind)) < 0)
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("unknown job kind \"%s\"", kind),
+						errhint("The kinds are insight, moderation and "
+								"create_vector_store.")));
+	if (!JB_ROOT_IS_OBJECT(args))
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("job arguments must be a JSON object")));
+
+	kind_def = &job_kinds[job_kind];
+	for (int i = 0; i < JOB_MAX_REQUIRED_ARGS; i++)
+		if (kind_def->required_args[i] &&
+			!get_job_arg(args, kind_def->required_args[i]))
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("job \"%s\" needs the string argument \"%s\"",
+							kind, kind_def->required_args[i])));
+
+	/* only the per-row kinds have a request per row to batch */
+	if (get_job_arg(args, JOB_ARG_MODE) &&
+		(!is_provider_batch_job(args) ||
+		 job_kind == JOB_KIND_CREATE_VECTOR_STORE))
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("job \"%s\" has no mode \"%s\"", kind,
+							   get_job_arg(args, JOB_ARG_MODE)),
+						errhint("The insight and moderation jobs have the "
+								"mode \"%s\".",
+								JOB_MODE_PROVIDER_BATCH)));
+}
+
+Oid get_job_tables_owner(const char *jobs_table)
+{
+	Oid arg_types[1] = {TEXTOID};
+	Datum args[1];
+	bool isnull;
+	Datum owner;
+
+	args[0] = CStringGetTextDatum(jobs_table);
+	if (SPI_execute_with_args(JOB_TABLES_OWNER_QUERY, 1, arg_types, args,
+							  NULL, true /* read_only */,
+							  1) != SPI_OK_SELECT ||
+		SPI_processed == 0)
+		return InvalidOid;
+
+	owner = SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1,
+						  &isnull);
+	return isnull ? InvalidOid : DatumGetObjectId(owner);
+}
+
+/*
+ * Insert a validated job as the owner of the job tables, so the columns the
+ * workers keep are never set by a role. An error restores the role as the
+ * transaction aborts.
+ */
+static int64 insert_job(Oid *arg_types, Datum *args)
+{
+	char *jobs_table = get_jobs_table();
+	Oid owner = get_job_tables_owner(jobs_table);
+	Oid user_id;
+	int sec_context;
+	bool isnull;
+	int64 job_id = 0;
+
+	if (!OidIsValid(owner))
+		ereport(ERROR, (errcode(ERRCODE_UNDEFINED_OBJECT),
+						errmsg("extension \"%s\" is not created",
+							   PG_AI_EXTENSION_NAME)));
+
+	GetUserIdAndSecContext(&user_id, &sec_context);
+	SetUserIdAndSecContext(owner, sec_context | SECURITY_LOCAL_USERID_CHANGE);
+	if (SPI_execute_with_args(psprintf(JOB_SUBMIT_QUERY, jobs_table), 5,
+							  arg_types, args, NULL, false /* read_only */,
+							  1) == SPI_OK_INSERT_RETURNING)
+		job_id = DatumGetInt64(SPI_getbinval(SPI_tuptable->vals[0],
+											 SPI_tuptable->tupdesc, 1,
+											 &isnull));
+	SetUserIdAndSecContext(user_id, sec_context);
+	return job_id;
+}
+
+int64 submit_job(const char *kind, Jsonb *args)
+{
+	const char *names[PG_AI_GUC_COUNT];
+	char *values[PG_AI_GUC_COUNT];
+	Datum name_datums[PG_AI_GUC_COUNT];
+	Datum value_datums[PG_AI_GUC_COUNT];
+	Oid arg_types[5] = {TEXTOID, JSONBOID, TEXTARRAYOID, TEXTARRAYOID, OIDOID};
+	Datum query_args[5];
+	int64 job_id;
+	int count;
+
+	validate_job(kind, args);
+
+	count = get_pg_ai_job_settings(names, values);
+	for (int i = 0; i < count; i++)
+	{
+		name_datums[i] = CStringGetTextDatum(names[i]);
+		value_datums[i] = CStringGetTextDatum(values[i]);
+	}
+
+	query_args[0] = CStringGetTextDatum(kind);
+	query_args[1] = JsonbPGetDatum(args);
+	query_args[2] = PointerGetDatum(
+		construct_array_builtin(name_datums, count, TEXTOID));
+	query_args[3] = PointerGetDatum(
+		construct_array_builtin(value_datums, count, TEXTOID));
+	query_args[4] = ObjectIdGetDatum(GetUserId());
+
+	SPI_connect();
+	job_id = insert_job(arg_types, query_args);
+	schedule_job_worker();
+	SPI_finish();
+
+	return job_id;
+}
+
+bool resume_jobs(void)
+{
+	Oid arg_types[1] = {OIDOID};
+	Datum args[1];
+	bool waiting;
+
+	args[0] = ObjectIdGetDatum(GetUserId());
+
+	SPI_connect();
+	waiting = SPI_execute_with_args(psprintf(JOB_WAITING_QUERY,
+											 get_jobs_table()),
+									1, arg_types, args, NULL,
+									true /* read_only */, 1) == SPI_OK_SELECT &&
+			  SPI_processed > 0;
+	if (waiting)
+		schedule_job_worker();
+	SPI_finish();
+
+	return waiting;
+}
@@ -0,0 +1,55 @@
+#ifndef _JOB_QUEUE_H_
+#define _JOB_QUEUE_H_
+
+#include "postgres.h"
+#include "utils/jsonb.h"
+
+/* the arguments of the jobs */
+#define JOB_ARG_QUERY "query"
+#define JOB_ARG_PROMPT "prompt"
+#define JOB_ARG_STORE "store"
+#define JOB_ARG_NOTES "notes"
+#define JOB_ARG_MODE "mode"
+
+/* the mode of an insight or moderation job run by the batch API */
+#define JOB_MODE_PROVIDER_BATCH "provider_batch"
+
+/* the kinds of jobs, by the name given to pg_ai_submit_job */
+typedef enum PgAiJobKind
+{
+	JOB_KIND_INSIGHT = 0,
+	JOB_KIND_MODERATION,
+	JOB_KIND_CREATE_VECTOR_STORE,
+	JOB_KIND_COUNT
+} PgAiJobKind;
+
+/* the kind of a name, -1 for an unknown kind */
+int get_job_kind(const char *name);
+
+/* a string argument of a job, NULL if it is not set */
+char *get_job_arg(Jsonb *args, const char *name);
+
+/* true for a job to be run by the batch API of the provider */
+bool is_provider_batch_job(Jsonb *args);
+
+/* the owner of the job tables, InvalidOid if they are not found */
+Oid get_job_tables_owner(const char *jobs_table);
+
+/*
+ * Queue a job and return its id. The job is written as the owner of the
+ * job tables, the roles cannot insert into them. A worker for the jobs of
+ * the role is started as the transaction commits, unless pg_ai.job_workers
+ * are running already.
+ */
+int64 submit_job(const char *kind, Jsonb *args);
+
+/*
+ * Start a worker for the jobs of the role left queued or running, after a
+ * restart. False if no jobs are waiting.
+ */
+bool resume_jobs(void);
+
+/* the entry point of the job workers */
+PGDLLEXPORT void pg_ai_job_worker_main(Datum main_arg);
+
+#endif /* _JOB_QUEUE_H_ */
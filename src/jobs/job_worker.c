@@ -0,0 +1,904 @@
+#include "job_queue.h"
+
+#include "access/xact.h"
+#include "catalog/pg_type.h"
+#include "executor/spi.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "postmaster/bgworker.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "tcop/tcopprot.h"
+#include "utils/builtins.h"
+#include "utils/memutils.h"
+#include "utils/snapmgr.h"
+
+#include "cache/result_cache.h"
+#include "cache/service_cache.h"
+#include "core/ai_config.h"
+#include "core/ai_config_str.h"
+#include "core/ai_error.h"
+#include "core/batch_call.h"
+#include "core/utils_pg_ai.h"
+#include "guc/pg_ai_guc.h"
+#include "rest/provider_batch.h"
+#include "rest/rest_transfer.h"
+
+/* queries on the job tables, %s is the qualified table name */
+#define JOB_CANDIDATES_QUERY                                                   \
+	"SELECT id FROM %s WHERE owner = $1 AND status IN ('queued', 'running') "  \
+	"AND run_after <= now() ORDER BY id LIMIT $2"
+
+#define JOB_CLAIM_QUERY                                                        \
+	"UPDATE %s SET status = 'running', attempts = attempts + 1, "              \
+	"started_at = now() WHERE id = $1 AND status IN ('queued', 'running') "    \
+	"RETURNING kind, args, attempts, rows_done, provider_batch"
+
+#define JOB_SETTINGS_QUERY                                                     \
+	"SELECT s.key, s.value FROM %s, jsonb_each_text(settings) AS s "           \
+	"WHERE id = $1"
+
+#define JOB_NEXT_RETRY_QUERY                                                   \
+	"SELECT ceil(extract(epoch FROM min(run_after) - now()) * 1000)::int8 "    \
+	"FROM %s WHERE owner = $1 AND status = 'queued' AND run_after > now()"
+
+#define JOB_RESULT_QUERY                                                       \
+	"INSERT INTO %s (job_id, ordinality, value, result) "                      \
+	"VALUES ($1, $2, $3, $4) ON CONFLICT (job_id, ordinality) DO UPDATE "      \
+	"SET value = EXCLUDED.value, result = EXCLUDED.result"
+
+#define JOB_PROGRESS_QUERY "UPDATE %s SET rows_done = $2 WHERE id = $1"
+
+#define JOB_PROVIDER_BATCH_QUERY                                               \
+	"UPDATE %s SET provider_batch = $2 WHERE id = $1"
+
+#define JOB_BATCH_RESULT_QUERY                                                 \
+	"UPDATE %s SET result = $3 WHERE job_id = $1 AND ordinality = $2 "         \
+	"RETURNING value"
+
+#define JOB_BATCH_ROWS_QUERY                                                   \
+	"SELECT max(ordinality) FROM %s WHERE job_id = $1"
+
+#define JOB_FINISH_QUERY                                                       \
+	"UPDATE %s SET status = $2, error = $3, finished_at = now() WHERE id = $1"
+
+#define JOB_RETRY_QUERY                                                        \
+	"UPDATE %s SET status = 'queued', error = $2, "                            \
+	"run_after = now() + make_interval(secs => $3) WHERE id = $1"
+
+#define JOB_NOTIFY_QUERY "SELECT pg_notify($1, $2)"
+#define JOB_LOCK_QUERY "SELECT pg_try_advisory_lock($1, $2)"
+#define JOB_UNLOCK_QUERY "SELECT pg_advisory_unlock($1, $2)"
+
+#define JOB_VECTOR_STORE_QUERY "SELECT %s($1::name, $2, $3::name)"
+
+/* a job claimed by the worker, allocated in the job context */
+typedef struct PgAiJob
+{
+	int64 id;
+	int kind;
+	Jsonb *args;
+	int attempts;
+	int64 rows_done;
+	char *provider_batch; /* the batch of the provider the job waits on */
+} PgAiJob;
+
+/* the values of a window of a job, for the rows of its results */
+typedef struct JobWindow
+{
+	int64 job_id;
+	char **values;
+	int64 first_ordinality;
+} JobWindow;
+
+/* the memory of the job being run, reset between the jobs */
+static MemoryContext job_context = NULL;
+
+/* the qualified names of the job tables, and their owner */
+static char *jobs_table = NULL;
+static char *job_results_table = NULL;
+static Oid job_tables_owner = InvalidOid;
+
+/*
+ * Each step of a job is a transaction of its own, so the progress and the
+ * results stay as a later step fails.
+ */
+static void begin_job_transaction(void)
+{
+	SetCurrentStatementStartTimestamp();
+	StartTransactionCommand();
+	SPI_connect();
+	PushActiveSnapshot(GetTransactionSnapshot());
+}
+
+static void end_job_transaction(void)
+{
+	SPI_finish();
+	PopActiveSnapshot();
+	CommitTransactionCommand();
+	MemoryContextSwitchTo(job_context);
+}
+
+/*
+ * Write the job tables. The roles can only submit and read their jobs, the
+ * worker writes them as the owner of the tables. An error restores the role
+ * as the transaction aborts.
+ */
+static int write_job_tables(const char *query, const int nargs,
+							Oid *arg_types, Datum *args, const char *nulls,
+							const long count)
+{
+	Oid user_id;
+	int sec_context;
+	int ret;
+
+	GetUserIdAndSecContext(&user_id, &sec_context);
+	SetUserIdAndSecContext(job_tables_owner,
+						   sec_context | SECURITY_LOCAL_USERID_CHANGE);
+	ret = SPI_execute_with_args(query, nargs, arg_types, args, nulls,
+								false /* read_only */, count);
+	SetUserIdAndSecContext(user_id, sec_context);
+	return ret;
+}
+
+/* the cursor of the rows of a job, kept across its transactions */
+static char *get_job_cursor_name(const int64 job_id)
+{
+	return psprintf("pg_ai_job_" INT64_FORMAT, job_id);
+}
+
+/*
+ * Take or release the lock keeping the other workers off a job. The key is
+ * the low half of the id with the high half added to the class, a distinct
+ * key for every id that stays in the class for all but huge ids.
+ */
+static bool lock_job(const int64 job_id, const bool lock)
+{
+	Oid arg_types[2] = {INT4OID, INT4OID};
+	Datum args[2];
+	bool isnull;
+
+	args[0] = Int32GetDatum(
+		(int32)((uint32)JOB_LOCK_CLASS + (uint32)((uint64)job_id >> 32)));
+	args[1] = Int32GetDatum((int32)(uint32)job_id);
+
+	return SPI_execute_with_args(lock ? JOB_LOCK_QUERY : JOB_UNLOCK_QUERY, 2,
+								 arg_types, args, NULL, false /* read_only */,
+								 1) == SPI_OK_SELECT &&
+		   SPI_processed > 0 &&
+		   DatumGetBool(SPI_getbinval(SPI_tuptable->vals[0],
+									  SPI_tuptable->tupdesc, 1, &isnull));
+}
+
+/* run the job with the settings of the session that submitted it */
+static void set_job_settings(const int64 job_id)
+{
+	Oid arg_types[1] = {INT8OID};
+	Datum args[1];
+
+	reset_pg_ai_job_settings();
+
+	args[0] = Int64GetDatum(job_id);
+	if (SPI_execute_with_args(psprintf(JOB_SETTINGS_QUERY, jobs_table), 1,
+							  arg_types, args, NULL, true /* read_only */,
+							  0) != SPI_OK_SELECT)
+		return;
+
+	for (uint64 i = 0; i < SPI_processed; i++)
+		set_pg_ai_job_setting(
+			SPI_getvalue(SPI_tuptable->vals[i], SPI_tuptable->tupdesc, 1),
+			SPI_getvalue(SPI_tuptable->vals[i], SPI_tuptable->tupdesc, 2));
+}
+
+/*
+ * Mark a locked job running, NULL if another worker has finished it since it
+ * was picked.
+ */
+static PgAiJob *start_job(const int64 job_id)
+{
+	Oid arg_types[1] = {INT8OID};
+	Datum args[1];
+	HeapTuple tuple;
+	TupleDesc tupdesc;
+	MemoryContext old_context;
+	PgAiJob *job;
+	bool isnull;
+
+	args[0] = Int64GetDatum(job_id);
+	if (write_job_tables(psprintf(JOB_CLAIM_QUERY, jobs_table), 1, arg_types,
+						 args, NULL, 1) != SPI_OK_UPDATE_RETURNING ||
+		SPI_processed == 0)
+		return NULL;
+
+	tuple = SPI_tuptable->vals[0];
+	tupdesc = SPI_tuptable->tupdesc;
+
+	old_context = MemoryContextSwitchTo(job_context);
+	job = palloc0(sizeof(PgAiJob));
+	job->id = job_id;
+	job->kind = get_job_kind(SPI_getvalue(tuple, tupdesc, 1));
+	job->args = DatumGetJsonbPCopy(SPI_getbinval(tuple, tupdesc, 2, &isnull));
+	job->attempts = DatumGetInt32(SPI_getbinval(tuple, tupdesc, 3, &isnull));
+	job->rows_done = DatumGetInt64(SPI_getbinval(tuple, tupdesc, 4, &isnull));
+	job->provider_batch = SPI_getvalue(tuple, tupdesc, 5);
+	MemoryContextSwitchTo(old_context);
+
+	set_job_settings(job_id);
+	return job;
+}
+
+/*
+ * Claim the oldest job of the role that is due. A job still running with no
+ * worker holding its lock is one whose worker died, it is taken over. With no
+ * job to claim, wait_ms is the time till the next retry, -1 if none is
+ * queued.
+ */
+static PgAiJob *claim_job(const Oid role_id, long *wait_ms)
+{
+	Oid arg_types[2] = {OIDOID, INT4OID};
+	Datum args[2];
+	int64 candidates[JOB_CLAIM_CANDIDATES];
+	int count = 0;
+	PgAiJob *job = NULL;
+	bool isnull;
+
+	begin_job_transaction();
+
+	args[0] = ObjectIdGetDatum(role_id);
+	args[1] = Int32GetDatum(JOB_CLAIM_CANDIDATES);
+	if (SPI_execute_with_args(psprintf(JOB_CANDIDATES_QUERY, jobs_table), 2,
+							  arg_types, args, NULL, true /* read_only */,
+							  0) == SPI_OK_SELECT)
+		for (; count < (int)SPI_processed; count++)
+			candidates[count] =
+				DatumGetInt64(SPI_getbinval(SPI_tuptable->vals[count],
+											SPI_tuptable->tupdesc, 1, &isnull));
+
+	for (int i = 0; i < count && !job; i++)
+	{
+		if (!lock_job(candidates[i], true))
+			continue;
+		if (!(job = start_job(candidates[i])))
+			lock_job(candidates[i], false);
+	}
+
+	*wait_ms = -1;
+	if (!job &&
+		SPI_execute_with_args(psprintf(JOB_NEXT_RETRY_QUERY, jobs_table), 1,
+							  arg_types, args, NULL, true /* read_only */,
+							  1) == SPI_OK_SELECT &&
+		SPI_processed > 0)
+	{
+		Datum next = SPI_getbinval(SPI_tuptable->vals[0],
+								   SPI_tuptable->tupdesc, 1, &isnull);
+
+		if (!isnull)
+			*wait_ms = (long)Max(DatumGetInt64(next), 1);
+	}
+
+	end_job_transaction();
+	return job;
+}
+
+/* store the result of a value of a job, called by batch_call */
+static void put_job_result(void *arg, const int64 ordinality,
+						   const char *result)
+{
+	JobWindow *window = (JobWindow *)arg;
+	Oid arg_types[4] = {INT8OID, INT8OID, TEXTOID, TEXTOID};
+	Datum args[4];
+	char nulls[4] = {' ', ' ', ' ', ' '};
+	char *value = window->values ?
+					  window->values[ordinality - window->first_ordinality] :
+					  NULL;
+
+	args[0] = Int64GetDatum(window->job_id);
+	args[1] = Int64GetDatum(ordinality);
+	args[2] = value ? CStringGetTextDatum(value) : (Datum)0;
+	nulls[2] = value ? ' ' : 'n';
+	args[3] = result ? CStringGetTextDatum(result) : (Datum)0;
+	nulls[3] = result ? ' ' : 'n';
+
+	write_job_tables(psprintf(JOB_RESULT_QUERY, job_results_table), 4,
+					 arg_types, args, nulls, 0);
+}
+
+/* record the rows of a job done, with their results */
+static void set_job_progress(PgAiJob *job, const int64 rows_done)
+{
+	Oid arg_types[2] = {INT8OID, INT8OID};
+	Datum args[2];
+
+	args[0] = Int64GetDatum(job->id);
+	args[1] = Int64GetDatum(rows_done);
+	write_job_tables(psprintf(JOB_PROGRESS_QUERY, jobs_table), 2, arg_types,
+					 args, NULL, 0);
+	job->rows_done = rows_done;
+}
+
+/*
+ * Open the cursor of the rows of a job after the rows done, unless it is
+ * open from an earlier step of the job.
+ */
+static void open_job_cursor(PgAiJob *job)
+{
+	char *cursor_name = get_job_cursor_name(job->id);
+	SPIParseOpenOptions options;
+	Portal portal;
+
+	begin_job_transaction();
+	if (!SPI_cursor_find(cursor_name))
+	{
+		memset(&options, 0, sizeof(options));
+		options.cursorOptions = CURSOR_OPT_HOLD | CURSOR_OPT_NO_SCROLL;
+		options.read_only = true;
+		portal = SPI_cursor_parse_open(
+			cursor_name, get_job_arg(job->args, JOB_ARG_QUERY), &options);
+		if (job->rows_done > 0)
+			SPI_cursor_move(portal, true, job->rows_done);
+	}
+	end_job_transaction();
+}
+
+/* the service of a job with its prompt, as for a single call */
+static AIService *get_job_service(PgAiJob *job, const int function_flags)
+{
+	AIService *ai_service;
+
+	if (!(ai_service =
+			  get_session_service(function_flags, CurrentMemoryContext)) ||
+		!ai_service->process_rest_response)
+		ereport(ERROR, (errmsg("%s", GET_ERR_STR(UNSUPPORTED_SERVICE))));
+	if (set_row_call_options(ai_service, "",
+							 get_job_arg(job->args, JOB_ARG_PROMPT)))
+		ereport(ERROR, (errmsg("%s", GET_ERR_STR(INVALID_OPTIONS))));
+
+	return ai_service;
+}
+
+/*
+ * Run an insight or moderation job: the first column of the rows of its
+ * query is sent to the service a window at a time. Every window commits its
+ * results with the progress, a retried job goes on after the rows done.
+ */
+static void run_batch_job(PgAiJob *job, const int function_flags)
+{
+	char *cursor_name = get_job_cursor_name(job->id);
+	Portal portal;
+	AIService *ai_service;
+	JobWindow window;
+	uint64 size;
+
+	open_job_cursor(job);
+
+	window.job_id = job->id;
+	for (;;)
+	{
+		CHECK_FOR_INTERRUPTS();
+		begin_job_transaction();
+
+		portal = SPI_cursor_find(cursor_name);
+		SPI_cursor_fetch(portal, true, BATCH_WINDOW_SIZE);
+		if ((size = SPI_processed) == 0)
+		{
+			SPI_cursor_close(portal);
+			end_job_transaction();
+			break;
+		}
+
+		window.values = palloc(sizeof(char *) * size);
+		for (uint64 i = 0; i < size; i++)
+			window.values[i] = SPI_getvalue(SPI_tuptable->vals[i],
+											SPI_tuptable->tupdesc, 1);
+		window.first_ordinality = job->rows_done + 1;
+
+		ai_service = get_job_service(job, function_flags);
+		batch_call(ai_service, window.values, (int)size,
+				   window.first_ordinality, put_job_result, &window);
+		set_job_progress(job, job->rows_done + size);
+		end_job_transaction();
+	}
+}
+
+/* record the batch of the provider the job waits on, NULL once it is done */
+static void set_job_provider_batch(PgAiJob *job, const char *batch_id)
+{
+	Oid arg_types[2] = {INT8OID, TEXTOID};
+	Datum args[2];
+	char nulls[2] = {' ', ' '};
+
+	args[0] = Int64GetDatum(job->id);
+	args[1] = batch_id ? CStringGetTextDatum(batch_id) : (Datum)0;
+	nulls[1] = batch_id ? ' ' : 'n';
+	write_job_tables(psprintf(JOB_PROVIDER_BATCH_QUERY, jobs_table), 2,
+					 arg_types, args, nulls, 0);
+	job->provider_batch =
+		batch_id ? MemoryContextStrdup(job_context, batch_id) : NULL;
+}
+
+/*
+ * Write the requests of the next rows of a job, up to the requests a batch
+ * of the provider takes, and create the batch of them. The rows get their
+ * result rows as they are written, those answered without a request with
+ * their results. False once the rows of the job are all done.
+ */
+static bool create_provider_batch(PgAiJob *job, const int function_flags)
+{
+	char *cursor_name = get_job_cursor_name(job->id);
+	char *post_data;
+	BufFile *volatile input = NULL;
+	AIService *ai_service;
+	const char *endpoint = NULL;
+	JobWindow window = {job->id, NULL, 0};
+	volatile int64 rows = 0;
+	int64 requests = 0;
+	MemoryContext old_context;
+	uint64 size;
+	char *cached;
+
+	open_job_cursor(job);
+
+	/* an interXact file is not closed as the transaction aborts */
+	PG_TRY();
+	{
+		while (rows < PROVIDER_BATCH_MAX_REQUESTS)
+		{
+			CHECK_FOR_INTERRUPTS();
+			begin_job_transaction();
+
+			SPI_cursor_fetch(SPI_cursor_find(cursor_name), true,
+							 Min(BATCH_WINDOW_SIZE,
+								 PROVIDER_BATCH_MAX_REQUESTS - rows));
+			if ((size = SPI_processed) == 0)
+			{
+				end_job_transaction();
+				break;
+			}
+
+			/* the input is kept across the transactions of the windows */
+			ai_service = get_job_service(job, function_flags);
+			if (!input)
+			{
+				old_context = MemoryContextSwitchTo(job_context);
+				input = BufFileCreateTemp(true /* interXact */);
+				endpoint = pstrdup(provider_batch_endpoint(ai_service));
+				MemoryContextSwitchTo(old_context);
+			}
+
+			window.values = palloc(sizeof(char *) * size);
+			for (uint64 i = 0; i < size; i++)
+				window.values[i] = SPI_getvalue(SPI_tuptable->vals[i],
+												SPI_tuptable->tupdesc, 1);
+			window.first_ordinality = job->rows_done + rows + 1;
+
+			/* the values are copied before the results are written */
+			for (uint64 i = 0; i < size; i++)
+			{
+				int64 ordinality = window.first_ordinality + i;
+				char *value = window.values[i];
+
+				if (!value)
+					put_job_result(&window, ordinality, NULL);
+				else if ((cached = result_cache_lookup(ai_service, value)))
+					put_job_result(&window, ordinality, cached);
+				else
+				{
+					reset_option_value(AI_SERVICE_OPTIONS, OPTION_COLUMN_VALUE);
+					if (ai_service->set_service_data(ai_service, value) ||
+						ai_service->prepare_for_transfer(ai_service))
+						ereport(ERROR,
+								(errmsg("%s", GET_ERR_STR(INT_PREP_TNSFR))));
+					post_data = make_post_data(
+						ai_service,
+						pnstrdup(ai_service->rest_request->data,
+								 ai_service->rest_request->data_size));
+					provider_batch_add_request(input, endpoint, ordinality,
+											   post_data);
+					pfree(post_data);
+					put_job_result(&window, ordinality, NULL);
+					requests++;
+				}
+			}
+			rows += size;
+			end_job_transaction();
+		}
+
+		/* rows all answered without a request need no batch */
+		if (rows > 0)
+		{
+			begin_job_transaction();
+			if (requests > 0)
+				set_job_provider_batch(
+					job, provider_batch_create(
+							 get_job_service(job, function_flags), input,
+							 endpoint));
+			else
+				set_job_progress(job, job->rows_done + rows);
+			end_job_transaction();
+		}
+	}
+	PG_CATCH();
+	{
+		if (input)
+			BufFileClose(input);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	if (input)
+		BufFileClose(input);
+	return rows > 0;
+}
+
+/* wait for the batch of a job to complete, errors out if it has failed */
+static void wait_provider_batch(PgAiJob *job, const int function_flags,
+								char **output_file_id, char **error_file_id)
+{
+	ProviderBatchStatus status;
+	char *error;
+
+	for (;;)
+	{
+		CHECK_FOR_INTERRUPTS();
+		begin_job_transaction();
+
+		status = provider_batch_status(get_job_service(job, function_flags),
+									   job->provider_batch, output_file_id,
+									   error_file_id, &error);
+		if (*output_file_id)
+			*output_file_id = MemoryContextStrdup(job_context, *output_file_id);
+		if (*error_file_id)
+			*error_file_id = MemoryContextStrdup(job_context, *error_file_id);
+		if (error)
+			error = MemoryContextStrdup(job_context, error);
+
+		/* a retry of the job makes a batch of its rows again */
+		if (status == PROVIDER_BATCH_FAILED)
+			set_job_provider_batch(job, NULL);
+		end_job_transaction();
+
+		if (status == PROVIDER_BATCH_COMPLETED)
+			return;
+		if (status == PROVIDER_BATCH_FAILED)
+			ereport(ERROR, (errmsg("%s", error)));
+
+		pgstat_report_activity(
+			STATE_IDLE,
+			psprintf("pg_ai job " INT64_FORMAT " waiting on batch %s",
+					 job->id, job->provider_batch));
+		(void)WaitLatch(MyLatch,
+						WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
+						PROVIDER_BATCH_POLL_INTERVAL, PG_WAIT_EXTENSION);
+		ResetLatch(MyLatch);
+	}
+}
+
+/*
+ * Set the result of a row from the response to its request, as the per-row
+ * function makes it. A successful result is stored in the result cache.
+ */
+static void put_provider_batch_result(PgAiJob *job, AIService *ai_service,
+									  ProviderBatchResponse *batch_response)
+{
+	Oid arg_types[3] = {INT8OID, INT8OID, TEXTOID};
+	Datum args[3];
+	RestResponse response;
+	char *result = batch_response->body;
+	char *value;
+
+	response.response_code = batch_response->status_code;
+	response.headers = NULL;
+	response.data = batch_response->body;
+	response.data_size = strlen(batch_response->body);
+	response.max_size = response.data_size + 1;
+
+	process_many_response(ai_service, &response);
+	if (response.response_code == HTTP_OK)
+		result = ai_service->service_data->response_data;
+
+	args[0] = Int64GetDatum(job->id);
+	args[1] = Int64GetDatum(batch_response->custom_id);
+	args[2] = CStringGetTextDatum(result);
+	if (write_job_tables(psprintf(JOB_BATCH_RESULT_QUERY, job_results_table),
+						 3, arg_types, args, NULL,
+						 1) == SPI_OK_UPDATE_RETURNING &&
+		SPI_processed > 0 && response.response_code == HTTP_OK &&
+		(value = SPI_getvalue(SPI_tuptable->vals[0], SPI_tuptable->tupdesc,
+							  1)))
+		result_cache_store(ai_service, value);
+}
+
+/* download a file of the batch of a job and set the results of its lines */
+static void ingest_provider_batch_file(PgAiJob *job, const int function_flags,
+									   const char *file_id)
+{
+	ProviderBatchResponse response;
+	StringInfoData line;
+	AIService *ai_service;
+	MemoryContext old_context;
+	BufFile *output;
+	bool more = true;
+
+	begin_job_transaction();
+	ai_service = get_job_service(job, function_flags);
+	old_context = MemoryContextSwitchTo(job_context);
+	output = provider_batch_download(ai_service, file_id);
+	MemoryContextSwitchTo(old_context);
+	end_job_transaction();
+
+	initStringInfo(&line);
+	while (more)
+	{
+		CHECK_FOR_INTERRUPTS();
+		begin_job_transaction();
+
+		ai_service = get_job_service(job, function_flags);
+		for (int i = 0; i < BATCH_WINDOW_SIZE &&
+						(more = provider_batch_next_response(output, &line,
+															 &response));
+			 i++)
+			put_provider_batch_result(job, ai_service, &response);
+
+		end_job_transaction();
+	}
+
+	BufFileClose(output);
+}
+
+/* the rows of a job done once its batch is, the last of its result rows */
+static void end_provider_batch(PgAiJob *job)
+{
+	Oid arg_types[1] = {INT8OID};
+	Datum args[1];
+	bool isnull;
+	Datum rows;
+
+	begin_job_transaction();
+	args[0] = Int64GetDatum(job->id);
+	if (SPI_execute_with_args(psprintf(JOB_BATCH_ROWS_QUERY,
+									   job_results_table),
+							  1, arg_types, args, NULL, true /* read_only */,
+							  1) == SPI_OK_SELECT &&
+		SPI_processed > 0)
+	{
+		rows = SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1,
+							 &isnull);
+		if (!isnull)
+			set_job_progress(job, DatumGetInt64(rows));
+	}
+	set_job_provider_batch(job, NULL);
+	end_job_transaction();
+}
+
+/*
+ * Run an insight or moderation job through the batch API of the provider:
+ * the requests of up to PROVIDER_BATCH_MAX_REQUESTS rows are uploaded as a
+ * batch, polled till the batch completes and the responses set as the
+ * results, and so on for the next rows. A job retried while waiting on its
+ * batch goes on waiting on it.
+ */
+static void run_provider_batch_job(PgAiJob *job, const int function_flags)
+{
+	size_t service_flags;
+	size_t model_flags;
+	char *output_file_id;
+	char *error_file_id;
+
+	if (get_service_model_flags(function_flags, &service_flags,
+								&model_flags) ||
+		service_flags != SERVICE_OPENAI)
+		ereport(ERROR, (errmsg("the provider batch mode is supported for "
+							   "the %s service only",
+							   SERVICE_OPENAI_NAME)));
+
+	while (job->provider_batch || create_provider_batch(job, function_flags))
+	{
+		if (!job->provider_batch)
+			continue;
+
+		wait_provider_batch(job, function_flags, &output_file_id,
+							&error_file_id);
+		pgstat_report_activity(
+			STATE_RUNNING, psprintf("pg_ai job " INT64_FORMAT, job->id));
+		if (output_file_id)
+			ingest_provider_batch_file(job, function_flags, output_file_id);
+		if (error_file_id)
+			ingest_provider_batch_file(job, function_flags, error_file_id);
+		end_provider_batch(job);
+	}
+}
+
+/*
+ * Run a create_vector_store job through the SQL function, in one transaction.
+ * Its result is the single row of the results.
+ */
+static void run_vector_store_job(PgAiJob *job)
+{
+	Oid arg_types[3] = {TEXTOID, TEXTOID, TEXTOID};
+	Datum args[3];
+	char nulls[3] = {' ', ' ', ' '};
+	char *notes = get_job_arg(job->args, JOB_ARG_NOTES);
+	char *query;
+	JobWindow window = {job->id, NULL, 1};
+
+	args[0] = CStringGetTextDatum(get_job_arg(job->args, JOB_ARG_STORE));
+	args[1] = CStringGetTextDatum(get_job_arg(job->args, JOB_ARG_QUERY));
+	args[2] = notes ? CStringGetTextDatum(notes) : (Datum)0;
+	nulls[2] = notes ? ' ' : 'n';
+
+	begin_job_transaction();
+	query = psprintf(JOB_VECTOR_STORE_QUERY,
+					 make_pg_ai_object_name("pg_ai_create_vector_store"));
+	if (SPI_execute_with_args(query, 3, arg_types, args, nulls,
+							  false /* read_only */, 1) == SPI_OK_SELECT &&
+		SPI_processed > 0)
+		put_job_result(&window, 1,
+					   SPI_getvalue(SPI_tuptable->vals[0],
+									SPI_tuptable->tupdesc, 1));
+	set_job_progress(job, 1);
+	end_job_transaction();
+}
+
+/* run an insight or moderation job, in the mode it was submitted with */
+static void run_rows_job(PgAiJob *job, const int function_flags)
+{
+	if (is_provider_batch_job(job->args))
+		run_provider_batch_job(job, function_flags);
+	else
+		run_batch_job(job, function_flags);
+}
+
+/* tell the listeners of the channel a job is done or has failed */
+static void notify_job(PgAiJob *job, const char *status)
+{
+	Oid arg_types[2] = {TEXTOID, TEXTOID};
+	Datum args[2];
+
+	args[0] = CStringGetTextDatum(PG_AI_JOB_CHANNEL);
+	args[1] = CStringGetTextDatum(
+		psprintf(INT64_FORMAT ":%s", job->id, status));
+	SPI_execute_with_args(JOB_NOTIFY_QUERY, 2, arg_types, args, NULL,
+						  false /* read_only */, 1);
+}
+
+/*
+ * Finish a job, done without an error. A failed job is queued again with a
+ * growing delay until it is out of attempts.
+ */
+static void end_job(PgAiJob *job, const char *error)
+{
+	Oid arg_types[3] = {INT8OID, TEXTOID, TEXTOID};
+	Datum args[3];
+	char nulls[3] = {' ', ' ', ' '};
+	const char *status = error ? "failed" : "done";
+	Portal portal;
+
+	begin_job_transaction();
+
+	if ((portal = SPI_cursor_find(get_job_cursor_name(job->id))))
+		SPI_cursor_close(portal);
+
+	args[0] = Int64GetDatum(job->id);
+	if (error && job->attempts < JOB_MAX_ATTEMPTS)
+	{
+		arg_types[2] = FLOAT8OID;
+		args[1] = CStringGetTextDatum(error);
+		args[2] = Float8GetDatum(
+			(float8)JOB_RETRY_DELAY *
+			(1 << (Max(Min(job->attempts, JOB_MAX_ATTEMPTS), 1) - 1)));
+		write_job_tables(psprintf(JOB_RETRY_QUERY, jobs_table), 3,
+						 arg_types, args, NULL, 0);
+	}
+	else
+	{
+		args[1] = CStringGetTextDatum(status);
+		args[2] = error ? CStringGetTextDatum(error) : (Datum)0;
+		nulls[2] = error ? ' ' : 'n';
+		write_job_tables(psprintf(JOB_FINISH_QUERY, jobs_table), 3,
+						 arg_types, args, nulls, 0);
+		notify_job(job, status);
+	}
+
+	lock_job(job->id, false);
+	end_job_transaction();
+}
+
+/*
+ * Run a claimed job. An error of a step rolls back that step only, the job
+ * is then retried from the progress it has committed.
+ */
+static void run_job(PgAiJob *job)
+{
+	ErrorData *error = NULL;
+
+	pgstat_report_activity(STATE_RUNNING,
+						   psprintf("pg_ai job " INT64_FORMAT, job->id));
+
+	PG_TRY();
+	{
+		switch (job->kind)
+		{
+		case JOB_KIND_INSIGHT:
+			run_rows_job(job, FUNCTION_GET_INSIGHT);
+			break;
+		case JOB_KIND_MODERATION:
+			run_rows_job(job, FUNCTION_MODERATION);
+			break;
+		case JOB_KIND_CREATE_VECTOR_STORE:
+			run_vector_store_job(job);
+			break;
+		default:
+			ereport(ERROR, (errmsg("unknown job kind")));
+		}
+	}
+	PG_CATCH();
+	{
+		MemoryContextSwitchTo(job_context);
+		error = CopyErrorData();
+		FlushErrorState();
+		AbortCurrentTransaction();
+		MemoryContextSwitchTo(job_context);
+	}
+	PG_END_TRY();
+
+	end_job(job, error ? error->message : NULL);
+	pgstat_report_activity(STATE_IDLE, NULL);
+}
+
+/*
+ * A worker runs the jobs of one role in one database, one job at a time,
+ * and exits once no job is queued.
+ */
+void pg_ai_job_worker_main(Datum main_arg)
+{
+	Oid role_id;
+	PgAiJob *job;
+	long wait_ms;
+
+	memcpy(&role_id, MyBgworkerEntry->bgw_extra, sizeof(Oid));
+
+	pqsignal(SIGTERM, die);
+	BackgroundWorkerUnblockSignals();
+	BackgroundWorkerInitializeConnectionByOid(DatumGetObjectId(main_arg),
+											  role_id, 0);
+
+	job_context = AllocSetContextCreate(TopMemoryContext, PG_AI_JOB_MCTX,
+										ALLOCSET_DEFAULT_SIZES);
+	MemoryContextSwitchTo(job_context);
+
+	begin_job_transaction();
+	jobs_table = make_pg_ai_object_name(PG_AI_JOBS_TABLE);
+	job_results_table = make_pg_ai_object_name(PG_AI_JOB_RESULTS_TABLE);
+	if (jobs_table && job_results_table)
+	{
+		jobs_table = MemoryContextStrdup(TopMemoryContext, jobs_table);
+		job_results_table =
+			MemoryContextStrdup(TopMemoryContext, job_results_table);
+		job_tables_owner = get_job_tables_owner(jobs_table);
+	}
+	end_job_transaction();
+
+	if (!OidIsValid(job_tables_owner))
+		proc_exit(0);
+
+	for (;;)
+	{
+		CHECK_FOR_INTERRUPTS();
+		MemoryContextReset(job_context);
+
+		if ((job = claim_job(role_id, &wait_ms)))
+		{
+			run_job(job);
+			continue;
+		}
+		if (wait_ms < 0)
+			break;
+
+		(void)WaitLatch(MyLatch,
+						WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
+						Min(wait_ms, JOB_WORKER_MAX_WAIT), PG_WAIT_EXTENSION);
+		ResetLatch(MyLatch);
+	}
+
+	proc_exit(0);
+}
@@ -0,0 +1,58 @@
+#include <postgres.h>
+#include <funcapi.h>
+
+#include "core/agg_state.h"
+
+/*
+ * The combine function of the pg_ai aggregates, merges the states of the
+ * parallel workers. Refer the SQL FUNCTION _pg_ai_agg_combinefn in the .sql
+ * file for details on the parameters and return value.
+ */
+PG_FUNCTION_INFO_V1(pg_ai_agg_combinefn);
+Datum pg_ai_agg_combinefn(PG_FUNCTION_ARGS)
+{
+	MemoryContext agg_context;
+	PgAiAggState *state1;
+	PgAiAggState *state2;
+
+	if (!AggCheckCallContext(fcinfo, &agg_context))
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("Function called in non-aggregate context")));
+
+	state1 = PG_ARGISNULL(0) ? NULL : (PgAiAggState *)PG_GETARG_POINTER(0);
+	state2 = PG_ARGISNULL(1) ? NULL : (PgAiAggState *)PG_GETARG_POINTER(1);
+	state1 = agg_state_combine(agg_context, state1, state2);
+
+	if (!state1)
+		PG_RETURN_NULL();
+	PG_RETURN_POINTER(state1);
+}
+
+/*
+ * The serialize function of the pg_ai aggregates, the state of a parallel
+ * worker is passed to the leader as bytea.
+ */
+PG_FUNCTION_INFO_V1(pg_ai_agg_serialfn);
+Datum pg_ai_agg_serialfn(PG_FUNCTION_ARGS)
+{
+	if (!AggCheckCallContext(fcinfo, NULL))
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("Function called in non-aggregate context")));
+
+	PG_RETURN_BYTEA_P(
+		agg_state_serialize((PgAiAggState *)PG_GETARG_POINTER(0)));
+}
+
+/*
+ * The deserialize function of the pg_ai aggregates, makes the state of a
+ * parallel worker from the bytea.
+ */
+PG_FUNCTION_INFO_V1(pg_ai_agg_deserialfn);
+Datum pg_ai_agg_deserialfn(PG_FUNCTION_ARGS)
+{
+	if (!AggCheckCallContext(fcinfo, NULL))
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("Function called in non-aggregate context")));
+
+	PG_RETURN_POINTER(agg_state_deserialize(PG_GETARG_BYTEA_PP(0)));
+}
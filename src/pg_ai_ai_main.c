@@ -1,7 +1,9 @@
 #include <postgres.h>
 #include <funcapi.h>
 
+#include "core/prefetch_scan.h"
 #include "guc/pg_ai_guc.h"
+#include "shmem/pg_ai_shmem.h"
 
 #define PG_AI_MIN_PG_VERSION 160000
 #if PG_VERSION_NUM < PG_AI_MIN_PG_VERSION
@@ -12,6 +14,11 @@
 PG_MODULE_MAGIC;
 #endif
 
-void _PG_init(void) { define_pg_ai_guc_variables(); }
+void _PG_init(void)
+{
+	define_pg_ai_guc_variables();
+	pg_ai_shmem_init();
+	init_prefetch_scan();
+}
 
 void _PG_fini(void) {}
@@ -0,0 +1,92 @@
+#include <postgres.h>
+#include <fmgr.h>
+
+#include "catalog/pg_type.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+
+#include "core/ai_config.h"
+#include "core/ai_error.h"
+#include "core/async_call.h"
+
+/*
+ * Start a call of a per-row function in the background, the value must not
+ * be NULL.
+ */
+static int64 start_async(FunctionCallInfo fcinfo, const int function_flags)
+{
+	if (PG_ARGISNULL(0))
+		ereport(ERROR, (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+						errmsg("%s", GET_ERR_STR(ARG_NULL))));
+
+	return async_call_start(
+		function_flags, text_to_cstring(PG_GETARG_TEXT_PP(0)),
+		PG_ARGISNULL(1) ? NULL : text_to_cstring(PG_GETARG_TEXT_PP(1)));
+}
+
+/*
+ * Implementation of SQL FUNCTION pg_ai_insight_async(). Refer to the .sql
+ * file for details on the parameters and return value.
+ */
+PG_FUNCTION_INFO_V1(pg_ai_insight_async);
+Datum pg_ai_insight_async(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_INT64(start_async(fcinfo, FUNCTION_GET_INSIGHT));
+}
+
+/*
+ * Implementation of SQL FUNCTION pg_ai_moderation_async().
+ */
+PG_FUNCTION_INFO_V1(pg_ai_moderation_async);
+Datum pg_ai_moderation_async(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_INT64(start_async(fcinfo, FUNCTION_MODERATION));
+}
+
+/*
+ * Implementation of SQL FUNCTION pg_ai_await().
+ */
+PG_FUNCTION_INFO_V1(pg_ai_await);
+Datum pg_ai_await(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_TEXT_P(cstring_to_text(async_call_await(PG_GETARG_INT64(0))));
+}
+
+/*
+ * Implementation of SQL FUNCTION pg_ai_await_all(), the results are in the
+ * order of the handles.
+ */
+PG_FUNCTION_INFO_V1(pg_ai_await_all);
+Datum pg_ai_await_all(PG_FUNCTION_ARGS)
+{
+	ArrayType *array = PG_GETARG_ARRAYTYPE_P(0);
+	Datum *elements;
+	bool *nulls;
+	int64 *handles;
+	char **results;
+	Datum *result_datums;
+	int dims[1];
+	int lbs[1] = {1};
+	int count;
+
+	deconstruct_array_builtin(array, INT8OID, &elements, &nulls, &count);
+	if (count == 0)
+		PG_RETURN_ARRAYTYPE_P(construct_empty_array(TEXTOID));
+
+	handles = palloc(sizeof(int64) * count);
+	for (int i = 0; i < count; i++)
+		handles[i] = nulls[i] ? 0 : DatumGetInt64(elements[i]);
+
+	results = palloc(sizeof(char *) * count);
+	async_call_await_all(handles, nulls, count, results);
+
+	result_datums = palloc(sizeof(Datum) * count);
+	for (int i = 0; i < count; i++)
+		result_datums[i] =
+			results[i] ? CStringGetTextDatum(results[i]) : (Datum)0;
+
+	dims[0] = count;
+	PG_RETURN_ARRAYTYPE_P(construct_md_array(result_datums, nulls, 1, dims,
+											 lbs, TEXTOID, -1, false,
+											 TYPALIGN_INT));
+}
@@ -0,0 +1,176 @@
+#include <postgres.h>
+#include <funcapi.h>
+
+#include "catalog/pg_type.h"
+#include "executor/spi.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/memutils.h"
+
+#include "core/ai_service.h"
+#include "core/batch_call.h"
+#include "cache/service_cache.h"
+
+/*
+ * Set up the call of a batch function with the service of the session and
+ * the prompt of the call, the rows of the result are materialized.
+ */
+static AIService *init_batch(FunctionCallInfo fcinfo, const int function_flags)
+{
+	AIService *ai_service;
+
+	InitMaterializedSRF(fcinfo, 0);
+
+	if (!(ai_service = get_call_service(fcinfo, function_flags)) ||
+		!ai_service->process_rest_response)
+		ereport(ERROR, (errmsg("%s", GET_ERR_STR(UNSUPPORTED_SERVICE))));
+	if (ai_service->set_and_validate_options(ai_service, fcinfo))
+		ereport(ERROR, (errmsg("%s", GET_ERR_STR(INVALID_OPTIONS))));
+
+	return ai_service;
+}
+
+/* put a result in the materialized rows of the batch function */
+static void put_batch_row(void *arg, const int64 ordinality, const char *result)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *)arg;
+	Datum row[2];
+	bool nulls[2] = {false, false};
+
+	row[0] = Int64GetDatum(ordinality);
+	row[1] = result ? CStringGetTextDatum(result) : (Datum)0;
+	nulls[1] = (result == NULL);
+	tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, row, nulls);
+}
+
+/*
+ * Call the service for the values of an array, a window of values at a
+ * time.
+ */
+static void batch_array(FunctionCallInfo fcinfo, const int function_flags)
+{
+	AIService *ai_service = init_batch(fcinfo, function_flags);
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
+	MemoryContext window_context;
+	MemoryContext old_context;
+	Datum *elements;
+	bool *nulls;
+	int count;
+
+	if (PG_ARGISNULL(0))
+		return;
+
+	deconstruct_array_builtin(PG_GETARG_ARRAYTYPE_P(0), TEXTOID, &elements,
+							  &nulls, &count);
+	window_context = AllocSetContextCreate(
+		CurrentMemoryContext, PG_AI_BATCH_MCTX, ALLOCSET_DEFAULT_SIZES);
+
+	for (int start = 0; start < count; start += BATCH_WINDOW_SIZE)
+	{
+		int size = Min(count - start, BATCH_WINDOW_SIZE);
+		char **values;
+
+		old_context = MemoryContextSwitchTo(window_context);
+		values = palloc(sizeof(char *) * size);
+		for (int i = 0; i < size; i++)
+			values[i] = nulls[start + i] ?
+							NULL :
+							TextDatumGetCString(elements[start + i]);
+		batch_call(ai_service, values, size, start + 1, put_batch_row, rsinfo);
+		MemoryContextSwitchTo(old_context);
+		MemoryContextReset(window_context);
+	}
+
+	MemoryContextDelete(window_context);
+}
+
+/*
+ * Call the service for the first column of the rows of an open cursor, a
+ * window of rows fetched at a time.
+ */
+static void batch_cursor(FunctionCallInfo fcinfo, const int function_flags)
+{
+	AIService *ai_service = init_batch(fcinfo, function_flags);
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
+	MemoryContext caller_context = CurrentMemoryContext;
+	MemoryContext window_context;
+	char *cursor_name;
+	Portal portal;
+	int64 ordinality = 1;
+
+	if (PG_ARGISNULL(0))
+		return;
+
+	cursor_name = text_to_cstring(PG_GETARG_TEXT_PP(0));
+	window_context = AllocSetContextCreate(caller_context, PG_AI_BATCH_MCTX,
+										   ALLOCSET_DEFAULT_SIZES);
+
+	SPI_connect();
+	if (!(portal = SPI_cursor_find(cursor_name)))
+		ereport(ERROR, (errcode(ERRCODE_UNDEFINED_CURSOR),
+						errmsg("cursor \"%s\" does not exist", cursor_name)));
+
+	for (;;)
+	{
+		SPITupleTable *tuptable;
+		char **values;
+		int size;
+
+		SPI_cursor_fetch(portal, true /* forward */, BATCH_WINDOW_SIZE);
+		if (SPI_processed == 0)
+			break;
+		tuptable = SPI_tuptable;
+		size = SPI_processed;
+
+		/* the values are copied out, the calls use SPI of their own */
+		MemoryContextSwitchTo(window_context);
+		values = palloc(sizeof(char *) * size);
+		for (int i = 0; i < size; i++)
+			values[i] = SPI_getvalue(tuptable->vals[i], tuptable->tupdesc, 1);
+		SPI_freetuptable(tuptable);
+
+		batch_call(ai_service, values, size, ordinality, put_batch_row, rsinfo);
+		ordinality += size;
+		MemoryContextReset(window_context);
+	}
+
+	SPI_finish();
+	MemoryContextSwitchTo(caller_context);
+	MemoryContextDelete(window_context);
+}
+
+/*
+ * The implementation of SQL FUNCTION pg_ai_insight_batch. Refer to the .sql
+ * file for details on the parameters and return values.
+ */
+PG_FUNCTION_INFO_V1(pg_ai_insight_batch);
+Datum pg_ai_insight_batch(PG_FUNCTION_ARGS)
+{
+	batch_array(fcinfo, FUNCTION_GET_INSIGHT);
+	return (Datum)0;
+}
+
+PG_FUNCTION_INFO_V1(pg_ai_insight_batch_cursor);
+Datum pg_ai_insight_batch_cursor(PG_FUNCTION_ARGS)
+{
+	batch_cursor(fcinfo, FUNCTION_GET_INSIGHT);
+	return (Datum)0;
+}
+
+/*
+ * The implementation of SQL FUNCTION pg_ai_moderation_batch. Refer to the
+ * .sql file for details on the parameters and return values.
+ */
+PG_FUNCTION_INFO_V1(pg_ai_moderation_batch);
+Datum pg_ai_moderation_batch(PG_FUNCTION_ARGS)
+{
+	batch_array(fcinfo, FUNCTION_MODERATION);
+	return (Datum)0;
+}
+
+PG_FUNCTION_INFO_V1(pg_ai_moderation_batch_cursor);
+Datum pg_ai_moderation_batch_cursor(PG_FUNCTION_ARGS)
+{
+	batch_cursor(fcinfo, FUNCTION_MODERATION);
+	return (Datum)0;
+}
@@ -0,0 +1,49 @@
+#include <postgres.h>
+#include <funcapi.h>
+#include <utils/builtins.h>
+
+#include "cache/query_cache.h"
+
+/*
+ * Implementation of SQL FUNCTION pg_ai_query_cache_stats(). Refer to the .sql
+ * file for details on the return values.
+ */
+PG_FUNCTION_INFO_V1(pg_ai_query_cache_stats);
+Datum pg_ai_query_cache_stats(PG_FUNCTION_ARGS)
+{
+	TupleDesc tupdesc;
+	Datum values[4];
+	bool nulls[4] = {false, false, false, false};
+	int64 entries;
+	int64 hits;
+	int64 misses;
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("Function returning record called in context "
+							   "that cannot accept type record")));
+
+	query_cache_get_stats(&entries, &hits, &misses);
+	values[0] = Int64GetDatum(entries);
+	values[1] = Int64GetDatum(hits);
+	values[2] = Int64GetDatum(misses);
+
+	/* no ratio till the cache is used */
+	if (hits + misses > 0)
+		values[3] = Float8GetDatum((double)hits / (double)(hits + misses));
+	else
+		nulls[3] = true;
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(
+		heap_form_tuple(BlessTupleDesc(tupdesc), values, nulls)));
+}
+
+/*
+ * Implementation of SQL FUNCTION pg_ai_query_cache_reset().
+ */
+PG_FUNCTION_INFO_V1(pg_ai_query_cache_reset);
+Datum pg_ai_query_cache_reset(PG_FUNCTION_ARGS)
+{
+	query_cache_reset();
+	PG_RETURN_VOID();
+}
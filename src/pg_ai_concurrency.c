@@ -0,0 +1,67 @@
+#include <postgres.h>
+#include <funcapi.h>
+#include <utils/builtins.h>
+
+#include "rest/adaptive_limit.h"
+
+/*
+ * Implementation of SQL FUNCTION pg_ai_concurrency_limits(). Refer to the
+ * .sql file for details on the return values.
+ */
+PG_FUNCTION_INFO_V1(pg_ai_concurrency_limits);
+Datum pg_ai_concurrency_limits(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
+	AdaptiveLimitStats *stats;
+	Datum values[7];
+	bool nulls[7] = {false, false, false, false, false, false, false};
+	int count;
+
+	InitMaterializedSRF(fcinfo, 0);
+
+	count = adaptive_limit_get_stats(&stats);
+	for (int i = 0; i < count; i++)
+	{
+		values[0] = CStringGetTextDatum(stats[i].url);
+		values[1] = Float8GetDatum(stats[i].limit);
+		values[2] = Int32GetDatum(stats[i].in_flight);
+		values[3] = Int32GetDatum(stats[i].batch_in_flight);
+		values[4] = Int32GetDatum(stats[i].waiting[TRAFFIC_CLASS_INTERACTIVE]);
+		values[5] = Int32GetDatum(stats[i].waiting[TRAFFIC_CLASS_BATCH]);
+		values[6] = Float8GetDatum(stats[i].latency_ms);
+		tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values,
+							 nulls);
+	}
+
+	return (Datum)0;
+}
+
+/*
+ * Implementation of SQL FUNCTION pg_ai_concurrency_history(). Refer to the
+ * .sql file for details on the return values.
+ */
+PG_FUNCTION_INFO_V1(pg_ai_concurrency_history);
+Datum pg_ai_concurrency_history(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
+	AdaptiveLimitChange *changes;
+	Datum values[4];
+	bool nulls[4] = {false, false, false, false};
+	int count;
+
+	InitMaterializedSRF(fcinfo, 0);
+
+	count = adaptive_limit_get_history(&changes);
+	for (int i = 0; i < count; i++)
+	{
+		values[0] = CStringGetTextDatum(changes[i].url);
+		values[1] = TimestampTzGetDatum(changes[i].changed_at);
+		values[2] = Float8GetDatum(changes[i].limit);
+		values[3] = CStringGetTextDatum(
+			adaptive_limit_reason_name(changes[i].reason));
+		tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values,
+							 nulls);
+	}
+
+	return (Datum)0;
+}
@@ -49,8 +49,8 @@ static void process_result_set(AIService *ai_service, FuncCallContext *funcctx)
 	 * These should match the column names/alias of the SELECT statement
 	 * returned by the respective_embeddings services (make_embeddings_query())
 	 */
-	char *hide_cols[] = {EMBEDDINGS_COLUMN_NAME, OPTION_SIMILARITY_ALGORITHM,
-						 pk_col};
+	char *hide_cols[] = {EMBEDDINGS_COLUMN_NAME,
+						 OPTION_SIMILARITY_ALGORITHM_STR, pk_col};
 	int hide_col_count = sizeof(hide_cols) / sizeof(hide_cols[0]);
 	SrfQueryData *query_data;
 
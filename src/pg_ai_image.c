@@ -2,29 +2,22 @@
 #include <funcapi.h>
 #include <utils/builtins.h>
 
+#include "core/agg_state.h"
 #include "core/ai_service.h"
+#include "cache/service_cache.h"
 
 PG_FUNCTION_INFO_V1(pg_ai_generate_image);
 Datum pg_ai_generate_image(PG_FUNCTION_ARGS)
 {
-	AIService *ai_service = palloc_AIService();
-	MemoryContext func_context;
-	MemoryContext old_context;
+	AIService *ai_service;
 	text *return_text;
 
 	/* check for the column name whose value is to be interpreted */
 	if (PG_ARGISNULL(0))
 		PG_RETURN_TEXT_P(GET_ERR_TEXT(NULL_STR));
 
-	/* Create a new memory context for this PgAi function */
-	func_context = AllocSetContextCreate(CurrentMemoryContext, PG_AI_MCTX,
-										 ALLOCSET_DEFAULT_SIZES);
-	old_context = MemoryContextSwitchTo(func_context);
-	ai_service->memory_context = func_context;
-
-	/* set the function specific flag */
-	ai_service->function_flags |= FUNCTION_GENERATE_IMAGE;
-	CREATE_SERVICE(ai_service);
+	/* the service of the session is reused */
+	GET_CALL_SERVICE(ai_service, fcinfo, FUNCTION_GENERATE_IMAGE);
 
 	/* set options based on parameters and read from guc */
 	SET_AND_VALIDATE_OPTIONS(ai_service, fcinfo);
@@ -38,12 +31,8 @@ Datum pg_ai_generate_image(PG_FUNCTION_ARGS)
 	/* call the transfer */
 	REST_TRANSFER(ai_service);
 
-	/* copy the result to old mem conext and free the function context */
-	MemoryContextSwitchTo(old_context);
+	/* copy the result, the service buffers are reused by the next call */
 	return_text = cstring_to_text((char *)(ai_service->rest_response->data));
-	if (ai_service->memory_context)
-		MemoryContextDelete(ai_service->memory_context);
-	pfree(ai_service);
 
 	PG_RETURN_TEXT_P(return_text);
 }
@@ -57,36 +46,8 @@ Datum pg_ai_generate_image(PG_FUNCTION_ARGS)
 PG_FUNCTION_INFO_V1(pg_ai_generate_image_agg_transfn);
 Datum pg_ai_generate_image_agg_transfn(PG_FUNCTION_ARGS)
 {
-	MemoryContext old_context;
-	MemoryContext agg_context;
-	AIService *ai_service;
-
-	if (!AggCheckCallContext(fcinfo, &agg_context))
-		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-						errmsg("Function called in non-aggregate context")));
-
-	ai_service = fcinfo->flinfo->fn_extra;
-	/* if this is the first call, set up the query state */
-	if (ai_service == NULL)
-	{
-		old_context = MemoryContextSwitchTo(agg_context);
-		ai_service = palloc_AIService();
-		ai_service->memory_context = agg_context;
-
-		ai_service->function_flags |= FUNCTION_GENERATE_IMAGE_AGGREGATE;
-		CREATE_SERVICE(ai_service);
-
-		SET_AND_VALIDATE_OPTIONS(ai_service, fcinfo);
-
-		MemoryContextSwitchTo(old_context);
-		fcinfo->flinfo->fn_extra = ai_service;
-	}
-
-	/* accumulate non NULL values and set the service data */
-	if (!PG_ARGISNULL(1))
-		SET_SERVICE_DATA(ai_service, text_to_cstring(PG_GETARG_TEXT_P(1)));
-
-	PG_RETURN_POINTER(ai_service);
+	/* only the values are kept, the service is used by the final function */
+	PG_RETURN_POINTER(agg_state_accumulate(fcinfo, false));
 }
 
 /*
@@ -98,17 +59,22 @@ Datum pg_ai_generate_image_agg_transfn(PG_FUNCTION_ARGS)
 PG_FUNCTION_INFO_V1(pg_ai_generate_image_agg_finalfn);
 Datum pg_ai_generate_image_agg_finalfn(PG_FUNCTION_ARGS)
 {
+	PgAiAggState *state;
 	AIService *ai_service;
 	text *return_text;
 
-	/* ai_service will not created if all values of column are NULL */
-	ai_service = (AIService *)PG_GETARG_POINTER(0);
-	if (ai_service == NULL)
+	/* no state if there were no rows, no values if all of them were NULL */
+	state = PG_ARGISNULL(0) ? NULL : (PgAiAggState *)PG_GETARG_POINTER(0);
+	if (!state || !state->value_count)
 		PG_RETURN_TEXT_P(GET_ERR_TEXT(NULL_STR));
 
-	/* error out if the final fn called on unsupported model */
-	if (!valid_AIService_ptr(ai_service))
-		PG_RETURN_TEXT_P(GET_ERR_TEXT(UNSUPPORTED_SERVICE));
+	/* the service of the session is reused */
+	GET_CALL_SERVICE(ai_service, fcinfo, FUNCTION_GENERATE_IMAGE_AGGREGATE);
+
+	/* set the prompt and the accumulated values of the aggregate */
+	if (set_agg_state_options(ai_service, state))
+		PG_RETURN_TEXT_P(GET_ERR_TEXT(INVALID_OPTIONS));
+	SET_SERVICE_DATA(ai_service, agg_state_get_values(state));
 
 	/* prepare for transfer */
 	PREPARE_FOR_TRANSFER(ai_service);
@@ -1,8 +1,16 @@
 #include <postgres.h>
 #include <funcapi.h>
 
+#include "core/agg_state.h"
 #include "core/ai_service.h"
+#include "core/map_reduce.h"
 #include "core/utils_pg_ai.h"
+#include "cache/memo_cache.h"
+#include "cache/prefetch_cache.h"
+#include "cache/result_cache.h"
+#include "cache/semantic_cache.h"
+#include "cache/service_cache.h"
+#include "rest/single_flight.h"
 
 /*
  * The implementation of SQL FUNCTION get_insight. Refer to the .sql file for
@@ -11,43 +19,68 @@
 PG_FUNCTION_INFO_V1(pg_ai_insight);
 Datum pg_ai_insight(PG_FUNCTION_ARGS)
 {
-	AIService *ai_service = palloc_AIService();
-	MemoryContext func_context;
-	MemoryContext old_context;
+	AIService *ai_service;
+	char *column_value;
+	char *prompt;
+	char *result;
+	char *embeddings;
+	bool cacheable = true;
 	text *return_text;
 
 	/* check for the column to be interpreted */
 	if (PG_ARGISNULL(0))
 		PG_RETURN_TEXT_P(GET_ERR_TEXT(NULL_STR));
 
-	/* Create a new memory context for this PgAi function */
-	func_context = AllocSetContextCreate(CurrentMemoryContext, PG_AI_MCTX,
-										 ALLOCSET_DEFAULT_SIZES);
-	old_context = MemoryContextSwitchTo(func_context);
-	ai_service->memory_context = func_context;
+	/* a value repeated within the query is answered from the memo */
+	column_value = text_to_cstring(PG_GETARG_TEXT_P(0));
+	prompt = PG_ARGISNULL(1) ? NULL : text_to_cstring(PG_GETARG_TEXT_P(1));
+	if ((result = memo_cache_lookup(fcinfo, column_value, prompt)))
+		PG_RETURN_TEXT_P(cstring_to_text(result));
+
+	/* a row read ahead by a prefetch scan has its result already */
+	if ((result = prefetch_cache_lookup(FUNCTION_GET_INSIGHT, column_value,
+										prompt)))
+	{
+		memo_cache_store(fcinfo, column_value, prompt, result);
+		PG_RETURN_TEXT_P(cstring_to_text(result));
+	}
 
-	/* set the function specific flag */
-	ai_service->function_flags |= FUNCTION_GET_INSIGHT;
-	CREATE_SERVICE(ai_service);
+	/*
+	 * The service of the session is reused, the buffers are overwritten by
+	 * every call and the other allocations of a row go with the caller's
+	 * memory context.
+	 */
+	GET_CALL_SERVICE(ai_service, fcinfo, FUNCTION_GET_INSIGHT);
 
 	/* set options based on parameters and read from guc */
 	SET_AND_VALIDATE_OPTIONS(ai_service, fcinfo);
 
 	/* set the service data to be sent to the AI service	*/
-	SET_SERVICE_DATA(ai_service, text_to_cstring(PG_GETARG_TEXT_P(0)));
+	SET_SERVICE_DATA(ai_service, column_value);
 
-	/* prepare for transfer */
-	PREPARE_FOR_TRANSFER(ai_service);
+	/* a value seen earlier, or a similar one, is served from the caches */
+	result = result_cache_lookup(ai_service, column_value);
+	if (!result)
+		result = semantic_cache_lookup(ai_service, column_value, &embeddings);
+	if (!result)
+	{
+		/* prepare for transfer */
+		PREPARE_FOR_TRANSFER(ai_service);
 
-	/* call the transfer */
-	REST_TRANSFER(ai_service);
+		/* call the transfer, shared with the same calls of other sessions */
+		SHARED_REST_TRANSFER(ai_service, column_value);
 
-	/* copy the result to old mem conext and free the function context */
-	MemoryContextSwitchTo(old_context);
-	return_text = cstring_to_text((char *)(ai_service->rest_response->data));
-	if (ai_service->memory_context)
-		MemoryContextDelete(ai_service->memory_context);
-	pfree(ai_service);
+		result_cache_store(ai_service, column_value);
+		semantic_cache_store(ai_service, embeddings);
+		result = (char *)(ai_service->rest_response->data);
+		cacheable = (ai_service->rest_response->response_code == HTTP_OK);
+	}
+
+	if (cacheable)
+		memo_cache_store(fcinfo, column_value, prompt, result);
+
+	/* copy the result, the service buffers are reused by the next call */
+	return_text = cstring_to_text(result);
 
 	PG_RETURN_TEXT_P(return_text);
 }
@@ -61,36 +94,8 @@ Datum pg_ai_insight(PG_FUNCTION_ARGS)
 PG_FUNCTION_INFO_V1(pg_ai_insight_agg_transfn);
 Datum pg_ai_insight_agg_transfn(PG_FUNCTION_ARGS)
 {
-	MemoryContext old_context;
-	MemoryContext agg_context;
-	AIService *ai_service;
-
-	if (!AggCheckCallContext(fcinfo, &agg_context))
-		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-						errmsg("Function called in non-aggregate context")));
-
-	ai_service = fcinfo->flinfo->fn_extra;
-	/* if this is the first call, set up the query state */
-	if (ai_service == NULL)
-	{
-		old_context = MemoryContextSwitchTo(agg_context);
-		ai_service = palloc_AIService();
-		ai_service->memory_context = agg_context;
-
-		ai_service->function_flags |= FUNCTION_GET_INSIGHT_AGGREGATE;
-		CREATE_SERVICE(ai_service);
-
-		SET_AND_VALIDATE_OPTIONS(ai_service, fcinfo);
-
-		MemoryContextSwitchTo(old_context);
-		fcinfo->flinfo->fn_extra = ai_service;
-	}
-
-	/* accumulate non NULL values and set the service data */
-	if (!PG_ARGISNULL(1))
-		SET_SERVICE_DATA(ai_service, text_to_cstring(PG_GETARG_TEXT_P(1)));
-
-	PG_RETURN_POINTER(ai_service);
+	/* only the values are kept, the service is used by the final function */
+	PG_RETURN_POINTER(agg_state_accumulate(fcinfo, true));
 }
 
 /*
@@ -102,17 +107,30 @@ Datum pg_ai_insight_agg_transfn(PG_FUNCTION_ARGS)
 PG_FUNCTION_INFO_V1(pg_ai_insight_agg_finalfn);
 Datum pg_ai_insight_agg_finalfn(PG_FUNCTION_ARGS)
 {
+	PgAiAggState *state;
 	AIService *ai_service;
+	char *values;
+	char *error;
 	text *return_text;
 
-	/* ai_service will not created if all values of column are NULL */
-	ai_service = (AIService *)PG_GETARG_POINTER(0);
-	if (ai_service == NULL)
+	/* no state if there were no rows, no values if all of them were NULL */
+	state = PG_ARGISNULL(0) ? NULL : (PgAiAggState *)PG_GETARG_POINTER(0);
+	if (!state || !state->value_count)
 		PG_RETURN_TEXT_P(GET_ERR_TEXT(NULL_STR));
 
-	/* error out if the final fn called on unsupported model */
-	if (!valid_AIService_ptr(ai_service))
-		PG_RETURN_TEXT_P(GET_ERR_TEXT(UNSUPPORTED_SERVICE));
+	/* the service of the session is reused */
+	GET_CALL_SERVICE(ai_service, fcinfo, FUNCTION_GET_INSIGHT_AGGREGATE);
+
+	/* set the prompt of the aggregate */
+	if (set_agg_state_options(ai_service, state))
+		PG_RETURN_TEXT_P(GET_ERR_TEXT(INVALID_OPTIONS));
+
+	/* an input over the context of the model is summarized in chunks first */
+	values =
+		map_reduce_values(ai_service, agg_state_get_values(state), &error);
+	if (!values)
+		PG_RETURN_TEXT_P(cstring_to_text(error));
+	SET_SERVICE_DATA(ai_service, values);
 
 	/* prepare for transfer */
 	PREPARE_FOR_TRANSFER(ai_service);
@@ -0,0 +1,30 @@
+#include <postgres.h>
+#include <fmgr.h>
+#include <utils/builtins.h>
+#include <utils/jsonb.h>
+
+#include "jobs/job_queue.h"
+
+/*
+ * Implementation of SQL FUNCTION pg_ai_submit_job(). Refer to the .sql file
+ * for the kinds of jobs and their arguments.
+ */
+PG_FUNCTION_INFO_V1(pg_ai_submit_job);
+Datum pg_ai_submit_job(PG_FUNCTION_ARGS)
+{
+	if (PG_ARGISNULL(0) || PG_ARGISNULL(1))
+		ereport(ERROR, (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+						errmsg("job kind and arguments cannot be null")));
+
+	PG_RETURN_INT64(submit_job(text_to_cstring(PG_GETARG_TEXT_PP(0)),
+							   PG_GETARG_JSONB_P(1)));
+}
+
+/*
+ * Implementation of SQL FUNCTION pg_ai_resume_jobs().
+ */
+PG_FUNCTION_INFO_V1(pg_ai_resume_jobs);
+Datum pg_ai_resume_jobs(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_BOOL(resume_jobs());
+}
@@ -0,0 +1,143 @@
+#include <postgres.h>
+#include <funcapi.h>
+#include <utils/builtins.h>
+
+#include "rest/recent_requests.h"
+#include "rest/request_stats.h"
+
+#define PG_AI_STAT_COLUMNS 29
+#define PG_AI_RECENT_REQUESTS_COLUMNS 16
+
+/*
+ * Implementation of SQL FUNCTION pg_ai_stat(), behind the pg_stat_pg_ai
+ * view. Refer to the .sql file for details on the return values.
+ */
+PG_FUNCTION_INFO_V1(pg_ai_stat);
+Datum pg_ai_stat(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
+	RequestStats *stats;
+	Datum values[PG_AI_STAT_COLUMNS];
+	bool nulls[PG_AI_STAT_COLUMNS];
+	double percentiles[3] = {0.5, 0.95, 0.99};
+	int count;
+	int col;
+
+	InitMaterializedSRF(fcinfo, 0);
+
+	count = request_stats_get(&stats);
+	for (int i = 0; i < count; i++)
+	{
+		memset(nulls, 0, sizeof(nulls));
+		col = 0;
+		values[col++] = CStringGetTextDatum(stats[i].service);
+		values[col++] = CStringGetTextDatum(stats[i].model);
+		values[col++] = CStringGetTextDatum(
+			request_stats_function_name(stats[i].function_flags));
+		values[col++] = Int64GetDatum(stats[i].calls);
+		values[col++] = Int64GetDatum(stats[i].errors);
+		values[col++] = Int64GetDatum(stats[i].client_errors);
+		values[col++] = Int64GetDatum(stats[i].throttled);
+		values[col++] = Int64GetDatum(stats[i].server_errors);
+		values[col++] = Int64GetDatum(stats[i].transfer_errors);
+		values[col++] = Int64GetDatum(stats[i].bytes_sent);
+		values[col++] = Int64GetDatum(stats[i].bytes_received);
+		values[col++] = Int64GetDatum(stats[i].tokens_in);
+		values[col++] = Int64GetDatum(stats[i].tokens_out);
+		values[col++] = Int64GetDatum(stats[i].cache_hits);
+		values[col++] = Float8GetDatum(stats[i].total_time_ms);
+
+		/* no latencies till the first request */
+		nulls[col] = stats[i].calls == 0;
+		values[col++] =
+			Float8GetDatum(stats[i].calls ?
+							   stats[i].total_time_ms / stats[i].calls :
+							   0);
+		for (int p = 0; p < 3; p++)
+		{
+			nulls[col] = stats[i].calls == 0;
+			values[col++] = Float8GetDatum(
+				request_stats_latency_percentile(&stats[i], percentiles[p]));
+		}
+		values[col++] = Float8GetDatum(stats[i].dns_time_ms);
+		values[col++] = Float8GetDatum(stats[i].connect_time_ms);
+		values[col++] = Float8GetDatum(stats[i].tls_time_ms);
+		values[col++] = Float8GetDatum(stats[i].ttfb_time_ms);
+		values[col++] = Float8GetDatum(stats[i].transfer_time_ms);
+		values[col++] = Int64GetDatum(stats[i].new_connections);
+		values[col++] = Int64GetDatum(stats[i].http1_calls);
+		values[col++] = Int64GetDatum(stats[i].http2_calls);
+		values[col++] = Int64GetDatum(stats[i].http3_calls);
+		values[col++] = TimestampTzGetDatum(stats[i].stats_since);
+
+		tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values,
+							 nulls);
+	}
+
+	return (Datum)0;
+}
+
+/*
+ * Implementation of SQL FUNCTION pg_ai_stat_reset().
+ */
+PG_FUNCTION_INFO_V1(pg_ai_stat_reset);
+Datum pg_ai_stat_reset(PG_FUNCTION_ARGS)
+{
+	request_stats_reset();
+	PG_RETURN_VOID();
+}
+
+/*
+ * Implementation of SQL FUNCTION pg_ai_recent_requests(). Refer to the .sql
+ * file for details on the return values.
+ */
+PG_FUNCTION_INFO_V1(pg_ai_recent_requests);
+Datum pg_ai_recent_requests(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *)fcinfo->resultinfo;
+	RecentRequest *requests;
+	RequestTimings *timings;
+	Datum values[PG_AI_RECENT_REQUESTS_COLUMNS];
+	bool nulls[PG_AI_RECENT_REQUESTS_COLUMNS];
+	char request_hash[9];
+	int count;
+	int col;
+
+	InitMaterializedSRF(fcinfo, 0);
+
+	count = recent_requests_get(&requests);
+	for (int i = 0; i < count; i++)
+	{
+		timings = &requests[i].timings;
+		memset(nulls, 0, sizeof(nulls));
+		col = 0;
+		values[col++] = TimestampTzGetDatum(requests[i].finished_at);
+		values[col++] = Int32GetDatum(requests[i].pid);
+		values[col++] = CStringGetTextDatum(
+			request_stats_function_name(requests[i].function_flags));
+		values[col++] = CStringGetTextDatum(requests[i].endpoint);
+
+		/* no status for a transfer without an HTTP answer */
+		nulls[col] = requests[i].status < 100;
+		values[col++] = Int32GetDatum((int32)requests[i].status);
+		values[col++] = CStringGetTextDatum(
+			request_stats_http_version_name(timings->http_version));
+		values[col++] = Float8GetDatum((double)requests[i].latency_ms);
+		values[col++] = Float8GetDatum(timings->dns_us / 1000.0);
+		values[col++] = Float8GetDatum(timings->connect_us / 1000.0);
+		values[col++] = Float8GetDatum(timings->tls_us / 1000.0);
+		values[col++] = Float8GetDatum(timings->ttfb_us / 1000.0);
+		values[col++] = Float8GetDatum(timings->transfer_us / 1000.0);
+		values[col++] = BoolGetDatum(timings->new_connections > 0);
+		values[col++] = Int64GetDatum(timings->bytes_sent);
+		values[col++] = Int64GetDatum(timings->bytes_received);
+		snprintf(request_hash, sizeof(request_hash), "%08x",
+				 requests[i].request_hash);
+		values[col++] = CStringGetTextDatum(request_hash);
+
+		tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values,
+							 nulls);
+	}
+
+	return (Datum)0;
+}
@@ -0,0 +1,144 @@
+#include <postgres.h>
+#include <fmgr.h>
+
+#include "nodes/nodeFuncs.h"
+#include "nodes/pathnodes.h"
+#include "nodes/supportnodes.h"
+#include "optimizer/cost.h"
+#include "utils/lsyscache.h"
+
+#include "core/ai_service.h"
+#include "core/tokenizer.h"
+#include "core/utils_pg_ai.h"
+
+/* the SQL functions the support function estimates for */
+typedef struct PgAiSupportedFunction
+{
+	const char *name;
+	int function_flags;
+} PgAiSupportedFunction;
+
+static const PgAiSupportedFunction supported_functions[] = {
+	{"pg_ai_insight", FUNCTION_GET_INSIGHT},
+	{"pg_ai_moderation", FUNCTION_MODERATION},
+	{"pg_ai_generate_image", FUNCTION_GENERATE_IMAGE},
+	{"pg_ai_query_vector_store", FUNCTION_QUERY_VECTOR_STORE}};
+
+/* the argument of pg_ai_query_vector_store with the rows returned */
+#define QUERY_VECTOR_STORE_COUNT_ARG 2
+
+/* the functions of the extension, not others of the same name */
+static int get_function_flags(const Oid funcid)
+{
+	char *name;
+
+	if (get_func_namespace(funcid) != get_pg_ai_schema())
+		return 0;
+
+	name = get_func_name(funcid);
+	if (name)
+		for (int i = 0; i < lengthof(supported_functions); i++)
+			if (strcmp(supported_functions[i].name, name) == 0)
+				return supported_functions[i].function_flags;
+	return 0;
+}
+
+/*
+ * The width of an argument in bytes: the length of a constant, the average
+ * width in the statistics of a column, or the average of its type.
+ */
+static int32 get_arg_width(PlannerInfo *root, Node *arg)
+{
+	int32 width = 0;
+
+	if (IsA(arg, Const))
+	{
+		Const *value = (Const *)arg;
+
+		if (value->constisnull)
+			return 0;
+		if (value->constlen == -1)
+			return VARSIZE_ANY_EXHDR(DatumGetPointer(value->constvalue));
+	}
+
+	if (IsA(arg, Var) && root && ((Var *)arg)->varlevelsup == 0 &&
+		((Var *)arg)->varno < root->simple_rel_array_size)
+	{
+		Var *var = (Var *)arg;
+		RangeTblEntry *rte = planner_rt_fetch(var->varno, root);
+
+		if (rte->rtekind == RTE_RELATION)
+			width = get_attavgwidth(rte->relid, var->varattno);
+	}
+
+	return width > 0 ? width : get_typavgwidth(exprType(arg), exprTypmod(arg));
+}
+
+/*
+ * The cost of a call is a round trip to the model, the tokens sent and the
+ * tokens the model is asked to generate. The model is the one the current
+ * settings use for the function.
+ */
+static void estimate_cost(SupportRequestCost *req, const int function_flags)
+{
+	const ModelContext *model = get_function_model_context(function_flags);
+	int64 input_tokens = 0;
+	ListCell *lc;
+
+	foreach (lc, ((FuncExpr *)req->node)->args)
+		input_tokens +=
+			get_arg_width(req->root, lfirst(lc)) / ESTIMATE_BYTES_PER_TOKEN;
+
+	req->startup = 0;
+	req->per_tuple =
+		cpu_operator_cost *
+		(model->call_cost + input_tokens * PLANNER_INPUT_TOKEN_COST +
+		 model->output_tokens * PLANNER_OUTPUT_TOKEN_COST);
+}
+
+/*
+ * The planner support function of the AI functions. Refer the SQL FUNCTION
+ * _pg_ai_support in the .sql file, the functions without an estimate here
+ * keep their declared COST and ROWS.
+ */
+PG_FUNCTION_INFO_V1(pg_ai_support);
+Datum pg_ai_support(PG_FUNCTION_ARGS)
+{
+	Node *rawreq = (Node *)PG_GETARG_POINTER(0);
+	int function_flags;
+
+	if (IsA(rawreq, SupportRequestCost))
+	{
+		SupportRequestCost *req = (SupportRequestCost *)rawreq;
+
+		if (!req->node || !IsA(req->node, FuncExpr) ||
+			!(function_flags = get_function_flags(req->funcid)))
+			PG_RETURN_POINTER(NULL);
+
+		estimate_cost(req, function_flags);
+		PG_RETURN_POINTER(req);
+	}
+
+	if (IsA(rawreq, SupportRequestRows))
+	{
+		SupportRequestRows *req = (SupportRequestRows *)rawreq;
+		Node *count;
+
+		/* a constant count of the matches is the rows returned */
+		if (!req->node || !IsA(req->node, FuncExpr) ||
+			get_function_flags(req->funcid) != FUNCTION_QUERY_VECTOR_STORE ||
+			list_length(((FuncExpr *)req->node)->args) <=
+				QUERY_VECTOR_STORE_COUNT_ARG)
+			PG_RETURN_POINTER(NULL);
+
+		count = list_nth(((FuncExpr *)req->node)->args,
+						 QUERY_VECTOR_STORE_COUNT_ARG);
+		if (!IsA(count, Const) || ((Const *)count)->constisnull)
+			PG_RETURN_POINTER(NULL);
+
+		req->rows = Max(DatumGetInt32(((Const *)count)->constvalue), 0);
+		PG_RETURN_POINTER(req);
+	}
+
+	PG_RETURN_POINTER(NULL);
+}
@@ -0,0 +1,505 @@
+#include "adaptive_limit.h"
+
+#include "miscadmin.h"
+#include "access/xact.h"
+#include "storage/condition_variable.h"
+#include "storage/ipc.h"
+#include "storage/shmem.h"
+#include "utils/wait_event.h"
+
+#include "guc/pg_ai_guc.h"
+
+/* the concurrency limit of an endpoint and the recent changes to it */
+typedef struct AdaptiveLimitEndpoint
+{
+	char url[ADAPTIVE_LIMIT_URL_LENGTH]; /* empty for an unused endpoint */
+	double limit;
+	int in_flight;
+	int batch_in_flight;
+	int waiting[TRAFFIC_CLASS_COUNT];
+	double latency_ms; /* smoothed latency of the successful requests */
+	TimestampTz last_decrease;
+	int history_next;
+	int history_count;
+	TimestampTz history_at[ADAPTIVE_LIMIT_HISTORY_SIZE];
+	double history_limit[ADAPTIVE_LIMIT_HISTORY_SIZE];
+	AdaptiveLimitReason history_reason[ADAPTIVE_LIMIT_HISTORY_SIZE];
+	ConditionVariable slot_cv;
+} AdaptiveLimitEndpoint;
+
+/* the endpoints shared across the backends */
+typedef struct AdaptiveLimitState
+{
+	LWLock *lock;
+	AdaptiveLimitEndpoint endpoints[ADAPTIVE_LIMIT_MAX_ENDPOINTS];
+} AdaptiveLimitState;
+
+/* stays NULL if pg_ai is not in shared_preload_libraries */
+static AdaptiveLimitState *adaptive_limit = NULL;
+
+/* set once the exit and transaction callbacks of the backend are registered */
+static bool callbacks_registered = false;
+
+/* the slots this backend holds, per endpoint and traffic class */
+static int held[ADAPTIVE_LIMIT_MAX_ENDPOINTS][TRAFFIC_CLASS_COUNT];
+
+static const char *reason_names[] = {"increase", "throttled", "latency"};
+
+static int get_max_concurrency(void)
+{
+	return *get_pg_ai_guc_int_variable(PG_AI_GUC_MAX_CONCURRENCY);
+}
+
+/*
+ * The traffic class of the requests of a service call, pg_ai.traffic_class if
+ * it is set. Otherwise the vector store builds are batch traffic and all the
+ * other calls interactive.
+ */
+TrafficClass get_traffic_class(const AIService *ai_service)
+{
+	const char *name = get_pg_ai_guc_string_variable(PG_AI_GUC_TRAFFIC_CLASS);
+
+	if (name && strcmp(name, TRAFFIC_CLASS_BATCH_NAME) == 0)
+		return TRAFFIC_CLASS_BATCH;
+
+	if (name && strcmp(name, TRAFFIC_CLASS_INTERACTIVE_NAME) == 0)
+		return TRAFFIC_CLASS_INTERACTIVE;
+
+	return (ai_service->function_flags & FUNCTION_CREATE_VECTOR_STORE) ?
+			   TRAFFIC_CLASS_BATCH :
+			   TRAFFIC_CLASS_INTERACTIVE;
+}
+
+/*
+ * Shared memory needed by the endpoints.
+ */
+Size adaptive_limit_shmem_size(void)
+{
+	return sizeof(AdaptiveLimitState);
+}
+
+/*
+ * Attach to the endpoints, initialize them on the first call.
+ */
+void adaptive_limit_shmem_startup(LWLock *lock)
+{
+	bool found;
+
+	adaptive_limit = ShmemInitStruct(PG_AI_SHMEM_ADAPTIVE_LIMIT,
+									 adaptive_limit_shmem_size(), &found);
+	if (found)
+		return;
+
+	memset(adaptive_limit, 0, sizeof(AdaptiveLimitState));
+	adaptive_limit->lock = lock;
+	for (int i = 0; i < ADAPTIVE_LIMIT_MAX_ENDPOINTS; i++)
+		ConditionVariableInit(&adaptive_limit->endpoints[i].slot_cv);
+}
+
+/*
+ * Record a change of the limit in the history of the endpoint. Called with
+ * the lock held.
+ */
+static void record_change(AdaptiveLimitEndpoint *endpoint,
+						  const AdaptiveLimitReason reason)
+{
+	int next = endpoint->history_next;
+
+	endpoint->history_at[next] = GetCurrentTimestamp();
+	endpoint->history_limit[next] = endpoint->limit;
+	endpoint->history_reason[next] = reason;
+	endpoint->history_next = (next + 1) % ADAPTIVE_LIMIT_HISTORY_SIZE;
+	if (endpoint->history_count < ADAPTIVE_LIMIT_HISTORY_SIZE)
+		endpoint->history_count++;
+}
+
+/*
+ * Find the endpoint of the URL, start tracking it if it is new. The query
+ * string is not part of the endpoint, it may hold an API key. Returns -1 if
+ * all the endpoints are in use. Called with the lock held.
+ */
+static int find_endpoint(const char *url)
+{
+	char key[ADAPTIVE_LIMIT_URL_LENGTH];
+	int free_index = -1;
+	size_t len = strcspn(url, "?");
+
+	len = Min(len, ADAPTIVE_LIMIT_URL_LENGTH - 1);
+	memcpy(key, url, len);
+	key[len] = '\0';
+
+	for (int i = 0; i < ADAPTIVE_LIMIT_MAX_ENDPOINTS; i++)
+	{
+		AdaptiveLimitEndpoint *endpoint = &adaptive_limit->endpoints[i];
+
+		if (endpoint->url[0] == '\0')
+		{
+			if (free_index < 0)
+				free_index = i;
+		}
+		else if (strcmp(endpoint->url, key) == 0)
+			return i;
+	}
+
+	if (free_index >= 0)
+	{
+		AdaptiveLimitEndpoint *endpoint =
+			&adaptive_limit->endpoints[free_index];
+
+		strcpy(endpoint->url, key);
+		endpoint->limit = Min(ADAPTIVE_LIMIT_INITIAL, get_max_concurrency());
+		endpoint->in_flight = 0;
+		endpoint->batch_in_flight = 0;
+		endpoint->waiting[TRAFFIC_CLASS_INTERACTIVE] = 0;
+		endpoint->waiting[TRAFFIC_CLASS_BATCH] = 0;
+		endpoint->latency_ms = 0;
+		endpoint->last_decrease = 0;
+	}
+	return free_index;
+}
+
+/*
+ * Take a slot of the endpoint if it is under its limit. Interactive requests
+ * can use the whole limit. Batch requests wait while interactive requests
+ * are waiting and leave pg_ai.interactive_reserve of the limit to them, but
+ * always get at least one slot. Called with the lock held.
+ */
+static bool try_acquire(AdaptiveLimitEndpoint *endpoint,
+						const TrafficClass traffic_class)
+{
+	int limit = Max((int)Min(endpoint->limit, get_max_concurrency()), 1);
+	int batch_limit;
+	double reserve;
+
+	if (endpoint->in_flight >= limit)
+		return false;
+
+	if (traffic_class == TRAFFIC_CLASS_BATCH)
+	{
+		reserve = *get_pg_ai_guc_real_variable(PG_AI_GUC_INTERACTIVE_RESERVE);
+		batch_limit = Max(limit - (int)(limit * reserve), 1);
+		if (endpoint->waiting[TRAFFIC_CLASS_INTERACTIVE] > 0 ||
+			endpoint->batch_in_flight >= batch_limit)
+			return false;
+		endpoint->batch_in_flight++;
+	}
+
+	endpoint->in_flight++;
+	endpoint->waiting[traffic_class]--;
+	return true;
+}
+
+/* release the slots this backend still holds */
+static void release_held_slots(void)
+{
+	for (int i = 0; i < ADAPTIVE_LIMIT_MAX_ENDPOINTS; i++)
+		for (int c = 0; c < TRAFFIC_CLASS_COUNT; c++)
+			while (held[i][c] > 0)
+				adaptive_limit_release(i, (TrafficClass)c, 0, 0);
+}
+
+/*
+ * Release the slots held by this backend if it exits with requests in
+ * flight.
+ */
+static void adaptive_limit_exit_callback(int code, Datum arg)
+{
+	release_held_slots();
+}
+
+/*
+ * Release the slots still held as a transaction aborts. The requests give
+ * back their slots before the transaction ends, one missed on an error path
+ * would otherwise take a share of the endpoint till the backend exits.
+ */
+static void adaptive_limit_xact_callback(XactEvent event, void *arg)
+{
+	if (event == XACT_EVENT_ABORT || event == XACT_EVENT_PARALLEL_ABORT)
+		release_held_slots();
+}
+
+/* register the exit and transaction callbacks of this backend once */
+static void register_callbacks(void)
+{
+	if (!callbacks_registered)
+	{
+		before_shmem_exit(adaptive_limit_exit_callback, (Datum)0);
+		RegisterXactCallback(adaptive_limit_xact_callback, NULL);
+		callbacks_registered = true;
+	}
+}
+
+/* note a slot taken by this backend */
+static void hold_slot(const int index, const TrafficClass traffic_class)
+{
+	held[index][traffic_class]++;
+}
+
+/*
+ * Wait till the number of requests in flight to the endpoint of the URL is
+ * under the limit of the traffic class. Returns the endpoint to be released
+ * once the request is over, -1 if the endpoint is not limited.
+ */
+int adaptive_limit_acquire(const char *url, const TrafficClass traffic_class)
+{
+	AdaptiveLimitEndpoint *endpoint;
+	bool acquired = false;
+	int index;
+
+	if (!adaptive_limit || !url || get_max_concurrency() == 0)
+		return -1;
+
+	register_callbacks();
+
+	LWLockAcquire(adaptive_limit->lock, LW_EXCLUSIVE);
+	index = find_endpoint(url);
+	if (index >= 0)
+		adaptive_limit->endpoints[index].waiting[traffic_class]++;
+	LWLockRelease(adaptive_limit->lock);
+
+	if (index < 0)
+		return -1;
+
+	endpoint = &adaptive_limit->endpoints[index];
+	PG_TRY();
+	{
+		ConditionVariablePrepareToSleep(&endpoint->slot_cv);
+		for (;;)
+		{
+			LWLockAcquire(adaptive_limit->lock, LW_EXCLUSIVE);
+			acquired = try_acquire(endpoint, traffic_class);
+			LWLockRelease(adaptive_limit->lock);
+			if (acquired)
+				break;
+			ConditionVariableSleep(&endpoint->slot_cv, PG_WAIT_EXTENSION);
+		}
+		ConditionVariableCancelSleep();
+	}
+	PG_CATCH();
+	{
+		/* stop waiting if the query is cancelled */
+		ConditionVariableCancelSleep();
+		LWLockAcquire(adaptive_limit->lock, LW_EXCLUSIVE);
+		endpoint->waiting[traffic_class]--;
+		LWLockRelease(adaptive_limit->lock);
+
+		/* the batch requests held back by this one can go now */
+		ConditionVariableBroadcast(&endpoint->slot_cv);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	hold_slot(index, traffic_class);
+	return index;
+}
+
+/*
+ * Take a slot of the endpoint of the URL without waiting, for the requests a
+ * backend sends while it has others in flight. Waiting for a slot with slots
+ * held could wait forever on a limit of one. Returns false if the endpoint
+ * is at the limit of the traffic class, otherwise sets the endpoint to be
+ * released, -1 if the endpoint is not limited.
+ */
+bool adaptive_limit_try_acquire(const char *url,
+								const TrafficClass traffic_class,
+								int *endpoint)
+{
+	bool acquired;
+	int index;
+
+	*endpoint = -1;
+	if (!adaptive_limit || !url || get_max_concurrency() == 0)
+		return true;
+
+	register_callbacks();
+
+	LWLockAcquire(adaptive_limit->lock, LW_EXCLUSIVE);
+	index = find_endpoint(url);
+	if (index < 0)
+	{
+		LWLockRelease(adaptive_limit->lock);
+		return true;
+	}
+
+	/* try_acquire takes the request off the waiting ones */
+	adaptive_limit->endpoints[index].waiting[traffic_class]++;
+	acquired = try_acquire(&adaptive_limit->endpoints[index], traffic_class);
+	if (!acquired)
+		adaptive_limit->endpoints[index].waiting[traffic_class]--;
+	LWLockRelease(adaptive_limit->lock);
+
+	if (!acquired)
+		return false;
+
+	hold_slot(index, traffic_class);
+	*endpoint = index;
+	return true;
+}
+
+/*
+ * Cut the limit multiplicatively, at most once per smoothed latency so that
+ * a burst of responses to the same overload counts once. Called with the
+ * lock held.
+ */
+static void decrease_limit(AdaptiveLimitEndpoint *endpoint,
+						   const AdaptiveLimitReason reason)
+{
+	TimestampTz now = GetCurrentTimestamp();
+
+	if (endpoint->last_decrease != 0 &&
+		TimestampDifferenceMilliseconds(endpoint->last_decrease, now) <
+			(long)endpoint->latency_ms)
+		return;
+
+	endpoint->limit = Max(endpoint->limit * ADAPTIVE_LIMIT_DECREASE_FACTOR, 1);
+	endpoint->last_decrease = now;
+	record_change(endpoint, reason);
+}
+
+/*
+ * Grow the limit additively, by one after a limit's worth of successful
+ * requests. Only the changes of the whole limit are recorded. Called with
+ * the lock held.
+ */
+static void increase_limit(AdaptiveLimitEndpoint *endpoint)
+{
+	int previous = (int)endpoint->limit;
+
+	endpoint->limit = Min(endpoint->limit + 1.0 / endpoint->limit,
+						  get_max_concurrency());
+	if ((int)endpoint->limit != previous)
+		record_change(endpoint, ADAPTIVE_LIMIT_INCREASE);
+}
+
+/*
+ * Release the slot of the endpoint and adjust its limit with the outcome of
+ * the request. The limit is cut when the service throttles the requests or
+ * when the latency spikes over pg_ai.latency_spike_factor times the smoothed
+ * latency, and grows on the other successful requests.
+ */
+void adaptive_limit_release(const int index, const TrafficClass traffic_class,
+							const long response_code, const long latency_ms)
+{
+	AdaptiveLimitEndpoint *endpoint;
+	double spike_factor;
+
+	/* a slot released already, as its transaction aborted, is not again */
+	if (!adaptive_limit || index < 0 || held[index][traffic_class] == 0)
+		return;
+	held[index][traffic_class]--;
+
+	endpoint = &adaptive_limit->endpoints[index];
+	spike_factor =
+		*get_pg_ai_guc_real_variable(PG_AI_GUC_LATENCY_SPIKE_FACTOR);
+
+	LWLockAcquire(adaptive_limit->lock, LW_EXCLUSIVE);
+	endpoint->in_flight--;
+	if (traffic_class == TRAFFIC_CLASS_BATCH)
+		endpoint->batch_in_flight--;
+	if (response_code == HTTP_TOO_MANY_REQUESTS ||
+		response_code == HTTP_SERVICE_UNAVAILABLE)
+		decrease_limit(endpoint, ADAPTIVE_LIMIT_THROTTLED);
+	else if (response_code == HTTP_OK)
+	{
+		if (endpoint->latency_ms > 0 &&
+			latency_ms > endpoint->latency_ms * spike_factor)
+			decrease_limit(endpoint, ADAPTIVE_LIMIT_LATENCY);
+		else
+			increase_limit(endpoint);
+
+		/* a lasting change in the latency becomes the new normal */
+		endpoint->latency_ms =
+			(endpoint->latency_ms > 0) ?
+				endpoint->latency_ms +
+					ADAPTIVE_LIMIT_LATENCY_WEIGHT *
+						(latency_ms - endpoint->latency_ms) :
+				latency_ms;
+	}
+	LWLockRelease(adaptive_limit->lock);
+
+	ConditionVariableBroadcast(&endpoint->slot_cv);
+}
+
+/*
+ * Copy the state of the endpoints in use. Returns the number of endpoints.
+ */
+int adaptive_limit_get_stats(AdaptiveLimitStats **stats)
+{
+	int count = 0;
+
+	*stats = palloc(sizeof(AdaptiveLimitStats) * ADAPTIVE_LIMIT_MAX_ENDPOINTS);
+	if (!adaptive_limit)
+		return 0;
+
+	LWLockAcquire(adaptive_limit->lock, LW_SHARED);
+	for (int i = 0; i < ADAPTIVE_LIMIT_MAX_ENDPOINTS; i++)
+	{
+		AdaptiveLimitEndpoint *endpoint = &adaptive_limit->endpoints[i];
+		AdaptiveLimitStats *stat = &(*stats)[count];
+
+		if (endpoint->url[0] == '\0')
+			continue;
+
+		strcpy(stat->url, endpoint->url);
+		stat->limit = endpoint->limit;
+		stat->in_flight = endpoint->in_flight;
+		stat->batch_in_flight = endpoint->batch_in_flight;
+		stat->waiting[TRAFFIC_CLASS_INTERACTIVE] =
+			endpoint->waiting[TRAFFIC_CLASS_INTERACTIVE];
+		stat->waiting[TRAFFIC_CLASS_BATCH] =
+			endpoint->waiting[TRAFFIC_CLASS_BATCH];
+		stat->latency_ms = endpoint->latency_ms;
+		count++;
+	}
+	LWLockRelease(adaptive_limit->lock);
+
+	return count;
+}
+
+/*
+ * Copy the recorded changes of all the endpoints, oldest first for each
+ * endpoint. Returns the number of changes.
+ */
+int adaptive_limit_get_history(AdaptiveLimitChange **changes)
+{
+	int count = 0;
+
+	*changes = palloc(sizeof(AdaptiveLimitChange) *
+					  ADAPTIVE_LIMIT_MAX_ENDPOINTS *
+					  ADAPTIVE_LIMIT_HISTORY_SIZE);
+	if (!adaptive_limit)
+		return 0;
+
+	LWLockAcquire(adaptive_limit->lock, LW_SHARED);
+	for (int i = 0; i < ADAPTIVE_LIMIT_MAX_ENDPOINTS; i++)
+	{
+		AdaptiveLimitEndpoint *endpoint = &adaptive_limit->endpoints[i];
+		int first = endpoint->history_next - endpoint->history_count +
+					ADAPTIVE_LIMIT_HISTORY_SIZE;
+
+		if (endpoint->url[0] == '\0')
+			continue;
+
+		for (int j = 0; j < endpoint->history_count; j++)
+		{
+			int k = (first + j) % ADAPTIVE_LIMIT_HISTORY_SIZE;
+			AdaptiveLimitChange *change = &(*changes)[count++];
+
+			strcpy(change->url, endpoint->url);
+			change->changed_at = endpoint->history_at[k];
+			change->limit = endpoint->history_limit[k];
+			change->reason = endpoint->history_reason[k];
+		}
+	}
+	LWLockRelease(adaptive_limit->lock);
+
+	return count;
+}
+
+/*
+ * Name of the reason of a limit change, as shown by the SQL functions.
+ */
+const char *adaptive_limit_reason_name(const AdaptiveLimitReason reason)
+{
+	return reason_names[reason];
+}
@@ -0,0 +1,70 @@
+#ifndef _ADAPTIVE_LIMIT_H_
+#define _ADAPTIVE_LIMIT_H_
+
+#include "postgres.h"
+#include "storage/lwlock.h"
+#include "utils/timestamp.h"
+
+#include "core/ai_service.h"
+
+/* the cause of a change in the concurrency limit of an endpoint */
+typedef enum AdaptiveLimitReason
+{
+	ADAPTIVE_LIMIT_INCREASE = 0,
+	ADAPTIVE_LIMIT_THROTTLED,
+	ADAPTIVE_LIMIT_LATENCY
+} AdaptiveLimitReason;
+
+/*
+ * Interactive requests are served first and have a share of the limit kept
+ * for them, batch requests get the rest.
+ */
+typedef enum TrafficClass
+{
+	TRAFFIC_CLASS_INTERACTIVE = 0,
+	TRAFFIC_CLASS_BATCH,
+	TRAFFIC_CLASS_COUNT
+} TrafficClass;
+
+/* the current state of an endpoint, for monitoring */
+typedef struct AdaptiveLimitStats
+{
+	char url[ADAPTIVE_LIMIT_URL_LENGTH];
+	double limit;
+	int in_flight;
+	int batch_in_flight;
+	int waiting[TRAFFIC_CLASS_COUNT];
+	double latency_ms;
+} AdaptiveLimitStats;
+
+/* a change in the limit of an endpoint, for monitoring */
+typedef struct AdaptiveLimitChange
+{
+	char url[ADAPTIVE_LIMIT_URL_LENGTH];
+	TimestampTz changed_at;
+	double limit;
+	AdaptiveLimitReason reason;
+} AdaptiveLimitChange;
+
+/* shared memory setup, called from the pg_ai shmem hooks */
+Size adaptive_limit_shmem_size(void);
+void adaptive_limit_shmem_startup(LWLock *lock);
+
+/* the class of the requests of a service call */
+TrafficClass get_traffic_class(const AIService *ai_service);
+
+/* wait for a free slot under the limit of the endpoint and release it */
+int adaptive_limit_acquire(const char *url, const TrafficClass traffic_class);
+bool adaptive_limit_try_acquire(const char *url,
+								const TrafficClass traffic_class,
+								int *endpoint);
+void adaptive_limit_release(const int endpoint,
+							const TrafficClass traffic_class,
+							const long response_code, const long latency_ms);
+
+/* copies of the endpoint states and of their limit changes */
+int adaptive_limit_get_stats(AdaptiveLimitStats **stats);
+int adaptive_limit_get_history(AdaptiveLimitChange **changes);
+const char *adaptive_limit_reason_name(const AdaptiveLimitReason reason);
+
+#endif /* _ADAPTIVE_LIMIT_H_ */
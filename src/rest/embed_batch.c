@@ -0,0 +1,406 @@
+#include "embed_batch.h"
+
+#include "miscadmin.h"
+#include "storage/condition_variable.h"
+#include "storage/ipc.h"
+#include "storage/shmem.h"
+#include "utils/timestamp.h"
+#include "utils/wait_event.h"
+
+#include "core/utils_pg_ai.h"
+#include "guc/pg_ai_guc.h"
+
+/* state of a batch of embeddings requests */
+typedef enum EmbedBatchState
+{
+	EMBED_BATCH_FREE = 0,
+	EMBED_BATCH_COLLECTING,
+	EMBED_BATCH_SENDING,
+	EMBED_BATCH_DONE
+} EmbedBatchState;
+
+/* a text of the batch and its vector, once the batch is sent */
+typedef struct EmbedBatchItem
+{
+	int text_offset;
+	int dimensions; /* 0 if the vector was not received */
+	float4 vector[QUERY_CACHE_MAX_DIMENSIONS];
+} EmbedBatchItem;
+
+/*
+ * Texts of the same service, model and API key sent in one request. The
+ * first backend leads the batch, it collects the texts of the others for a
+ * few milliseconds and makes the transfer.
+ */
+typedef struct EmbedBatch
+{
+	PgAiFingerprint group;
+	EmbedBatchState state;
+	int leader_pid;
+	int max_count; /* the batch is sent without waiting at this count */
+	int count;
+	int pending; /* backends that are yet to collect their vectors */
+	int text_size;
+	ConditionVariable cv;
+	char texts[EMBED_BATCH_MAX_TEXT_SIZE];
+	EmbedBatchItem items[EMBED_BATCH_MAX_SIZE];
+} EmbedBatch;
+
+/* the batches shared across the backends */
+typedef struct EmbedBatchQueue
+{
+	LWLock *lock;
+	int num_batches;
+	EmbedBatch batches[FLEXIBLE_ARRAY_MEMBER];
+} EmbedBatchQueue;
+
+/* stays NULL if pg_ai is not in shared_preload_libraries */
+static EmbedBatchQueue *embed_batch = NULL;
+
+/* set once the exit callback of this backend is registered */
+static bool exit_callback_registered = false;
+
+/* the batch this backend is in, to be left if the backend exits */
+static EmbedBatch *current_batch = NULL;
+
+static int get_num_batches(void)
+{
+	return *get_pg_ai_guc_int_variable(PG_AI_GUC_EMBED_BATCH_SLOTS);
+}
+
+static int get_wait(void)
+{
+	return *get_pg_ai_guc_int_variable(PG_AI_GUC_EMBED_BATCH_WAIT);
+}
+
+/*
+ * Shared memory needed by the batches, none if batching is disabled.
+ */
+Size embed_batch_shmem_size(void)
+{
+	int num_batches = get_num_batches();
+
+	if (num_batches == 0)
+		return 0;
+
+	return add_size(offsetof(EmbedBatchQueue, batches),
+					mul_size(num_batches, sizeof(EmbedBatch)));
+}
+
+/*
+ * Attach to the batches, initialize them on the first call.
+ */
+void embed_batch_shmem_startup(LWLock *lock)
+{
+	bool found;
+
+	embed_batch = ShmemInitStruct(PG_AI_SHMEM_EMBED_BATCH,
+								  embed_batch_shmem_size(), &found);
+	if (found)
+		return;
+
+	embed_batch->lock = lock;
+	embed_batch->num_batches = get_num_batches();
+	for (int i = 0; i < embed_batch->num_batches; i++)
+	{
+		embed_batch->batches[i].state = EMBED_BATCH_FREE;
+		embed_batch->batches[i].pending = 0;
+		ConditionVariableInit(&embed_batch->batches[i].cv);
+	}
+}
+
+/*
+ * Add a text to the batch, returns its index. Called with the lock held.
+ */
+static int add_text(EmbedBatch *batch, const char *text, const int len)
+{
+	EmbedBatchItem *item = &batch->items[batch->count];
+
+	item->text_offset = batch->text_size;
+	item->dimensions = 0;
+	memcpy(batch->texts + batch->text_size, text, len + 1);
+	batch->text_size += len + 1;
+	batch->pending++;
+
+	return batch->count++;
+}
+
+/*
+ * Leave the batch, the last backend to leave a sent batch frees it.
+ */
+static void leave_batch(EmbedBatch *batch)
+{
+	LWLockAcquire(embed_batch->lock, LW_EXCLUSIVE);
+	batch->pending--;
+	if (batch->pending == 0 && batch->state == EMBED_BATCH_DONE)
+		batch->state = EMBED_BATCH_FREE;
+	LWLockRelease(embed_batch->lock);
+	current_batch = NULL;
+}
+
+/*
+ * Publish the vectors of the batch and wake up the members. A NULL vectors
+ * array lets the members make their own requests.
+ */
+static void finish_batch(EmbedBatch *batch, char **vectors, const int count)
+{
+	/* only the leader writes the items of a batch being sent */
+	for (int i = 1; vectors && i < count; i++)
+		batch->items[i].dimensions =
+			vectors[i] ? parse_vector_text(vectors[i], batch->items[i].vector,
+										   QUERY_CACHE_MAX_DIMENSIONS) :
+						 0;
+
+	LWLockAcquire(embed_batch->lock, LW_EXCLUSIVE);
+	batch->state = EMBED_BATCH_DONE;
+	LWLockRelease(embed_batch->lock);
+
+	ConditionVariableBroadcast(&batch->cv);
+}
+
+/*
+ * Close the batch led by this backend and leave the batch it is in when it
+ * exits, so that the batch is not held forever.
+ */
+static void embed_batch_exit_callback(int code, Datum arg)
+{
+	EmbedBatch *batch = current_batch;
+
+	if (!batch)
+		return;
+
+	if (batch->leader_pid == MyProcPid && batch->state != EMBED_BATCH_DONE)
+		finish_batch(batch, NULL, 0);
+	leave_batch(batch);
+}
+
+/*
+ * Join a batch being collected for the same group or lead a new one. Returns
+ * NULL if the text does not fit in any batch.
+ */
+static EmbedBatch *join_or_lead(const PgAiFingerprint *group, const char *text,
+								int *index)
+{
+	EmbedBatch *free_batch = NULL;
+	EmbedBatch *batch = NULL;
+	int len = strlen(text);
+	bool full = false;
+
+	LWLockAcquire(embed_batch->lock, LW_EXCLUSIVE);
+	for (int i = 0; i < embed_batch->num_batches; i++)
+	{
+		EmbedBatch *candidate = &embed_batch->batches[i];
+
+		if (candidate->state == EMBED_BATCH_FREE)
+		{
+			if (!free_batch)
+				free_batch = candidate;
+		}
+		else if (candidate->state == EMBED_BATCH_COLLECTING &&
+				 candidate->count < candidate->max_count &&
+				 candidate->text_size + len < EMBED_BATCH_MAX_TEXT_SIZE &&
+				 !memcmp(&candidate->group, group, sizeof(PgAiFingerprint)))
+		{
+			batch = candidate;
+			*index = add_text(batch, text, len);
+			full = (batch->count == batch->max_count);
+			break;
+		}
+	}
+
+	if (!batch && free_batch)
+	{
+		batch = free_batch;
+		batch->group = *group;
+		batch->state = EMBED_BATCH_COLLECTING;
+		batch->leader_pid = MyProcPid;
+		batch->max_count =
+			*get_pg_ai_guc_int_variable(PG_AI_GUC_EMBED_BATCH_SIZE);
+		batch->count = 0;
+		batch->pending = 0;
+		batch->text_size = 0;
+		*index = add_text(batch, text, len);
+	}
+	current_batch = batch;
+	LWLockRelease(embed_batch->lock);
+
+	/* a full batch is sent right away */
+	if (full)
+		ConditionVariableBroadcast(&batch->cv);
+
+	return batch;
+}
+
+/*
+ * Copy the vector to the response buffer in the vector text format.
+ */
+static bool set_response(AIService *ai_service, const float4 *vector,
+						 const int dimensions)
+{
+	RestResponse *response = ai_service->rest_response;
+
+	if (dimensions == 0 ||
+		!format_vector_text(vector, dimensions, (char *)(response->data),
+							response->max_size))
+		return false;
+
+	response->data_size = strlen((char *)(response->data));
+	response->response_code = HTTP_OK;
+	return true;
+}
+
+/*
+ * Wait for the leader to send the batch. Returns true if the vector of the
+ * text is copied to the response buffer.
+ */
+static bool wait_for_batch(AIService *ai_service, EmbedBatch *batch,
+						   const int index)
+{
+	EmbedBatchItem *item = &batch->items[index];
+	bool done = false;
+
+	PG_TRY();
+	{
+		ConditionVariablePrepareToSleep(&batch->cv);
+		for (;;)
+		{
+			LWLockAcquire(embed_batch->lock, LW_SHARED);
+			done = (batch->state == EMBED_BATCH_DONE);
+			LWLockRelease(embed_batch->lock);
+			if (done)
+				break;
+			ConditionVariableSleep(&batch->cv, PG_WAIT_EXTENSION);
+		}
+		ConditionVariableCancelSleep();
+	}
+	PG_CATCH();
+	{
+		/* leave the batch if the wait is cancelled */
+		ConditionVariableCancelSleep();
+		leave_batch(batch);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	/* the items are not changed once the batch is done */
+	done = set_response(ai_service, item->vector, item->dimensions);
+	leave_batch(batch);
+	return done;
+}
+
+/*
+ * Collect the texts of the other backends until the wait is over or the
+ * batch is full, then send them all in one request. Returns true if the
+ * vector of the leader's text is copied to the response buffer.
+ */
+static bool send_batch(AIService *ai_service, EmbedBatch *batch,
+					   EmbedBatchTransfer transfer)
+{
+	TimestampTz deadline;
+	char **texts = NULL;
+	char **vectors = NULL;
+	float4 *vector;
+	long timeout;
+	int count;
+	bool done = false;
+
+	deadline = TimestampTzPlusMilliseconds(GetCurrentTimestamp(), get_wait());
+
+	PG_TRY();
+	{
+		ConditionVariablePrepareToSleep(&batch->cv);
+		for (;;)
+		{
+			LWLockAcquire(embed_batch->lock, LW_SHARED);
+			done = (batch->count >= batch->max_count);
+			LWLockRelease(embed_batch->lock);
+			if (done)
+				break;
+
+			timeout = TimestampDifferenceMilliseconds(GetCurrentTimestamp(),
+													  deadline);
+			if (timeout <= 0 || ConditionVariableTimedSleep(
+									&batch->cv, timeout, PG_WAIT_EXTENSION))
+				break;
+		}
+		ConditionVariableCancelSleep();
+
+		/* no more texts once the batch is being sent */
+		LWLockAcquire(embed_batch->lock, LW_EXCLUSIVE);
+		batch->state = EMBED_BATCH_SENDING;
+		count = batch->count;
+		texts = palloc(sizeof(char *) * count);
+		for (int i = 0; i < count; i++)
+			texts[i] = pstrdup(batch->texts + batch->items[i].text_offset);
+		LWLockRelease(embed_batch->lock);
+
+		/* a text with no company is left to the usual request */
+		if (count > 1)
+		{
+			vectors = palloc0(sizeof(char *) * count);
+			if (!transfer(ai_service, texts, count, vectors))
+				vectors = NULL;
+		}
+	}
+	PG_CATCH();
+	{
+		ConditionVariableCancelSleep();
+		finish_batch(batch, NULL, 0);
+		leave_batch(batch);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	finish_batch(batch, vectors, count);
+	leave_batch(batch);
+
+	if (!vectors || !vectors[0])
+		return false;
+
+	vector = palloc(sizeof(float4) * QUERY_CACHE_MAX_DIMENSIONS);
+	done = set_response(ai_service, vector,
+						parse_vector_text(vectors[0], vector,
+										  QUERY_CACHE_MAX_DIMENSIONS));
+	if (done && DEBUG_LEVEL(PG_AI_DEBUG_3))
+		ereport(INFO, (errmsg("Sent a batch of %d embeddings requests\n",
+							  count)));
+	return done;
+}
+
+/*
+ * Get the vector of the text in a batch with the texts of the other backends
+ * embedding with the same service, model and API key. The first backend
+ * waits up to pg_ai.embed_batch_wait for others to join and sends the batch
+ * as one request. Returns true if the vector is in the response buffer, false
+ * if the caller has to make its own request.
+ */
+bool embed_batch_transfer(AIService *ai_service, const char *text,
+						  EmbedBatchTransfer transfer)
+{
+	PgAiFingerprint group;
+	EmbedBatch *batch;
+	const char *parts[3];
+	int index;
+
+	if (!embed_batch || get_wait() == 0 ||
+		strlen(text) >= EMBED_BATCH_MAX_TEXT_SIZE ||
+		strstr(text, EMBED_BATCH_SEPARATOR))
+		return false;
+
+	parts[0] = ai_service->get_service_name(ai_service);
+	parts[1] = ai_service->get_model_name(ai_service);
+	parts[2] = get_option_value(AI_SERVICE_OPTIONS, OPTION_SERVICE_API_KEY);
+	make_fingerprint(&group, parts, 3);
+
+	if (!exit_callback_registered)
+	{
+		before_shmem_exit(embed_batch_exit_callback, (Datum)0);
+		exit_callback_registered = true;
+	}
+
+	if (!(batch = join_or_lead(&group, text, &index)))
+		return false;
+
+	return (index == 0) ? send_batch(ai_service, batch, transfer) :
+						  wait_for_batch(ai_service, batch, index);
+}
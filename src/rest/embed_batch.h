@@ -0,0 +1,26 @@
+#ifndef _EMBED_BATCH_H_
+#define _EMBED_BATCH_H_
+
+#include "core/ai_service.h"
+#include "storage/lwlock.h"
+
+/* the texts of a batch are joined with this before they are escaped */
+#define EMBED_BATCH_SEPARATOR "\x1e"
+#define EMBED_BATCH_SEPARATOR_ESCAPED "%1E"
+
+/*
+ * The service transfer of a batch. Gets the vector texts of all the texts in
+ * one request, returns false if the transfer fails.
+ */
+typedef bool (*EmbedBatchTransfer)(void *ai_service, char **texts,
+								   const int count, char **vectors);
+
+/* shared memory setup, called from the pg_ai shmem hooks */
+Size embed_batch_shmem_size(void);
+void embed_batch_shmem_startup(LWLock *lock);
+
+/* get the vector of a text in a batch with the texts of other backends */
+bool embed_batch_transfer(AIService *ai_service, const char *text,
+						  EmbedBatchTransfer transfer);
+
+#endif /* _EMBED_BATCH_H_ */
@@ -0,0 +1,349 @@
+#include "provider_batch.h"
+
+#include "miscadmin.h"
+#include "utils/builtins.h"
+#include "utils/json.h"
+#include "utils/jsonb.h"
+#include "utils/numeric.h"
+
+#include "guc/pg_ai_guc.h"
+
+/* the paths of the batch API under its base URL */
+#define BATCH_API_FILES "/files"
+#define BATCH_API_BATCHES "/batches"
+
+/* the file of the requests, as uploaded */
+#define BATCH_API_FILE_NAME "pg_ai_batch.jsonl"
+
+/* the response to a request of the batch API, in memory or in a file */
+typedef struct BatchApiResponse
+{
+	StringInfo body;
+	BufFile *file;
+} BatchApiResponse;
+
+static const char *get_batch_api_url(void)
+{
+	const char *url = get_pg_ai_guc_string_variable(PG_AI_GUC_BATCH_API_URL);
+
+	return (url && url[0]) ? url : BATCH_API_URL;
+}
+
+const char *provider_batch_endpoint(AIService *ai_service)
+{
+	const char *url = get_option_value(ai_service->service_data->options,
+									   OPTION_ENDPOINT_URL);
+	const char *host = strstr(url, "://");
+	const char *path = host ? strchr(host + 3, '/') : NULL;
+
+	return path ? path : url;
+}
+
+void provider_batch_add_request(BufFile *input, const char *endpoint,
+								const int64 custom_id, const char *post_data)
+{
+	StringInfoData line;
+
+	initStringInfo(&line);
+	appendStringInfo(&line,
+					 "{\"custom_id\": \"" INT64_FORMAT "\", "
+					 "\"method\": \"POST\", \"url\": ",
+					 custom_id);
+	escape_json(&line, endpoint);
+	appendStringInfo(&line, ", \"body\": %s}\n", post_data);
+	BufFileWrite(input, line.data, line.len);
+	pfree(line.data);
+}
+
+static size_t write_response(void *contents, size_t size, size_t nmemb,
+							 void *userp)
+{
+	BatchApiResponse *response = (BatchApiResponse *)userp;
+	size_t realsize = size * nmemb;
+
+	if (response->file)
+		BufFileWrite(response->file, contents, realsize);
+	else
+		appendBinaryStringInfo(response->body, contents, realsize);
+	return realsize;
+}
+
+/* the upload is read from the temporary file of the input */
+static size_t read_input(char *buffer, size_t size, size_t nitems, void *arg)
+{
+	return BufFileRead((BufFile *)arg, buffer, size * nitems);
+}
+
+static int seek_input(void *arg, curl_off_t offset, int origin)
+{
+	if (offset != 0 || origin != SEEK_SET ||
+		BufFileSeek((BufFile *)arg, 0, 0, SEEK_SET) != 0)
+		return CURL_SEEKFUNC_CANTSEEK;
+	return CURL_SEEKFUNC_OK;
+}
+
+/* a cancelled job stops the upload or download in progress */
+static int check_interrupts(void *clientp, curl_off_t dltotal, curl_off_t dlnow,
+							curl_off_t ultotal, curl_off_t ulnow)
+{
+	return InterruptPending ? 1 : 0;
+}
+
+/*
+ * Make a request to the batch API: a GET, or a POST of the JSON or of the
+ * input file as a form. The response goes to the body, or to the output
+ * file if given. A failed request errors out.
+ */
+static void batch_api_request(AIService *ai_service, const char *path,
+							  const char *json, BufFile *input,
+							  BufFile *output, StringInfo body)
+{
+	BatchApiResponse response = {body, output};
+	struct curl_slist *headers = NULL;
+	curl_mime *mime = NULL;
+	curl_mimepart *part;
+	char key_header[MAX_BYTE_VALUE];
+	long response_code = 0;
+	CURLcode res;
+	CURL *curl;
+
+	if (!(curl = curl_easy_init()))
+		ereport(ERROR, (errmsg("%s", GET_ERR_STR(INT_TNSFR))));
+
+	snprintf(key_header, sizeof(key_header), "Authorization: Bearer %s",
+			 get_option_value(ai_service->service_data->options,
+							  OPTION_SERVICE_API_KEY));
+	headers = curl_slist_append(headers, key_header);
+	curl_easy_setopt(curl, CURLOPT_URL,
+					 psprintf("%s%s", get_batch_api_url(), path));
+
+	if (json)
+	{
+		headers = curl_slist_append(headers, "Content-Type: application/json");
+		curl_easy_setopt(curl, CURLOPT_POSTFIELDS, json);
+	}
+	if (input)
+	{
+		mime = curl_mime_init(curl);
+		part = curl_mime_addpart(mime);
+		curl_mime_name(part, "purpose");
+		curl_mime_data(part, "batch", CURL_ZERO_TERMINATED);
+		part = curl_mime_addpart(mime);
+		curl_mime_name(part, "file");
+		curl_mime_filename(part, BATCH_API_FILE_NAME);
+		BufFileSeek(input, 0, 0, SEEK_SET);
+		curl_mime_data_cb(part, (curl_off_t)BufFileSize(input), read_input,
+						  seek_input, NULL, input);
+		curl_easy_setopt(curl, CURLOPT_MIMEPOST, mime);
+	}
+
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_response);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&response);
+	curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+	curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, check_interrupts);
+
+	res = curl_easy_perform(curl);
+	if (res == CURLE_OK)
+		curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
+	curl_easy_cleanup(curl);
+	curl_mime_free(mime);
+	curl_slist_free_all(headers);
+
+	CHECK_FOR_INTERRUPTS();
+	if (res != CURLE_OK)
+		ereport(ERROR, (errmsg("batch API request %s failed: %s", path,
+							   curl_easy_strerror(res))));
+	if (response_code != HTTP_OK)
+		ereport(ERROR,
+				(errmsg("batch API request %s failed with status %ld", path,
+						response_code),
+				 output ? 0 : errdetail("%s", body->data)));
+}
+
+static JsonbContainer *parse_json(const char *json)
+{
+	return &DatumGetJsonbP(DirectFunctionCall1(jsonb_in,
+											   CStringGetDatum(json)))
+				->root;
+}
+
+/* a field of a JSON object, NULL if it is not set or is null */
+static JsonbValue *get_json_field(JsonbContainer *container, const char *key,
+								  JsonbValue *value)
+{
+	if (!JsonContainerIsObject(container) ||
+		!getKeyJsonValueFromContainer(container, key, strlen(key), value) ||
+		value->type == jbvNull)
+		return NULL;
+	return value;
+}
+
+static char *get_json_string(JsonbContainer *container, const char *key)
+{
+	JsonbValue value;
+
+	if (!get_json_field(container, key, &value) || value.type != jbvString)
+		return NULL;
+	return pnstrdup(value.val.string.val, value.val.string.len);
+}
+
+/* the object of a field, NULL if the field is not an object or array */
+static JsonbContainer *get_json_container(JsonbContainer *container,
+										  const char *key)
+{
+	JsonbValue value;
+
+	if (!get_json_field(container, key, &value) || value.type != jbvBinary)
+		return NULL;
+	return value.val.binary.data;
+}
+
+/* the id of a file or batch created, errors out if there is none */
+static char *get_created_id(const char *response)
+{
+	char *id = get_json_string(parse_json(response), "id");
+
+	if (!id)
+		ereport(ERROR, (errmsg("batch API response has no id"),
+						errdetail("%s", response)));
+	return id;
+}
+
+char *provider_batch_create(AIService *ai_service, BufFile *input,
+							const char *endpoint)
+{
+	StringInfoData body;
+	StringInfoData request;
+	char *file_id;
+
+	initStringInfo(&body);
+	batch_api_request(ai_service, BATCH_API_FILES, NULL, input, NULL, &body);
+	file_id = get_created_id(body.data);
+
+	initStringInfo(&request);
+	appendStringInfoString(&request, "{\"input_file_id\": ");
+	escape_json(&request, file_id);
+	appendStringInfoString(&request, ", \"endpoint\": ");
+	escape_json(&request, endpoint);
+	appendStringInfo(&request, ", \"completion_window\": \"%s\"}",
+					 BATCH_API_COMPLETION_WINDOW);
+
+	resetStringInfo(&body);
+	batch_api_request(ai_service, BATCH_API_BATCHES, request.data, NULL, NULL,
+					  &body);
+	return get_created_id(body.data);
+}
+
+/* the message of the first error of a batch, NULL if it has none */
+static char *get_batch_error(JsonbContainer *batch)
+{
+	JsonbContainer *errors = get_json_container(batch, "errors");
+	JsonbContainer *data = errors ? get_json_container(errors, "data") : NULL;
+	JsonbValue *error;
+
+	if (!data || !JsonContainerIsArray(data) ||
+		!(error = getIthJsonbValueFromContainer(data, 0)) ||
+		error->type != jbvBinary)
+		return NULL;
+	return get_json_string(error->val.binary.data, "message");
+}
+
+/*
+ * An expired batch is completed, its output has the requests done in the
+ * completion window and its errors the others.
+ */
+ProviderBatchStatus provider_batch_status(AIService *ai_service,
+										  const char *batch_id,
+										  char **output_file_id,
+										  char **error_file_id, char **error)
+{
+	StringInfoData body;
+	JsonbContainer *batch;
+	char *status;
+
+	initStringInfo(&body);
+	batch_api_request(ai_service,
+					  psprintf("%s/%s", BATCH_API_BATCHES, batch_id), NULL,
+					  NULL, NULL, &body);
+	batch = parse_json(body.data);
+
+	*output_file_id = get_json_string(batch, "output_file_id");
+	*error_file_id = get_json_string(batch, "error_file_id");
+	*error = NULL;
+
+	if (!(status = get_json_string(batch, "status")))
+		ereport(ERROR, (errmsg("batch API response has no status"),
+						errdetail("%s", body.data)));
+	if (strcmp(status, "completed") == 0 || strcmp(status, "expired") == 0)
+		return PROVIDER_BATCH_COMPLETED;
+	if (strcmp(status, "failed") == 0 || strcmp(status, "cancelled") == 0)
+	{
+		*error = get_batch_error(batch);
+		if (!*error)
+			*error = psprintf("batch %s %s", batch_id, status);
+		return PROVIDER_BATCH_FAILED;
+	}
+	return PROVIDER_BATCH_IN_PROGRESS;
+}
+
+BufFile *provider_batch_download(AIService *ai_service, const char *file_id)
+{
+	BufFile *output = BufFileCreateTemp(true /* interXact */);
+
+	batch_api_request(ai_service,
+					  psprintf("%s/%s/content", BATCH_API_FILES, file_id),
+					  NULL, NULL, output, NULL);
+	BufFileSeek(output, 0, 0, SEEK_SET);
+	return output;
+}
+
+/*
+ * A line of the output has the response of a request, a line of the errors
+ * the response or the error of a request that failed.
+ */
+bool provider_batch_next_response(BufFile *output, StringInfo line,
+								  ProviderBatchResponse *response)
+{
+	JsonbContainer *root;
+	JsonbContainer *result;
+	JsonbContainer *body;
+	JsonbValue status_code;
+	char *custom_id;
+	char c;
+
+	resetStringInfo(line);
+	while (BufFileRead(output, &c, 1) == 1)
+	{
+		if (c != '\n')
+			appendStringInfoChar(line, c);
+		else if (line->len > 0)
+			break;
+	}
+	if (line->len == 0)
+		return false;
+
+	root = parse_json(line->data);
+	if (!(custom_id = get_json_string(root, "custom_id")))
+		ereport(ERROR, (errmsg("batch API output line has no custom_id"),
+						errdetail("%s", line->data)));
+	response->custom_id = strtoll(custom_id, NULL, 10);
+	response->status_code = 0;
+	response->body = NULL;
+
+	if ((result = get_json_container(root, "response")))
+	{
+		if (get_json_field(result, "status_code", &status_code) &&
+			status_code.type == jbvNumeric)
+			response->status_code = DatumGetInt64(DirectFunctionCall1(
+				numeric_int8, NumericGetDatum(status_code.val.numeric)));
+		if ((body = get_json_container(result, "body")))
+			response->body = JsonbToCString(NULL, body, line->len);
+	}
+	if (!response->body && (result = get_json_container(root, "error")))
+		response->body = get_json_string(result, "message");
+	if (!response->body)
+		response->body = pstrdup(GET_ERR_STR(TRANSFER_FAIL));
+
+	return true;
+}
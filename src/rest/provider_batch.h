@@ -0,0 +1,58 @@
+#ifndef _PROVIDER_BATCH_H_
+#define _PROVIDER_BATCH_H_
+
+#include "postgres.h"
+#include "lib/stringinfo.h"
+#include "storage/buffile.h"
+
+#include "core/ai_service.h"
+
+/*
+ * The offline batch API of the provider: a JSONL file of requests is
+ * uploaded, run by the provider within its completion window, and the
+ * responses are downloaded as a JSONL file. The endpoints are under
+ * pg_ai.batch_api_url, the API key is the key of the service.
+ */
+typedef enum ProviderBatchStatus
+{
+	PROVIDER_BATCH_IN_PROGRESS = 0,
+	PROVIDER_BATCH_COMPLETED,
+	PROVIDER_BATCH_FAILED
+} ProviderBatchStatus;
+
+/* the response to a request of a batch, from a line of the output */
+typedef struct ProviderBatchResponse
+{
+	int64 custom_id;
+	long status_code;
+	char *body; /* the response body, or the error message */
+} ProviderBatchResponse;
+
+/* the path of the endpoint of the service, as a batch request names it */
+const char *provider_batch_endpoint(AIService *ai_service);
+
+/* add a request with the given POST data to the JSONL input of a batch */
+void provider_batch_add_request(BufFile *input, const char *endpoint,
+								const int64 custom_id, const char *post_data);
+
+/* upload the input and create a batch of it, returns the id of the batch */
+char *provider_batch_create(AIService *ai_service, BufFile *input,
+							const char *endpoint);
+
+/*
+ * The status of a batch. A completed batch has the ids of its output and
+ * error files, either can be NULL, a failed batch its error.
+ */
+ProviderBatchStatus provider_batch_status(AIService *ai_service,
+										  const char *batch_id,
+										  char **output_file_id,
+										  char **error_file_id, char **error);
+
+/* download a file of the batch API into a temporary file, read from start */
+BufFile *provider_batch_download(AIService *ai_service, const char *file_id);
+
+/* the next response of a downloaded file, false at its end */
+bool provider_batch_next_response(BufFile *output, StringInfo line,
+								  ProviderBatchResponse *response);
+
+#endif /* _PROVIDER_BATCH_H_ */
@@ -0,0 +1,134 @@
+#include "recent_requests.h"
+
+#include "miscadmin.h"
+#include "common/hashfn.h"
+#include "port/atomics.h"
+#include "storage/shmem.h"
+
+/*
+ * A request in the ring. The sequence of the request at a position is odd
+ * while it is written and even once it is complete, so a reader can tell a
+ * complete request from one being overwritten without taking a lock.
+ */
+typedef struct RecentRequestSlot
+{
+	pg_atomic_uint64 sequence; /* 2 * position + 2 once written, 0 unused */
+	RecentRequest request;
+} RecentRequestSlot;
+
+/* the ring shared across the backends, next counts every added request */
+typedef struct RecentRequestsState
+{
+	pg_atomic_uint64 next;
+	RecentRequestSlot slots[RECENT_REQUESTS_SIZE];
+} RecentRequestsState;
+
+/* stays NULL if pg_ai is not in shared_preload_libraries */
+static RecentRequestsState *recent_requests = NULL;
+
+/*
+ * Shared memory needed by the ring.
+ */
+Size recent_requests_shmem_size(void)
+{
+	return sizeof(RecentRequestsState);
+}
+
+/*
+ * Attach to the ring, initialize it on the first call. The ring takes no
+ * lock, the one of the segment is not used.
+ */
+void recent_requests_shmem_startup(LWLock *lock)
+{
+	bool found;
+
+	recent_requests = ShmemInitStruct(PG_AI_SHMEM_RECENT_REQUESTS,
+									  recent_requests_shmem_size(), &found);
+	if (found)
+		return;
+
+	memset(recent_requests, 0, sizeof(RecentRequestsState));
+	pg_atomic_init_u64(&recent_requests->next, 0);
+	for (int i = 0; i < RECENT_REQUESTS_SIZE; i++)
+		pg_atomic_init_u64(&recent_requests->slots[i].sequence, 0);
+}
+
+/*
+ * Add a finished request at the next position of the ring. The request is
+ * dropped in the rare case the slot is still written by a request a whole
+ * ring earlier, so a backend never waits for another one.
+ */
+void recent_requests_add(const int function_flags, const char *url,
+						 const char *post_data, const RequestTimings *timings,
+						 const RestResponse *response, const long latency_ms)
+{
+	RecentRequest request;
+	RecentRequestSlot *slot;
+	uint64 position;
+	uint64 sequence;
+
+	if (!recent_requests)
+		return;
+
+	memset(&request, 0, sizeof(request));
+	request.finished_at = GetCurrentTimestamp();
+	request.pid = MyProcPid;
+	request.function_flags = function_flags;
+	if (url)
+		snprintf(request.endpoint, sizeof(request.endpoint), "%.*s",
+				 (int)strcspn(url, "?"), url);
+	request.status = response->response_code;
+	request.latency_ms = latency_ms;
+	request.timings = *timings;
+	if (post_data)
+		request.request_hash =
+			hash_bytes((const unsigned char *)post_data, strlen(post_data));
+
+	position = pg_atomic_fetch_add_u64(&recent_requests->next, 1);
+	slot = &recent_requests->slots[position % RECENT_REQUESTS_SIZE];
+
+	/* the exchange is a full barrier, the copy cannot start before it */
+	sequence = pg_atomic_read_u64(&slot->sequence);
+	if (sequence % 2 == 1 || sequence > position * 2 ||
+		!pg_atomic_compare_exchange_u64(&slot->sequence, &sequence,
+										position * 2 + 1))
+		return;
+
+	memcpy(&slot->request, &request, sizeof(RecentRequest));
+	pg_write_barrier();
+	pg_atomic_write_u64(&slot->sequence, position * 2 + 2);
+}
+
+/*
+ * Copy the complete requests of the ring. A request overwritten while it is
+ * copied is left out.
+ */
+int recent_requests_get(RecentRequest **requests)
+{
+	RecentRequestSlot *slot;
+	uint64 next;
+	uint64 position;
+	uint64 sequence;
+	int count = 0;
+
+	*requests = palloc(sizeof(RecentRequest) * RECENT_REQUESTS_SIZE);
+	if (!recent_requests)
+		return 0;
+
+	next = pg_atomic_read_u64(&recent_requests->next);
+	position = next > RECENT_REQUESTS_SIZE ? next - RECENT_REQUESTS_SIZE : 0;
+	for (; position < next; position++)
+	{
+		slot = &recent_requests->slots[position % RECENT_REQUESTS_SIZE];
+		sequence = position * 2 + 2;
+		if (pg_atomic_read_u64(&slot->sequence) != sequence)
+			continue;
+
+		pg_read_barrier();
+		memcpy(&(*requests)[count], &slot->request, sizeof(RecentRequest));
+		pg_read_barrier();
+		if (pg_atomic_read_u64(&slot->sequence) == sequence)
+			count++;
+	}
+	return count;
+}
@@ -0,0 +1,35 @@
+#ifndef _RECENT_REQUESTS_H_
+#define _RECENT_REQUESTS_H_
+
+#include "postgres.h"
+#include "storage/lwlock.h"
+#include "utils/timestamp.h"
+
+#include "rest/request_stats.h"
+
+/* a finished request, as kept in the ring of the recent requests */
+typedef struct RecentRequest
+{
+	TimestampTz finished_at;
+	int pid;
+	int function_flags;
+	char endpoint[RECENT_REQUESTS_ENDPOINT_LENGTH]; /* without the query */
+	long status;
+	long latency_ms;
+	RequestTimings timings;
+	uint32 request_hash; /* of the request body, which is not kept */
+} RecentRequest;
+
+/* shared memory setup, called from the pg_ai shmem hooks */
+Size recent_requests_shmem_size(void);
+void recent_requests_shmem_startup(LWLock *lock);
+
+/* add a finished request to the ring, in place of the oldest one */
+void recent_requests_add(const int function_flags, const char *url,
+						 const char *post_data, const RequestTimings *timings,
+						 const RestResponse *response, const long latency_ms);
+
+/* copies of the requests in the ring, the oldest first */
+int recent_requests_get(RecentRequest **requests);
+
+#endif /* _RECENT_REQUESTS_H_ */
@@ -0,0 +1,394 @@
+#include "request_stats.h"
+
+#include <math.h>
+
+#include "storage/shmem.h"
+#include "storage/spin.h"
+
+/* an entry in shared memory, its counters are updated under its mutex */
+typedef struct RequestStatsEntry
+{
+	slock_t mutex;
+	RequestStats stats; /* empty service for an unused entry */
+} RequestStatsEntry;
+
+/*
+ * The entries shared across the backends. The lock is taken shared to find
+ * and update an entry, exclusive to add or reset entries.
+ */
+typedef struct RequestStatsState
+{
+	LWLock *lock;
+	RequestStatsEntry entries[REQUEST_STATS_MAX_ENTRIES];
+} RequestStatsState;
+
+/* stays NULL if pg_ai is not in shared_preload_libraries */
+static RequestStatsState *request_stats = NULL;
+
+/* the SQL function of each of the function flags, in the order of the bits */
+static const char *function_names[] = {"pg_ai_insight",
+										"pg_ai_insight_agg",
+										"pg_ai_generate_image",
+										"pg_ai_generate_image_agg",
+										"pg_ai_create_vector_store",
+										"pg_ai_query_vector_store",
+										"pg_ai_moderation",
+										"pg_ai_moderation_agg",
+										"embed_text"};
+
+/* the usage fields of the OpenAI and Gemini responses */
+static const char *tokens_in_keys[] = {"prompt_tokens", "promptTokenCount"};
+static const char *tokens_out_keys[] = {"completion_tokens",
+										"candidatesTokenCount"};
+
+/*
+ * Shared memory needed by the entries.
+ */
+Size request_stats_shmem_size(void)
+{
+	return sizeof(RequestStatsState);
+}
+
+/*
+ * Attach to the entries, initialize them on the first call.
+ */
+void request_stats_shmem_startup(LWLock *lock)
+{
+	bool found;
+
+	request_stats = ShmemInitStruct(PG_AI_SHMEM_REQUEST_STATS,
+									request_stats_shmem_size(), &found);
+	if (found)
+		return;
+
+	memset(request_stats, 0, sizeof(RequestStatsState));
+	request_stats->lock = lock;
+	for (int i = 0; i < REQUEST_STATS_MAX_ENTRIES; i++)
+		SpinLockInit(&request_stats->entries[i].mutex);
+}
+
+const char *request_stats_function_name(const int function_flags)
+{
+	for (int i = 0; i < lengthof(function_names); i++)
+		if (function_flags & (1 << i))
+			return function_names[i];
+	return "unknown";
+}
+
+/*
+ * Find the entry of the key, -1 if it has none. With a free index, an unused
+ * entry is returned there. Called with the lock held.
+ */
+static int find_entry(const char *service, const char *model,
+					  const int function_flags, int *free_index)
+{
+	if (free_index)
+		*free_index = -1;
+
+	for (int i = 0; i < REQUEST_STATS_MAX_ENTRIES; i++)
+	{
+		RequestStats *stats = &request_stats->entries[i].stats;
+
+		if (stats->service[0] == '\0')
+		{
+			if (free_index && *free_index < 0)
+				*free_index = i;
+		}
+		else if (stats->function_flags == function_flags &&
+				 strcmp(stats->service, service) == 0 &&
+				 strcmp(stats->model, model) == 0)
+			return i;
+	}
+	return -1;
+}
+
+/*
+ * The entry of the service, model and function of the call, added if it is
+ * new. Returns -1 once all the entries are in use.
+ */
+int request_stats_entry(const AIService *ai_service)
+{
+	char service[REQUEST_STATS_NAME_LENGTH];
+	char model[REQUEST_STATS_NAME_LENGTH];
+	RequestStats *stats;
+	int free_index;
+	int entry;
+
+	if (!request_stats)
+		return -1;
+
+	strlcpy(service, get_service_name(ai_service), sizeof(service));
+	strlcpy(model, get_model_name(ai_service), sizeof(model));
+
+	LWLockAcquire(request_stats->lock, LW_SHARED);
+	entry = find_entry(service, model, ai_service->function_flags, NULL);
+	LWLockRelease(request_stats->lock);
+	if (entry >= 0)
+		return entry;
+
+	/* added by another backend since the shared lock was released */
+	LWLockAcquire(request_stats->lock, LW_EXCLUSIVE);
+	entry = find_entry(service, model, ai_service->function_flags,
+					   &free_index);
+	if (entry < 0 && free_index >= 0)
+	{
+		entry = free_index;
+		stats = &request_stats->entries[entry].stats;
+		memset(stats, 0, sizeof(RequestStats));
+		strcpy(stats->service, service);
+		strcpy(stats->model, model);
+		stats->function_flags = ai_service->function_flags;
+		stats->stats_since = GetCurrentTimestamp();
+	}
+	LWLockRelease(request_stats->lock);
+
+	return entry;
+}
+
+/*
+ * The count following a key of the usage in a JSON response, 0 if the
+ * response has none. The response is not null terminated.
+ */
+static int64 get_usage_count(const char *data, const size_t size,
+							 const char **keys, const int key_count)
+{
+	for (int k = 0; k < key_count; k++)
+	{
+		size_t key_len = strlen(keys[k]);
+		int64 count = 0;
+		size_t i;
+
+		for (i = 0; i + key_len + 2 < size; i++)
+			if (data[i] == '"' && data[i + key_len + 1] == '"' &&
+				strncmp(data + i + 1, keys[k], key_len) == 0)
+				break;
+		if (i + key_len + 2 >= size)
+			continue;
+
+		for (i += key_len + 2; i < size && (data[i] == ':' || data[i] == ' ');
+			 i++)
+			;
+		for (; i < size && data[i] >= '0' && data[i] <= '9'; i++)
+			count = count * 10 + (data[i] - '0');
+		return count;
+	}
+	return 0;
+}
+
+static int get_latency_bucket(const long latency_ms)
+{
+	int bucket;
+
+	if (latency_ms <= 1)
+		return 0;
+	bucket = (int)(log2((double)latency_ms) *
+				   REQUEST_STATS_BUCKETS_PER_DOUBLING);
+	return Min(bucket, REQUEST_STATS_LATENCY_BUCKETS - 1);
+}
+
+/* the time from the start of a request to a point of it, 0 if not reached */
+static int64 get_time_us(CURL *curl, const CURLINFO info)
+{
+	curl_off_t time_us = 0;
+
+	curl_easy_getinfo(curl, info, &time_us);
+	return (int64)time_us;
+}
+
+void request_stats_read_timings(CURL *curl, RequestTimings *timings)
+{
+	int64 name_lookup = get_time_us(curl, CURLINFO_NAMELOOKUP_TIME_T);
+	int64 connect = get_time_us(curl, CURLINFO_CONNECT_TIME_T);
+	int64 app_connect = get_time_us(curl, CURLINFO_APPCONNECT_TIME_T);
+	int64 pre_transfer = get_time_us(curl, CURLINFO_PRETRANSFER_TIME_T);
+	int64 start_transfer = get_time_us(curl, CURLINFO_STARTTRANSFER_TIME_T);
+	curl_off_t bytes_sent = 0;
+	curl_off_t bytes_received = 0;
+
+	/* a plain or reused connection has no handshake, its time is 0 */
+	timings->total_us = get_time_us(curl, CURLINFO_TOTAL_TIME_T);
+	timings->dns_us = name_lookup;
+	timings->connect_us = Max(connect - name_lookup, 0);
+	timings->tls_us = app_connect > 0 ? Max(app_connect - connect, 0) : 0;
+	timings->ttfb_us =
+		start_transfer > 0 ? Max(start_transfer - pre_transfer, 0) : 0;
+	timings->transfer_us =
+		start_transfer > 0 ? Max(timings->total_us - start_transfer, 0) : 0;
+
+	timings->http_version = 0;
+	timings->new_connections = 0;
+	curl_easy_getinfo(curl, CURLINFO_HTTP_VERSION, &timings->http_version);
+	curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &timings->new_connections);
+	curl_easy_getinfo(curl, CURLINFO_SIZE_UPLOAD_T, &bytes_sent);
+	curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &bytes_received);
+	timings->bytes_sent = (int64)bytes_sent;
+	timings->bytes_received = (int64)bytes_received;
+}
+
+const char *request_stats_http_version_name(const long http_version)
+{
+	switch (http_version)
+	{
+	case CURL_HTTP_VERSION_1_0:
+		return "HTTP/1.0";
+	case CURL_HTTP_VERSION_1_1:
+		return "HTTP/1.1";
+	case CURL_HTTP_VERSION_2_0:
+		return "HTTP/2";
+	case CURL_HTTP_VERSION_3:
+		return "HTTP/3";
+	default:
+		return "none";
+	}
+}
+
+void request_stats_record(const int entry, const RequestTimings *timings,
+						  const RestResponse *response, const long latency_ms)
+{
+	int64 tokens_in = 0;
+	int64 tokens_out = 0;
+	long code = response->response_code;
+	RequestStatsEntry *shared;
+	RequestStats *stats;
+
+	if (!request_stats || entry < 0)
+		return;
+
+	if (code == HTTP_OK)
+	{
+		tokens_in = get_usage_count(response->data, response->data_size,
+									tokens_in_keys, lengthof(tokens_in_keys));
+		tokens_out =
+			get_usage_count(response->data, response->data_size,
+							tokens_out_keys, lengthof(tokens_out_keys));
+	}
+
+	LWLockAcquire(request_stats->lock, LW_SHARED);
+	shared = &request_stats->entries[entry];
+	stats = &shared->stats;
+
+	/* an entry reset since the request started is not counted into */
+	if (stats->service[0] != '\0')
+	{
+		SpinLockAcquire(&shared->mutex);
+		stats->calls++;
+		if (code != HTTP_OK)
+			stats->errors++;
+		if (code == HTTP_TOO_MANY_REQUESTS)
+			stats->throttled++;
+		else if (code >= 400 && code < 500)
+			stats->client_errors++;
+		else if (code >= 500 && code < 600)
+			stats->server_errors++;
+		else if (code < 100)
+			stats->transfer_errors++;
+		stats->bytes_sent += timings->bytes_sent;
+		stats->bytes_received += timings->bytes_received;
+		stats->tokens_in += tokens_in;
+		stats->tokens_out += tokens_out;
+		stats->total_time_ms += latency_ms;
+		stats->dns_time_ms += timings->dns_us / 1000.0;
+		stats->connect_time_ms += timings->connect_us / 1000.0;
+		stats->tls_time_ms += timings->tls_us / 1000.0;
+		stats->ttfb_time_ms += timings->ttfb_us / 1000.0;
+		stats->transfer_time_ms += timings->transfer_us / 1000.0;
+		stats->new_connections += timings->new_connections > 0;
+		if (timings->http_version == CURL_HTTP_VERSION_1_0 ||
+			timings->http_version == CURL_HTTP_VERSION_1_1)
+			stats->http1_calls++;
+		else if (timings->http_version == CURL_HTTP_VERSION_2_0)
+			stats->http2_calls++;
+		else if (timings->http_version == CURL_HTTP_VERSION_3)
+			stats->http3_calls++;
+		stats->latency_buckets[get_latency_bucket(latency_ms)]++;
+		SpinLockRelease(&shared->mutex);
+	}
+	LWLockRelease(request_stats->lock);
+}
+
+void request_stats_count_cache_hit(const AIService *ai_service)
+{
+	RequestStatsEntry *shared;
+	int entry;
+
+	if ((entry = request_stats_entry(ai_service)) < 0)
+		return;
+
+	LWLockAcquire(request_stats->lock, LW_SHARED);
+	shared = &request_stats->entries[entry];
+	if (shared->stats.service[0] != '\0')
+	{
+		SpinLockAcquire(&shared->mutex);
+		shared->stats.cache_hits++;
+		SpinLockRelease(&shared->mutex);
+	}
+	LWLockRelease(request_stats->lock);
+}
+
+/*
+ * Copy the entries in use. Returns the number of entries.
+ */
+int request_stats_get(RequestStats **stats)
+{
+	int count = 0;
+
+	*stats = palloc(sizeof(RequestStats) * REQUEST_STATS_MAX_ENTRIES);
+	if (!request_stats)
+		return 0;
+
+	LWLockAcquire(request_stats->lock, LW_SHARED);
+	for (int i = 0; i < REQUEST_STATS_MAX_ENTRIES; i++)
+	{
+		RequestStatsEntry *shared = &request_stats->entries[i];
+
+		if (shared->stats.service[0] == '\0')
+			continue;
+
+		SpinLockAcquire(&shared->mutex);
+		memcpy(&(*stats)[count++], &shared->stats, sizeof(RequestStats));
+		SpinLockRelease(&shared->mutex);
+	}
+	LWLockRelease(request_stats->lock);
+
+	return count;
+}
+
+/*
+ * Forget all the entries, they start over with the next requests.
+ */
+void request_stats_reset(void)
+{
+	if (!request_stats)
+		return;
+
+	LWLockAcquire(request_stats->lock, LW_EXCLUSIVE);
+	for (int i = 0; i < REQUEST_STATS_MAX_ENTRIES; i++)
+		memset(&request_stats->entries[i].stats, 0, sizeof(RequestStats));
+	LWLockRelease(request_stats->lock);
+}
+
+/*
+ * Estimated from the histogram, the latency is taken to grow evenly on the
+ * log scale within a bucket. Returns -1 for an entry without calls.
+ */
+double request_stats_latency_percentile(const RequestStats *stats,
+										const double fraction)
+{
+	double rank = fraction * stats->calls;
+	double below = 0;
+
+	if (stats->calls == 0)
+		return -1;
+
+	for (int i = 0; i < REQUEST_STATS_LATENCY_BUCKETS; i++)
+	{
+		int64 count = stats->latency_buckets[i];
+
+		if (count > 0 && below + count >= rank)
+			return pow(2.0, (i + (rank - below) / count) /
+								REQUEST_STATS_BUCKETS_PER_DOUBLING);
+		below += count;
+	}
+	return pow(2.0, (double)REQUEST_STATS_LATENCY_BUCKETS /
+						REQUEST_STATS_BUCKETS_PER_DOUBLING);
+}
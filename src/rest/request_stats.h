@@ -0,0 +1,96 @@
+#ifndef _REQUEST_STATS_H_
+#define _REQUEST_STATS_H_
+
+#include "postgres.h"
+#include "storage/lwlock.h"
+#include "utils/timestamp.h"
+
+#include "core/ai_service.h"
+
+/*
+ * Where the time of a finished request went, and what it sent and received,
+ * read from its curl handle. The phases follow one another: the DNS lookup,
+ * the TCP connect, the TLS handshake, the wait from the request sent to the
+ * first byte of the answer, and the transfer of the answer. The phases of a
+ * reused connection take no time.
+ */
+typedef struct RequestTimings
+{
+	int64 dns_us;
+	int64 connect_us;
+	int64 tls_us;
+	int64 ttfb_us;
+	int64 transfer_us;
+	int64 total_us;
+	long http_version; /* CURL_HTTP_VERSION_*, 0 without an answer */
+	long new_connections;
+	int64 bytes_sent;
+	int64 bytes_received;
+} RequestTimings;
+
+/*
+ * The counters of the requests of a (service, model, function), over all
+ * the backends since the last reset.
+ */
+typedef struct RequestStats
+{
+	char service[REQUEST_STATS_NAME_LENGTH];
+	char model[REQUEST_STATS_NAME_LENGTH];
+	int function_flags;
+	int64 calls;
+	int64 errors;		   /* the calls without an HTTP 200 answer */
+	int64 client_errors;   /* 4xx other than 429 */
+	int64 throttled;	   /* 429, sent again by the callers that retry */
+	int64 server_errors;   /* 5xx */
+	int64 transfer_errors; /* no HTTP answer at all */
+	int64 bytes_sent;
+	int64 bytes_received;
+	int64 tokens_in;  /* from the usage of the responses */
+	int64 tokens_out;
+	int64 cache_hits; /* calls answered by the shared caches */
+	double total_time_ms;
+	double dns_time_ms; /* the time of each phase of the requests */
+	double connect_time_ms;
+	double tls_time_ms;
+	double ttfb_time_ms;
+	double transfer_time_ms;
+	int64 new_connections; /* the requests not on a reused connection */
+	int64 http1_calls;
+	int64 http2_calls;
+	int64 http3_calls;
+	int64 latency_buckets[REQUEST_STATS_LATENCY_BUCKETS];
+	TimestampTz stats_since;
+} RequestStats;
+
+/* shared memory setup, called from the pg_ai shmem hooks */
+Size request_stats_shmem_size(void);
+void request_stats_shmem_startup(LWLock *lock);
+
+/* the entry of the service call, -1 if the statistics are not kept */
+int request_stats_entry(const AIService *ai_service);
+
+/* the timings of the last request of a handle */
+void request_stats_read_timings(CURL *curl, RequestTimings *timings);
+
+/* the name of an HTTP version, as in the statistics */
+const char *request_stats_http_version_name(const long http_version);
+
+/* count a finished request of the entry, with its timings and response */
+void request_stats_record(const int entry, const RequestTimings *timings,
+						  const RestResponse *response, const long latency_ms);
+
+/* count a call answered by a cache without a request */
+void request_stats_count_cache_hit(const AIService *ai_service);
+
+/* copies of the entries, and forgetting them all */
+int request_stats_get(RequestStats **stats);
+void request_stats_reset(void);
+
+/* the SQL function name of the function flags */
+const char *request_stats_function_name(const int function_flags);
+
+/* the latency under which the given fraction of the calls were, in ms */
+double request_stats_latency_percentile(const RequestStats *stats,
+										const double fraction);
+
+#endif /* _REQUEST_STATS_H_ */
@@ -1,20 +1,44 @@
 #include "rest_transfer.h"
 
+#include "miscadmin.h"
+#include "utils/timestamp.h"
+
+#include "core/tokenizer.h"
 #include "core/utils_pg_ai.h"
+#include "rest/adaptive_limit.h"
+#include "rest/recent_requests.h"
+#include "rest/request_stats.h"
+
+/* how long a set of transfers waits before it looks for a free slot again */
+#define REST_TRANSFER_POLL_MS 100
 
 /*
- * Initialize the transfer buffers required for the REST transfer.
- * TODO these pointers to be cached to be reused between calls.
+ * The handle of the single transfers and the connections, DNS entries and TLS
+ * sessions shared by all the handles of the process. Each backend and each
+ * parallel worker has its own, so a worker keeps its connections alive
+ * across the rows it is given.
+ */
+static CURL *process_curl = NULL;
+static CURLSH *process_curl_share = NULL;
+
+/* the multi handle of the background transfers of the session */
+static CURLM *async_multi = NULL;
+static int async_in_flight = 0;
+
+/*
+ * Initialize the transfer buffers required for the REST transfer. They live
+ * as long as the service and are reused by its later calls.
  */
 void init_rest_transfer(AIService *ai_service)
 {
 	if (!ai_service->rest_request)
-		ai_service->rest_request = (RestRequest *)palloc(sizeof(RestRequest));
+		ai_service->rest_request = (RestRequest *)MemoryContextAlloc(
+			ai_service->memory_context, sizeof(RestRequest));
 	ai_service->rest_request->data_size = 0;
 
 	if (!ai_service->rest_response)
-		ai_service->rest_response =
-			(RestResponse *)palloc(sizeof(RestResponse));
+		ai_service->rest_response = (RestResponse *)MemoryContextAlloc(
+			ai_service->memory_context, sizeof(RestResponse));
 	ai_service->rest_response->data_size = 0;
 
 	(ai_service->set_service_buffers)(ai_service->rest_request,
@@ -26,16 +50,15 @@ void init_rest_transfer(AIService *ai_service)
 
 /*
  * Cleanup the buffers used for the REST transfer
- * TODO these pointers to be cached to be reused between calls.
  */
 void cleanup_rest_transfer(AIService *ai_service)
 {
 	if (ai_service->rest_request)
-		free(ai_service->rest_request);
+		pfree(ai_service->rest_request);
 	ai_service->rest_request = NULL;
 
 	if (ai_service->rest_response)
-		free(ai_service->rest_response);
+		pfree(ai_service->rest_response);
 	ai_service->rest_response = NULL;
 }
 
@@ -74,72 +97,240 @@ static size_t read_callback(void *contents, size_t size, size_t nmemb,
 }
 
 /*
- * The callback function called by curl library with debug information if
- * CURLOPT_VERBOSE is set. The data will not be null terminated.
+ * Helper function to make the REST headers. Makes call to the service specific
+ * callback to make the headers.
  */
-static int debug_curl(CURL *curl, curl_infotype type, char *data, size_t size,
-					  void *userp)
+static void make_curl_headers(CURL *curl, AIService *ai_service)
 {
-	size_t i;
-	size_t c;
-	unsigned int display_width = 0x10;
-	const char *delimiter_start = "\n----8<----\n";
-	const char *delimiter_end = "\n---->8----\n";
+	struct curl_slist *headers = NULL;
+	/* set the URL */
+	curl_easy_setopt(curl, CURLOPT_URL,
+					 get_option_value(ai_service->service_data->options,
+									  OPTION_ENDPOINT_URL));
+	ai_service->add_rest_headers(curl, &headers, ai_service);
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+}
+
+/*
+ * Helper function to check the tokens to be passed to the service against
+ * the context of its model, less the part kept for the output.
+ */
+static int vaildate_data_size(const AIService *ai_service, const char *text,
+							  size_t *max_supported)
+{
+	const ModelContext *model =
+		get_model_context(ai_service->get_model_name(ai_service));
+	size_t len = strlen(text);
 
-	fprintf(stderr, "%s, %10.10ld bytes (0x%8.8lx)\n", delimiter_start,
-			(long)size, (long)size);
+	*max_supported = get_request_token_limit(model);
+	if (get_token_prefix_length(model, text, len, *max_supported) < len)
+		return RETURN_ERROR;
+	return RETURN_ZERO;
+}
 
-	for (i = 0; i < size; i += display_width)
+/*
+ * Answer a request over the tokens of the model without a transfer, the
+ * response buffer must hold ERROR_MSG_LEN.
+ */
+static void set_data_too_big(RestResponse *response, const size_t max_tokens)
+{
+	response->response_code = 0x2;
+	snprintf(response->data, ERROR_MSG_LEN, GET_ERR_STR(DATA_TOO_BIG),
+			 max_tokens);
+	response->data_size = strlen(response->data);
+}
+
+/*
+ * The share of the process, made on the first transfer. Without it each
+ * handle keeps its connections to itself.
+ */
+static CURLSH *get_curl_share(void)
+{
+	if (!process_curl_share && (process_curl_share = curl_share_init()))
 	{
-		fprintf(stderr, "%4.4lx: ", (long)i);
-		/* hex on the left */
-		for (c = 0; c < display_width; c++)
-		{
-			if (i + c < size)
-				fprintf(stderr, "%02x ", data[i + c]);
-			else
-				fputs("   ", stderr);
-		}
-		/* ascii on the right */
-		for (c = 0; (c < display_width) && (i + c < size); c++)
-		{
-			char x;
+		curl_share_setopt(process_curl_share, CURLSHOPT_SHARE,
+						  CURL_LOCK_DATA_CONNECT);
+		curl_share_setopt(process_curl_share, CURLSHOPT_SHARE,
+						  CURL_LOCK_DATA_DNS);
+		curl_share_setopt(process_curl_share, CURLSHOPT_SHARE,
+						  CURL_LOCK_DATA_SSL_SESSION);
+	}
+	return process_curl_share;
+}
 
-			x = (data[i + c] >= 0x20 && data[i + c] < 0x80) ? data[i + c] : '.';
-			fputc(x, stderr);
-		}
-		fputc('\n', stderr); /* newline */
+/*
+ * The handle of the single transfers, reset for each transfer. The options
+ * of the previous transfer are cleared, its connection stays open.
+ */
+static CURL *get_process_curl(void)
+{
+	if (process_curl)
+		curl_easy_reset(process_curl);
+	else
+		process_curl = curl_easy_init();
+	return process_curl;
+}
+
+/*
+ * Make the POST data of a request, allocated in the current memory context.
+ * The escaped data can be three times the size of the data, the buffer is
+ * sized from it with POST_DATA_SIZE for the JSON of the service around it.
+ */
+static char *set_post_data(CURL *curl, AIService *ai_service,
+						   const char *data, const size_t data_size)
+{
+	char *encoded_prompt;
+	char *post_data;
+	size_t encoded_size;
+	size_t size;
+
+	encoded_prompt = curl_easy_escape(curl, data, data_size);
+	if (!encoded_prompt)
+		ereport(ERROR, (errmsg("%s", GET_ERR_STR(INT_PREP_TNSFR))));
+	encoded_size = strlen(encoded_prompt);
+	size = encoded_size + POST_DATA_SIZE;
+	post_data = palloc(size);
+	(ai_service->add_rest_data)(post_data, size, encoded_prompt,
+								encoded_size);
+	curl_free(encoded_prompt);
+
+	/* the callbacks truncate the POST data to the size, never send that */
+	if (strlen(post_data) + 1 >= size)
+		ereport(ERROR, (errmsg("%s", GET_ERR_STR(INT_PREP_TNSFR))));
+	return post_data;
+}
+
+/*
+ * Make the POST data of a request as a transfer of the service would send
+ * it, for the requests sent by other means than a transfer.
+ */
+char *make_post_data(AIService *ai_service, const char *data)
+{
+	CURL *curl = get_process_curl();
+
+	if (!curl)
+		ereport(ERROR, (errmsg("%s", GET_ERR_STR(INT_PREP_TNSFR))));
+	return set_post_data(curl, ai_service, data, strlen(data));
+}
+
+/*
+ * Set the request of a transfer on the curl handle, the response goes to the
+ * given response. Returns the POST data, which curl does not copy, allocated
+ * in the current memory context to be kept till the transfer is finished.
+ */
+static char *set_curl_request(CURL *curl, AIService *ai_service,
+							  const char *data, const size_t data_size,
+							  RestResponse *response)
+{
+	char *post_data;
+
+	make_curl_headers(curl, ai_service);
+	curl_easy_setopt(curl, CURLOPT_SHARE, get_curl_share());
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)response);
+
+	curl_easy_setopt(curl, CURLOPT_READFUNCTION, read_callback);
+	curl_easy_setopt(curl, CURLOPT_READDATA,
+					 (void *)(ai_service->rest_request));
+
+	/* TODO POST DATA has to be moved to respective service */
+	curl_easy_setopt(curl, CURLOPT_POST, 1);
+	post_data = set_post_data(curl, ai_service, data, data_size);
+	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, post_data);
+	return post_data;
+}
+
+/*
+ * Set the outcome of a finished transfer in its response.
+ */
+static void set_curl_response(CURL *curl, CURLcode res,
+							  RestResponse *response)
+{
+	if (res != CURLE_OK)
+	{
+		ereport(INFO, (errmsg("CURL ERROR: %d : %s\n\n", res,
+							  curl_easy_strerror(res))));
+		response->response_code = 0x1;
+		strcpy(response->data, GET_ERR_STR(TRANSFER_FAIL));
+		response->data_size = strlen(GET_ERR_STR(TRANSFER_FAIL));
 	}
+	else
+	{
+		curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE,
+						  &response->response_code);
+	}
+}
 
-	fprintf(stderr, "%s, %10.10ld bytes (0x%8.8lx)\n", delimiter_end,
-			(long)size, (long)size);
-	return 0;
+/* how the finished transfers of a service call are recorded */
+typedef struct TransferRecorder
+{
+	int stats_entry;
+	int function_flags;
+	bool debug;
+} TransferRecorder;
+
+static void init_transfer_recorder(AIService *ai_service,
+								   TransferRecorder *recorder)
+{
+	recorder->stats_entry = request_stats_entry(ai_service);
+	recorder->function_flags = ai_service->function_flags;
+	recorder->debug = DEBUG_LEVEL(PG_AI_DEBUG_3);
 }
 
 /*
- * Helper function to make the REST headers. Makes call to the service specific
- * callback to make the headers.
+ * Count a finished transfer in the statistics and add it to the recent
+ * requests. At debug level 3 where its time went is reported, the query
+ * string of the URL is left out as it may hold an API key.
  */
-static void make_curl_headers(CURL *curl, AIService *ai_service)
+static void record_transfer(CURL *curl, const TransferRecorder *recorder,
+							const char *post_data,
+							const RestResponse *response,
+							const long latency_ms)
 {
-	struct curl_slist *headers = NULL;
-	/* set the URL */
-	curl_easy_setopt(curl, CURLOPT_URL,
-					 get_option_value(ai_service->service_data->options,
-									  OPTION_ENDPOINT_URL));
-	ai_service->add_rest_headers(curl, &headers, ai_service);
-	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+	RequestTimings timings;
+	char *url = NULL;
+
+	request_stats_read_timings(curl, &timings);
+	request_stats_record(recorder->stats_entry, &timings, response,
+						 latency_ms);
+	curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &url);
+	recent_requests_add(recorder->function_flags, url, post_data, &timings,
+						response, latency_ms);
+
+	if (!recorder->debug)
+		return;
+	ereport(INFO,
+			(errmsg("pg_ai request %.*s: status %ld, %s, dns %.1f ms, "
+					"connect %.1f ms, tls %.1f ms, ttfb %.1f ms, "
+					"transfer %.1f ms, total %.1f ms, %s connection",
+					url ? (int)strcspn(url, "?") : 0, url ? url : "",
+					response->response_code,
+					request_stats_http_version_name(timings.http_version),
+					timings.dns_us / 1000.0, timings.connect_us / 1000.0,
+					timings.tls_us / 1000.0, timings.ttfb_us / 1000.0,
+					timings.transfer_us / 1000.0, timings.total_us / 1000.0,
+					timings.new_connections > 0 ? "new" : "reused")));
 }
 
 /*
- * Helper function to check the word count to be passed to the service.
- * TODO this has to get the word cound dynamically from the model used
+ * Take a slot of the endpoint of the URL. The limit is waited for only with
+ * no background transfer of the session in flight, as they are not moved on
+ * while waiting and could hold the slots waited for. With some in flight the
+ * finished ones give back their slots first.
  */
-static int vaildate_data_size(const char *text, size_t *max_supported)
+static int acquire_endpoint(const char *url, const TrafficClass traffic_class)
 {
-	/* TODO get the word count dynamically from the model used */
-	*max_supported = 1024;
-	return get_word_count(text, *max_supported, NULL);
+	int endpoint;
+
+	rest_async_poll(0);
+	while (async_in_flight > 0)
+	{
+		if (adaptive_limit_try_acquire(url, traffic_class, &endpoint))
+			return endpoint;
+		rest_async_poll(REST_TRANSFER_POLL_MS);
+		CHECK_FOR_INTERRUPTS();
+	}
+	return adaptive_limit_acquire(url, traffic_class);
 }
 
 /*
@@ -150,64 +341,411 @@ void rest_transfer(AIService *ai_service)
 {
 	CURL *curl;
 	CURLcode res;
-	char post_data[POST_DATA_SIZE];
-	char *encoded_prompt;
-	char error_msg[ERROR_MSG_LEN];
-	size_t max_word_count;
+	char *post_data;
+	size_t max_token_count;
+	TimestampTz start;
+	TrafficClass traffic_class = get_traffic_class(ai_service);
+	TransferRecorder recorder;
+	int endpoint;
+	long latency_ms;
 
 	/* TODO check for the size dynamically even before the trasfer is called */
-	if (vaildate_data_size(ai_service->rest_request->data, &max_word_count))
+	if (vaildate_data_size(ai_service, ai_service->rest_request->data,
+						   &max_token_count))
 	{
-		ai_service->rest_response->response_code = 0x2;
-		sprintf(error_msg, GET_ERR_STR(DATA_TOO_BIG), max_word_count);
-		strcpy(ai_service->rest_response->data, error_msg);
-		ai_service->rest_response->data_size = strlen(error_msg);
+		set_data_too_big(ai_service->rest_response, max_token_count);
 		return;
 	}
 
-	curl = curl_easy_init();
+	curl = get_process_curl();
 	if (curl)
 	{
-		/* set function to print curl request/response */
-		curl_easy_setopt(curl, CURLOPT_DEBUGFUNCTION, debug_curl);
-		/* CURLOPT_DEBUGFUNCTION has no effect if CURLOPT_VERBOSE is not set */
-		if (DEBUG_LEVEL(PG_AI_DEBUG_3))
-			curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
-
-		make_curl_headers(curl, ai_service);
-		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
-		curl_easy_setopt(curl, CURLOPT_WRITEDATA,
-						 (void *)(ai_service->rest_response));
-
-		curl_easy_setopt(curl, CURLOPT_READFUNCTION, read_callback);
-		curl_easy_setopt(curl, CURLOPT_READDATA,
-						 (void *)(ai_service->rest_request));
-
-		/* TODO POST DATA has to be moved to respective service */
-		curl_easy_setopt(curl, CURLOPT_POST, 1);
-		encoded_prompt = curl_easy_escape(curl, ai_service->rest_request->data,
-										  ai_service->rest_request->data_size);
-		(ai_service->add_rest_data)(post_data, POST_DATA_SIZE, encoded_prompt,
-									sizeof(encoded_prompt));
-		curl_free(encoded_prompt);
-		curl_easy_setopt(curl, CURLOPT_POSTFIELDS, post_data);
-
-		/* the actual REST data transfer */
+		post_data = set_curl_request(curl, ai_service,
+									 ai_service->rest_request->data,
+									 ai_service->rest_request->data_size,
+									 ai_service->rest_response);
+
+		/* the actual REST data transfer, within the limit of the endpoint */
+		endpoint = acquire_endpoint(
+			get_option_value(ai_service->service_data->options,
+							 OPTION_ENDPOINT_URL),
+			traffic_class);
+		start = GetCurrentTimestamp();
 		res = curl_easy_perform(curl);
-		if (res != CURLE_OK)
-		{
-			ereport(INFO, (errmsg("CURL ERROR: %d : %s\n\n", res,
-								  curl_easy_strerror(res))));
-			ai_service->rest_response->response_code = 0x1;
-			strcpy(ai_service->rest_response->data, GET_ERR_STR(TRANSFER_FAIL));
-			ai_service->rest_response->data_size =
-				strlen(GET_ERR_STR(TRANSFER_FAIL));
-		}
-		else
+		set_curl_response(curl, res, ai_service->rest_response);
+		latency_ms =
+			TimestampDifferenceMilliseconds(start, GetCurrentTimestamp());
+		adaptive_limit_release(endpoint, traffic_class,
+							   ai_service->rest_response->response_code,
+							   latency_ms);
+		init_transfer_recorder(ai_service, &recorder);
+		record_transfer(curl, &recorder, post_data, ai_service->rest_response,
+						latency_ms);
+		pfree(post_data);
+	}
+}
+
+/* a request of rest_transfer_many in flight, with its own buffers */
+typedef struct TransferSlot
+{
+	CURL *curl;
+	int index; /* the request in the slot, -1 for a free slot */
+	int endpoint;
+	TimestampTz start;
+	char *post_data; /* of the request in the slot */
+	RestResponse response;
+} TransferSlot;
+
+/*
+ * Start the request of the given index in a free slot.
+ */
+static void start_slot(AIService *ai_service, CURLM *multi,
+					   TransferSlot *slot, const char *request,
+					   const int index, const TrafficClass traffic_class)
+{
+	slot->curl = curl_easy_init();
+	if (!slot->curl)
+	{
+		adaptive_limit_release(slot->endpoint, traffic_class, 0, 0);
+		ereport(ERROR, (errmsg("%s", GET_ERR_STR(INT_TNSFR))));
+	}
+
+	slot->response.response_code = 0;
+	slot->response.data_size = 0;
+
+	/* the slot is not in flight yet, its limit slot is given back here */
+	PG_TRY();
+	{
+		slot->post_data = set_curl_request(slot->curl, ai_service, request,
+										   strlen(request), &slot->response);
+	}
+	PG_CATCH();
+	{
+		adaptive_limit_release(slot->endpoint, traffic_class, 0, 0);
+		curl_easy_cleanup(slot->curl);
+		slot->curl = NULL;
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+	curl_easy_setopt(slot->curl, CURLOPT_PRIVATE, (char *)slot);
+
+	slot->index = index;
+	slot->start = GetCurrentTimestamp();
+	curl_multi_add_handle(multi, slot->curl);
+}
+
+/*
+ * Release the endpoint slot of a request and free its handle. A finished
+ * request is recorded, a cancelled one is not.
+ */
+static void finish_slot(CURLM *multi, TransferSlot *slot,
+						const TrafficClass traffic_class,
+						const TransferRecorder *recorder)
+{
+	long latency_ms =
+		TimestampDifferenceMilliseconds(slot->start, GetCurrentTimestamp());
+
+	adaptive_limit_release(slot->endpoint, traffic_class,
+						   slot->response.response_code, latency_ms);
+	if (slot->response.response_code != 0)
+		record_transfer(slot->curl, recorder, slot->post_data, &slot->response,
+						latency_ms);
+	curl_multi_remove_handle(multi, slot->curl);
+	curl_easy_cleanup(slot->curl);
+	pfree(slot->post_data);
+	slot->curl = NULL;
+	slot->post_data = NULL;
+	slot->index = -1;
+}
+
+/*
+ * Transfer a set of requests of the service with up to the given number in
+ * flight at a time, each within the limit of the endpoint. The first request
+ * in flight waits for the limit, the others only go while the limit has free
+ * slots. The response of each request is passed to the done callback, in the
+ * order they finish, and its buffer is reused once the callback returns. A
+ * request over the tokens of the model is answered without a transfer.
+ */
+void rest_transfer_many(AIService *ai_service, char **requests,
+						const int count, const int concurrency,
+						RestTransferDone done, void *arg)
+{
+	const char *url = get_option_value(ai_service->service_data->options,
+									   OPTION_ENDPOINT_URL);
+	TrafficClass traffic_class = get_traffic_class(ai_service);
+	TransferRecorder recorder;
+	int slot_count = Max(Min(concurrency, count), 1);
+	TransferSlot *slots;
+	RestResponse rejected;
+	char rejected_data[ERROR_MSG_LEN];
+	size_t max_token_count;
+	CURLM *multi;
+	CURLMsg *msg;
+	int next = 0;
+	int in_flight = 0;
+	int running;
+	int pending;
+	int i;
+
+	init_transfer_recorder(ai_service, &recorder);
+	slots = palloc0(sizeof(TransferSlot) * slot_count);
+	for (i = 0; i < slot_count; i++)
+	{
+		slots[i].index = -1;
+		slots[i].response.data = palloc(REST_TRANSFER_MANY_RESPONSE_SIZE + 1);
+		slots[i].response.max_size = REST_TRANSFER_MANY_RESPONSE_SIZE;
+	}
+
+	rejected.data = rejected_data;
+	rejected.max_size = ERROR_MSG_LEN;
+
+	multi = curl_multi_init();
+	if (!multi)
+		ereport(ERROR, (errmsg("%s", GET_ERR_STR(INT_TNSFR))));
+
+	PG_TRY();
+	{
+		while (next < count || in_flight > 0)
 		{
-			curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE,
-							  &ai_service->rest_response->response_code);
+			/* fill the free slots while the endpoint has room */
+			for (i = 0; i < slot_count && next < count; i++)
+			{
+				if (slots[i].index >= 0)
+					continue;
+				if (vaildate_data_size(ai_service, requests[next],
+									   &max_token_count))
+				{
+					set_data_too_big(&rejected, max_token_count);
+					done(ai_service, next++, &rejected, arg);
+					continue;
+				}
+				if (in_flight == 0)
+					slots[i].endpoint = acquire_endpoint(url, traffic_class);
+				else if (!adaptive_limit_try_acquire(url, traffic_class,
+													 &slots[i].endpoint))
+					break;
+				start_slot(ai_service, multi, &slots[i], requests[next], next,
+						   traffic_class);
+				next++;
+				in_flight++;
+			}
+
+			curl_multi_perform(multi, &running);
+			while ((msg = curl_multi_info_read(multi, &pending)))
+			{
+				TransferSlot *slot;
+				int index;
+
+				if (msg->msg != CURLMSG_DONE)
+					continue;
+
+				curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE,
+								  (char **)&slot);
+				set_curl_response(slot->curl, msg->data.result,
+								  &slot->response);
+				index = slot->index;
+				finish_slot(multi, slot, traffic_class, &recorder);
+				in_flight--;
+
+				done(ai_service, index, &slot->response, arg);
+			}
+
+			/* wait for the transfers, and for the limit to have room */
+			if (in_flight > 0)
+				curl_multi_poll(multi, NULL, 0, REST_TRANSFER_POLL_MS, NULL);
+			CHECK_FOR_INTERRUPTS();
 		}
-		curl_easy_cleanup(curl);
 	}
+	PG_CATCH();
+	{
+		/* a cancelled query gives back the slots of the requests in flight */
+		for (i = 0; i < slot_count; i++)
+			if (slots[i].index >= 0)
+				finish_slot(multi, &slots[i], traffic_class, &recorder);
+		curl_multi_cleanup(multi);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	curl_multi_cleanup(multi);
+	for (i = 0; i < slot_count; i++)
+		pfree(slots[i].response.data);
+	pfree(slots);
+}
+
+/*
+ * Process a response of rest_transfer_many as the service processes the
+ * response of its own transfer. The service buffers then hold the result
+ * as after a single transfer.
+ */
+void process_many_response(AIService *ai_service, RestResponse *response)
+{
+	RestResponse *service_response = ai_service->rest_response;
+
+	ai_service->rest_response = response;
+	ai_service->process_rest_response(ai_service);
+	ai_service->rest_response = service_response;
+	service_response->response_code = response->response_code;
+}
+
+/* a request of rest_async_start, in flight till its response is set */
+struct RestAsyncTransfer
+{
+	CURL *curl; /* NULL once the transfer is finished */
+	int endpoint;
+	TrafficClass traffic_class;
+	TransferRecorder recorder;
+	TimestampTz start;
+	char *post_data;
+	RestResponse response;
+	bool done;
+};
+
+/*
+ * Release the endpoint slot of a background transfer and free its handle. A
+ * transfer freed while in flight is not recorded.
+ */
+static void finish_async(RestAsyncTransfer *transfer)
+{
+	long latency_ms =
+		TimestampDifferenceMilliseconds(transfer->start, GetCurrentTimestamp());
+
+	adaptive_limit_release(transfer->endpoint, transfer->traffic_class,
+						   transfer->response.response_code, latency_ms);
+	if (transfer->response.response_code != 0)
+		record_transfer(transfer->curl, &transfer->recorder,
+						transfer->post_data, &transfer->response, latency_ms);
+	curl_multi_remove_handle(async_multi, transfer->curl);
+	curl_easy_cleanup(transfer->curl);
+	transfer->curl = NULL;
+	async_in_flight--;
+}
+
+/* set the response of the finished transfers, returns how many finished */
+static int read_async_done(void)
+{
+	RestAsyncTransfer *transfer;
+	CURLMsg *msg;
+	int running;
+	int pending;
+	int finished = 0;
+
+	curl_multi_perform(async_multi, &running);
+	while ((msg = curl_multi_info_read(async_multi, &pending)))
+	{
+		if (msg->msg != CURLMSG_DONE)
+			continue;
+
+		curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE,
+						  (char **)&transfer);
+		set_curl_response(transfer->curl, msg->data.result,
+						  &transfer->response);
+		finish_async(transfer);
+		transfer->done = true;
+		finished++;
+	}
+	return finished;
+}
+
+void rest_async_poll(const long timeout)
+{
+	if (!async_multi || async_in_flight == 0)
+		return;
+
+	if (read_async_done() == 0 && timeout > 0 && async_in_flight > 0)
+	{
+		curl_multi_poll(async_multi, NULL, 0, timeout, NULL);
+		read_async_done();
+	}
+}
+
+/*
+ * Start a request on the multi handle of the session and return without
+ * waiting for it.
+ */
+RestAsyncTransfer *rest_async_start(AIService *ai_service, const char *request,
+									MemoryContext memory_context)
+{
+	const char *url = get_option_value(ai_service->service_data->options,
+									   OPTION_ENDPOINT_URL);
+	RestAsyncTransfer *transfer;
+	MemoryContext old_context;
+	size_t max_token_count;
+
+	transfer =
+		MemoryContextAllocZero(memory_context, sizeof(RestAsyncTransfer));
+	transfer->response.data = MemoryContextAlloc(
+		memory_context, REST_TRANSFER_MANY_RESPONSE_SIZE + 1);
+	transfer->response.max_size = REST_TRANSFER_MANY_RESPONSE_SIZE;
+	transfer->traffic_class = get_traffic_class(ai_service);
+	init_transfer_recorder(ai_service, &transfer->recorder);
+
+	/* a request over the tokens of the model is answered without a transfer */
+	if (vaildate_data_size(ai_service, request, &max_token_count))
+	{
+		set_data_too_big(&transfer->response, max_token_count);
+		transfer->done = true;
+		return transfer;
+	}
+
+	if (!async_multi && !(async_multi = curl_multi_init()))
+		ereport(ERROR, (errmsg("%s", GET_ERR_STR(INT_TNSFR))));
+
+	transfer->endpoint = acquire_endpoint(url, transfer->traffic_class);
+
+	if (!(transfer->curl = curl_easy_init()))
+	{
+		adaptive_limit_release(transfer->endpoint, transfer->traffic_class, 0,
+							   0);
+		ereport(ERROR, (errmsg("%s", GET_ERR_STR(INT_TNSFR))));
+	}
+
+	/*
+	 * The POST data is not copied by curl, it lives as long as the transfer.
+	 * A request that cannot be built gives back the slot and the handle, the
+	 * memory of the transfer outlives the error.
+	 */
+	old_context = MemoryContextSwitchTo(memory_context);
+	PG_TRY();
+	{
+		transfer->post_data =
+			set_curl_request(transfer->curl, ai_service, request,
+							 strlen(request), &transfer->response);
+	}
+	PG_CATCH();
+	{
+		MemoryContextSwitchTo(old_context);
+		adaptive_limit_release(transfer->endpoint, transfer->traffic_class, 0,
+							   0);
+		curl_easy_cleanup(transfer->curl);
+		pfree(transfer->response.data);
+		pfree(transfer);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+	MemoryContextSwitchTo(old_context);
+	curl_easy_setopt(transfer->curl, CURLOPT_PRIVATE, (char *)transfer);
+
+	transfer->start = GetCurrentTimestamp();
+	curl_multi_add_handle(async_multi, transfer->curl);
+	async_in_flight++;
+
+	/* send the request out before returning */
+	rest_async_poll(0);
+	return transfer;
+}
+
+RestResponse *rest_async_response(RestAsyncTransfer *transfer)
+{
+	return transfer->done ? &transfer->response : NULL;
+}
+
+void rest_async_free(RestAsyncTransfer *transfer)
+{
+	if (transfer->curl)
+		finish_async(transfer);
+	if (transfer->post_data)
+		pfree(transfer->post_data);
+	pfree(transfer->response.data);
+	pfree(transfer);
 }
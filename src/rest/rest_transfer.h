@@ -6,6 +6,30 @@
 typedef void (*make_post_header)(char *buffer, const size_t maxlen,
 								 const char *data, const size_t len);
 void rest_transfer(AIService *ai_service);
+
+/* called with the response of each request of rest_transfer_many */
+typedef void (*RestTransferDone)(AIService *ai_service, const int index,
+								 RestResponse *response, void *arg);
+void rest_transfer_many(AIService *ai_service, char **requests,
+						const int count, const int concurrency,
+						RestTransferDone done, void *arg);
+void process_many_response(AIService *ai_service, RestResponse *response);
+char *make_post_data(AIService *ai_service, const char *data);
+
+/*
+ * A request transferred in the background on the multi handle of the
+ * session, progressed by rest_async_poll. The transfer is allocated in the
+ * given memory context and has its own buffers.
+ */
+typedef struct RestAsyncTransfer RestAsyncTransfer;
+RestAsyncTransfer *rest_async_start(AIService *ai_service, const char *request,
+									MemoryContext memory_context);
+/* move the transfers on, waiting up to timeout ms for any of them */
+void rest_async_poll(const long timeout);
+/* the response of a finished transfer, NULL while it is in flight */
+RestResponse *rest_async_response(RestAsyncTransfer *transfer);
+/* stop a transfer if in flight and free it */
+void rest_async_free(RestAsyncTransfer *transfer);
 void init_rest_transfer(AIService *ai_service);
 void cleanup_rest_transfer(AIService *ai_service);
 
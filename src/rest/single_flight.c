@@ -0,0 +1,313 @@
+#include "single_flight.h"
+
+#include "miscadmin.h"
+#include "storage/condition_variable.h"
+#include "storage/ipc.h"
+#include "storage/shmem.h"
+#include "utils/wait_event.h"
+
+#include "core/utils_pg_ai.h"
+#include "guc/pg_ai_guc.h"
+
+/* state of a request in flight */
+typedef enum SingleFlightState
+{
+	SINGLE_FLIGHT_FREE = 0,
+	SINGLE_FLIGHT_RUNNING,
+	SINGLE_FLIGHT_DONE,
+	SINGLE_FLIGHT_FAILED
+} SingleFlightState;
+
+/* a request made by the leader backend, the waiters reuse its result */
+typedef struct SingleFlightSlot
+{
+	PgAiFingerprint fingerprint;
+	SingleFlightState state;
+	int leader_pid;
+	int waiters;
+	ConditionVariable done_cv;
+	size_t result_size;
+	char result[SINGLE_FLIGHT_MAX_RESULT_SIZE];
+} SingleFlightSlot;
+
+/* the in flight table shared across the backends */
+typedef struct SingleFlightTable
+{
+	LWLock *lock;
+	int num_slots;
+	SingleFlightSlot slots[FLEXIBLE_ARRAY_MEMBER];
+} SingleFlightTable;
+
+/* stays NULL if pg_ai is not in shared_preload_libraries */
+static SingleFlightTable *single_flight = NULL;
+
+/* set once the exit callback of this backend is registered */
+static bool exit_callback_registered = false;
+
+/* the slot this backend waits on, to be left if the backend exits */
+static SingleFlightSlot *waiting_slot = NULL;
+
+static int get_num_slots(void)
+{
+	return *get_pg_ai_guc_int_variable(PG_AI_GUC_SINGLE_FLIGHT_SLOTS);
+}
+
+/*
+ * Shared memory needed by the in flight table, none if it is disabled.
+ */
+Size single_flight_shmem_size(void)
+{
+	int num_slots = get_num_slots();
+
+	if (num_slots == 0)
+		return 0;
+
+	return add_size(offsetof(SingleFlightTable, slots),
+					mul_size(num_slots, sizeof(SingleFlightSlot)));
+}
+
+/*
+ * Attach to the in flight table, initialize it on the first call.
+ */
+void single_flight_shmem_startup(LWLock *lock)
+{
+	bool found;
+
+	single_flight = ShmemInitStruct(PG_AI_SHMEM_SINGLE_FLIGHT,
+									single_flight_shmem_size(), &found);
+	if (found)
+		return;
+
+	single_flight->lock = lock;
+	single_flight->num_slots = get_num_slots();
+	for (int i = 0; i < single_flight->num_slots; i++)
+	{
+		single_flight->slots[i].state = SINGLE_FLIGHT_FREE;
+		single_flight->slots[i].waiters = 0;
+		ConditionVariableInit(&single_flight->slots[i].done_cv);
+	}
+}
+
+/*
+ * Free the slot once the request is over and the last waiter has left.
+ * Called with the lock held.
+ */
+static void release_slot(SingleFlightSlot *slot)
+{
+	if (slot->state != SINGLE_FLIGHT_RUNNING && slot->waiters == 0)
+		slot->state = SINGLE_FLIGHT_FREE;
+}
+
+/*
+ * Publish the result of the leader and wake up the waiters, a NULL result
+ * lets the waiters make their own requests.
+ */
+static void finish_slot(SingleFlightSlot *slot, const char *result)
+{
+	size_t result_size = result ? strlen(result) : 0;
+
+	LWLockAcquire(single_flight->lock, LW_EXCLUSIVE);
+	if (result && result_size < SINGLE_FLIGHT_MAX_RESULT_SIZE)
+	{
+		memcpy(slot->result, result, result_size + 1);
+		slot->result_size = result_size;
+		slot->state = SINGLE_FLIGHT_DONE;
+	}
+	else
+		slot->state = SINGLE_FLIGHT_FAILED;
+	release_slot(slot);
+	LWLockRelease(single_flight->lock);
+
+	ConditionVariableBroadcast(&slot->done_cv);
+}
+
+/*
+ * Leave the slot waited on and fail the requests still led by this backend
+ * when it exits, so that the slots are not held forever.
+ */
+static void single_flight_exit_callback(int code, Datum arg)
+{
+	if (waiting_slot)
+	{
+		LWLockAcquire(single_flight->lock, LW_EXCLUSIVE);
+		waiting_slot->waiters--;
+		release_slot(waiting_slot);
+		LWLockRelease(single_flight->lock);
+		waiting_slot = NULL;
+	}
+
+	for (int i = 0; i < single_flight->num_slots; i++)
+	{
+		SingleFlightSlot *slot = &single_flight->slots[i];
+
+		if (slot->state == SINGLE_FLIGHT_RUNNING &&
+			slot->leader_pid == MyProcPid)
+			finish_slot(slot, NULL);
+	}
+}
+
+/*
+ * Wait for the leader of the slot to finish. Returns true if the result is
+ * copied to the response buffer.
+ */
+static bool wait_for_leader(AIService *ai_service, SingleFlightSlot *slot)
+{
+	RestResponse *response = ai_service->rest_response;
+	bool done = false;
+
+	waiting_slot = slot;
+	PG_TRY();
+	{
+		ConditionVariablePrepareToSleep(&slot->done_cv);
+		for (;;)
+		{
+			LWLockAcquire(single_flight->lock, LW_SHARED);
+			done = (slot->state != SINGLE_FLIGHT_RUNNING);
+			LWLockRelease(single_flight->lock);
+			if (done)
+				break;
+			ConditionVariableSleep(&slot->done_cv, PG_WAIT_EXTENSION);
+		}
+		ConditionVariableCancelSleep();
+	}
+	PG_CATCH();
+	{
+		/* leave the slot if the wait is cancelled */
+		ConditionVariableCancelSleep();
+		LWLockAcquire(single_flight->lock, LW_EXCLUSIVE);
+		slot->waiters--;
+		release_slot(slot);
+		LWLockRelease(single_flight->lock);
+		waiting_slot = NULL;
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	LWLockAcquire(single_flight->lock, LW_EXCLUSIVE);
+	done = (slot->state == SINGLE_FLIGHT_DONE &&
+			slot->result_size < response->max_size);
+	if (done)
+	{
+		memcpy(response->data, slot->result, slot->result_size + 1);
+		response->data_size = slot->result_size;
+		response->response_code = HTTP_OK;
+	}
+	slot->waiters--;
+	release_slot(slot);
+	LWLockRelease(single_flight->lock);
+	waiting_slot = NULL;
+
+	if (done && DEBUG_LEVEL(PG_AI_DEBUG_3))
+		ereport(INFO, (errmsg("Shared the in flight request of %d\n",
+							  slot->leader_pid)));
+	return done;
+}
+
+/*
+ * Join the request in flight with the same fingerprint or lead a new one.
+ * Returns the slot led by this backend, NULL if this backend is a waiter or
+ * if all the slots are in use.
+ */
+static SingleFlightSlot *join_or_lead(const PgAiFingerprint *fingerprint,
+									  SingleFlightSlot **joined)
+{
+	SingleFlightSlot *free_slot = NULL;
+
+	*joined = NULL;
+	LWLockAcquire(single_flight->lock, LW_EXCLUSIVE);
+	for (int i = 0; i < single_flight->num_slots; i++)
+	{
+		SingleFlightSlot *slot = &single_flight->slots[i];
+
+		if (slot->state == SINGLE_FLIGHT_FREE)
+		{
+			if (!free_slot)
+				free_slot = slot;
+		}
+		else if (slot->state == SINGLE_FLIGHT_RUNNING &&
+				 !memcmp(&slot->fingerprint, fingerprint,
+						 sizeof(PgAiFingerprint)))
+		{
+			slot->waiters++;
+			*joined = slot;
+			break;
+		}
+	}
+
+	if (!*joined && free_slot)
+	{
+		free_slot->fingerprint = *fingerprint;
+		free_slot->state = SINGLE_FLIGHT_RUNNING;
+		free_slot->leader_pid = MyProcPid;
+		free_slot->waiters = 0;
+		free_slot->result_size = 0;
+	}
+	LWLockRelease(single_flight->lock);
+
+	return *joined ? NULL : free_slot;
+}
+
+/*
+ * Make the transfer, sharing it with the other backends making the identical
+ * request at the same time. The request is identified by the service, model,
+ * function, prompt, API key and the request text. The first backend makes the
+ * transfer, the others wait for it and reuse the response. If the leader
+ * fails, the waiters make their own transfers.
+ */
+void single_flight_transfer(AIService *ai_service, const char *request_text,
+							SingleFlightTransfer transfer)
+{
+	PgAiFingerprint fingerprint;
+	SingleFlightSlot *joined;
+	SingleFlightSlot *slot;
+	char function_id[16];
+	const char *parts[6];
+
+	if (!single_flight)
+	{
+		transfer(ai_service);
+		return;
+	}
+
+	snprintf(function_id, sizeof(function_id), "%d",
+			 ai_service->function_flags);
+	parts[0] = ai_service->get_service_name(ai_service);
+	parts[1] = ai_service->get_model_name(ai_service);
+	parts[2] = function_id;
+	parts[3] = get_option_value(AI_SERVICE_OPTIONS, OPTION_SERVICE_PROMPT);
+	parts[4] = get_option_value(AI_SERVICE_OPTIONS, OPTION_SERVICE_API_KEY);
+	parts[5] = request_text;
+	make_fingerprint(&fingerprint, parts, 6);
+
+	if (!exit_callback_registered)
+	{
+		before_shmem_exit(single_flight_exit_callback, (Datum)0);
+		exit_callback_registered = true;
+	}
+
+	slot = join_or_lead(&fingerprint, &joined);
+	if (joined && wait_for_leader(ai_service, joined))
+		return;
+
+	/* no slot to lead, or the leader failed */
+	if (!slot)
+	{
+		transfer(ai_service);
+		return;
+	}
+
+	PG_TRY();
+	{
+		transfer(ai_service);
+	}
+	PG_CATCH();
+	{
+		finish_slot(slot, NULL);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	finish_slot(slot, ai_service->rest_response->response_code == HTTP_OK ?
+						  (char *)(ai_service->rest_response->data) :
+						  NULL);
+}
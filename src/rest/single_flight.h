@@ -0,0 +1,22 @@
+#ifndef _SINGLE_FLIGHT_H_
+#define _SINGLE_FLIGHT_H_
+
+#include "core/ai_service.h"
+#include "storage/lwlock.h"
+
+/* the transfer to be shared, leaves the result in the response buffer */
+typedef void (*SingleFlightTransfer)(void *ai_service);
+
+/* shared memory setup, called from the pg_ai shmem hooks */
+Size single_flight_shmem_size(void);
+void single_flight_shmem_startup(LWLock *lock);
+
+/* make the transfer once for identical requests in flight across backends */
+void single_flight_transfer(AIService *ai_service, const char *request_text,
+							SingleFlightTransfer transfer);
+
+/* REST_TRANSFER shared with the identical requests of other backends */
+#define SHARED_REST_TRANSFER(ai_service, request_text)                         \
+	single_flight_transfer(ai_service, request_text, ai_service->rest_transfer)
+
+#endif /* _SINGLE_FLIGHT_H_ */
@@ -12,6 +12,12 @@
 #define GENC_SUMMARY_PROMPT "Get summary of the following in 1 lines."
 #define GENC_AGG_PROMPT "Suggest a topic for the following."
 
+/* input and output token limits of the model */
+#define GENC_CONTEXT_TOKENS (30720 + 2048)
+#define GENC_OUTPUT_TOKENS 2048
+/* the planner cost of a call before its tokens, in cpu_operator_cost units */
+#define GENC_CALL_COST 40000
+
 #define GEN_CONTENT_HELP INSIGHT_FUNCTIONS
 /* -----------------generate content >8---------- */
 
@@ -38,6 +44,9 @@
 	"https://generativelanguage.googleapis.com/v1beta/models/"                 \
 	"embedding-001:batchEmbedContents?key="
 
+#define GEMINI_EMBEDDINGS_CONTEXT_TOKENS 2048
+#define GEMINI_EMBEDDINGS_CALL_COST 8000
+
 #define GEMINI_EMBEDDINGS_HELP EMBEDDING_FUNCTIONS
 
 /*  seems const - TODO */
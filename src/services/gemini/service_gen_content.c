@@ -11,28 +11,26 @@
  */
 static void define_options(AIService *ai_service)
 {
-	ServiceOption **option_list = &(ai_service->service_data->options);
+	ServiceOption *option_list = ai_service->service_data->options;
 
 	/* define the common options from the base */
 	ai_service->define_common_options(ai_service);
 
 	/* define the option to hold the column value */
 	define_new_option(option_list, OPTION_COLUMN_VALUE,
-					  OPTION_COLUMN_VALUE_DESC, OPTION_FLAG_HELP_DISPLAY,
+					  OPTION_FLAG_HELP_DISPLAY,
 					  ai_service->service_data->request_data,
 					  SERVICE_MAX_REQUEST_SIZE);
 
 	/* options for the non-aggregate function */
 	if (ai_service->function_flags & FUNCTION_GET_INSIGHT)
 		define_new_option(option_list, OPTION_SERVICE_PROMPT,
-						  OPTION_SERVICE_PROMPT_DESC,
 						  OPTION_FLAG_REQUIRED | OPTION_FLAG_HELP_DISPLAY,
 						  NULL /* storage ptr */, 0 /* max size */);
 
 	/* options for the aggregate function */
 	if (ai_service->function_flags & FUNCTION_GET_INSIGHT_AGGREGATE)
 		define_new_option(option_list, OPTION_SERVICE_PROMPT_AGG,
-						  OPTION_SERVICE_PROMPT_AGG_DESC,
 						  OPTION_FLAG_REQUIRED | OPTION_FLAG_HELP_DISPLAY,
 						  NULL /* storage ptr */, 0 /* max size */);
 }
@@ -71,7 +69,6 @@ int gen_content_set_and_validate_options(void *service, void *function_options)
 	ServiceOption *options = ai_service->service_data->options;
 	int arg_offset;
 	char temp_url[SERVICE_DATA_SIZE];
-	char *url;
 
 	/* aggregate functions get an extra argument at position 0 */
 	arg_offset =
@@ -100,26 +97,14 @@ int gen_content_set_and_validate_options(void *service, void *function_options)
 	}
 
 	/* check if all required options are set */
-	for (options = ai_service->service_data->options; options;
-		 options = options->next)
-	{
-		if ((options->flags & OPTION_FLAG_REQUIRED) &&
-			!(options->flags & OPTION_FLAG_IS_SET))
-		{
-			ereport(INFO, (errmsg("Required %s option \"%s\" missing.\n",
-								  options->flags & OPTION_FLAG_GUC ? "GUC" :
-																	 "function",
-								  options->name)));
-			return RETURN_ERROR;
-		}
-	}
-
-	/* manipulate the url */
-	url = get_option_value(ai_service->service_data->options,
-						   OPTION_ENDPOINT_URL);
-	strcpy(temp_url, url);
-	strcat(temp_url, get_option_value(ai_service->service_data->options,
-									  OPTION_SERVICE_API_KEY));
+	if (check_required_options(ai_service->service_data->options))
+		return RETURN_ERROR;
+
+	/* append the key to the base url, a reused service is validated again */
+	snprintf(temp_url, SERVICE_DATA_SIZE, "%s%s",
+			 make_service_url(GENC_API_URL),
+			 get_option_value(ai_service->service_data->options,
+							  OPTION_SERVICE_API_KEY));
 	set_option_value(ai_service->service_data->options, OPTION_ENDPOINT_URL,
 					 temp_url, false /* concat */);
 
@@ -249,18 +234,18 @@ int gen_content_add_rest_headers(CURL *curl, struct curl_slist **headers,
 void gen_content_add_rest_data(char *buffer, const size_t maxlen,
 							   const char *data, const size_t len)
 {
-	sprintf(buffer, JSON_FORMAT_STR, data);
+	snprintf(buffer, maxlen, JSON_FORMAT_STR, data);
 }
 
 /*
- * Function to initiate the curl transfer and extract the response from
- * the json returned by the service.
+ * Function to extract the response text from the json returned by the
+ * service, into the response data of the service.
  */
 #define RESPONSE_JSON_CANDIDATES "candidates"
 #define RESPONSE_JSON_CONTENT "content"
 #define RESPONSE_JSON_PARTS "parts"
 #define RESPONSE_JSON_TEXT "text"
-void gen_content_rest_transfer(void *service)
+void gen_content_process_rest_response(void *service)
 {
 	Datum candidates;
 	Datum first_candidate;
@@ -271,7 +256,6 @@ void gen_content_rest_transfer(void *service)
 	AIService *ai_service;
 
 	ai_service = (AIService *)(service);
-	rest_transfer(ai_service);
 	*((char *)(ai_service->rest_response->data) +
 	  ai_service->rest_response->data_size) = '\0';
 
@@ -322,6 +306,16 @@ void gen_content_rest_transfer(void *service)
 			break;
 }
 
+/*
+ * Function to initiate the curl transfer and extract the response from
+ * the json returned by the service.
+ */
+void gen_content_rest_transfer(void *service)
+{
+	rest_transfer((AIService *)service);
+	gen_content_process_rest_response(service);
+}
+
 /* this has to be based on the context lengths of the supported services */
 void gen_content_get_max_request_response_sizes(size_t *max_request_size,
 												size_t *max_response_size)
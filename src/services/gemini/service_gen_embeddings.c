@@ -2,9 +2,12 @@
 
 #include "executor/spi.h"
 
+#include "cache/query_cache.h"
 #include "core/utils_pg_ai.h"
 #include "guc/pg_ai_guc.h"
+#include "rest/embed_batch.h"
 #include "rest/rest_transfer.h"
+#include "rest/single_flight.h"
 
 /*
  * Function to define aptions applicable to the embeddings service calls.
@@ -12,15 +15,23 @@
  */
 static void define_options(AIService *ai_service)
 {
-	ServiceOption **option_list = &(ai_service->service_data->options);
+	ServiceOption *option_list = ai_service->service_data->options;
 
 	/* define the common options from the base */
 	ai_service->define_common_options(ai_service);
 
 	/* the vector store to be craeted or queried */
-	define_new_option(option_list, OPTION_STORE_NAME, OPTION_STORE_NAME_DESC,
-					  OPTION_FLAG_REQUIRED | OPTION_FLAG_HELP_DISPLAY,
-					  NULL /* storage ptr */, 0 /* max size */);
+	if (ai_service->function_flags &
+		(FUNCTION_CREATE_VECTOR_STORE | FUNCTION_QUERY_VECTOR_STORE))
+		define_new_option(option_list, OPTION_STORE_NAME,
+						  OPTION_FLAG_REQUIRED | OPTION_FLAG_HELP_DISPLAY,
+						  NULL /* storage ptr */, 0 /* max size */);
+
+	/* the text to be embedded is held in the request buffer */
+	if (ai_service->function_flags & FUNCTION_EMBED_TEXT)
+		define_new_option(option_list, OPTION_COLUMN_VALUE, 0 /* flags */,
+						  ai_service->service_data->request_data,
+						  SERVICE_MAX_REQUEST_SIZE);
 
 	/*
 	 * vector store creation options: 1.SQL query 2.optional notes on the
@@ -29,10 +40,10 @@ static void define_options(AIService *ai_service)
 	if (ai_service->function_flags & FUNCTION_CREATE_VECTOR_STORE)
 	{
 		/* the query is text and passed to SPI for execution */
-		define_new_option(option_list, OPTION_SQL_QUERY, OPTION_SQL_QUERY_DESC,
+		define_new_option(option_list, OPTION_SQL_QUERY,
 						  OPTION_FLAG_REQUIRED | OPTION_FLAG_HELP_DISPLAY,
 						  NULL /* storage ptr */, 0 /* max size */);
-		define_new_option(option_list, OPTION_NL_NOTES, OPTION_NL_NOTES_DESC,
+		define_new_option(option_list, OPTION_NL_NOTES,
 						  OPTION_FLAG_REQUIRED | OPTION_FLAG_HELP_DISPLAY,
 						  NULL /* storage ptr */, 0 /* max size */);
 	}
@@ -43,15 +54,13 @@ static void define_options(AIService *ai_service)
 	 */
 	if (ai_service->function_flags & FUNCTION_QUERY_VECTOR_STORE)
 	{
-		define_new_option(option_list, OPTION_NL_QUERY, OPTION_NL_QUERY_DESC,
+		define_new_option(option_list, OPTION_NL_QUERY,
 						  OPTION_FLAG_REQUIRED | OPTION_FLAG_HELP_DISPLAY,
 						  NULL /* storage ptr */, 0 /* max size */);
 		define_new_option(option_list, OPTION_RECORD_COUNT,
-						  OPTION_RECORD_COUNT_DESC,
 						  OPTION_FLAG_REQUIRED | OPTION_FLAG_HELP_DISPLAY,
 						  NULL /* storage ptr */, 0 /* max size */);
 		define_new_option(option_list, OPTION_SIMILARITY_ALGORITHM,
-						  OPTION_SIMILARITY_ALGORITHM_DESC,
 						  OPTION_FLAG_REQUIRED, NULL /* storage ptr */,
 						  0 /* max size */);
 	}
@@ -92,9 +101,11 @@ int gen_embeddings_set_and_validate_options(void *service,
 	char count_str[10];
 	int count;
 	char temp_url[SERVICE_DATA_SIZE];
-	char *url;
 
-	if (!PG_ARGISNULL(0))
+	/* no function arguments for the internal text embeddings */
+	if ((ai_service->function_flags &
+		 (FUNCTION_CREATE_VECTOR_STORE | FUNCTION_QUERY_VECTOR_STORE)) &&
+		!PG_ARGISNULL(0))
 		set_option_value(options, OPTION_STORE_NAME,
 						 NameStr(*PG_GETARG_NAME(0)), false /* concat */);
 
@@ -133,26 +144,14 @@ int gen_embeddings_set_and_validate_options(void *service,
 	}
 
 	/* check if all required options are set */
-	for (options = ai_service->service_data->options; options;
-		 options = options->next)
-	{
-		if ((options->flags & OPTION_FLAG_REQUIRED) &&
-			!(options->flags & OPTION_FLAG_IS_SET))
-		{
-			ereport(INFO, (errmsg("Required %s option \"%s\" missing.\n",
-								  options->flags & OPTION_FLAG_GUC ? "GUC" :
-																	 "function",
-								  options->name)));
-			return RETURN_ERROR;
-		}
-	}
+	if (check_required_options(ai_service->service_data->options))
+		return RETURN_ERROR;
 
-	/* manipulate the url */
-	url = get_option_value(ai_service->service_data->options,
-						   OPTION_ENDPOINT_URL);
-	strcpy(temp_url, url);
-	strcat(temp_url, get_option_value(ai_service->service_data->options,
-									  OPTION_SERVICE_API_KEY));
+	/* append the key to the base url, a reused service is validated again */
+	snprintf(temp_url, SERVICE_DATA_SIZE, "%s%s",
+			 make_service_url(GEMINI_EMBEDDINGS_API_URL),
+			 get_option_value(ai_service->service_data->options,
+							  OPTION_SERVICE_API_KEY));
 	set_option_value(ai_service->service_data->options, OPTION_ENDPOINT_URL,
 					 temp_url, false /* concat */);
 
@@ -164,6 +163,8 @@ int gen_embeddings_set_and_validate_options(void *service,
  */
 int gen_embeddings_set_service_data(void *service, void *data)
 {
+	AIService *ai_service = (AIService *)service;
+
 	/* embeddings use pg_vector extension */
 	if (!is_extension_installed(PG_EXTENSION_PG_VECTOR))
 	{
@@ -172,6 +173,12 @@ int gen_embeddings_set_service_data(void *service, void *data)
 		return RETURN_ERROR;
 	}
 
+	/* the text to be embedded */
+	if (ai_service->function_flags & FUNCTION_EMBED_TEXT)
+		set_option_value(ai_service->service_data->options,
+						 OPTION_COLUMN_VALUE, (char *)data,
+						 false /* concat */);
+
 	return RETURN_ZERO;
 }
 
@@ -281,10 +288,42 @@ int gen_embeddings_add_rest_headers(CURL *curl, struct curl_slist **headers,
 void gen_embeddings_add_rest_data(char *buffer, const size_t maxlen,
 								  const char *data, const size_t len)
 {
-	sprintf(buffer, JSON_EMBED_FORMAT_STR, MODEL_GEMINI_EMBEDDINGS_NAME, data);
+	snprintf(buffer, maxlen, JSON_EMBED_FORMAT_STR,
+			 MODEL_GEMINI_EMBEDDINGS_NAME, data);
 	/* ereport(INFO, (errmsg("POST: %s\n\n", buffer))); */
 }
 
+/*
+ * Callback to make the POST data of a batch, one request for each of the
+ * escaped texts split at the escaped separators.
+ */
+#define JSON_EMBED_BATCH_REQUEST_STR                                           \
+	"{\"model\":\"models/%s\",\"content\":{\"parts\":[{\"text\":\"%.*s\"}]}}"
+
+static void add_rest_batch_data(char *buffer, const size_t maxlen,
+								const char *data, const size_t len)
+{
+	const char *text = data;
+	const char *separator;
+	int text_len;
+	size_t used;
+
+	strlcpy(buffer, "{\"requests\":[", maxlen);
+	for (;;)
+	{
+		separator = strstr(text, EMBED_BATCH_SEPARATOR_ESCAPED);
+		text_len = separator ? separator - text : strlen(text);
+		used = strlen(buffer);
+		snprintf(buffer + used, maxlen - used, JSON_EMBED_BATCH_REQUEST_STR,
+				 MODEL_GEMINI_EMBEDDINGS_NAME, text_len, text);
+		if (!separator)
+			break;
+		strlcat(buffer, ",", maxlen);
+		text = separator + strlen(EMBED_BATCH_SEPARATOR_ESCAPED);
+	}
+	strlcat(buffer, "]}", maxlen);
+}
+
 int gen_embeddings_handle_response_headers(void *service, void *user_data)
 {
 	return RETURN_ZERO;
@@ -321,28 +360,39 @@ static void add_cols_name_value_to_prompt(char *buf, const size_t max_buf_size,
 }
 
 /*
- * Extract the vector from the json response returned by the service.
+ * Get the vector at the given index of the json response returned by the
+ * service.
  */
 #define RESPONSE_JSON_EMBEDDINGS "embeddings"
 #define RESPONSE_JSON_VALUES "values"
-static void extract_vector_from_json(char *response)
+static char *get_vector_from_json(const char *response, const int index)
 {
 	Datum embeddings;
-	Datum first_choice;
+	Datum choice;
 	Datum return_text;
+	char *vector;
 
 	embeddings = DirectFunctionCall2(
 		json_object_field_text, CStringGetTextDatum(response),
 		PointerGetDatum(cstring_to_text(RESPONSE_JSON_EMBEDDINGS)));
-	first_choice = DirectFunctionCall2(json_array_element_text, embeddings,
-									   PointerGetDatum(0));
+	choice = DirectFunctionCall2(json_array_element_text, embeddings,
+								 Int32GetDatum(index));
 	return_text = DirectFunctionCall2(
-		json_object_field_text, first_choice,
+		json_object_field_text, choice,
 		PointerGetDatum(cstring_to_text(RESPONSE_JSON_VALUES)));
 
+	vector = text_to_cstring(DatumGetTextPP(return_text));
+	remove_new_lines(vector);
+	return vector;
+}
+
+/*
+ * Extract the vector from the json response returned by the service.
+ */
+static void extract_vector_from_json(char *response)
+{
 	/* the response is stored back in the source */
-	strcpy(response, text_to_cstring(DatumGetTextPP(return_text)));
-	remove_new_lines(response);
+	strcpy(response, get_vector_from_json(response, 0));
 }
 
 /*
@@ -441,6 +491,95 @@ static void create_embeddings(AIService *ai_service, char *query)
 	}
 }
 
+/*
+ * Transfer the texts of a batch in one request and extract their vectors
+ * from the response. The request buffer and the request format of the
+ * service, which is cached for the session, are restored for the caller even
+ * if the transfer fails with an error.
+ */
+static bool transfer_embeddings_batch(void *service, char **texts,
+									  const int count, char **vectors)
+{
+	AIService *ai_service = (AIService *)service;
+	char *request = (char *)(ai_service->service_data->request_data);
+	char *data = (char *)(ai_service->rest_response->data);
+	char *text = pstrdup(request);
+
+	request[0] = '\0';
+	for (int i = 0; i < count; i++)
+	{
+		if (i > 0)
+			strcat(request, EMBED_BATCH_SEPARATOR);
+		strcat(request, texts[i]);
+	}
+	ai_service->rest_request->data_size = strlen(request);
+
+	ai_service->add_rest_data = add_rest_batch_data;
+	PG_TRY();
+	{
+		rest_transfer(ai_service);
+	}
+	PG_FINALLY();
+	{
+		ai_service->add_rest_data = gen_embeddings_add_rest_data;
+		strcpy(request, text);
+		ai_service->rest_request->data_size = strlen(request);
+	}
+	PG_END_TRY();
+	*(data + ai_service->rest_response->data_size) = '\0';
+
+	if (ai_service->rest_response->response_code != HTTP_OK)
+		return false;
+
+	for (int i = 0; i < count; i++)
+		vectors[i] = get_vector_from_json(data, i);
+	return true;
+}
+
+/*
+ * Transfer the text in the request buffer and extract the vector from the
+ * response.
+ */
+static void transfer_embeddings(void *service)
+{
+	AIService *ai_service = (AIService *)service;
+	char *text = (char *)(ai_service->service_data->request_data);
+	char *data = (char *)(ai_service->rest_response->data);
+
+	/* texts embedded at the same time by other sessions go in one request */
+	if (embed_batch_transfer(ai_service, text, transfer_embeddings_batch))
+		return;
+
+	rest_transfer(ai_service);
+	*(data + ai_service->rest_response->data_size) = '\0';
+
+	if (ai_service->rest_response->response_code == HTTP_OK)
+		extract_vector_from_json(data);
+}
+
+/*
+ * Get the embeddings of the text in the request buffer, a recently seen text
+ * gets its vector from the cache. The vector is left in the response buffer.
+ */
+static void fetch_embeddings(AIService *ai_service)
+{
+	char *text = (char *)(ai_service->service_data->request_data);
+	char *data = (char *)(ai_service->rest_response->data);
+
+	if (query_cache_lookup(ai_service, text, data,
+						   ai_service->rest_response->max_size))
+	{
+		ai_service->rest_response->response_code = HTTP_OK;
+		ai_service->rest_response->data_size = strlen(data);
+		return;
+	}
+
+	/* the same text embedded by other sessions is transferred only once */
+	single_flight_transfer(ai_service, text, transfer_embeddings);
+	if (ai_service->rest_response->response_code == HTTP_OK)
+		query_cache_store(ai_service, text, data);
+}
+
 /*
  * Function to initiate the curl transfer and extract the response from
  * the json returned by the service.
@@ -462,31 +601,30 @@ void gen_embeddings_rest_transfer(void *service)
 		return create_embeddings(ai_service, query);
 	}
 
+	/* only the vector is returned for the internal text embeddings */
+	if (ai_service->function_flags & FUNCTION_EMBED_TEXT)
+		return fetch_embeddings(ai_service);
+
 	/* return a SQL query for the SRF */
 	if (ai_service->function_flags & FUNCTION_QUERY_VECTOR_STORE)
 	{
+		char *data = (char *)(ai_service->rest_response->data);
+
 		/* get the embeddings for the NL query */
 		strcpy(ai_service->service_data->request_data,
 			   get_option_value(options, OPTION_NL_QUERY));
-		rest_transfer(ai_service);
-		*((char *)(ai_service->rest_response->data) +
-		  ai_service->rest_response->data_size) = '\0';
+		fetch_embeddings(ai_service);
 
 		/* make the SQL query */
 		if (ai_service->rest_response->response_code == HTTP_OK)
 		{
-			char *data = (char *)(ai_service->rest_response->data);
-
-			/* extract the embeddings from response */
-			extract_vector_from_json(data);
-
 			/* names in select, to match hide_cols[] in process_result_set() */
 			make_embeddings_query(
 				query, SQL_QUERY_MAX_LENGTH, data,
 				get_option_value(options, OPTION_STORE_NAME),
 				EMBEDDINGS_COLUMN_NAME,
 				get_option_value(options, OPTION_SIMILARITY_ALGORITHM),
-				OPTION_SIMILARITY_ALGORITHM);
+				OPTION_SIMILARITY_ALGORITHM_STR);
 
 			/* add the limit value to the query */
 			if (get_option_value(options, OPTION_RECORD_COUNT))
@@ -15,6 +15,7 @@ int genc_mod_cleanup_service_data(void *ai_service);
 
 /* call backs from REST <-> PgAi */
 void genc_mod_rest_transfer(void *ai_service);
+void genc_mod_process_rest_response(void *ai_service);
 void genc_mod_set_service_buffers(RestRequest *rest_request,
 								  RestResponse *rest_response,
 								  ServiceData *service_data);
@@ -11,6 +11,12 @@
 	"GPT Model for answering pointed questions."
 
 #define GPT_API_URL "https://api.openai.com/v1/completions"
+
+/* context of the model, and the tokens of it asked for the completion */
+#define GPT_CONTEXT_TOKENS 4096
+#define GPT_OUTPUT_TOKENS 1024
+/* the planner cost of a call before its tokens, in cpu_operator_cost units */
+#define GPT_CALL_COST 40000
 #define GPT_SUMMARY_PROMPT "Get summary of the following in 1 lines."
 #define GPT_AGG_PROMPT "Suggest a topic for the following."
 
@@ -26,6 +32,8 @@
 #define MODEL_OPENAI_EMBEDDINGS_DESCRIPTION "OpenAI's embeddings model(vectors)"
 
 #define EMBEDDINGS_API_URL "https://api.openai.com/v1/embeddings"
+#define EMBEDDINGS_CONTEXT_TOKENS 8191
+#define EMBEDDINGS_CALL_COST 8000
 
 #define EMBEDDINGS_HELP EMBEDDING_FUNCTIONS
 
@@ -40,6 +48,10 @@
 #define IMAGE_GEN_PROMPT "Make a picture of the following"
 #define IMAGE_GEN_AGG_PROMPT "Make a picture with the following"
 #define IMAGE_GEN_API_URL "https://api.openai.com/v1/images/generations"
+/* the prompt is limited to 4000 characters, about a 1000 tokens */
+#define IMAGE_GEN_CONTEXT_TOKENS 1000
+/* an image takes as long as a long completion */
+#define IMAGE_GEN_CALL_COST 400000
 
 #define IMAGE_GEN_HELP                                                         \
 	"\nFunctions:\n"                                                           \
@@ -59,8 +71,15 @@
 	"Classifies input on harmful categories."
 
 #define MODERATION_API_URL "https://api.openai.com/v1/moderations"
+#define MODERATION_CONTEXT_TOKENS 32768
+#define MODERATION_CALL_COST 8000
 
 #define MODERATION_HELP MODERATION_FUNCTIONS
 /* -----------------moderation service >8---------- */
 
+/* -----------------8< batch API ------------------- */
+#define BATCH_API_URL "https://api.openai.com/v1"
+#define BATCH_API_COMPLETION_WINDOW "24h"
+/* -----------------batch API >8------------------- */
+
 #endif /* _OPENAI_CONFIG_H_ */
@@ -11,28 +11,26 @@
  */
 static void define_options(AIService *ai_service)
 {
-	ServiceOption **option_list = &(ai_service->service_data->options);
+	ServiceOption *option_list = ai_service->service_data->options;
 
 	/* define the common options from the base */
 	ai_service->define_common_options(ai_service);
 
 	/* define the option to hold the column value */
 	define_new_option(option_list, OPTION_COLUMN_VALUE,
-					  OPTION_COLUMN_VALUE_DESC, OPTION_FLAG_HELP_DISPLAY,
+					  OPTION_FLAG_HELP_DISPLAY,
 					  ai_service->service_data->request_data,
 					  SERVICE_MAX_REQUEST_SIZE);
 
 	/* options for the non-aggregate function */
 	if (ai_service->function_flags & FUNCTION_GET_INSIGHT)
 		define_new_option(option_list, OPTION_SERVICE_PROMPT,
-						  OPTION_SERVICE_PROMPT_DESC,
 						  OPTION_FLAG_REQUIRED | OPTION_FLAG_HELP_DISPLAY,
 						  NULL /* storage ptr */, 0 /* max size */);
 
 	/* options for the aggregate function */
 	if (ai_service->function_flags & FUNCTION_GET_INSIGHT_AGGREGATE)
 		define_new_option(option_list, OPTION_SERVICE_PROMPT_AGG,
-						  OPTION_SERVICE_PROMPT_AGG_DESC,
 						  OPTION_FLAG_REQUIRED | OPTION_FLAG_HELP_DISPLAY,
 						  NULL /* storage ptr */, 0 /* max size */);
 }
@@ -98,19 +96,8 @@ int gpt_set_and_validate_options(void *service, void *function_options)
 	}
 
 	/* check if all required options are set */
-	for (options = ai_service->service_data->options; options;
-		 options = options->next)
-	{
-		if ((options->flags & OPTION_FLAG_REQUIRED) &&
-			!(options->flags & OPTION_FLAG_IS_SET))
-		{
-			ereport(INFO, (errmsg("Required %s option \"%s\" missing.\n",
-								  options->flags & OPTION_FLAG_GUC ? "GUC" :
-																	 "function",
-								  options->name)));
-			return RETURN_ERROR;
-		}
-	}
+	if (check_required_options(ai_service->service_data->options))
+		return RETURN_ERROR;
 	return RETURN_ZERO;
 }
 
@@ -245,14 +232,14 @@ void gpt_add_rest_data(char *buffer, const size_t maxlen, const char *data,
 	const char *keys[] = {GPT_MODEL_KEY, GPT_PROMPT_KEY, GPT_MAX_TOKENS_KEY};
 	const char *values[] = {MODEL_OPENAI_GPT_NAME, data, GPT_MAX_TOKENS_VAUE};
 
-	generate_json(buffer, keys, values, data_types, 3);
+	generate_json(buffer, maxlen, keys, values, data_types, 3);
 }
 
 /*
- * Function to initiate the curl transfer and extract the response from
- * the json returned by the service.
+ * Function to extract the response text from the json returned by the
+ * service, into the response data of the service.
  */
-void gpt_rest_transfer(void *service)
+void gpt_process_rest_response(void *service)
 {
 	Datum choices;
 	Datum first_choice;
@@ -260,7 +247,6 @@ void gpt_rest_transfer(void *service)
 	AIService *ai_service;
 
 	ai_service = (AIService *)(service);
-	rest_transfer(ai_service);
 	*((char *)(ai_service->rest_response->data) +
 	  ai_service->rest_response->data_size) = '\0';
 
@@ -305,6 +291,16 @@ void gpt_rest_transfer(void *service)
 			break;
 }
 
+/*
+ * Function to initiate the curl transfer and extract the response from
+ * the json returned by the service.
+ */
+void gpt_rest_transfer(void *service)
+{
+	rest_transfer((AIService *)service);
+	gpt_process_rest_response(service);
+}
+
 /* this has to be based on the context lengths of the supported services */
 void gpt_get_max_request_response_sizes(size_t *max_request_size,
 										size_t *max_response_size)
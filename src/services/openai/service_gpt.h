@@ -15,6 +15,7 @@ int gpt_cleanup_service_data(void *ai_service);
 
 /* call backs from REST <-> PgAi */
 void gpt_rest_transfer(void *ai_service);
+void gpt_process_rest_response(void *ai_service);
 void gpt_set_service_buffers(RestRequest *rest_request,
 							 RestResponse *rest_response,
 							 ServiceData *service_data);
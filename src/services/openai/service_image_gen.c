@@ -11,27 +11,25 @@
  */
 static void define_options(AIService *ai_service)
 {
-	ServiceOption **option_list = &(ai_service->service_data->options);
+	ServiceOption *option_list = ai_service->service_data->options;
 
 	/* define the common options from the base */
 	ai_service->define_common_options(ai_service);
 
 	define_new_option(option_list, OPTION_COLUMN_VALUE,
-					  OPTION_COLUMN_VALUE_DESC, OPTION_FLAG_HELP_DISPLAY,
+					  OPTION_FLAG_HELP_DISPLAY,
 					  ai_service->service_data->request_data,
 					  SERVICE_MAX_REQUEST_SIZE);
 
 	/* options for the non-aggregate function */
 	if (ai_service->function_flags & FUNCTION_GENERATE_IMAGE)
 		define_new_option(option_list, OPTION_SERVICE_PROMPT,
-						  OPTION_SERVICE_PROMPT_DESC,
 						  OPTION_FLAG_REQUIRED | OPTION_FLAG_HELP_DISPLAY,
 						  NULL /* storage ptr */, 0 /* max size */);
 
 	/* options for the aggregate function */
 	if (ai_service->function_flags & FUNCTION_GENERATE_IMAGE_AGGREGATE)
 		define_new_option(option_list, OPTION_SERVICE_PROMPT_AGG,
-						  OPTION_SERVICE_PROMPT_AGG_DESC,
 						  OPTION_FLAG_REQUIRED | OPTION_FLAG_HELP_DISPLAY,
 						  NULL /* storage ptr */, 0 /* max size */);
 }
@@ -99,19 +97,8 @@ int image_gen_set_and_validate_options(void *service, void *function_options)
 	}
 
 	/* check if all required options are set */
-	for (options = ai_service->service_data->options; options;
-		 options = options->next)
-	{
-		if ((options->flags & OPTION_FLAG_REQUIRED) &&
-			!(options->flags & OPTION_FLAG_IS_SET))
-		{
-			ereport(INFO, (errmsg("Required %s option \"%s\" missing.\n",
-								  options->flags & OPTION_FLAG_GUC ? "GUC" :
-																	 "function",
-								  options->name)));
-			return RETURN_ERROR;
-		}
-	}
+	if (check_required_options(ai_service->service_data->options))
+		return RETURN_ERROR;
 
 	return RETURN_ZERO;
 }
@@ -238,9 +225,9 @@ int image_gen_add_rest_headers(CURL *curl, struct curl_slist **headers,
 void image_gen_add_rest_data(char *buffer, const size_t maxlen,
 							 const char *data, const size_t len)
 {
-	strcpy(buffer, IMAGE_GEN_PRE_PREFIX);
-	strcat(buffer, data);
-	strcat(buffer, IMAGE_GEN_POST_PREFIX);
+	strlcpy(buffer, IMAGE_GEN_PRE_PREFIX, maxlen);
+	strlcat(buffer, data, maxlen);
+	strlcat(buffer, IMAGE_GEN_POST_PREFIX, maxlen);
 	/* ereport(INFO, (errmsg("Post header: %s\n", buffer))); */
 }
 
@@ -9,26 +9,25 @@
  */
 static void define_options(AIService *ai_service)
 {
-	ServiceOption **option_list = &(ai_service->service_data->options);
+	ServiceOption *option_list = ai_service->service_data->options;
 
 	/* define the common options from the base */
 	ai_service->define_common_options(ai_service);
 
 	define_new_option(option_list, OPTION_COLUMN_VALUE,
-					  OPTION_COLUMN_VALUE_DESC, OPTION_FLAG_HELP_DISPLAY,
+					  OPTION_FLAG_HELP_DISPLAY,
 					  ai_service->service_data->request_data,
 					  SERVICE_MAX_REQUEST_SIZE);
 
 	/* options for the non-aggregate function */
 	if (ai_service->function_flags & FUNCTION_MODERATION)
 		define_new_option(option_list, OPTION_SERVICE_PROMPT,
-						  OPTION_SERVICE_PROMPT_DESC, OPTION_FLAG_HELP_DISPLAY,
-						  NULL /* storage ptr */, 0 /* max size */);
+						  OPTION_FLAG_HELP_DISPLAY, NULL /* storage ptr */,
+						  0 /* max size */);
 
 	/* options for the aggregate function */
 	if (ai_service->function_flags & FUNCTION_MODERATION_AGGREGATE)
 		define_new_option(option_list, OPTION_SERVICE_PROMPT_AGG,
-						  OPTION_SERVICE_PROMPT_AGG_DESC,
 						  OPTION_FLAG_HELP_DISPLAY, NULL /* storage ptr */,
 						  0 /* max size */);
 }
@@ -85,19 +84,8 @@ int moderation_set_and_validate_options(void *service, void *function_options)
 	}
 
 	/* check if all required args are set */
-	for (options = ai_service->service_data->options; options;
-		 options = options->next)
-	{
-		if ((options->flags & OPTION_FLAG_REQUIRED) &&
-			!(options->flags & OPTION_FLAG_IS_SET))
-		{
-			ereport(INFO, (errmsg("Required %s option \"%s\" missing.\n",
-								  options->flags & OPTION_FLAG_GUC ? "GUC" :
-																	 "function",
-								  options->name)));
-			return RETURN_ERROR;
-		}
-	}
+	if (check_required_options(ai_service->service_data->options))
+		return RETURN_ERROR;
 	return RETURN_ZERO;
 }
 
@@ -234,22 +222,21 @@ int moderation_add_rest_headers(CURL *curl, struct curl_slist **headers,
 void moderation_add_rest_data(char *buffer, const size_t maxlen,
 							  const char *data, const size_t len)
 {
-	strcpy(buffer, MODERATION_PREFIX);
-	strcat(buffer, data);
-	strcat(buffer, MODERATION_POST_PREFIX);
+	strlcpy(buffer, MODERATION_PREFIX, maxlen);
+	strlcat(buffer, data, maxlen);
+	strlcat(buffer, MODERATION_POST_PREFIX, maxlen);
 	/* ereport(INFO, (errmsg("Post header: %s\n", buffer))); */
 }
 
 /*
- * Function to initiate the curl transfer and extract the response from
- * the json returned by the service.
+ * Function to extract the response text from the json returned by the
+ * service, into the response data of the service.
  */
-void moderation_rest_transfer(void *service)
+void moderation_process_rest_response(void *service)
 {
 	AIService *ai_service;
 
 	ai_service = (AIService *)(service);
-	rest_transfer(ai_service);
 
 	/* truncate the response */
 	*((char *)(ai_service->rest_response->data) +
@@ -274,6 +261,16 @@ void moderation_rest_transfer(void *service)
 			break;
 }
 
+/*
+ * Function to initiate the curl transfer and extract the response from
+ * the json returned by the service.
+ */
+void moderation_rest_transfer(void *service)
+{
+	rest_transfer((AIService *)service);
+	moderation_process_rest_response(service);
+}
+
 /* this has to be based on the context lengths of the supported services */
 void moderation_get_max_request_response_sizes(size_t *max_request_size,
 											   size_t *max_response_size)
@@ -0,0 +1,87 @@
+#include "pg_ai_shmem.h"
+
+#include "miscadmin.h"
+#include "storage/ipc.h"
+#include "storage/shmem.h"
+
+#include "core/ai_config.h"
+#include "cache/query_cache.h"
+#include "rest/adaptive_limit.h"
+#include "rest/embed_batch.h"
+#include "rest/recent_requests.h"
+#include "rest/request_stats.h"
+#include "rest/single_flight.h"
+
+/* a shared memory area owned by one of the pg_ai features */
+typedef struct PgAiShmemSegment
+{
+	ShmemSizeFunction size;
+	ShmemStartupFunction startup;
+} PgAiShmemSegment;
+
+/* for new shared memory users, add entries to this array */
+static PgAiShmemSegment pg_ai_shmem_segments[] = {
+	{query_cache_shmem_size, query_cache_shmem_startup},
+	{single_flight_shmem_size, single_flight_shmem_startup},
+	{embed_batch_shmem_size, embed_batch_shmem_startup},
+	{adaptive_limit_shmem_size, adaptive_limit_shmem_startup},
+	{request_stats_shmem_size, request_stats_shmem_startup},
+	{recent_requests_shmem_size, recent_requests_shmem_startup}};
+
+#define PG_AI_SHMEM_SEGMENT_COUNT                                              \
+	(sizeof(pg_ai_shmem_segments) / sizeof(pg_ai_shmem_segments[0]))
+
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+/*
+ * Reserve the shared memory and one lock for every segment.
+ */
+static void pg_ai_shmem_request(void)
+{
+	Size total_size = 0;
+
+	if (prev_shmem_request_hook)
+		prev_shmem_request_hook();
+
+	for (int i = 0; i < PG_AI_SHMEM_SEGMENT_COUNT; i++)
+		total_size = add_size(total_size, pg_ai_shmem_segments[i].size());
+
+	RequestAddinShmemSpace(total_size);
+	RequestNamedLWLockTranche(PG_AI_LWLOCK_TRANCHE, PG_AI_SHMEM_SEGMENT_COUNT);
+}
+
+/*
+ * Attach to(or create on the first call) the shared memory of every segment.
+ */
+static void pg_ai_shmem_startup(void)
+{
+	LWLockPadded *locks;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	locks = GetNamedLWLockTranche(PG_AI_LWLOCK_TRANCHE);
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+	for (int i = 0; i < PG_AI_SHMEM_SEGMENT_COUNT; i++)
+		if (pg_ai_shmem_segments[i].size() > 0)
+			pg_ai_shmem_segments[i].startup(&locks[i].lock);
+	LWLockRelease(AddinShmemInitLock);
+}
+
+/*
+ * Install the shared memory hooks. Shared memory can only be reserved when
+ * pg_ai is in shared_preload_libraries, otherwise the features depending on
+ * it stay disabled.
+ */
+void pg_ai_shmem_init(void)
+{
+	if (!process_shared_preload_libraries_in_progress)
+		return;
+
+	prev_shmem_request_hook = shmem_request_hook;
+	shmem_request_hook = pg_ai_shmem_request;
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = pg_ai_shmem_startup;
+}
@@ -0,0 +1,13 @@
+#ifndef _PG_AI_SHMEM_H_
+#define _PG_AI_SHMEM_H_
+
+#include "postgres.h"
+#include "storage/lwlock.h"
+
+/* every shared memory user of pg_ai provides these two functions */
+typedef Size (*ShmemSizeFunction)(void);
+typedef void (*ShmemStartupFunction)(LWLock *lock);
+
+void pg_ai_shmem_init(void);
+
+#endif /* _PG_AI_SHMEM_H_ */
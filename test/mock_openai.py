@@ -0,0 +1,223 @@
+#!/usr/bin/env python3
+"""
+Mock of the OpenAI API for the regression tests of pg_ai.
+
+    mock_openai.py start    start the server in the background
+    mock_openai.py stop     stop it
+
+The server listens on 127.0.0.1:MOCK_PORT and takes the key mock-key. A
+completion is the prompt it was sent, a moderation is not flagged. A batch is
+completed as it is created, its requests answered the same. The requests with
+a marker in their value go other ways:
+
+    mock-summarize      the completion is "summary"
+    mock-flag           the moderation is flagged
+    mock-batch-error    the error file, with an error response
+    mock-batch-expired  the error file, expired with no response
+    mock-batch-fail     the whole batch fails
+    mock-upload-reject  the upload of the input file is rejected
+"""
+
+import email.parser
+import json
+import os
+import signal
+import socket
+import sys
+import tempfile
+import time
+import urllib.parse
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+MOCK_PORT = 18089
+MOCK_KEY = "mock-key"
+PID_FILE = os.path.join(tempfile.gettempdir(),
+                        "pg_ai_mock_openai_%d.pid" % MOCK_PORT)
+
+files = {}
+batches = {}
+
+
+def new_id(prefix, table):
+    return "%s-%d" % (prefix, len(table) + 1)
+
+
+def add_file(content):
+    file_id = new_id("file", files)
+    files[file_id] = content
+    return file_id
+
+
+def answer(url, body):
+    """the response body to a request, as the service would answer it"""
+    if url.endswith("/moderations"):
+        text = urllib.parse.unquote(body.get("input", ""))
+        return {"results": [{"flagged": "mock-flag" in text}]}
+    prompt = urllib.parse.unquote(body.get("prompt", ""))
+    text = "summary" if "mock-summarize" in prompt else prompt
+    return {"choices": [{"text": text, "index": 0}],
+            "usage": {"prompt_tokens": len(prompt.split()),
+                      "completion_tokens": len(text.split())}}
+
+
+def run_batch(input_file_id, endpoint):
+    """complete a batch at once, its output and errors as files"""
+    batch = {"id": new_id("batch", batches), "endpoint": endpoint,
+             "input_file_id": input_file_id, "status": "completed",
+             "output_file_id": None, "error_file_id": None}
+    output = []
+    errors = []
+
+    for line in files[input_file_id].decode().splitlines():
+        if not line.strip():
+            continue
+        request = json.loads(line)
+        custom_id = request["custom_id"]
+        if "mock-batch-fail" in line:
+            batch["status"] = "failed"
+            batch["errors"] = {"object": "list", "data": [
+                {"code": "invalid_request", "message": "mock batch failed",
+                 "line": len(output) + len(errors) + 1}]}
+            return batch
+        if "mock-batch-error" in line:
+            errors.append({"custom_id": custom_id, "response": {
+                "status_code": 400,
+                "body": {"error": {"message": "mock error"}}}})
+        elif "mock-batch-expired" in line:
+            errors.append({"custom_id": custom_id, "response": None,
+                           "error": {"code": "batch_expired",
+                                     "message": "mock request expired"}})
+        else:
+            output.append({"custom_id": custom_id, "response": {
+                "status_code": 200,
+                "body": answer(request["url"], request["body"])}})
+
+    if output:
+        batch["output_file_id"] = add_file(
+            "".join(json.dumps(o) + "\n" for o in output).encode())
+    if errors:
+        batch["error_file_id"] = add_file(
+            "".join(json.dumps(e) + "\n" for e in errors).encode())
+    return batch
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def log_message(self, format, *args):
+        pass
+
+    def reply(self, status, body):
+        data = body if isinstance(body, bytes) else json.dumps(body).encode()
+        self.send_response(status)
+        self.send_header("Content-Type", "application/json")
+        self.send_header("Content-Length", str(len(data)))
+        self.end_headers()
+        self.wfile.write(data)
+
+    def error(self, status, message):
+        self.reply(status, {"error": {"message": message}})
+
+    def authorized(self):
+        if self.headers.get("Authorization") == "Bearer " + MOCK_KEY:
+            return True
+        self.error(401, "Incorrect API key provided")
+        return False
+
+    def read_body(self):
+        return self.rfile.read(int(self.headers.get("Content-Length", 0)))
+
+    def upload_file(self, data):
+        form = email.parser.BytesParser().parsebytes(
+            b"Content-Type: " + self.headers["Content-Type"].encode() +
+            b"\r\n\r\n" + data)
+        fields = {part.get_param("name", header="content-disposition"):
+                  part.get_payload(decode=True)
+                  for part in form.get_payload()}
+        if fields.get("purpose") != b"batch" or "file" not in fields:
+            return self.error(400, "purpose and file are required")
+        if b"mock-upload-reject" in fields["file"]:
+            return self.error(400, "mock upload rejected")
+        self.reply(200, {"id": add_file(fields["file"]), "object": "file",
+                         "purpose": "batch"})
+
+    def create_batch(self, data):
+        request = json.loads(data)
+        if request.get("input_file_id") not in files or \
+                not request.get("endpoint") or \
+                not request.get("completion_window"):
+            return self.error(400, "invalid batch")
+        batch = run_batch(request["input_file_id"], request["endpoint"])
+        batches[batch["id"]] = batch
+        self.reply(200, {"id": batch["id"], "status": "validating"})
+
+    def do_POST(self):
+        data = self.read_body()
+        if not self.authorized():
+            return
+        if self.path == "/v1/files":
+            return self.upload_file(data)
+        if self.path == "/v1/batches":
+            return self.create_batch(data)
+        if self.path in ("/v1/completions", "/v1/moderations"):
+            return self.reply(200, answer(self.path, json.loads(data)))
+        self.error(404, "no such path")
+
+    def do_GET(self):
+        if not self.authorized():
+            return
+        parts = self.path.strip("/").split("/")
+        if len(parts) == 3 and parts[:2] == ["v1", "batches"] and \
+                parts[2] in batches:
+            return self.reply(200, batches[parts[2]])
+        if len(parts) == 4 and parts[:2] == ["v1", "files"] and \
+                parts[2] in files and parts[3] == "content":
+            return self.reply(200, files[parts[2]])
+        self.error(404, "no such path")
+
+
+def wait_port(up):
+    for _ in range(100):
+        try:
+            socket.create_connection(("127.0.0.1", MOCK_PORT), 1).close()
+            if up:
+                return True
+        except OSError:
+            if not up:
+                return True
+        time.sleep(0.1)
+    return False
+
+
+def start():
+    server = ThreadingHTTPServer(("127.0.0.1", MOCK_PORT), Handler)
+    pid = os.fork()
+    if pid > 0:
+        server.server_close()
+        with open(PID_FILE, "w") as f:
+            f.write(str(pid))
+        if not wait_port(True):
+            sys.exit("mock server did not start")
+        return
+
+    os.setsid()
+    devnull = os.open(os.devnull, os.O_RDWR)
+    for fd in (0, 1, 2):
+        os.dup2(devnull, fd)
+    server.serve_forever()
+
+
+def stop():
+    try:
+        with open(PID_FILE) as f:
+            os.kill(int(f.read()), signal.SIGTERM)
+        os.unlink(PID_FILE)
+    except (OSError, ValueError):
+        return
+    wait_port(False)
+
+
+if __name__ == "__main__":
+    if len(sys.argv) != 2 or sys.argv[1] not in ("start", "stop"):
+        sys.exit("usage: mock_openai.py start|stop")
+    start() if sys.argv[1] == "start" else stop()
@@ -0,0 +1,61 @@
+-- the values of an aggregate are sent joined by a space, without the NULLs
+SELECT pg_ai_insight_agg(v, 'Topic' ORDER BY o)
+  FROM (VALUES (1, 'alpha'), (2, NULL), (3, 'beta'), (4, 'alpha')) t(o, v);
+SELECT pg_ai_insight_agg(v, 'Topic') FROM (VALUES (NULL::TEXT)) t(v);
+SELECT g, pg_ai_insight_agg(v, 'Topic' ORDER BY v)
+  FROM (VALUES (1, 'a'), (1, 'b'), (2, 'c')) t(g, v) GROUP BY g ORDER BY g;
+SELECT pg_ai_moderation_agg(v, 'Check' ORDER BY o)
+  FROM (VALUES (1, 'fine'), (2, 'mock-flag')) t(o, v);
+
+CREATE TABLE agg_values AS
+	SELECT i, 'w' || i AS v, repeat('x', 200) AS pad
+	  FROM generate_series(1, 500) i;
+ANALYZE agg_values;
+
+-- the values between the quotes of the prompt the mock answers with
+CREATE FUNCTION agg_words(result TEXT) RETURNS TEXT[] AS $$
+	SELECT string_to_array(substring(result FROM '"(.*)"'), ' ')
+$$ LANGUAGE sql IMMUTABLE;
+
+-- a sample is within the budget, a value in it once, and the same for the
+-- same distinct values in any order
+SET pg_ai.agg_sample_tokens = 100;
+SELECT pg_ai_insight_agg(v, 'Topic' ORDER BY i) AS sampled
+  FROM agg_values \gset
+SELECT count(*) AS sampled_values, count(DISTINCT w) AS distinct_values,
+	   bool_and(w IN (SELECT v FROM agg_values)) AS input_values
+  FROM unnest(agg_words(:'sampled')) w;
+SELECT pg_ai_insight_agg(v, 'Topic' ORDER BY i DESC) = :'sampled' AS same
+  FROM agg_values;
+SELECT pg_ai_insight_agg(v, 'Topic') = :'sampled' AS same
+  FROM (SELECT v FROM agg_values UNION ALL SELECT v FROM agg_values) t;
+SELECT pg_ai_insight_agg(v, 'Topic', (i % 3)::TEXT ORDER BY i) =
+	   pg_ai_insight_agg(v, 'Topic', (i % 3)::TEXT ORDER BY i DESC) AS same
+  FROM agg_values;
+
+-- the states of the parallel workers are serialized and combined
+SET parallel_setup_cost = 0;
+SET parallel_tuple_cost = 0;
+SET min_parallel_table_scan_size = 0;
+SET max_parallel_workers_per_gather = 2;
+EXPLAIN (COSTS OFF) SELECT pg_ai_insight_agg(v, 'Topic') FROM agg_values;
+SELECT pg_ai_insight_agg(v, 'Topic') = :'sampled' AS same FROM agg_values;
+RESET pg_ai.agg_sample_tokens;
+SELECT pg_ai_insight_agg(v, 'Topic') AS combined FROM agg_values \gset
+SELECT array_agg(w ORDER BY w) =
+	   (SELECT array_agg(v ORDER BY v) FROM agg_values) AS all_values
+  FROM unnest(agg_words(:'combined')) w;
+RESET parallel_setup_cost;
+RESET parallel_tuple_cost;
+RESET min_parallel_table_scan_size;
+RESET max_parallel_workers_per_gather;
+
+-- an input over a request is summarized in chunks first, the summaries must
+-- be shorter than the input
+CREATE TABLE agg_long AS
+	SELECT i, 'w' || i AS v FROM generate_series(1, 1000) i;
+SELECT pg_ai_insight_agg(v, 'mock-summarize' ORDER BY i) FROM agg_long;
+SELECT pg_ai_insight_agg(v, 'Topic' ORDER BY i) FROM agg_long;
+
+DROP TABLE agg_values, agg_long;
+DROP FUNCTION agg_words(TEXT);
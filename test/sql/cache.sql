@@ -0,0 +1,26 @@
+-- a value seen before is answered by the result cache, a value repeated in
+-- a query by the memo of the query. The statistics count the requests sent
+-- and the calls answered by the caches.
+SET pg_ai.prefetch_rows = 0;
+SET pg_ai.result_cache_ttl = 3600;
+SELECT pg_ai_stat_reset();
+SELECT pg_ai_insight('alpha', 'Echo');
+SELECT pg_ai_insight('alpha', 'Echo');
+SELECT pg_ai_insight('alpha', 'Other');
+SELECT function, calls, errors, tokens_in, tokens_out, cache_hits
+  FROM pg_stat_pg_ai ORDER BY function;
+SELECT count(*) FROM pg_ai_result_cache;
+SELECT function, endpoint, status FROM pg_ai_recent_requests()
+ WHERE pid = pg_backend_pid() ORDER BY finished_at DESC LIMIT 1;
+
+SET pg_ai.result_cache_ttl = 0;
+SELECT pg_ai_stat_reset();
+SELECT o, pg_ai_insight(v, 'Echo')
+  FROM (VALUES (1, 'gamma'), (2, 'gamma'), (3, 'delta')) t(o, v) ORDER BY o;
+SELECT function, calls, cache_hits FROM pg_stat_pg_ai ORDER BY function;
+
+SELECT pg_ai_moderation('fine'), pg_ai_moderation('mock-flag');
+
+-- the query embeddings cache is only used by pg_ai_query_vector_store
+SELECT pg_ai_query_cache_reset();
+SELECT entries, hits, misses FROM pg_ai_query_cache_stats();
@@ -0,0 +1,30 @@
+-- the rows of a job are called by a worker, the results are in the order of
+-- the query
+SELECT pg_ai_submit_job('insight', jsonb_build_object(
+	'query', $$SELECT v FROM (VALUES (1, 'alpha'), (2, NULL), (3, 'beta')) t(o, v)
+		ORDER BY o$$,
+	'prompt', 'Echo')) AS job_id \gset
+SELECT wait_job(:job_id);
+SELECT kind, status, attempts, rows_done, error FROM pg_ai_job_status(:job_id);
+SELECT ordinality, value, result
+  FROM pg_ai_job_results WHERE job_id = :job_id ORDER BY ordinality;
+
+SELECT pg_ai_submit_job('moderation', jsonb_build_object(
+	'query', $$SELECT unnest(ARRAY['fine', 'mock-flag'])$$)) AS job_id \gset
+SELECT wait_job(:job_id);
+SELECT ordinality, value, result
+  FROM pg_ai_job_results WHERE job_id = :job_id ORDER BY ordinality;
+
+-- the jobs are checked as they are submitted
+SELECT pg_ai_submit_job('unknown', '{}');
+SELECT pg_ai_submit_job('insight', '{"prompt": "Echo"}');
+SELECT pg_ai_submit_job('insight', '{"query": "SELECT 1", "mode": "fast"}');
+
+-- a role sees its own jobs, and inserts them only through pg_ai_submit_job
+CREATE ROLE regress_pg_ai_jobs;
+SET ROLE regress_pg_ai_jobs;
+SELECT count(*) FROM pg_ai_jobs;
+INSERT INTO pg_ai_jobs(kind, args, owner)
+	VALUES ('insight', '{"query": "SELECT 1"}', 'regress_pg_ai_jobs');
+RESET ROLE;
+DROP ROLE regress_pg_ai_jobs;
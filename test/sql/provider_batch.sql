@@ -0,0 +1,36 @@
+-- insight and moderation jobs run through the batch API: the input is
+-- uploaded, the batch polled and its output and error files downloaded
+SELECT pg_ai_submit_job('insight', jsonb_build_object(
+	'query', $$SELECT v FROM (VALUES (1, 'alpha'), (2, 'mock-batch-error'),
+		(3, NULL), (4, 'mock-batch-expired'), (5, 'omega')) t(o, v)
+		ORDER BY o$$,
+	'prompt', 'Echo', 'mode', 'provider_batch')) AS job_id \gset
+SELECT wait_job(:job_id);
+SELECT status, attempts, rows_done, provider_batch, error
+  FROM pg_ai_jobs WHERE id = :job_id;
+SELECT ordinality, value, result
+  FROM pg_ai_job_results WHERE job_id = :job_id ORDER BY ordinality;
+
+SELECT pg_ai_submit_job('moderation', jsonb_build_object(
+	'query', $$SELECT 'some text'$$, 'mode', 'provider_batch')) AS job_id \gset
+SELECT wait_job(:job_id);
+SELECT ordinality, value, result
+  FROM pg_ai_job_results WHERE job_id = :job_id ORDER BY ordinality;
+
+-- a failed batch fails the attempt, the retry makes a new batch
+SELECT pg_ai_submit_job('insight', jsonb_build_object(
+	'query', $$SELECT 'mock-batch-fail'$$, 'prompt', 'Echo',
+	'mode', 'provider_batch')) AS job_id \gset
+SELECT wait_job(:job_id);
+SELECT status, attempts, provider_batch, error
+  FROM pg_ai_jobs WHERE id = :job_id;
+DELETE FROM pg_ai_jobs WHERE id = :job_id;
+
+-- as does an upload the batch API rejects
+SELECT pg_ai_submit_job('insight', jsonb_build_object(
+	'query', $$SELECT 'mock-upload-reject'$$, 'prompt', 'Echo',
+	'mode', 'provider_batch')) AS job_id \gset
+SELECT wait_job(:job_id);
+SELECT status, attempts, provider_batch, error
+  FROM pg_ai_jobs WHERE id = :job_id;
+DELETE FROM pg_ai_jobs WHERE id = :job_id;
@@ -0,0 +1,19 @@
+CREATE EXTENSION pg_ai;
+\! python3 "$PG_ABS_SRCDIR/mock_openai.py" start
+
+-- wait for a job to be done or failed, or queued again after a failed attempt
+CREATE FUNCTION wait_job(job_id BIGINT) RETURNS TEXT AS $$
+DECLARE
+	job		pg_ai_jobs;
+BEGIN
+	FOR i IN 1 .. 600 LOOP
+		SELECT * INTO job FROM pg_ai_jobs WHERE id = job_id;
+		IF job.status IN ('done', 'failed') OR
+		   (job.status = 'queued' AND job.error IS NOT NULL) THEN
+			RETURN job.status;
+		END IF;
+		PERFORM pg_sleep(0.1);
+	END LOOP;
+	RETURN 'timeout';
+END
+$$ LANGUAGE plpgsql;
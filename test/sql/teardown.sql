@@ -0,0 +1,3 @@
+\! python3 "$PG_ABS_SRCDIR/mock_openai.py" stop
+DROP FUNCTION wait_job(BIGINT);
+DROP EXTENSION pg_ai;
@@ -0,0 +1,20 @@
+-- the tokens of a request are counted with the BPE vocabulary of
+-- pg_ai.tokenizer_file, estimated at 4 bytes a token without it. The request
+-- is the prompt, the quoted value and 4 tokens around them.
+\getenv abs_srcdir PG_ABS_SRCDIR
+SELECT pg_ai_insight(repeat('x', 4000), 'p') =
+	   'p : "' || repeat('x', 4000) || '"' AS answered;
+
+-- a token a byte, with no merges
+\set tokenizer_file :abs_srcdir '/data/bytes.tiktoken'
+SET pg_ai.tokenizer_file = :'tokenizer_file';
+SELECT pg_ai_insight(repeat('x', 4000), 'p');
+SELECT pg_ai_insight(repeat('x', 3000), 'p') =
+	   'p : "' || repeat('x', 3000) || '"' AS answered;
+
+-- a token for 4 bytes, with the merges of "xx" and "xxxx"
+\set tokenizer_file :abs_srcdir '/data/merges.tiktoken'
+SET pg_ai.tokenizer_file = :'tokenizer_file';
+SELECT pg_ai_insight(repeat('x', 4000), 'p') =
+	   'p : "' || repeat('x', 4000) || '"' AS answered;
+RESET pg_ai.tokenizer_file;